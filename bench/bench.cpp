@@ -0,0 +1,735 @@
+/**
+ * @file
+ *
+ * Benchmarks for the Pool thread pool, built on Google Benchmark.
+ *
+ * Each benchmark is run against every executor: the Pool with each
+ * Scheduler, a naive pool built on a single mutex-protected queue, and (when
+ * they are available) TBB and BS::thread_pool.  Run with `make bench`, and
+ * pass arguments to Google Benchmark with `make bench BENCH_ARGS=...`, e.g.
+ * `BENCH_ARGS=--benchmark_filter=latency`.
+ */
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "pool.hpp"
+#include "pool_basic.hpp"
+
+#ifdef GHOTI_POOL_BENCH_TBB
+#include <tbb/global_control.h>
+#include <tbb/task_arena.h>
+#endif
+
+#if __has_include(<BS_thread_pool.hpp>)
+#include <BS_thread_pool.hpp>
+#define GHOTI_POOL_BENCH_BS
+#endif
+
+using namespace std;
+using namespace Ghoti::Pool;
+
+/**
+ * The number of tasks that each producer enqueues per iteration of the
+ * throughput benchmarks.
+ */
+static constexpr size_t TASKS_PER_ITERATION{1000};
+
+/**
+ * The number of child tasks in the fan-out/fan-in benchmark.
+ */
+static constexpr size_t FAN_OUT{1000};
+
+/**
+ * The depth of the binary tree of tasks in the recursive fan-out benchmark.
+ */
+static constexpr size_t TREE_DEPTH{10};
+
+/**
+ * The most worker (or producer) threads that a benchmark uses.
+ */
+static const int64_t MAX_THREADS{max<int64_t>(thread::hardware_concurrency(), 1)};
+
+/**
+ * The size of a cache line, as used by the pool to keep fields apart.
+ */
+#ifdef __cpp_lib_hardware_interference_size
+static constexpr size_t BENCH_CACHE_LINE_SIZE{hardware_destructive_interference_size};
+#else
+static constexpr size_t BENCH_CACHE_LINE_SIZE{64};
+#endif
+
+/**
+ * Runs tasks on a Pool with a fixed Scheduler.
+ */
+template <Scheduler S>
+struct PoolExecutor {
+  /**
+   * Constructor.
+   *
+   * @param threadCount The number of worker threads.
+   */
+  PoolExecutor(size_t threadCount) : pool{threadCount, S} {
+    this->pool.start();
+  }
+
+  /**
+   * Destructor.
+   */
+  ~PoolExecutor() {
+    this->pool.join();
+  }
+
+  /**
+   * Run a function on one of the worker threads.
+   *
+   * @param f The function.
+   */
+  template <typename F>
+  void post(F && f) {
+    this->pool.enqueue(forward<F>(f));
+  }
+
+  /**
+   * The pool.
+   */
+  Pool pool;
+};
+
+/**
+ * Runs tasks on a FIFO Pool whose threads claim tasks in batches.
+ */
+struct BatchedPoolExecutor : PoolExecutor<Scheduler::FIFO> {
+  /**
+   * Constructor.
+   *
+   * @param threadCount The number of worker threads.
+   */
+  BatchedPoolExecutor(size_t threadCount) : PoolExecutor<Scheduler::FIFO>{threadCount} {
+    this->pool.setBatchSize(32);
+  }
+};
+
+/**
+ * Runs tasks on a naive pool, in which every thread shares a single queue of
+ * `std::function` that is protected by a single mutex.
+ *
+ * This is the baseline that the Pool should beat.
+ */
+struct MutexQueueExecutor {
+  /**
+   * Constructor.
+   *
+   * @param threadCount The number of worker threads.
+   */
+  MutexQueueExecutor(size_t threadCount) {
+    for (size_t i = 0; i < threadCount; ++i) {
+      this->threads.emplace_back([this](){
+        while (true) {
+          function<void()> task;
+          {
+            unique_lock<mutex> lock{this->queueMutex};
+            this->condition.wait(lock, [this](){ return this->stopping || !this->tasks.empty(); });
+            if (this->tasks.empty()) {
+              return;
+            }
+            task = move(this->tasks.front());
+            this->tasks.pop_front();
+          }
+          task();
+        }
+      });
+    }
+  }
+
+  /**
+   * Destructor.
+   *
+   * Runs any remaining tasks, then joins the threads.
+   */
+  ~MutexQueueExecutor() {
+    {
+      scoped_lock lock{this->queueMutex};
+      this->stopping = true;
+    }
+    this->condition.notify_all();
+    this->threads.clear();
+  }
+
+  /**
+   * Run a function on one of the worker threads.
+   *
+   * @param f The function.
+   */
+  template <typename F>
+  void post(F && f) {
+    {
+      scoped_lock lock{this->queueMutex};
+      this->tasks.emplace_back(forward<F>(f));
+    }
+    this->condition.notify_one();
+  }
+
+  /**
+   * Protects the tasks and stopping.
+   */
+  mutex queueMutex;
+
+  /**
+   * Wakes the threads when there is a task, or when they should stop.
+   */
+  condition_variable condition;
+
+  /**
+   * The tasks that are waiting to run.
+   */
+  deque<function<void()>> tasks;
+
+  /**
+   * Whether or not the threads should stop once the queue is empty.
+   */
+  bool stopping{false};
+
+  /**
+   * The worker threads.  Declared last, so that they are joined before the
+   * queue is destroyed.
+   */
+  vector<jthread> threads;
+};
+
+/**
+ * A task of a single type, which increments a counter.
+ */
+struct CountTask {
+  /**
+   * The counter.
+   */
+  atomic<size_t> * counter{nullptr};
+
+  /**
+   * Increment the counter.
+   */
+  void operator()() const {
+    this->counter->fetch_add(1, memory_order_release);
+  }
+};
+
+/**
+ * Runs CountTasks on a BasicPool.
+ *
+ * @tparam IdleT The idle policy of the BasicPool.
+ */
+template <typename IdleT>
+struct BasicPoolExecutor {
+  /**
+   * Constructor.
+   *
+   * @param threadCount The number of worker threads.
+   */
+  BasicPoolExecutor(size_t threadCount) : pool{threadCount} {
+    this->pool.start();
+  }
+
+  /**
+   * Destructor.
+   */
+  ~BasicPoolExecutor() {
+    this->pool.join();
+  }
+
+  /**
+   * Run a task on one of the worker threads.
+   *
+   * @param task The task.
+   */
+  void post(CountTask task) {
+    this->pool.enqueue(move(task));
+  }
+
+  /**
+   * The pool.
+   */
+  BasicPool<CountTask, LockedQueue<CountTask>, IdleT> pool;
+};
+
+#ifdef GHOTI_POOL_BENCH_TBB
+/**
+ * Runs tasks on a TBB task arena.
+ */
+struct TbbExecutor {
+  /**
+   * Constructor.
+   *
+   * @param threadCount The number of worker threads.
+   */
+  TbbExecutor(size_t threadCount)
+    : control{tbb::global_control::max_allowed_parallelism, threadCount + 1},
+      arena{static_cast<int>(threadCount), 0} {}
+
+  /**
+   * Run a function on one of the worker threads.
+   *
+   * @param f The function.
+   */
+  template <typename F>
+  void post(F && f) {
+    this->arena.enqueue(forward<F>(f));
+  }
+
+  /**
+   * Allows TBB to create as many workers as were asked for, even when that
+   * is more than the number of cores.
+   */
+  tbb::global_control control;
+
+  /**
+   * The arena, which reserves no slot for the calling thread.
+   */
+  tbb::task_arena arena;
+};
+#endif
+
+#ifdef GHOTI_POOL_BENCH_BS
+/**
+ * Runs tasks on a BS::thread_pool.
+ */
+struct BsExecutor {
+  /**
+   * Constructor.
+   *
+   * @param threadCount The number of worker threads.
+   */
+  BsExecutor(size_t threadCount) : pool{static_cast<unsigned int>(threadCount)} {}
+
+  /**
+   * Run a function on one of the worker threads.
+   *
+   * @param f The function.
+   */
+  template <typename F>
+  void post(F && f) {
+    this->pool.detach_task(forward<F>(f));
+  }
+
+  /**
+   * The pool.
+   */
+  BS::thread_pool pool;
+};
+#endif
+
+/**
+ * Wait, without sleeping, until a counter reaches a value.
+ *
+ * @param counter The counter.
+ * @param value The value.
+ */
+static void waitFor(const atomic<size_t> & counter, size_t value) {
+  while (counter.load(memory_order_acquire) < value) {
+    this_thread::yield();
+  }
+}
+
+/**
+ * A counter on a cache line of its own.
+ */
+struct alignas(64) PaddedCounter {
+  /**
+   * The count.
+   */
+  atomic<size_t> count{0};
+};
+
+/**
+ * Measure the throughput of tasks that capture a payload of a given size.
+ *
+ * Every benchmark thread is a producer, and enqueues TASKS_PER_ITERATION
+ * tasks per iteration, then waits for them to finish.
+ *
+ * @tparam PayloadSize The number of bytes captured by each task.
+ * @param state range(0) is the number of worker threads.
+ */
+template <typename Executor, size_t PayloadSize>
+static void throughputWithPayload(benchmark::State & state) {
+  static unique_ptr<Executor> executor{};
+  static unique_ptr<PaddedCounter[]> counters{};
+  if (state.thread_index() == 0) {
+    executor = make_unique<Executor>(static_cast<size_t>(state.range(0)));
+    counters = make_unique<PaddedCounter[]>(static_cast<size_t>(state.threads()));
+  }
+
+  // The benchmark loop starts only once the setup above has been done.
+  size_t expected{0};
+  array<unsigned char, PayloadSize> payload{};
+  for (auto _ : state) {
+    auto & counter = counters[static_cast<size_t>(state.thread_index())].count;
+    for (size_t i = 0; i < TASKS_PER_ITERATION; ++i) {
+      executor->post([&counter, payload](){
+        benchmark::DoNotOptimize(payload);
+        counter.fetch_add(1, memory_order_release);
+      });
+    }
+    expected += TASKS_PER_ITERATION;
+    waitFor(counter, expected);
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * TASKS_PER_ITERATION));
+
+  if (state.thread_index() == 0) {
+    executor.reset();
+    counters.reset();
+  }
+}
+
+/**
+ * Measure the throughput of empty tasks.
+ *
+ * @param state range(0) is the number of worker threads.
+ */
+template <typename Executor>
+static void throughput(benchmark::State & state) {
+  throughputWithPayload<Executor, 0>(state);
+}
+
+/**
+ * Measure the throughput of tasks that are too large to be stored inline, so
+ * that each one is allocated by a producer and freed by a worker.
+ *
+ * @param state range(0) is the number of worker threads.
+ */
+template <typename Executor>
+static void largeTaskThroughput(benchmark::State & state) {
+  throughputWithPayload<Executor, 2 * FUNCTION_INLINE_SIZE>(state);
+}
+
+/**
+ * Measure the throughput of tasks that are all of the same type, so that an
+ * executor which knows the type need not erase it.
+ *
+ * @param state range(0) is the number of worker threads.
+ */
+template <typename Executor>
+static void fixedTaskThroughput(benchmark::State & state) {
+  static unique_ptr<Executor> executor{};
+  static unique_ptr<PaddedCounter[]> counters{};
+  if (state.thread_index() == 0) {
+    executor = make_unique<Executor>(static_cast<size_t>(state.range(0)));
+    counters = make_unique<PaddedCounter[]>(static_cast<size_t>(state.threads()));
+  }
+
+  size_t expected{0};
+  for (auto _ : state) {
+    auto & counter = counters[static_cast<size_t>(state.thread_index())].count;
+    for (size_t i = 0; i < TASKS_PER_ITERATION; ++i) {
+      executor->post(CountTask{&counter});
+    }
+    expected += TASKS_PER_ITERATION;
+    waitFor(counter, expected);
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * TASKS_PER_ITERATION));
+
+  if (state.thread_index() == 0) {
+    executor.reset();
+    counters.reset();
+  }
+}
+
+/**
+ * Measure the time from enqueuing a task until it starts to run.
+ *
+ * The worker threads are idle when each task is enqueued, so this includes
+ * the time taken to wake one of them.
+ *
+ * @param state range(0) is the number of worker threads.
+ */
+template <typename Executor>
+static void latency(benchmark::State & state) {
+  Executor executor{static_cast<size_t>(state.range(0))};
+  atomic<size_t> done{0};
+  atomic<chrono::steady_clock::rep> startedAt{0};
+  size_t expected{0};
+
+  for (auto _ : state) {
+    // Let the workers go idle.
+    this_thread::sleep_for(chrono::microseconds{20});
+
+    auto enqueuedAt = chrono::steady_clock::now();
+    executor.post([&](){
+      startedAt.store(chrono::steady_clock::now().time_since_epoch().count(), memory_order_relaxed);
+      done.fetch_add(1, memory_order_release);
+    });
+    waitFor(done, ++expected);
+
+    auto started = chrono::steady_clock::time_point{chrono::steady_clock::duration{startedAt.load(memory_order_relaxed)}};
+    state.SetIterationTime(chrono::duration<double>(started - enqueuedAt).count());
+  }
+}
+
+/**
+ * Measure a task that enqueues FAN_OUT children from inside of the pool,
+ * and waits (by returning) for the last child to finish.
+ *
+ * @param state range(0) is the number of worker threads.
+ */
+template <typename Executor>
+static void fanOutFanIn(benchmark::State & state) {
+  Executor executor{static_cast<size_t>(state.range(0))};
+  atomic<size_t> finished{0};
+  size_t expected{0};
+
+  for (auto _ : state) {
+    atomic<size_t> remaining{FAN_OUT};
+    executor.post([&](){
+      for (size_t i = 0; i < FAN_OUT; ++i) {
+        executor.post([&](){
+          if (remaining.fetch_sub(1, memory_order_acq_rel) == 1) {
+            finished.fetch_add(1, memory_order_release);
+          }
+        });
+      }
+    });
+    waitFor(finished, ++expected);
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * FAN_OUT));
+}
+
+/**
+ * Enqueue a binary tree of tasks, in which each task enqueues its two
+ * children.
+ *
+ * @param executor The executor.
+ * @param depth The number of levels below this task.
+ * @param remaining The number of tasks that have yet to finish.
+ * @param finished Incremented when the last task finishes.
+ */
+template <typename Executor>
+static void postTree(Executor & executor, size_t depth, atomic<size_t> & remaining, atomic<size_t> & finished) {
+  executor.post([&executor, depth, &remaining, &finished](){
+    if (depth) {
+      postTree(executor, depth - 1, remaining, finished);
+      postTree(executor, depth - 1, remaining, finished);
+    }
+    if (remaining.fetch_sub(1, memory_order_acq_rel) == 1) {
+      finished.fetch_add(1, memory_order_release);
+    }
+  });
+}
+
+/**
+ * Measure a recursive fan-out, in which every task enqueues two more, down to
+ * a depth of TREE_DEPTH.
+ *
+ * @param state range(0) is the number of worker threads.
+ */
+template <typename Executor>
+static void recursiveFanOut(benchmark::State & state) {
+  static constexpr size_t taskCount{(size_t{1} << (TREE_DEPTH + 1)) - 1};
+  Executor executor{static_cast<size_t>(state.range(0))};
+  atomic<size_t> finished{0};
+  size_t expected{0};
+
+  for (auto _ : state) {
+    atomic<size_t> remaining{taskCount};
+    postTree(executor, TREE_DEPTH, remaining, finished);
+    waitFor(finished, ++expected);
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * taskCount));
+}
+
+/**
+ * Measure the cost of starting and joining a Pool.
+ *
+ * @param state range(0) is the number of threads.
+ */
+template <Scheduler S>
+static void startJoin(benchmark::State & state) {
+  Pool pool{static_cast<size_t>(state.range(0)), S};
+  for (auto _ : state) {
+    pool.start();
+    pool.join();
+  }
+}
+
+/**
+ * Measure the cost of creating and joining the threads of the naive pool,
+ * for comparison with startJoin().
+ *
+ * @param state range(0) is the number of threads.
+ */
+static void mutexQueueStartJoin(benchmark::State & state) {
+  for (auto _ : state) {
+    MutexQueueExecutor executor{static_cast<size_t>(state.range(0))};
+  }
+}
+
+/**
+ * Measure the cost of growing a running Pool by range(0) threads, and then
+ * shrinking it back again.
+ *
+ * @param state range(0) is the number of threads that are added and removed.
+ */
+static void setThreadCount(benchmark::State & state) {
+  auto delta = static_cast<size_t>(state.range(0));
+  Pool pool{1};
+  pool.start();
+  for (auto _ : state) {
+    auto terminated = pool.getTerminatedThreadCount();
+    pool.setThreadCount(1 + delta);
+    pool.setThreadCount(1);
+
+    // Wait for the extra threads to leave, so that the next iteration does
+    // not overlap with this one.
+    while (pool.getTerminatedThreadCount() < terminated + delta) {
+      this_thread::yield();
+    }
+  }
+  pool.join();
+}
+
+/**
+ * Measure adding and cancelling delayed tasks, with many timers pending at
+ * once.
+ *
+ * Each iteration adds range(0) timers, spread over the next minute, and then
+ * cancels all of them.
+ *
+ * @param state range(0) is the number of timers.
+ */
+static void timers(benchmark::State & state) {
+  auto count = static_cast<size_t>(state.range(0));
+  Pool pool{1};
+  pool.start();
+  vector<TimerHandle> handles;
+  handles.reserve(count);
+  for (auto _ : state) {
+    auto now = chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i) {
+      handles.push_back(pool.enqueueAt(now + chrono::milliseconds{i % 60000}, [](){}));
+    }
+    for (auto & handle : handles) {
+      handle.cancel();
+    }
+    handles.clear();
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * count));
+  pool.join();
+}
+
+/**
+ * A write-hot counter and a read-mostly setting, packed together as the
+ * fields of the pool State used to be.
+ */
+struct PackedFields {
+  /**
+   * Written constantly, like the pool's count of queued tasks.
+   */
+  atomic<size_t> hot{0};
+
+  /**
+   * Read constantly, like the pool's capacity.
+   */
+  atomic<size_t> setting{1};
+};
+
+/**
+ * The same fields as PackedFields, on separate cache lines, as they are laid
+ * out in the pool State now.
+ */
+struct IsolatedFields {
+  /**
+   * Written constantly, like the pool's count of queued tasks.
+   */
+  alignas(BENCH_CACHE_LINE_SIZE) atomic<size_t> hot{0};
+
+  /**
+   * Read constantly, like the pool's capacity.
+   */
+  alignas(BENCH_CACHE_LINE_SIZE) atomic<size_t> setting{1};
+};
+
+/**
+ * Measure how much a write-hot field slows down the readers of a field next
+ * to it (false sharing).
+ *
+ * Thread 0 writes the hot field, and every other thread reads the setting.
+ * Only the reads are counted.  With a single thread there are no readers,
+ * so run this with at least two threads, on a machine with several cores.
+ *
+ * @tparam Fields PackedFields or IsolatedFields.
+ */
+template <typename Fields>
+static void falseSharing(benchmark::State & state) {
+  static Fields fields{};
+  constexpr size_t OPERATIONS{10000};
+  size_t reads{0};
+  for (auto _ : state) {
+    if (state.thread_index() == 0) {
+      for (size_t i = 0; i < OPERATIONS; ++i) {
+        fields.hot.fetch_add(1, memory_order_relaxed);
+      }
+    }
+    else {
+      size_t sum{0};
+      for (size_t i = 0; i < OPERATIONS; ++i) {
+        sum += fields.setting.load(memory_order_relaxed);
+      }
+      benchmark::DoNotOptimize(sum);
+      reads += OPERATIONS;
+    }
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(reads));
+}
+
+/**
+ * Register a benchmark, which takes the number of worker threads, for every
+ * executor.
+ */
+#define EXECUTOR_BENCHMARK(name, ...) \
+  BENCHMARK_TEMPLATE(name, PoolExecutor<Scheduler::FIFO>)->__VA_ARGS__; \
+  BENCHMARK_TEMPLATE(name, PoolExecutor<Scheduler::WORK_STEALING>)->__VA_ARGS__; \
+  BENCHMARK_TEMPLATE(name, PoolExecutor<Scheduler::RING>)->__VA_ARGS__; \
+  BENCHMARK_TEMPLATE(name, BatchedPoolExecutor)->__VA_ARGS__; \
+  BENCHMARK_TEMPLATE(name, MutexQueueExecutor)->__VA_ARGS__; \
+  TBB_BENCHMARK(name, __VA_ARGS__) \
+  BS_BENCHMARK(name, __VA_ARGS__)
+
+#ifdef GHOTI_POOL_BENCH_TBB
+#define TBB_BENCHMARK(name, ...) BENCHMARK_TEMPLATE(name, TbbExecutor)->__VA_ARGS__;
+#else
+#define TBB_BENCHMARK(name, ...)
+#endif
+
+#ifdef GHOTI_POOL_BENCH_BS
+#define BS_BENCHMARK(name, ...) BENCHMARK_TEMPLATE(name, BsExecutor)->__VA_ARGS__;
+#else
+#define BS_BENCHMARK(name, ...)
+#endif
+
+EXECUTOR_BENCHMARK(largeTaskThroughput, RangeMultiplier(2)->Range(1, MAX_THREADS)->ThreadRange(1, MAX_THREADS)->UseRealTime())
+EXECUTOR_BENCHMARK(throughput, RangeMultiplier(2)->Range(1, MAX_THREADS)->ThreadRange(1, MAX_THREADS)->UseRealTime())
+BENCHMARK_TEMPLATE(fixedTaskThroughput, PoolExecutor<Scheduler::FIFO>)->RangeMultiplier(2)->Range(1, MAX_THREADS)->ThreadRange(1, MAX_THREADS)->UseRealTime();
+BENCHMARK_TEMPLATE(fixedTaskThroughput, BasicPoolExecutor<SleepWhenIdle>)->RangeMultiplier(2)->Range(1, MAX_THREADS)->ThreadRange(1, MAX_THREADS)->UseRealTime();
+BENCHMARK_TEMPLATE(fixedTaskThroughput, BasicPoolExecutor<SpinWhenIdle<1000>>)->RangeMultiplier(2)->Range(1, MAX_THREADS)->ThreadRange(1, MAX_THREADS)->UseRealTime();
+EXECUTOR_BENCHMARK(latency, RangeMultiplier(2)->Range(1, MAX_THREADS)->UseManualTime()->Unit(benchmark::kMicrosecond))
+EXECUTOR_BENCHMARK(fanOutFanIn, RangeMultiplier(2)->Range(1, MAX_THREADS)->UseRealTime()->Unit(benchmark::kMicrosecond))
+EXECUTOR_BENCHMARK(recursiveFanOut, RangeMultiplier(2)->Range(1, MAX_THREADS)->UseRealTime()->Unit(benchmark::kMicrosecond))
+
+BENCHMARK_TEMPLATE(startJoin, Scheduler::FIFO)->RangeMultiplier(4)->Range(1, 4 * MAX_THREADS)->UseRealTime()->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(startJoin, Scheduler::WORK_STEALING)->RangeMultiplier(4)->Range(1, 4 * MAX_THREADS)->UseRealTime()->Unit(benchmark::kMicrosecond);
+BENCHMARK(mutexQueueStartJoin)->RangeMultiplier(4)->Range(1, 4 * MAX_THREADS)->UseRealTime()->Unit(benchmark::kMicrosecond);
+BENCHMARK(setThreadCount)->RangeMultiplier(4)->Range(1, 4 * MAX_THREADS)->UseRealTime()->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(falseSharing, PackedFields)->ThreadRange(2, max<int64_t>(MAX_THREADS, 2))->UseRealTime();
+BENCHMARK_TEMPLATE(falseSharing, IsolatedFields)->ThreadRange(2, max<int64_t>(MAX_THREADS, 2))->UseRealTime();
+BENCHMARK(timers)->RangeMultiplier(10)->Range(1000, 1000000)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -7,13 +7,32 @@
 #ifndef POOL_HPP
 #define POOL_HPP
 
+#include <array>
+#include <chrono>
+#include <concepts>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <iosfwd>
+#include <limits>
 #include <memory>
+#include <memory_resource>
+#include <optional>
+#include <span>
 #include <stop_token>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "pool_function.hpp"
+#include "pool_future.hpp"
 
 namespace Ghoti::Pool{
 // Forward declaration.
 class State;
+struct TaskGroupState;
+struct WorkerGroupState;
+struct TaskGraphState;
 
 /**
  * Function type used to create the thread pool threads.
@@ -28,6 +47,31 @@ using ThreadFunction = std::function<void(std::stop_token)>;
  */
 std::thread::id createThread(ThreadFunction func);
 
+/**
+ * Function that will ask the global thread pool to create several threads,
+ * each executing the same function.
+ *
+ * All of the threads are created in a single pass of the global thread pool,
+ * so this is much cheaper than calling createThread() once for each thread.
+ *
+ * @param count The number of threads to create.
+ * @param func The function which will be provided to each thread for
+ *   execution.
+ * @return The ids of the threads that were created.
+ */
+std::vector<std::thread::id> createThreads(size_t count, ThreadFunction func);
+
+/**
+ * Function that will ask threads created by createThread() or createThreads()
+ * to stop, and then block until the global thread pool has joined them.
+ *
+ * Each thread is asked to stop through the `std::stop_token` that was given
+ * to its function.  Ids of threads that have already been joined are ignored.
+ *
+ * @param threadIds The ids of the threads.
+ */
+void joinThreads(const std::vector<std::thread::id> & threadIds);
+
 /**
  * Function that must be called in order to terminate and join the Global
  * thread pool.
@@ -38,7 +82,8 @@ std::thread::id createThread(ThreadFunction func);
  * need to terminate.
  *
  * This function will asynchronously request that all threads stop, and then
- * block until all threads join.
+ * block until all threads join.  Threads that are parked in the warm thread
+ * cache are told to exit, but are not waited for.
  *
  * The main program will not end until all threads have terminated.  It may not
  * be necessary to call this function explicitly, depending on the design of
@@ -53,53 +98,1186 @@ void joinGlobalPool();
  */
 size_t getGlobalPoolThreadCount();
 
+/**
+ * How the global thread pool keeps finished threads for reuse.
+ *
+ * When the function of a thread returns (e.g., because its Pool was joined),
+ * the thread parks in a cache of warm threads instead of exiting, and the
+ * next call to createThread() or createThreads() (and so the next
+ * Pool::start()) hands its function to a parked thread instead of creating a
+ * new one.  A thread that stays parked for idleTimeout exits.
+ *
+ * Parked threads are not counted by getGlobalPoolThreadCount().
+ */
+struct WarmThreadPolicy {
+  /**
+   * The most threads that may be parked at once.
+   *
+   * A value of 0 disables the cache, so that every thread exits when its
+   * function returns.
+   */
+  size_t maxThreads{std::thread::hardware_concurrency()};
+
+  /**
+   * How long a thread stays parked before it exits.
+   */
+  std::chrono::milliseconds idleTimeout{std::chrono::seconds{1}};
+};
+
+/**
+ * Set how the global thread pool keeps finished threads for reuse.
+ *
+ * Parked threads beyond the new maxThreads exit, and the new idleTimeout
+ * applies to the threads that are already parked.
+ *
+ * @param policy The policy.
+ */
+void setWarmThreadPolicy(const WarmThreadPolicy & policy);
+
+/**
+ * Get how the global thread pool keeps finished threads for reuse.
+ *
+ * @returns The policy.
+ */
+WarmThreadPolicy getWarmThreadPolicy();
+
+/**
+ * Get the number of threads that are parked in the warm thread cache.
+ *
+ * @returns The number of parked threads.
+ */
+size_t getWarmThreadCount();
+
+/**
+ * Get the number of NUMA nodes on the system.
+ *
+ * If the topology cannot be determined, then the whole system is treated as a
+ * single node.
+ *
+ * @returns The number of NUMA nodes on the system.
+ */
+size_t getNumaNodeCount();
+
+/**
+ * Get the CPUs that belong to a NUMA node.
+ *
+ * @param node The index of the NUMA node.
+ * @returns The CPUs that belong to the node, or an empty list if there is no
+ *   such node.
+ */
+std::vector<size_t> getNumaNodeCpus(size_t node);
+
+/**
+ * Describes the CPUs on which the threads of a Pool may run.
+ *
+ * Affinity is applied on a best-effort basis.  It is ignored on platforms
+ * that do not support it, and for CPUs that do not exist.
+ */
+struct ThreadAffinity {
+  /**
+   * The CPUs on which the threads may run.
+   *
+   * If empty, then the threads may run anywhere.
+   */
+  std::vector<size_t> cpus{};
+
+  /**
+   * If true, then the thread in worker slot i is pinned to the single CPU
+   * `cpus[i % cpus.size()]`.  Otherwise, every thread may run on any of the
+   * cpus.
+   */
+  bool pinEach{false};
+};
+
+/**
+ * The type of function executed by a Task.
+ *
+ * The function is move-only, and a callable of up to FUNCTION_INLINE_SIZE
+ * bytes is stored without allocating.
+ */
+using TaskFunction = Function<void()>;
+
+/**
+ * The order in which queued tasks are given to the threads of a Pool.
+ *
+ * A thread prefers higher priority tasks, but lower priority tasks are still
+ * given a small share of the claims, so that they are never starved.
+ */
+enum class Priority : uint8_t {
+  /**
+   * Claimed before any other task, most of the time.
+   */
+  HIGH,
+
+  /**
+   * The default priority.
+   */
+  NORMAL,
+
+  /**
+   * Claimed only when there are no other tasks, most of the time.
+   */
+  LOW,
+};
+
 /**
  * Holds information about a task.
  */
 struct Task {
-  std::function<void()> function;
+  TaskFunction function;
+  Priority priority{Priority::NORMAL};
+
+  /**
+   * A name for the Task, which is shown in a trace of the pool.
+   *
+   * The string is not copied, so it must outlive the trace (e.g., a string
+   * literal).
+   */
+  const char * label{nullptr};
+
+  /**
+   * When the Task was enqueued.
+   *
+   * Set by the Pool, and used to measure how long the Task waited in the
+   * queue.
+   */
+  std::chrono::steady_clock::time_point enqueued{};
+
+  /**
+   * Identifies the Task in a trace of the pool.
+   *
+   * Set by the Pool while it is being traced.
+   */
+  uint64_t traceId{0};
+
+  /**
+   * Allocate a Task that the Pool holds by pointer (e.g., on the deque of a
+   * worker), using the same recycled storage as large callables.
+   *
+   * @param size The size of the Task.
+   * @returns The storage for the Task.
+   */
+  static void * operator new(size_t size) {
+    return allocateFunctionStorage(size);
+  }
+
+  /**
+   * Free a Task that was allocated with operator new.
+   *
+   * @param task The storage of the Task.
+   * @param size The size of the Task.
+   */
+  static void operator delete(void * task, size_t size) noexcept {
+    deallocateFunctionStorage(task, size);
+  }
 };
 
 /**
- * Represents a generalized thread pool.
+ * The strategy that a Pool uses to hand out tasks to its threads.
  */
-class Pool {
-  public:
+enum class Scheduler {
+  /**
+   * All tasks are held in a shared FIFO queue for each Priority.
+   */
+  FIFO,
+
+  /**
+   * Each thread has its own lock-free deque.
+   *
+   * NORMAL priority tasks enqueued from one of the pool's own threads are
+   * pushed onto that thread's deque, while all other tasks are placed in a
+   * shared injection queue.  A thread runs any HIGH priority task first, then
+   * the newest task from its own deque, then the oldest task from the
+   * injection queue, and only then tries to steal the oldest task from the
+   * deque of another thread.
+   */
+  WORK_STEALING,
+
+  /**
+   * All tasks are held in a bounded, lock-free ring buffer for each Priority.
+   *
+   * The slots of the rings are allocated when the pool is constructed, so
+   * enqueuing and claiming a task never takes a lock, and never allocates
+   * (unless the callable is too large to be stored inline).  This suits many
+   * producers outside of the pool feeding plain FIFO consumers.
+   *
+   * The capacity of the pool starts out at RING_CAPACITY.  If it is raised
+   * above that, then the tasks that do not fit in a ring wait in a locked
+   * overflow queue instead.
+   */
+  RING,
+};
+
+/**
+ * The number of tasks that each ring of a Pool that uses Scheduler::RING can
+ * hold.
+ */
+constexpr size_t RING_CAPACITY{4096};
+
+/**
+ * The capacity of a Pool whose queue may grow without limit.
+ */
+constexpr size_t UNLIMITED_CAPACITY{std::numeric_limits<size_t>::max()};
+
+/**
+ * What a Pool does with a new task when its queue is already at capacity.
+ */
+enum class OverflowPolicy {
+  /**
+   * Wait until a thread claims a task and there is room in the queue.
+   *
+   * If the pool is not running, then this waits until it has been started.
+   *
+   * If the task is enqueued from one of the pool's own threads, then it is
+   * run immediately instead (as with CALLER_RUNS), because waiting could
+   * deadlock the pool.
+   */
+  BLOCK,
+
+  /**
+   * Do not enqueue the task, and return false.
+   */
+  REJECT,
+
+  /**
+   * Discard the oldest queued task, starting with the lowest priority, to
+   * make room for the new task.
+   */
+  DROP_OLDEST,
+
+  /**
+   * Run the task immediately on the thread that is enqueuing it.
+   */
+  CALLER_RUNS,
+};
+
+/**
+ * How an idle thread of a Pool waits for a new task.
+ *
+ * An idle thread first spins, repeatedly checking for a task, and only parks
+ * (sleeps until it is notified) once it has checked spinCount times or has
+ * spun for spinDuration, whichever comes first.  It pauses the processor
+ * between the checks of the first half of the spin, and yields to other
+ * threads between the checks of the second half.  Spinning costs CPU time, but
+ * a spinning thread picks up a new task without having to be woken, and the
+ * pool does not wake a parked thread while another thread is spinning.
+ */
+struct IdlePolicy {
+  /**
+   * The most times that an idle thread checks for a task before it parks.
+   *
+   * A count of 0 parks the thread immediately.
+   */
+  size_t spinCount{0};
+
+  /**
+   * The longest time that an idle thread spins before it parks.
+   */
+  std::chrono::nanoseconds spinDuration{std::chrono::microseconds{50}};
+};
+
+/**
+ * When a Pool runs a new task immediately, on the thread that is enqueuing
+ * it, instead of queueing it.
+ *
+ * Running a task inline skips the trip through the queue, and keeps its data
+ * in the cache of the thread that produced it, which pays off for small
+ * tasks.  A task that is run inline is not queued, so it is not counted by
+ * the capacity or by the statistics, and any exception that it throws is
+ * thrown by the call that enqueued it.  tryEnqueue() never runs a task
+ * inline.
+ *
+ * Inline tasks may enqueue tasks of their own, which may also run inline, so
+ * the number of inline tasks that are nested on one thread is limited by
+ * maxDepth.  Beyond that, tasks are queued as usual.
+ */
+struct InlinePolicy {
+  /**
+   * A task that is enqueued by one of the pool's own threads, while at least
+   * this many tasks are waiting in the queue, is run inline.
+   *
+   * UNLIMITED_CAPACITY never runs a task inline for this reason.
+   */
+  size_t queueDepth{UNLIMITED_CAPACITY};
+
+  /**
+   * The most inline tasks that may be nested on one thread.
+   */
+  size_t maxDepth{16};
+
+  /**
+   * Whether or not a task that is enqueued while the pool is not running
+   * (before start() or after stop()) is run inline, by any thread, instead
+   * of waiting in the queue for the pool to be started.
+   */
+  bool whenStopped{false};
+};
+
+/**
+ * Describes how a Pool adjusts its own thread count to match its load.
+ *
+ * The autoscaler samples the pool every interval.  It grows the pool when the
+ * queue is deep, or when tasks have been waiting for longer than
+ * waitThreshold because every thread is busy.  It shrinks the pool once a
+ * thread has been idle, with nothing queued, for idleTimeout.  After any
+ * change, no further change is made until the cooldown has passed, and no
+ * single change adds more than maxGrowth threads or removes more than
+ * maxShrink threads.
+ */
+struct AutoscalePolicy {
+  /**
+   * The fewest threads that the pool will shrink to.
+   */
+  size_t minThreads{1};
+
+  /**
+   * The most threads that the pool will grow to.
+   */
+  size_t maxThreads{std::thread::hardware_concurrency()};
+
+  /**
+   * Grow the pool when at least this many tasks are queued for each thread.
+   */
+  size_t queueDepthPerThread{16};
+
+  /**
+   * Grow the pool when tasks have been queued, with no thread free to claim
+   * them, for at least this long.
+   */
+  std::chrono::nanoseconds waitThreshold{std::chrono::milliseconds{10}};
+
+  /**
+   * Shrink the pool when a thread has been idle, with nothing queued, for at
+   * least this long.
+   */
+  std::chrono::nanoseconds idleTimeout{std::chrono::seconds{1}};
+
+  /**
+   * How often the autoscaler samples the pool.
+   */
+  std::chrono::nanoseconds interval{std::chrono::milliseconds{5}};
+
+  /**
+   * The shortest time between two changes of the thread count.
+   */
+  std::chrono::nanoseconds cooldown{std::chrono::milliseconds{50}};
+
+  /**
+   * The most threads that a single change may add.
+   */
+  size_t maxGrowth{4};
+
+  /**
+   * The most threads that a single change may remove.
+   */
+  size_t maxShrink{1};
+};
+
+/**
+ * The number of trace events that are kept for each worker of a Pool (and for
+ * the threads outside of the pool, together).  Once a buffer is full, the
+ * oldest events are overwritten.
+ */
+constexpr size_t TRACE_BUFFER_SIZE{size_t{1} << 14};
+
+/**
+ * A histogram of durations, in the style of an HDR histogram.
+ *
+ * Durations below SUB_BUCKET_COUNT nanoseconds are counted exactly.  Above
+ * that, each power of 2 is split into SUB_BUCKET_COUNT buckets, so that every
+ * duration is counted in a bucket that is no wider than 1/SUB_BUCKET_COUNT of
+ * the duration itself.  Durations of 2^MAX_BITS nanoseconds (about 18
+ * minutes) or more are counted in the last bucket.
+ */
+struct LatencyHistogram {
+  /**
+   * The number of bits of precision kept for each duration.
+   */
+  static constexpr size_t SUB_BUCKET_BITS{3};
+
+  /**
+   * The number of buckets that each power of 2 is split into.
+   */
+  static constexpr size_t SUB_BUCKET_COUNT{size_t{1} << SUB_BUCKET_BITS};
+
+  /**
+   * The number of bits of the longest duration that has a bucket of its own.
+   */
+  static constexpr size_t MAX_BITS{40};
+
+  /**
+   * The number of buckets.
+   */
+  static constexpr size_t BUCKET_COUNT{(MAX_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT};
+
+  /**
+   * Find the bucket that counts a duration.
+   *
+   * @param duration The duration.
+   * @returns The index of the bucket.
+   */
+  static size_t getBucket(std::chrono::nanoseconds duration);
+
+  /**
+   * Get the shortest duration that is counted in a bucket.
+   *
+   * @param bucket The index of the bucket.
+   * @returns The shortest duration that is counted in the bucket.
+   */
+  static std::chrono::nanoseconds getBucketStart(size_t bucket);
+
+  /**
+   * Returns the number of durations that have been counted.
+   *
+   * @returns The number of durations that have been counted.
+   */
+  uint64_t getCount() const;
+
+  /**
+   * Returns the mean of the durations that have been counted.
+   *
+   * @returns The mean of the durations, or 0 if there are none.
+   */
+  std::chrono::nanoseconds getMean() const;
+
+  /**
+   * Returns the duration below which a percentage of the durations fall.
+   *
+   * The result is the longest duration of the bucket that holds the
+   * percentile, so it overestimates by no more than the width of the bucket.
+   *
+   * @param percentile The percentage, from 0 to 100.
+   * @returns The duration, or 0 if no durations have been counted.
+   */
+  std::chrono::nanoseconds getPercentile(double percentile) const;
+
+  /**
+   * The number of durations counted in each bucket.
+   */
+  std::array<uint64_t, BUCKET_COUNT> counts{};
+
+  /**
+   * The sum of the durations that have been counted.
+   */
+  std::chrono::nanoseconds total{0};
+};
+
+/**
+ * Statistics about a single worker slot of a Pool.
+ *
+ * Worker slots are reused as threads come and go, so the statistics of a
+ * slot cover every thread that has used it.
+ */
+struct WorkerStats {
+  /**
+   * The number of tasks that were run.
+   */
+  uint64_t completed{0};
+
+  /**
+   * The number of tasks that were stolen from another worker.
+   */
+  uint64_t stolen{0};
+
+  /**
+   * The time spent running tasks.
+   */
+  std::chrono::nanoseconds busy{0};
+
+  /**
+   * The time spent waiting for (and claiming) tasks.
+   */
+  std::chrono::nanoseconds idle{0};
+};
+
+/**
+ * A snapshot of the statistics of a Pool, from getStats().
+ *
+ * The statistics are collected without locks and merged when the snapshot is
+ * taken, so a snapshot that is taken while tasks are running may be slightly
+ * inconsistent (e.g., a task may be counted as submitted but not yet in the
+ * queue wait histogram).
+ */
+struct PoolStats {
+  /**
+   * Whether or not statistics are collected.  If the library was built with
+   * GHOTI_POOL_NO_STATS defined, then this is false and everything else is 0.
+   */
+  bool enabled{false};
+
+  /**
+   * The number of tasks that were added to the queue.
+   *
+   * Tasks that were rejected, or that were run by the caller because of the
+   * OverflowPolicy, are not counted.
+   */
+  uint64_t submitted{0};
+
+  /**
+   * The number of tasks that were run by the threads of the pool.
+   */
+  uint64_t completed{0};
+
+  /**
+   * The number of tasks that were stolen by one worker from another.
+   */
+  uint64_t stolen{0};
+
+  /**
+   * How long the tasks waited in the queue before a thread started them.
+   */
+  LatencyHistogram queueWait{};
+
+  /**
+   * How long the tasks took to run.
+   */
+  LatencyHistogram execution{};
+
+  /**
+   * The statistics of each worker slot.
+   */
+  std::vector<WorkerStats> workers{};
+};
+
+/**
+ * The resolution of the timers of a Pool.
+ *
+ * A delayed task is never enqueued before its deadline, and is usually
+ * enqueued within one tick after it.
+ */
+constexpr std::chrono::milliseconds TIMER_TICK{1};
+
+/**
+ * Identifies a delayed or periodic task of a Pool, so that it can be
+ * cancelled.
+ *
+ * A default-constructed handle does not refer to any task.  Handles may be
+ * copied, and may outlive the Pool.
+ */
+class TimerHandle {
+  public:
+  /**
+   * Default constructor.
+   */
+  TimerHandle() = default;
+
+  /**
+   * Cancel the task, so that it is not enqueued (again).
+   *
+   * This takes constant time, no matter how many timers the pool has.  A
+   * periodic task that is running when it is cancelled finishes that run,
+   * but is not run again.
+   *
+   * @returns True if the task was cancelled, False if it had already been
+   *   enqueued (for a delayed task) or cancelled, or if the Pool no longer
+   *   exists.
+   */
+  bool cancel();
+
+  private:
+  friend class Pool;
+
+  /**
+   * Constructor.
+   *
+   * @param state The shared state of the pool.
+   * @param index The index of the timer in the pool's timer wheel.
+   * @param generation The generation of the timer.
+   */
+  TimerHandle(std::weak_ptr<State> state, uint32_t index, uint32_t generation);
+
+  /**
+   * The shared state of the pool.
+   */
+  std::weak_ptr<State> state{};
+
+  /**
+   * The index of the timer in the pool's timer wheel.
+   */
+  uint32_t index{0};
+
+  /**
+   * The generation of the timer, which identifies it among the timers that
+   * have used the same index.
+   */
+  uint32_t generation{0};
+};
+
+/**
+ * Memory for short-lived scratch data, from Pool::allocator().
+ *
+ * Allocating bumps a pointer through a chunk of memory, and deallocating does
+ * nothing.  Instead, all of the memory is reclaimed at once by reset(), which
+ * the threads of a Pool do after every task that they run.  The arena is a
+ * `std::pmr::memory_resource`, so that it can be used with the `std::pmr`
+ * containers.
+ *
+ * When the memory outgrows a chunk, another chunk is added.  On reset(), the
+ * chunks are replaced by a single chunk that is large enough for all of
+ * them, so that a thread soon settles on one chunk that fits its tasks.
+ */
+class ScratchArena : public std::pmr::memory_resource {
+  public:
+  /**
+   * The size of the first chunk of an arena.
+   */
+  static constexpr size_t CHUNK_SIZE{size_t{1} << 16};
+
+  /**
+   * Default constructor.
+   *
+   * No memory is allocated until it is first needed.
+   */
+  ScratchArena() = default;
+
+  /**
+   * Destructor.
+   */
+  ~ScratchArena() override;
+
+  // Remove the copy constructor.
+  ScratchArena(const ScratchArena &) = delete;
+
+  // Remove the copy assignment.
+  ScratchArena & operator=(const ScratchArena &) = delete;
+
+  /**
+   * Reclaim all of the memory that has been allocated from the arena.
+   *
+   * Everything that was allocated from the arena must no longer be in use.
+   */
+  void reset() noexcept;
+
+  /**
+   * Get the number of bytes that have been allocated since the last reset
+   * (including padding for alignment).
+   *
+   * @returns The number of bytes.
+   */
+  size_t getUsedBytes() const noexcept;
+
+  protected:
+  /**
+   * Allocate memory from the arena.
+   *
+   * @param bytes The number of bytes.
+   * @param alignment The alignment of the memory.
+   * @returns The memory.
+   */
+  void * do_allocate(size_t bytes, size_t alignment) override;
+
+  /**
+   * Does nothing, because the memory is reclaimed by reset().
+   */
+  void do_deallocate(void *, size_t, size_t) override {}
+
+  /**
+   * Memory from an arena may only be freed by the same arena.
+   *
+   * @param other The other memory resource.
+   * @returns True if other is this arena.
+   */
+  bool do_is_equal(const std::pmr::memory_resource & other) const noexcept override {
+    return this == &other;
+  }
+
+  private:
+  /**
+   * The header of a chunk of memory, followed by the memory itself.
+   */
+  struct Chunk {
+    /**
+     * The chunk that was added before this one, or nullptr.
+     */
+    Chunk * previous;
+
+    /**
+     * The number of bytes that follow the header.
+     */
+    size_t size;
+  };
+
+  /**
+   * Add a chunk that has room for an allocation.
+   *
+   * @param bytes The number of bytes that must fit.
+   * @param alignment The alignment of the allocation.
+   */
+  void addChunk(size_t bytes, size_t alignment);
+
+  /**
+   * The most recently added chunk, or nullptr.
+   */
+  Chunk * chunk{nullptr};
+
+  /**
+   * The next free byte of the current chunk.
+   */
+  std::byte * next{nullptr};
+
+  /**
+   * One past the last byte of the current chunk.
+   */
+  std::byte * end{nullptr};
+
+  /**
+   * The number of bytes in the chunks before the current one, that were
+   * used before it was added.
+   */
+  size_t previousUsed{0};
+};
+
+/**
+ * The most tasks of a Pool that may run at once, when there is no limit.
+ */
+constexpr size_t UNLIMITED_CONCURRENCY{std::numeric_limits<size_t>::max()};
+
+/**
+ * The share of the threads of a WorkerGroup that a Pool in the group may use.
+ *
+ * While the threads are all busy, each pool that has tasks waiting receives
+ * threads in proportion to its weight.  A pool that is running fewer than
+ * minConcurrency tasks is served before any pool that is not, and a pool
+ * that is running maxConcurrency tasks is not served at all until one of
+ * them finishes.
+ */
+struct ExecutorQuota {
+  /**
+   * The share of the group that the pool receives, relative to the weights
+   * of the other pools that have tasks waiting.  A weight of 0 is treated as
+   * a weight of 1.
+   */
+  size_t weight{1};
+
+  /**
+   * The number of tasks of the pool that are run before the tasks of any
+   * pool that has already reached its own minimum.
+   */
+  size_t minConcurrency{0};
+
+  /**
+   * The most tasks of the pool that the threads of the group run at once, or
+   * UNLIMITED_CONCURRENCY.
+   */
+  size_t maxConcurrency{UNLIMITED_CONCURRENCY};
+};
+
+/**
+ * A set of threads that is shared by several Pool objects.
+ *
+ * Each Pool that is constructed with a WorkerGroup keeps its own queue,
+ * capacity, policies, statistics and timers, but has no threads of its own.
+ * Its tasks are instead run by the threads of the group, which share their
+ * time between the pools of the group according to the ExecutorQuota of
+ * each pool.  A process with several subsystems can therefore give each its
+ * own pool without creating more threads than it has cores.
+ *
+ * The threads are created by the global thread pool when the group is
+ * constructed, and are joined when it is destroyed.  The group must outlive
+ * its pools' need for threads: once it is destroyed, tasks that are still
+ * queued in its pools are no longer run.
+ */
+class WorkerGroup {
+  public:
+  /**
+   * Default constructor.
+   *
+   * Will create as many threads as the total number of logical cores on the
+   * system.
+   */
+  WorkerGroup();
+
+  /**
+   * Constructor for a specific number of threads.
+   *
+   * @param threadCount The number of threads in the group.
+   */
+  WorkerGroup(size_t threadCount);
+
+  /**
+   * Destructor.
+   *
+   * Waits for the threads to finish the tasks that they are running, then
+   * joins them.
+   */
+  ~WorkerGroup();
+
+  // Remove the copy constructor.
+  WorkerGroup(const WorkerGroup &) = delete;
+
+  // Remove the copy assignment.
+  WorkerGroup & operator=(const WorkerGroup &) = delete;
+
+  /**
+   * Get the number of threads in the group.
+   *
+   * @returns The number of threads in the group.
+   */
+  size_t getThreadCount() const;
+
+  /**
+   * Get the number of pools that use the group.
+   *
+   * @returns The number of pools that use the group.
+   */
+  size_t getPoolCount() const;
+
+  private:
+  friend class Pool;
+
+  /**
+   * The state of the group, which is shared with its threads and pools.
+   */
+  std::shared_ptr<WorkerGroupState> state;
+};
+
+/**
+ * A callable that may be enqueued to a Pool: it either takes no arguments, or
+ * takes the `std::stop_token` of the pool that runs it.
+ */
+template <typename F>
+concept TaskCallable = std::is_invocable_r_v<void, std::decay_t<F> &>
+  || std::is_invocable_r_v<void, std::decay_t<F> &, std::stop_token>;
+
+/**
+ * Represents a generalized thread pool.
+ */
+class Pool {
+  public:
+  /**
+   * Default thread pool constructor.
+   *
+   * Will create as many threads as the total number of logical cores on the
+   * system.
+   */
+  Pool();
+
+  /**
+   * Thread pool constructor for a specific number of threads.
+   *
+   * @param threadCount The desired number of threads.
+   */
+  Pool(size_t threadCount);
+
+  /**
+   * Thread pool constructor for a specific number of threads and scheduler.
+   *
+   * @param threadCount The desired number of threads.
+   * @param scheduler The strategy used to hand out tasks to the threads.
+   */
+  Pool(size_t threadCount, Scheduler scheduler);
+
+  /**
+   * Thread pool constructor for a pool whose tasks are run by the threads of
+   * a WorkerGroup.
+   *
+   * The pool has no threads of its own (unless some are added with
+   * setThreadCount()), but is otherwise started, stopped and joined like
+   * any other pool.
+   *
+   * @param group The threads that run the tasks of the pool.
+   * @param quota The share of the group that the pool may use.
+   * @param scheduler The strategy used to hand out tasks to the threads.
+   */
+  Pool(WorkerGroup & group, ExecutorQuota quota = {}, Scheduler scheduler = Scheduler::FIFO);
+
+  /**
+   * Thread pool destructor.
+   *
+   * When the pool is destroyed, it will signal all threads to stop.
+   */
+  ~Pool();
+
+  // Remove the copy constructor.
+  Pool(const Ghoti::Pool::Pool&) = delete;
+
+  // Remove the copy assignment.
+  Ghoti::Pool::Pool& operator=(const Ghoti::Pool::Pool&) = delete;
+
+  /**
+   * Enqueue a Task for the thread pool.
+   *
+   * If the queue is at capacity, then the OverflowPolicy of the pool decides
+   * what happens to the Task.  If the Task is rejected, then it is not moved
+   * from.
+   *
+   * @param task A rvalue representing the Task to be enqueued.
+   * @returns True on success (including when the Task was run by the calling
+   *   thread), False if the Task was rejected.
+   */
+  bool enqueue(Task && task);
+
+  /**
+   * Enqueue a callable as a Task for the thread pool.
+   *
+   * The callable is constructed directly inside of the Task in the queue,
+   * without first creating a temporary Task.  A callable that takes a
+   * `std::stop_token` receives the token from getStopToken() when it runs.
+   *
+   * If the queue is at capacity, then the OverflowPolicy of the pool decides
+   * what happens to the callable.
+   *
+   * @param f The callable to be enqueued.
+   * @param priority The priority of the Task.
+   * @returns True on success (including when the callable was run by the
+   *   calling thread), False if the callable was rejected.
+   */
+  template <typename F>
+    requires (!std::same_as<std::remove_cvref_t<F>, Task>) && TaskCallable<F>
+  bool enqueue(F && f, Priority priority = Priority::NORMAL) {
+    return this->emplace(priority, constructTask<F>, const_cast<void *>(static_cast<const void *>(std::addressof(f))), false);
+  }
+
+  /**
+   * Enqueue a Task for the thread pool, unless the queue is at capacity.
+   *
+   * This never blocks, regardless of the OverflowPolicy of the pool.
+   *
+   * @param task A rvalue representing the Task to be enqueued.  If the queue
+   *   is at capacity, then it is not moved from.
+   * @returns True if the Task was enqueued, False otherwise.
+   */
+  bool tryEnqueue(Task && task);
+
+  /**
+   * Enqueue a callable as a Task for the thread pool, unless the queue is at
+   * capacity.
+   *
+   * This never blocks, regardless of the OverflowPolicy of the pool.
+   *
+   * @param f The callable to be enqueued.
+   * @param priority The priority of the Task.
+   * @returns True if the callable was enqueued, False otherwise.
+   */
+  template <typename F>
+    requires (!std::same_as<std::remove_cvref_t<F>, Task>) && TaskCallable<F>
+  bool tryEnqueue(F && f, Priority priority = Priority::NORMAL) {
+    return this->emplace(priority, constructTask<F>, const_cast<void *>(static_cast<const void *>(std::addressof(f))), true);
+  }
+
+  /**
+   * Submit a function, with arguments, to the thread pool and receive a
+   * Future for its result.
+   *
+   * The function and its arguments are decay-copied into the Task.  If the
+   * function throws, then the exception is stored in the Future.  If the
+   * Task is destroyed without having been run, then the Future receives a
+   * `std::future_errc::broken_promise` error.
+   *
+   * @param f The function to be called.
+   * @param args The arguments to pass to the function.
+   * @returns A Future for the result of the function.
+   */
+  template <typename F, typename... Args>
+  auto submit(F && f, Args &&... args) -> Future<std::invoke_result_t<std::decay_t<F> &, std::decay_t<Args> &...>> {
+    using R = std::invoke_result_t<std::decay_t<F> &, std::decay_t<Args> &...>;
+
+    Promise<R> promise{};
+    auto future = promise.getFuture();
+    this->enqueue([promise = std::move(promise), f = std::forward<F>(f), ...args = std::forward<Args>(args)]() mutable {
+      promise.setFrom(f, args...);
+    });
+    return future;
+  }
+
+  /**
+   * An awaitable that resumes the awaiting coroutine on one of the threads
+   * of a Pool.
+   */
+  class ScheduleAwaiter {
+    public:
+    /**
+     * Constructor.
+     *
+     * @param pool The pool on which the coroutine will be resumed.
+     */
+    explicit ScheduleAwaiter(Pool & pool) noexcept : pool{pool} {}
+
+    /**
+     * The coroutine is always suspended, so that it can be moved to the pool.
+     *
+     * @returns False.
+     */
+    bool await_ready() const noexcept {
+      return false;
+    }
+
+    /**
+     * Enqueue the resumption of the coroutine to the pool.
+     *
+     * @param coroutine The suspended coroutine.
+     * @returns True if the coroutine was handed to the pool, False if the
+     *   pool rejected it (in which case it continues on this thread).
+     */
+    bool await_suspend(std::coroutine_handle<> coroutine) {
+      // The awaiter lives in the coroutine frame, which may already be
+      // running on another thread once enqueue() returns.
+      auto & pool = this->pool;
+      return pool.enqueue([coroutine](){
+        coroutine.resume();
+      });
+    }
+
+    /**
+     * Nothing is produced by the resumption.
+     */
+    void await_resume() const noexcept {}
+
+    private:
+    /**
+     * The pool on which the coroutine will be resumed.
+     */
+    Pool & pool;
+  };
+
+  /**
+   * Move the current coroutine onto one of the threads of the pool.
+   *
+   * `co_await pool.schedule()` suspends the coroutine and enqueues its
+   * resumption as a task, which does not allocate.  If the pool rejects the
+   * task (according to its OverflowPolicy), then the coroutine simply
+   * continues on the current thread.  If the task is discarded without being
+   * run (e.g., by OverflowPolicy::DROP_OLDEST), then the coroutine is never
+   * resumed.
+   *
+   * @returns An awaitable that resumes the coroutine on the pool.
+   */
+  ScheduleAwaiter schedule() noexcept {
+    return ScheduleAwaiter{*this};
+  }
+
+  /**
+   * Enqueue a batch of Tasks for the thread pool.
+   *
+   * The tasks of each priority are added while holding that queue's lock
+   * only once, and only as many threads are woken as are needed to claim the
+   * tasks.  The tasks are moved out of the span.
+   *
+   * If the queue does not have room for every task, then as many as fit are
+   * enqueued together, and the OverflowPolicy of the pool decides what
+   * happens to the rest.
+   *
+   * @param tasks The Tasks to be enqueued.
+   * @returns True on success, False if any of the tasks were rejected.  The
+   *   rejected tasks are not moved from.
+   */
+  bool enqueueBatch(std::span<Task> tasks);
+
+  /**
+   * Enqueue a Task for the thread pool once a point in time is reached.
+   *
+   * The pool keeps its delayed tasks in a hierarchical timer wheel, which is
+   * driven by a single timer thread per pool.  When the deadline is reached,
+   * the Task is added to the normal queue (according to its Priority and the
+   * OverflowPolicy of the pool), where it waits for a thread like any other
+   * task.  The timer thread only runs while the pool is running; a deadline
+   * that passes while the pool is stopped is acted on once it is started.
+   *
+   * @param deadline When the Task should be enqueued.
+   * @param task The Task.
+   * @returns The handle with which the Task can be cancelled.
+   */
+  TimerHandle enqueueAt(std::chrono::steady_clock::time_point deadline, Task && task);
+
+  /**
+   * Enqueue a callable as a Task for the thread pool once a point in time is
+   * reached.
+   *
+   * @param deadline When the callable should be enqueued.
+   * @param f The callable.
+   * @param priority The priority of the Task.
+   * @returns The handle with which the Task can be cancelled.
+   */
+  template <typename F>
+    requires (!std::same_as<std::remove_cvref_t<F>, Task>)
+      && std::is_invocable_r_v<void, std::decay_t<F> &>
+  TimerHandle enqueueAt(std::chrono::steady_clock::time_point deadline, F && f, Priority priority = Priority::NORMAL) {
+    return this->enqueueAt(deadline, Task{std::forward<F>(f), priority});
+  }
+
+  /**
+   * Enqueue a Task for the thread pool after a delay.
+   *
+   * See enqueueAt() for details.
+   *
+   * @param delay How long to wait before the Task is enqueued.
+   * @param task The Task.
+   * @returns The handle with which the Task can be cancelled.
+   */
+  TimerHandle enqueueAfter(std::chrono::nanoseconds delay, Task && task);
+
+  /**
+   * Enqueue a callable as a Task for the thread pool after a delay.
+   *
+   * @param delay How long to wait before the callable is enqueued.
+   * @param f The callable.
+   * @param priority The priority of the Task.
+   * @returns The handle with which the Task can be cancelled.
+   */
+  template <typename F>
+    requires (!std::same_as<std::remove_cvref_t<F>, Task>)
+      && std::is_invocable_r_v<void, std::decay_t<F> &>
+  TimerHandle enqueueAfter(std::chrono::nanoseconds delay, F && f, Priority priority = Priority::NORMAL) {
+    return this->enqueueAfter(delay, Task{std::forward<F>(f), priority});
+  }
+
   /**
-   * Default thread pool constructor.
+   * Enqueue a Task for the thread pool repeatedly, once every period, until
+   * it is cancelled.
    *
-   * Will create as many threads as the total number of logical cores on the
-   * system.
+   * The first run is enqueued one period from now.  Each following run is
+   * scheduled one period after the deadline of the previous one, but not
+   * before the previous run has finished, so runs of the same Task never
+   * overlap, and a run that takes longer than the period delays the next one
+   * instead of causing a backlog.
+   *
+   * A run that the pool rejects or drops (see OverflowPolicy), or that is
+   * removed by discard(), is skipped, and the next run is scheduled when the
+   * skipped one is destroyed.  Likewise, a run that throws (e.g., when a
+   * discarded run is called elsewhere) still schedules the next one.
+   *
+   * @param period The time between runs.  It is rounded up to TIMER_TICK.
+   * @param task The Task.
+   * @returns The handle with which the Task can be cancelled.
    */
-  Pool();
+  TimerHandle enqueueEvery(std::chrono::nanoseconds period, Task && task);
 
   /**
-   * Thread pool constructor for a specific number of threads.
+   * Enqueue a callable as a Task for the thread pool repeatedly, once every
+   * period, until it is cancelled.
    *
-   * @param threadCount The desired number of threads.
+   * @param period The time between runs.
+   * @param f The callable.
+   * @param priority The priority of the Task.
+   * @returns The handle with which the Task can be cancelled.
    */
-  Pool(size_t threadCount);
+  template <typename F>
+    requires (!std::same_as<std::remove_cvref_t<F>, Task>)
+      && std::is_invocable_r_v<void, std::decay_t<F> &>
+  TimerHandle enqueueEvery(std::chrono::nanoseconds period, F && f, Priority priority = Priority::NORMAL) {
+    return this->enqueueEvery(period, Task{std::forward<F>(f), priority});
+  }
 
   /**
-   * Thread pool destructor.
+   * Get the number of delayed and periodic tasks that are waiting for their
+   * deadline.
    *
-   * When the pool is destroyed, it will signal all threads to stop.
+   * @returns The number of timers.
    */
-  ~Pool();
-
-  // Remove the copy constructor.
-  Pool(const Ghoti::Pool::Pool&) = delete;
-
-  // Remove the copy assignment.
-  Ghoti::Pool::Pool& operator=(const Ghoti::Pool::Pool&) = delete;
+  size_t getTimerCount() const;
 
   /**
-   * Enqueue a Task for the thread pool.
+   * Get the scratch memory of the current thread.
    *
-   * @param task A rvalue representing the Task to be enqueued.
-   * @returns True on success, False on failure.
+   * Tasks may use the arena for temporary data that does not outlive the
+   * task, e.g., with a `std::pmr::vector`.  A thread of a Pool resets its
+   * arena after each task that it runs, so the memory costs no more than a
+   * pointer increment and is never freed one piece at a time.  Any other
+   * thread must reset() the arena itself.
+   *
+   * @returns The arena of the current thread.
    */
-  bool enqueue(Task && task);
+  static ScratchArena & allocator();
 
   /**
    * Start the thread pool processing.
@@ -113,15 +1291,65 @@ class Pool {
    * threads.
    *
    * Note: This will not halt any currently processing thread.  It will only
-   * keep that thread from accepting a new Task from the queue.
+   * keep that thread from accepting a new Task from the queue.  Running tasks
+   * may notice the stop through getStopToken().
    */
   void stop();
 
   /**
    * Stop the thread pool (if not already stopped) and join all threads.
+   *
+   * Tasks that are still queued stay in the queue (see drain() and
+   * discard()).
    */
   void join();
 
+  /**
+   * Finish the queued tasks, then stop and join the pool.
+   *
+   * No further tasks are taken from the timers, and each thread terminates
+   * once it finds nothing left to do, so that the pool stops as soon as the
+   * queue is empty and the last running task has finished.  Tasks that are
+   * enqueued by the running tasks are finished as well.
+   *
+   * If the timeout passes first, then the pool is stopped anyway: the stop
+   * token of the pool is requested, so that running tasks which check it
+   * may finish early, and the remaining tasks are left in the queue (see
+   * discard()).  Either way, no task of the pool is running when this
+   * returns.
+   *
+   * A pool that is not running is only joined.
+   *
+   * @param timeout The longest time to wait for the queue to be finished.
+   * @returns True if every queued task was finished, False otherwise.
+   */
+  bool drain(std::chrono::nanoseconds timeout = std::chrono::nanoseconds::max());
+
+  /**
+   * Stop and join the pool, then remove every task that is still in the
+   * queue, without running it.
+   *
+   * Delayed and periodic tasks that have not yet reached their deadline are
+   * not removed.
+   *
+   * @returns The tasks that were removed, from the highest priority to the
+   *   lowest, so that they may be enqueued elsewhere.
+   */
+  std::vector<Task> discard();
+
+  /**
+   * Get the stop token of the pool that the current thread is running a
+   * task for.
+   *
+   * Stop is requested when the pool is stopped or joined (including when
+   * drain() runs out of time), so that long tasks may check the token and
+   * finish early.  Starting the pool again gives it a new token.
+   *
+   * @returns The stop token, or a token that can never be stopped if the
+   *   current thread is not one of the threads of a pool.
+   */
+  static std::stop_token getStopToken();
+
   /**
    * Returns the number of tasks currently in the task queue.
    *
@@ -129,6 +1357,130 @@ class Pool {
    */
   size_t getTaskQueueCount();
 
+  /**
+   * Limit the number of tasks that may be waiting in the queue.
+   *
+   * Tasks that have already been enqueued are not affected if the new
+   * capacity is lower than the current number of queued tasks.
+   *
+   * @param capacity The most tasks that may be waiting in the queue, or
+   *   UNLIMITED_CAPACITY.
+   * @param policy What to do with a new task when the queue is at capacity.
+   */
+  void setCapacity(size_t capacity, OverflowPolicy policy = OverflowPolicy::BLOCK);
+
+  /**
+   * Returns the most tasks that may be waiting in the queue.
+   *
+   * @returns The most tasks that may be waiting in the queue, or
+   *   UNLIMITED_CAPACITY.
+   */
+  size_t getCapacity() const;
+
+  /**
+   * Returns what is done with a new task when the queue is at capacity.
+   *
+   * @returns What is done with a new task when the queue is at capacity.
+   */
+  OverflowPolicy getOverflowPolicy() const;
+
+  /**
+   * Set how an idle thread waits for a new task.
+   *
+   * Threads that are already spinning or parked use the new policy the next
+   * time that they become idle.
+   *
+   * @param policy How an idle thread waits for a new task.
+   */
+  void setIdlePolicy(IdlePolicy policy);
+
+  /**
+   * Returns how an idle thread waits for a new task.
+   *
+   * @returns How an idle thread waits for a new task.
+   */
+  IdlePolicy getIdlePolicy() const;
+
+  /**
+   * Set the most NORMAL priority tasks that a thread claims from the shared
+   * queue at once.
+   *
+   * The first task is run at once, and the rest of the batch waits on the
+   * thread's own deque, so that the lock of the queue is taken only once for
+   * the whole batch.  Each thread claims no more than its share of the queue,
+   * and idle threads may still steal the tasks of a batch.  Before a thread
+   * runs a task, it prefetches the next task of its deque.
+   *
+   * The default is 1 (no batching) with Scheduler::FIFO, and 32 with
+   * Scheduler::WORK_STEALING.  Scheduler::RING does not batch.  A thread of
+   * the FIFO scheduler runs its batch oldest first, so tasks stay in order
+   * on a pool with a single thread.
+   *
+   * @param batchSize The most tasks that are claimed at once.  A value of 0
+   *   is treated as 1.
+   */
+  void setBatchSize(size_t batchSize);
+
+  /**
+   * Returns the most NORMAL priority tasks that a thread claims from the
+   * shared queue at once.
+   *
+   * @returns The most tasks that are claimed at once.
+   */
+  size_t getBatchSize() const;
+
+  /**
+   * Set when a new task is run inline by the thread that enqueues it.
+   *
+   * @param policy When a new task is run inline.
+   */
+  void setInlinePolicy(InlinePolicy policy);
+
+  /**
+   * Returns when a new task is run inline by the thread that enqueues it.
+   *
+   * @returns When a new task is run inline.
+   */
+  InlinePolicy getInlinePolicy() const;
+
+  /**
+   * Change the share of its WorkerGroup that the pool may use.
+   *
+   * This has no effect on a pool that does not use a WorkerGroup.
+   *
+   * @param quota The share of the group that the pool may use.
+   */
+  void setExecutorQuota(ExecutorQuota quota);
+
+  /**
+   * Returns the share of its WorkerGroup that the pool may use.
+   *
+   * @returns The share of the group that the pool may use, or the default
+   *   quota if the pool does not use a WorkerGroup.
+   */
+  ExecutorQuota getExecutorQuota() const;
+
+  /**
+   * Set the CPUs on which the threads of the pool may run.
+   *
+   * The affinity is applied by each thread when it starts, so it should be
+   * set before the pool is started.
+   *
+   * When using the work-stealing scheduler, a thread whose CPUs all belong to
+   * a single NUMA node only steals from threads on other nodes once there is
+   * nothing to steal from the threads on its own node.
+   *
+   * @param affinity The CPUs on which the threads of the pool may run.
+   */
+  void setThreadAffinity(ThreadAffinity affinity);
+
+  /**
+   * Returns the CPUs on which the threads of the pool may run.
+   *
+   * @returns The CPUs on which the threads of the pool may run.
+   */
+  ThreadAffinity getThreadAffinity() const;
+
   /**
    * Set the thread count.
    *
@@ -142,6 +1494,32 @@ class Pool {
    */
   void setThreadCount(size_t threadCount);
 
+  /**
+   * Let the pool adjust its own thread count as its load changes.
+   *
+   * The thread count is immediately clamped to the limits of the policy, and
+   * the autoscaler runs whenever the pool is running.  The thread count may
+   * still be changed with setThreadCount(), but the autoscaler will adjust it
+   * from there.
+   *
+   * @param policy How the pool adjusts its thread count.
+   */
+  void setAutoscalePolicy(AutoscalePolicy policy);
+
+  /**
+   * Stop the pool from adjusting its own thread count.
+   *
+   * The thread count stays wherever the autoscaler left it.
+   */
+  void clearAutoscalePolicy();
+
+  /**
+   * Returns how the pool adjusts its own thread count, if it does.
+   *
+   * @returns How the pool adjusts its own thread count, if it does.
+   */
+  std::optional<AutoscalePolicy> getAutoscalePolicy() const;
+
   /**
    * Returns the number of threads that are created.
    *
@@ -170,7 +1548,134 @@ class Pool {
    */
   size_t getRunningThreadCount() const;
 
+  /**
+   * Returns the scheduler that was chosen when the pool was constructed.
+   *
+   * @returns The scheduler that was chosen when the pool was constructed.
+   */
+  Scheduler getScheduler() const;
+
+  /**
+   * Returns a snapshot of the statistics of the pool.
+   *
+   * Taking a snapshot does not block the pool's threads.
+   *
+   * @returns A snapshot of the statistics of the pool.
+   */
+  PoolStats getStats() const;
+
+  /**
+   * Start recording a trace of the pool.
+   *
+   * While the pool is being traced, an event is recorded whenever a task is
+   * enqueued, claimed by a thread, started, and finished.  The events are
+   * kept in a fixed-size ring buffer for each worker (see TRACE_BUFFER_SIZE),
+   * so only the most recent events are kept.  Any events from an earlier
+   * trace are discarded.
+   *
+   * When the pool is not being traced, each of those points costs a single
+   * branch.
+   */
+  void startTrace();
+
+  /**
+   * Stop recording a trace of the pool.
+   *
+   * The recorded events are kept until the next call to startTrace().
+   */
+  void stopTrace();
+
+  /**
+   * Returns whether or not the pool is being traced.
+   *
+   * @returns True if the pool is being traced, False otherwise.
+   */
+  bool isTracing() const;
+
+  /**
+   * Write the recorded trace in the Chrome trace event JSON format, which may
+   * be loaded into Perfetto (https://ui.perfetto.dev) or chrome://tracing.
+   *
+   * Each worker is shown as a thread, with a slice for every task that it
+   * ran, and with flow arrows from where each task was enqueued.  Tasks
+   * enqueued from outside of the pool are shown on a thread of their own.
+   *
+   * This should be called after stopTrace(), because events that are
+   * recorded while the trace is being written may be incomplete.
+   *
+   * @param out The stream to write the trace to.
+   */
+  void writeTrace(std::ostream & out) const;
+
   private:
+  /**
+   * Function used to construct a Task in place.
+   *
+   * @param task The Task to be constructed.
+   * @param context The context that was given to emplace().
+   */
+  using TaskConstructor = void (*)(Task & task, void * context);
+
+  /**
+   * Construct a Task from a callable.
+   *
+   * @tparam F The type of the callable, as it was given to enqueue().
+   * @param task The Task to be constructed.
+   * @param f A pointer to the callable.
+   */
+  template <typename F>
+  static void constructTask(Task & task, void * f) {
+    auto & callable = *static_cast<std::remove_reference_t<F> *>(f);
+    if constexpr (std::is_invocable_r_v<void, std::decay_t<F> &>) {
+      task.function.emplace<std::decay_t<F>>(std::forward<F>(callable));
+    }
+    else {
+      task.function.emplace<StopTokenCallable<std::decay_t<F>>>(std::forward<F>(callable));
+    }
+  }
+
+  /**
+   * Adapts a callable that takes a `std::stop_token` into a Task function.
+   *
+   * @tparam F The type of the callable.
+   */
+  template <typename F>
+  class StopTokenCallable {
+    public:
+    /**
+     * Constructor.
+     *
+     * @param f The callable.
+     */
+    template <typename G>
+    explicit StopTokenCallable(G && f) : f{std::forward<G>(f)} {}
+
+    /**
+     * Call the callable with the stop token of the pool that is running it.
+     */
+    void operator()() {
+      this->f(Pool::getStopToken());
+    }
+
+    private:
+    /**
+     * The callable.
+     */
+    F f;
+  };
+
+  /**
+   * Enqueue a Task that is constructed directly in the queue.
+   *
+   * @param priority The priority of the Task.
+   * @param construct The function that will construct the Task.
+   * @param context The context that will be passed to construct.
+   * @param tryOnly If true, then the Task is rejected when the queue is at
+   *   capacity, regardless of the OverflowPolicy.
+   * @returns True on success, False if the Task was rejected.
+   */
+  bool emplace(Priority priority, TaskConstructor construct, void * context, bool tryOnly);
+
   /**
    * Keep creating threads until the limit is reached.
    */
@@ -182,6 +1687,259 @@ class Pool {
   std::shared_ptr<State> state;
 };
 
+/**
+ * A collection of tasks that can be waited on as a whole, without stopping
+ * or joining the Pool that runs them.
+ *
+ * Tasks that are added to the group are held by the group itself, and a
+ * placeholder is enqueued to the pool for each of them.  Whichever comes
+ * first, a pool thread running the placeholder or a thread waiting on the
+ * group, claims and runs the next task of the group.  A waiting thread
+ * therefore helps to run the group's tasks instead of sleeping, and it only
+ * blocks once every task has been claimed.
+ *
+ * A TaskGroup may be reused for any number of batches of tasks.
+ */
+class TaskGroup {
+  public:
+  /**
+   * Constructor.
+   *
+   * @param pool The pool that will run the tasks.  It must outlive the group.
+   */
+  TaskGroup(Pool & pool);
+
+  /**
+   * Destructor.
+   *
+   * Waits for all of the tasks in the group to finish.  Any exception thrown
+   * by the tasks is discarded.
+   */
+  ~TaskGroup();
+
+  // Remove the copy constructor.
+  TaskGroup(const TaskGroup &) = delete;
+
+  // Remove the copy assignment.
+  TaskGroup & operator=(const TaskGroup &) = delete;
+
+  /**
+   * Add a Task to the group and enqueue it to the pool.
+   *
+   * @param task A rvalue representing the Task to be run.
+   * @returns True on success, False on failure.
+   */
+  bool run(Task && task);
+
+  /**
+   * Add a callable to the group and enqueue it to the pool.
+   *
+   * @param f The callable to be run.
+   * @returns True on success, False on failure.
+   */
+  template <typename F>
+    requires (!std::same_as<std::remove_cvref_t<F>, Task>)
+      && std::is_invocable_r_v<void, std::decay_t<F> &>
+  bool run(F && f) {
+    return this->run(Task{TaskFunction{std::forward<F>(f)}});
+  }
+
+  /**
+   * Wait for all of the tasks in the group to finish, running unclaimed
+   * tasks of the group on this thread in the meantime.
+   *
+   * If any task threw an exception, then the first such exception is
+   * rethrown (and cleared from the group).
+   */
+  void wait();
+
+  /**
+   * Wait for all of the tasks in the group to finish, running unclaimed
+   * tasks of the group on this thread in the meantime, but give up once the
+   * timeout passes.
+   *
+   * A task that this thread has already started is always run to
+   * completion, so the call may take longer than the timeout.  If all tasks
+   * finished and any task threw an exception, then the first such exception
+   * is rethrown (and cleared from the group).
+   *
+   * @param timeout The longest time to wait.
+   * @returns True if all tasks finished, False if the timeout passed first.
+   */
+  bool waitFor(std::chrono::nanoseconds timeout);
+
+  /**
+   * Returns the number of tasks in the group that have not yet finished.
+   *
+   * @returns The number of tasks in the group that have not yet finished.
+   */
+  size_t getPendingCount() const;
+
+  private:
+  /**
+   * The pool that runs the tasks.
+   */
+  Pool & pool;
+
+  /**
+   * Pointer to the state of the group, which is shared with the placeholder
+   * tasks in the pool.
+   */
+  std::shared_ptr<TaskGroupState> state;
+};
+
+/**
+ * A graph of tasks, in which each task runs only once all of the tasks that
+ * precede it have finished.
+ *
+ * The graph is built once, by adding nodes and the edges between them, and
+ * may then be run on a Pool any number of times.  Each node keeps a count of
+ * the predecessors that have yet to finish, and is enqueued as soon as that
+ * count reaches zero, so there is no pause between "levels" of the graph.
+ * When a node finishes, the thread that ran it runs one of the successors
+ * that it made ready itself, and enqueues the rest (which the work-stealing
+ * scheduler keeps on that thread's own deque).
+ *
+ * Running a graph that has already been run does not allocate any memory,
+ * unless nodes or edges were added in the meantime.
+ */
+class TaskGraph {
+  public:
+  /**
+   * A handle to a node of a TaskGraph, which is used to add edges.
+   *
+   * The handle remains valid for as long as the graph exists.
+   */
+  class Node {
+    public:
+    /**
+     * Make this node run before another node.
+     *
+     * @param other The node that must wait for this node.
+     * @returns This node, so that calls may be chained.
+     */
+    Node & precede(Node other);
+
+    /**
+     * Make this node run after another node.
+     *
+     * @param other The node that this node must wait for.
+     * @returns This node, so that calls may be chained.
+     */
+    Node & succeed(Node other);
+
+    /**
+     * Returns the index of the node within its graph.
+     *
+     * Nodes are numbered in the order that they were added, from 0.
+     *
+     * @returns The index of the node within its graph.
+     */
+    size_t getIndex() const;
+
+    private:
+    friend class TaskGraph;
+
+    /**
+     * Constructor.
+     *
+     * @param graph The graph that holds the node.
+     * @param index The index of the node within the graph.
+     */
+    Node(TaskGraph & graph, size_t index);
+
+    /**
+     * The graph that holds the node.
+     */
+    TaskGraph * graph;
+
+    /**
+     * The index of the node within the graph.
+     */
+    size_t index;
+  };
+
+  /**
+   * Constructor.
+   */
+  TaskGraph();
+
+  /**
+   * Destructor.
+   */
+  ~TaskGraph();
+
+  // Remove the copy constructor.
+  TaskGraph(const TaskGraph &) = delete;
+
+  // Remove the copy assignment.
+  TaskGraph & operator=(const TaskGraph &) = delete;
+
+  /**
+   * Add a node to the graph.
+   *
+   * @param function The function that the node runs.  It is called once per
+   *   run of the graph.
+   * @param label A name for the node, which is shown in a trace of the pool.
+   *   The string is not copied.
+   * @returns The node.
+   */
+  Node add(TaskFunction && function, const char * label = nullptr);
+
+  /**
+   * Add a node to the graph.
+   *
+   * @param f The callable that the node runs.  It is called once per run of
+   *   the graph.
+   * @param label A name for the node, which is shown in a trace of the pool.
+   *   The string is not copied.
+   * @returns The node.
+   */
+  template <typename F>
+    requires (!std::same_as<std::remove_cvref_t<F>, TaskFunction>)
+      && std::is_invocable_r_v<void, std::decay_t<F> &>
+  Node add(F && f, const char * label = nullptr) {
+    return this->add(TaskFunction{std::forward<F>(f)}, label);
+  }
+
+  /**
+   * Run every node of the graph on a pool, and wait for them to finish.
+   *
+   * The calling thread runs one of the nodes that have no predecessors
+   * itself, and then keeps running nodes as they become ready until the whole
+   * graph has finished.  The nodes that it does not run are enqueued to the
+   * pool, but only as placeholders, so the graph still finishes if the pool
+   * is not started, is stopped, has no threads, or drops or discards some of
+   * the placeholders (e.g., through its OverflowPolicy or discard()).  A
+   * placeholder that runs after its node has already been run does nothing.
+   *
+   * If a node throws an exception, then the nodes that have not yet started
+   * are skipped, and the first exception is rethrown once the running nodes
+   * have finished.
+   *
+   * A graph must not be run more than once at the same time, and nodes and
+   * edges must not be added while it is running.
+   *
+   * @param pool The pool that runs the nodes.
+   * @throws std::logic_error If the graph has a cycle.
+   */
+  void run(Pool & pool);
+
+  /**
+   * Returns the number of nodes in the graph.
+   *
+   * @returns The number of nodes in the graph.
+   */
+  size_t size() const;
+
+  private:
+  /**
+   * Pointer to the state of the graph, which is shared with the placeholder
+   * tasks in the pool.
+   */
+  std::shared_ptr<TaskGraphState> state;
+};
+
 };
 
 
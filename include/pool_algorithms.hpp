@@ -0,0 +1,417 @@
+/**
+ * @file
+ *
+ * Blocking fork/join algorithms built on top of a Pool: parallelFor(),
+ * parallelReduce(), and parallelInvoke().
+ *
+ * Work is divided by recursively splitting the range in half.  At each split,
+ * the second half is forked to the pool and the first half is processed by
+ * the current thread.  When the current thread finishes its half, it joins
+ * the fork: if no pool thread has started the fork yet, then the current
+ * thread runs it itself, so the caller helps with the work instead of simply
+ * blocking, and the algorithms complete even on a pool that is stopped or has
+ * no threads.
+ */
+
+#ifndef POOL_ALGORITHMS_HPP
+#define POOL_ALGORITHMS_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <concepts>
+#include <cstdint>
+#include <exception>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include "pool.hpp"
+
+namespace Ghoti::Pool {
+
+/**
+ * The grain size which asks an algorithm to choose a grain size itself.
+ */
+constexpr size_t AUTO_GRAIN{0};
+
+/**
+ * The number of chunks that an automatic grain size aims to give each thread,
+ * so that uneven chunks can still be balanced between the threads.
+ */
+constexpr size_t AUTO_GRAIN_CHUNKS_PER_THREAD{8};
+
+/**
+ * A piece of work that has been forked to a Pool, and which may be run either
+ * by one of the pool's threads or by the thread that joins it.
+ *
+ * The work itself is owned by the caller, and must outlive the Fork.  The
+ * Fork joins automatically when it is destroyed.
+ *
+ * @tparam F The type of the work.  It is called with no arguments.
+ */
+template <typename F>
+class Fork {
+  public:
+  /**
+   * Constructor.
+   *
+   * Enqueues the work to the pool.
+   *
+   * @param pool The pool that may run the work.
+   * @param work The work.
+   */
+  Fork(Pool & pool, F & work) : control{Control::create(work)} {
+    pool.enqueue([control = Reference{this->control}](){
+      control.control->tryRun();
+    });
+  }
+
+  // Remove the copy constructor.
+  Fork(const Fork &) = delete;
+
+  // Remove the copy assignment.
+  Fork & operator=(const Fork &) = delete;
+
+  /**
+   * Destructor.
+   *
+   * Joins the work, if it has not already been joined.  Any exception from
+   * the work is discarded.
+   */
+  ~Fork() {
+    if (this->control) {
+      try {
+        this->join();
+      }
+      catch (...) {}
+    }
+  }
+
+  /**
+   * Wait for the work to finish, running it on this thread if no pool thread
+   * has started it yet.
+   *
+   * Rethrows any exception thrown by the work.
+   */
+  void join() {
+    auto control = std::exchange(this->control, nullptr);
+    control->tryRun();
+    control->wait();
+    auto exception = control->exception;
+    control->release();
+    if (exception) {
+      std::rethrow_exception(exception);
+    }
+  }
+
+  private:
+  /**
+   * The state that is shared between the Fork and the Task in the pool.
+   *
+   * The control block is allocated separately from the Fork, because the
+   * Task may outlive the Fork if the joining thread ran the work itself.
+   */
+  struct Control {
+    /**
+     * No one has started the work.
+     */
+    static constexpr uint8_t PENDING{0};
+
+    /**
+     * Someone has started the work.
+     */
+    static constexpr uint8_t RUNNING{1};
+
+    /**
+     * The work has finished.
+     */
+    static constexpr uint8_t DONE{2};
+
+    /**
+     * Create a control block with a reference for both the Fork and the Task.
+     *
+     * @param work The work.
+     * @returns The control block.
+     */
+    static Control * create(F & work) {
+      return ::new (allocateFunctionStorage(sizeof(Control))) Control{&work};
+    }
+
+    /**
+     * Give up one reference, destroying the control block if there are no
+     * more.
+     */
+    void release() noexcept {
+      if (this->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        this->~Control();
+        deallocateFunctionStorage(this, sizeof(Control));
+      }
+    }
+
+    /**
+     * Run the work, if no one else has started it.
+     */
+    void tryRun() noexcept {
+      auto expected = PENDING;
+      if (!this->status.compare_exchange_strong(expected, RUNNING, std::memory_order_acquire)) {
+        return;
+      }
+      try {
+        (*this->work)();
+      }
+      catch (...) {
+        this->exception = std::current_exception();
+      }
+      this->status.store(DONE, std::memory_order_release);
+      this->status.notify_all();
+    }
+
+    /**
+     * Block until the work has finished.
+     */
+    void wait() const noexcept {
+      auto status = this->status.load(std::memory_order_acquire);
+      while (status != DONE) {
+        this->status.wait(status, std::memory_order_acquire);
+        status = this->status.load(std::memory_order_acquire);
+      }
+    }
+
+    /**
+     * The work.  Only valid while the Fork exists.
+     */
+    F * work;
+
+    /**
+     * Whether the work is PENDING, RUNNING, or DONE.
+     */
+    std::atomic<uint8_t> status{PENDING};
+
+    /**
+     * The number of references to the control block.
+     */
+    std::atomic<uint8_t> references{2};
+
+    /**
+     * The exception thrown by the work, if any.
+     */
+    std::exception_ptr exception{};
+  };
+
+  /**
+   * A reference to a control block, which is given up when it is destroyed.
+   *
+   * The Task holds one of these, so that its reference is given up even if
+   * the Task is destroyed without having been run.
+   */
+  struct Reference {
+    /**
+     * Constructor.
+     *
+     * @param control The control block.
+     */
+    explicit Reference(Control * control) noexcept : control{control} {}
+
+    /**
+     * Move constructor.
+     *
+     * @param other The reference to move from.
+     */
+    Reference(Reference && other) noexcept : control{std::exchange(other.control, nullptr)} {}
+
+    // Remove the copy constructor.
+    Reference(const Reference &) = delete;
+
+    /**
+     * Destructor.
+     */
+    ~Reference() {
+      if (this->control) {
+        this->control->release();
+      }
+    }
+
+    /**
+     * The control block, or nullptr if the reference has been moved from.
+     */
+    Control * control;
+  };
+
+  /**
+   * The control block, or nullptr once the Fork has been joined.
+   */
+  Control * control;
+};
+
+/**
+ * Choose the grain size to use for a range.
+ *
+ * @param pool The pool that will process the range.
+ * @param count The number of elements in the range.
+ * @param grain The requested grain size, or AUTO_GRAIN.
+ * @returns The grain size to use.
+ */
+inline size_t chooseGrain(const Pool & pool, size_t count, size_t grain) {
+  if (grain != AUTO_GRAIN) {
+    return grain;
+  }
+  auto chunks = std::max(pool.getThreadCount(), size_t{1}) * AUTO_GRAIN_CHUNKS_PER_THREAD;
+  return std::max(count / chunks, size_t{1});
+}
+
+/**
+ * Recursive implementation of parallelFor().
+ *
+ * @param pool The pool that will help process the range.
+ * @param first The first index of the range.
+ * @param last One past the last index of the range.
+ * @param grain The largest range that will be processed without splitting.
+ * @param f The function that is called for each index.
+ */
+template <std::integral Index, typename F>
+void parallelForRange(Pool & pool, Index first, Index last, size_t grain, F & f) {
+  if (static_cast<size_t>(last - first) <= grain) {
+    for (auto i = first; i < last; ++i) {
+      f(i);
+    }
+    return;
+  }
+
+  auto middle = static_cast<Index>(first + (last - first) / 2);
+  auto right = [&pool, middle, last, grain, &f](){
+    parallelForRange(pool, middle, last, grain, f);
+  };
+  Fork fork{pool, right};
+  parallelForRange(pool, first, middle, grain, f);
+  fork.join();
+}
+
+/**
+ * Call a function for every index in a range, using a pool to help.
+ *
+ * The calling thread participates in the work, and the function returns once
+ * every index has been processed.  If any call throws, then the exception is
+ * rethrown after all of the forked work has finished.
+ *
+ * @param pool The pool that will help process the range.
+ * @param first The first index of the range.
+ * @param last One past the last index of the range.
+ * @param f The function that is called for each index.
+ * @param grain The largest range that will be processed without splitting,
+ *   or AUTO_GRAIN to choose one based on the number of pool threads.
+ */
+template <std::integral Index, typename F>
+  requires std::invocable<F &, Index>
+void parallelFor(Pool & pool, Index first, Index last, F && f, size_t grain = AUTO_GRAIN) {
+  if (last <= first) {
+    return;
+  }
+  parallelForRange(pool, first, last, chooseGrain(pool, static_cast<size_t>(last - first), grain), f);
+}
+
+/**
+ * Recursive implementation of parallelReduce().
+ *
+ * @param pool The pool that will help process the range.
+ * @param first The first index of the range.
+ * @param last One past the last index of the range.
+ * @param grain The largest range that will be processed without splitting.
+ * @param identity The identity value of the reduction.
+ * @param map The function that produces a value for each index.
+ * @param reduce The function that combines two values.
+ * @returns The reduction of the range.
+ */
+template <std::integral Index, typename T, typename Map, typename Reduce>
+T parallelReduceRange(Pool & pool, Index first, Index last, size_t grain, const T & identity, Map & map, Reduce & reduce) {
+  if (static_cast<size_t>(last - first) <= grain) {
+    T result{identity};
+    for (auto i = first; i < last; ++i) {
+      result = reduce(std::move(result), map(i));
+    }
+    return result;
+  }
+
+  auto middle = static_cast<Index>(first + (last - first) / 2);
+  std::optional<T> rightResult{};
+  auto right = [&, middle, last](){
+    rightResult.emplace(parallelReduceRange(pool, middle, last, grain, identity, map, reduce));
+  };
+  Fork fork{pool, right};
+  auto leftResult = parallelReduceRange(pool, first, middle, grain, identity, map, reduce);
+  fork.join();
+  return reduce(std::move(leftResult), std::move(*rightResult));
+}
+
+/**
+ * Reduce a range of indices to a single value, using a pool to help.
+ *
+ * Each index is mapped to a value, and the values are combined with the
+ * reduce function, which must be associative.  The calling thread
+ * participates in the work.
+ *
+ * @param pool The pool that will help process the range.
+ * @param first The first index of the range.
+ * @param last One past the last index of the range.
+ * @param identity The identity value of the reduction.
+ * @param map The function that produces a value for each index.
+ * @param reduce The function that combines two values.
+ * @param grain The largest range that will be processed without splitting,
+ *   or AUTO_GRAIN to choose one based on the number of pool threads.
+ * @returns The reduction of the range.
+ */
+template <std::integral Index, typename T, typename Map, typename Reduce>
+  requires std::invocable<Map &, Index>
+T parallelReduce(Pool & pool, Index first, Index last, T identity, Map && map, Reduce && reduce, size_t grain = AUTO_GRAIN) {
+  if (last <= first) {
+    return identity;
+  }
+  return parallelReduceRange(pool, first, last, chooseGrain(pool, static_cast<size_t>(last - first), grain), identity, map, reduce);
+}
+
+/**
+ * Call several functions in parallel, using a pool to help.
+ *
+ * The first function is run by the calling thread, and the rest are forked
+ * to the pool.  Returns once all of the functions have finished.  If any of
+ * them throws, then the first such exception (in argument order) is
+ * rethrown.
+ *
+ * @param pool The pool that will help run the functions.
+ * @param first The function that will be run by the calling thread.
+ * @param rest The functions that will be forked to the pool.
+ */
+template <typename F, typename... Fs>
+  requires std::invocable<F &> && (std::invocable<Fs &> && ...)
+void parallelInvoke(Pool & pool, F && first, Fs &&... rest) {
+  if constexpr (sizeof...(Fs) == 0) {
+    first();
+  }
+  else {
+    auto others = [&](){
+      parallelInvoke(pool, rest...);
+    };
+    Fork fork{pool, others};
+    std::exception_ptr exception{};
+    try {
+      first();
+    }
+    catch (...) {
+      exception = std::current_exception();
+    }
+    try {
+      fork.join();
+    }
+    catch (...) {
+      if (!exception) {
+        exception = std::current_exception();
+      }
+    }
+    if (exception) {
+      std::rethrow_exception(exception);
+    }
+  }
+}
+
+}
+
+#endif // POOL_ALGORITHMS_HPP
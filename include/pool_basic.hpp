@@ -0,0 +1,396 @@
+/**
+ * @file
+ *
+ * A header-only thread pool whose task type, queue, and idle behavior are
+ * chosen at compile time: BasicPool.
+ *
+ * A Pool accepts any callable, at the cost of storing it in a type-erased
+ * Task and reaching the queue through the shared library.  When every task is
+ * of the same type, a BasicPool stores the tasks as they are, and the whole
+ * path from enqueue() to running the task is visible to the compiler, so that
+ * it can be inlined.  The threads still come from the global thread pool, so
+ * a BasicPool is stopped and joined in the same way as a Pool.
+ *
+ * A BasicPool has none of the other features of a Pool (priorities,
+ * schedulers, timers, statistics, and so on).
+ */
+
+#ifndef POOL_BASIC_HPP
+#define POOL_BASIC_HPP
+
+#include <atomic>
+#include <concepts>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "pool.hpp"
+
+namespace Ghoti::Pool {
+
+/**
+ * The requirements of a queue that holds the tasks of a BasicPool.
+ *
+ * Every member must be safe to call from any thread at any time.
+ *
+ * @tparam Q The type of the queue.
+ * @tparam T The type of task held in the queue.
+ */
+template <typename Q, typename T>
+concept BasicQueue = std::default_initializable<Q> && requires (Q & queue, T & task) {
+  queue.push(std::move(task));
+  { queue.pop(task) } -> std::same_as<bool>;
+};
+
+/**
+ * The requirements of the idle policy of a BasicPool.
+ *
+ * @tparam I The type of the idle policy.
+ */
+template <typename I>
+concept BasicIdlePolicy = requires {
+  { I::spinCount } -> std::convertible_to<size_t>;
+};
+
+/**
+ * A first-in, first-out queue of tasks that is protected by a mutex.
+ *
+ * This is the default queue of a BasicPool.
+ *
+ * @tparam T The type of task held in the queue.
+ */
+template <typename T>
+class LockedQueue {
+  public:
+  /**
+   * Add a task to the back of the queue.
+   *
+   * @param task The task.
+   */
+  void push(T && task) {
+    std::scoped_lock queueMutexLock{this->queueMutex};
+    this->tasks.push_back(std::move(task));
+  }
+
+  /**
+   * Remove the task at the front of the queue.
+   *
+   * @param task Receives the task.
+   * @returns True if a task was removed, False if the queue was empty.
+   */
+  bool pop(T & task) {
+    std::scoped_lock queueMutexLock{this->queueMutex};
+    if (this->tasks.empty()) {
+      return false;
+    }
+    task = std::move(this->tasks.front());
+    this->tasks.pop_front();
+    return true;
+  }
+
+  private:
+  /**
+   * Protects the tasks.
+   */
+  std::mutex queueMutex;
+
+  /**
+   * The tasks, oldest first.
+   */
+  std::deque<T> tasks;
+};
+
+/**
+ * An idle policy for a BasicPool, in which idle threads go to sleep at once.
+ */
+struct SleepWhenIdle {
+  /**
+   * The number of times that an idle thread looks for a task before it goes
+   * to sleep.
+   */
+  static constexpr size_t spinCount{0};
+};
+
+/**
+ * An idle policy for a BasicPool, in which idle threads keep looking for a
+ * task for a while before they go to sleep.
+ *
+ * This lowers the latency of a task that arrives shortly after the threads
+ * run out of work, at the cost of keeping the CPUs busy.
+ *
+ * @tparam SpinCount The number of times that an idle thread looks for a task
+ *   (yielding in between) before it goes to sleep.
+ */
+template <size_t SpinCount>
+struct SpinWhenIdle {
+  /**
+   * The number of times that an idle thread looks for a task before it goes
+   * to sleep.
+   */
+  static constexpr size_t spinCount{SpinCount};
+};
+
+/**
+ * A thread pool that runs tasks of a single type.
+ *
+ * Like a Pool, a BasicPool does not start until start() is called, stopping
+ * it does not wait for the threads to finish unless join() is called, and
+ * tasks that are still queued when it stops stay queued until it is started
+ * again.  The destructor does not block.
+ *
+ * @tparam TaskT The type of task.  It must be default constructible, movable,
+ *   and callable with no arguments.  A task that throws ends the program.
+ * @tparam QueueT The queue that holds the tasks.
+ * @tparam IdleT The idle policy of the threads.
+ */
+template <typename TaskT, BasicQueue<TaskT> QueueT = LockedQueue<TaskT>, BasicIdlePolicy IdleT = SleepWhenIdle>
+requires std::default_initializable<TaskT> && std::movable<TaskT> && std::invocable<TaskT &>
+class BasicPool {
+  public:
+  /**
+   * The type of task.
+   */
+  using Task = TaskT;
+
+  /**
+   * Constructor.
+   *
+   * @param threadCount The number of threads that will run the tasks.
+   */
+  BasicPool(size_t threadCount = std::thread::hardware_concurrency()) : state{std::make_shared<State>()} {
+    this->state->threadCount = threadCount;
+  }
+
+  // Remove the copy constructor.
+  BasicPool(const BasicPool &) = delete;
+
+  // Remove the copy assignment.
+  BasicPool & operator=(const BasicPool &) = delete;
+
+  /**
+   * Destructor.
+   *
+   * Asks the threads to stop, but does not wait for them.
+   */
+  ~BasicPool() {
+    this->stop();
+  }
+
+  /**
+   * Add a task to the queue.
+   *
+   * @param task The task.
+   */
+  void enqueue(TaskT && task) {
+    auto & state = *this->state;
+    // Count the task first, so that the count never drops below zero.
+    state.queuedTasks.fetch_add(1);
+    state.tasks.push(std::move(task));
+    if (state.sleepingThreads.load()) {
+      std::scoped_lock stateMutexLock{state.stateMutex};
+      state.taskCondition.notify_one();
+    }
+  }
+
+  /**
+   * Start the threads, if they are not already running.
+   */
+  void start() {
+    auto state = this->state;
+    std::scoped_lock stateMutexLock{state->stateMutex};
+    if (!state->terminate.load()) {
+      return;
+    }
+    state->terminate = false;
+
+    // Threads that have not yet finished after a previous stop() carry on.
+    if (state->threadCount > state->threads.size()) {
+      auto threadIds = createThreads(state->threadCount - state->threads.size(), [state](std::stop_token token) {
+        BasicPool::threadLoop(*state, token);
+      });
+      state->threads.insert(state->threads.end(), threadIds.begin(), threadIds.end());
+    }
+  }
+
+  /**
+   * Ask the threads to stop, without waiting for them.
+   *
+   * Each thread finishes its current task first.
+   */
+  void stop() {
+    {
+      std::scoped_lock stateMutexLock{this->state->stateMutex};
+      this->state->terminate = true;
+    }
+    this->state->taskCondition.notify_all();
+  }
+
+  /**
+   * Stop the threads, and wait for the global thread pool to join them.
+   *
+   * This must not be called from one of the threads of the pool.
+   */
+  void join() {
+    std::vector<std::thread::id> threads;
+    {
+      std::scoped_lock stateMutexLock{this->state->stateMutex};
+      this->state->terminate = true;
+      threads = std::move(this->state->threads);
+      this->state->threads.clear();
+    }
+    this->state->taskCondition.notify_all();
+    joinThreads(threads);
+  }
+
+  /**
+   * Get the number of threads that the pool runs when it is started.
+   *
+   * @returns The number of threads.
+   */
+  size_t getThreadCount() const {
+    std::scoped_lock stateMutexLock{this->state->stateMutex};
+    return this->state->threadCount;
+  }
+
+  /**
+   * Get the number of threads that are running.
+   *
+   * @returns The number of running threads.
+   */
+  size_t getRunningThreadCount() const {
+    std::scoped_lock stateMutexLock{this->state->stateMutex};
+    return this->state->threads.size();
+  }
+
+  /**
+   * Get the number of tasks that are waiting to be run.
+   *
+   * @returns The number of queued tasks.
+   */
+  size_t getTaskQueueCount() const {
+    return this->state->queuedTasks.load();
+  }
+
+  private:
+  /**
+   * The state that is shared by the BasicPool and its threads.
+   *
+   * The threads keep the state alive after the BasicPool is destroyed.
+   */
+  struct State {
+    /**
+     * The tasks that are waiting to be run.
+     */
+    QueueT tasks{};
+
+    /**
+     * The number of tasks that are waiting to be run.
+     */
+    std::atomic<size_t> queuedTasks{0};
+
+    /**
+     * The number of threads that are waiting on the taskCondition.
+     */
+    std::atomic<size_t> sleepingThreads{0};
+
+    /**
+     * Whether or not the threads have been asked to stop.
+     *
+     * Only changed while the stateMutex is held.
+     */
+    std::atomic<bool> terminate{true};
+
+    /**
+     * Protects the threads and the threadCount, and the sleep of the
+     * threads.
+     */
+    mutable std::mutex stateMutex{};
+
+    /**
+     * Wakes the threads when there is a task, or when they should stop.
+     */
+    std::condition_variable_any taskCondition{};
+
+    /**
+     * The number of threads that the pool runs when it is started.
+     */
+    size_t threadCount{0};
+
+    /**
+     * The ids of the threads that have been created and have not finished.
+     */
+    std::vector<std::thread::id> threads{};
+  };
+
+  /**
+   * Try to claim a task and run it.
+   *
+   * @param state The shared state.
+   * @returns True if a task was run, False if the queue was empty.
+   */
+  static bool runTask(State & state) {
+    TaskT task{};
+    if (!state.tasks.pop(task)) {
+      return false;
+    }
+    state.queuedTasks.fetch_sub(1);
+    task();
+    return true;
+  }
+
+  /**
+   * The function run by each thread of the pool.
+   *
+   * @param state The shared state.
+   * @param token Stops the thread when the global thread pool is joined.
+   */
+  static void threadLoop(State & state, std::stop_token token) {
+    while (true) {
+      if (state.terminate.load() || token.stop_requested()) {
+        // The pool may have been started again in the meantime.
+        std::scoped_lock stateMutexLock{state.stateMutex};
+        if (state.terminate.load() || token.stop_requested()) {
+          std::erase(state.threads, std::this_thread::get_id());
+          return;
+        }
+      }
+
+      if (runTask(state)) {
+        continue;
+      }
+
+      bool ran{false};
+      for (size_t spin = 0; !ran && (spin < IdleT::spinCount); ++spin) {
+        std::this_thread::yield();
+        ran = runTask(state);
+      }
+      if (ran) {
+        continue;
+      }
+
+      // The count of sleeping threads is raised before the queue is checked,
+      // and enqueue() raises the count of tasks before it checks for sleeping
+      // threads, so at least one of them sees the other.
+      std::unique_lock stateMutexLock{state.stateMutex};
+      state.sleepingThreads.fetch_add(1);
+      state.taskCondition.wait(stateMutexLock, token, [&] {
+        return state.terminate.load() || state.queuedTasks.load();
+      });
+      state.sleepingThreads.fetch_sub(1);
+    }
+  }
+
+  /**
+   * The state that is shared by the BasicPool and its threads.
+   */
+  std::shared_ptr<State> state;
+};
+
+}
+
+#endif // POOL_BASIC_HPP
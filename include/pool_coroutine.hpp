@@ -0,0 +1,554 @@
+/**
+ * @file
+ *
+ * C++20 coroutine support for the Pool: the lazy coroutine type Lazy<T>, and
+ * syncWait() to run one from ordinary code.
+ *
+ * A coroutine moves itself onto the threads of a Pool with
+ * `co_await pool.schedule()`.  Awaiting a Lazy<T> starts it and transfers
+ * control directly to it, and when it finishes it transfers control directly
+ * back to the awaiting coroutine (symmetric transfer), so that long chains of
+ * awaits do not grow the stack.  Coroutine frames are allocated with
+ * allocateFunctionStorage(), so that they are recycled instead of going back
+ * to the system allocator.
+ */
+
+#ifndef POOL_COROUTINE_HPP
+#define POOL_COROUTINE_HPP
+
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include "pool.hpp"
+
+namespace Ghoti::Pool {
+
+template <typename T = void>
+class Lazy;
+
+/**
+ * The parts of the promise of a Lazy<T> that do not depend on T.
+ */
+class LazyPromiseBase {
+  public:
+  /**
+   * Resumes the awaiting coroutine when a Lazy finishes.
+   */
+  struct FinalAwaiter {
+    /**
+     * The coroutine is always suspended, so that it can transfer control.
+     *
+     * @returns False.
+     */
+    bool await_ready() const noexcept {
+      return false;
+    }
+
+    /**
+     * Transfer control to the awaiting coroutine, if there is one.
+     *
+     * @param coroutine The coroutine that has finished.
+     * @returns The coroutine to resume.
+     */
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> coroutine) const noexcept {
+      auto continuation = coroutine.promise().continuation;
+      return continuation ? continuation : std::noop_coroutine();
+    }
+
+    /**
+     * Never called, because a finished coroutine is not resumed.
+     */
+    void await_resume() const noexcept {}
+  };
+
+  /**
+   * Allocate a coroutine frame.
+   *
+   * @param size The size of the frame.
+   * @returns The frame.
+   */
+  static void * operator new(size_t size) {
+    return allocateFunctionStorage(size);
+  }
+
+  /**
+   * Free a coroutine frame.
+   *
+   * @param frame The frame.
+   * @param size The size of the frame.
+   */
+  static void operator delete(void * frame, size_t size) noexcept {
+    deallocateFunctionStorage(frame, size);
+  }
+
+  /**
+   * A Lazy does not start until it is awaited.
+   *
+   * @returns An awaitable that always suspends.
+   */
+  std::suspend_always initial_suspend() const noexcept {
+    return {};
+  }
+
+  /**
+   * Transfer control to the awaiting coroutine once the Lazy finishes.
+   *
+   * @returns The awaitable that transfers control.
+   */
+  FinalAwaiter final_suspend() const noexcept {
+    return {};
+  }
+
+  /**
+   * Keep an exception that escapes the coroutine, so that it can be rethrown
+   * to the awaiting coroutine.
+   */
+  void unhandled_exception() noexcept {
+    this->exception = std::current_exception();
+  }
+
+  /**
+   * The coroutine that is awaiting the Lazy.
+   */
+  std::coroutine_handle<> continuation{};
+
+  /**
+   * The exception that escaped the coroutine, if any.
+   */
+  std::exception_ptr exception{};
+
+  protected:
+  /**
+   * Rethrow the exception that escaped the coroutine, if any.
+   */
+  void rethrowException() const {
+    if (this->exception) {
+      std::rethrow_exception(this->exception);
+    }
+  }
+};
+
+/**
+ * The promise of a Lazy<T> that produces a value.
+ *
+ * @tparam T The type of the value.
+ */
+template <typename T>
+class LazyPromise : public LazyPromiseBase {
+  public:
+  /**
+   * Create the Lazy that owns the coroutine.
+   *
+   * @returns The Lazy.
+   */
+  Lazy<T> get_return_object() noexcept;
+
+  /**
+   * Keep the value of a `co_return` statement.
+   *
+   * @param value The value.
+   */
+  template <typename U>
+    requires std::is_convertible_v<U &&, T>
+  void return_value(U && value) {
+    this->value.emplace(std::forward<U>(value));
+  }
+
+  /**
+   * Take the result of the coroutine.
+   *
+   * @returns The value of the coroutine.
+   */
+  T getResult() {
+    this->rethrowException();
+    return std::move(*this->value);
+  }
+
+  private:
+  /**
+   * The value of the coroutine, once it has finished.
+   */
+  std::optional<T> value{};
+};
+
+/**
+ * The promise of a Lazy<void>.
+ */
+template <>
+class LazyPromise<void> : public LazyPromiseBase {
+  public:
+  /**
+   * Create the Lazy that owns the coroutine.
+   *
+   * @returns The Lazy.
+   */
+  Lazy<void> get_return_object() noexcept;
+
+  /**
+   * Nothing is kept for a `co_return` statement.
+   */
+  void return_void() const noexcept {}
+
+  /**
+   * Take the result of the coroutine.
+   */
+  void getResult() const {
+    this->rethrowException();
+  }
+};
+
+/**
+ * A coroutine that does not start until it is awaited, and that produces a
+ * value of type T.
+ *
+ * The Lazy owns the coroutine, and destroys it when the Lazy is destroyed.
+ * It may be awaited only once.  Use `co_await pool.schedule()` inside of the
+ * coroutine to move it onto the threads of a Pool, and syncWait() to run one
+ * from a function that is not a coroutine.
+ *
+ * @tparam T The type of the value, or void.
+ */
+template <typename T>
+class [[nodiscard]] Lazy {
+  public:
+  /**
+   * The promise type of the coroutine.
+   */
+  using promise_type = LazyPromise<T>;
+
+  /**
+   * Starts the Lazy when it is awaited, and produces its result.
+   */
+  class Awaiter {
+    public:
+    /**
+     * Constructor.
+     *
+     * @param coroutine The coroutine of the Lazy.
+     */
+    explicit Awaiter(std::coroutine_handle<promise_type> coroutine) noexcept : coroutine{coroutine} {}
+
+    /**
+     * Determine whether or not the Lazy has already finished.
+     *
+     * @returns True if the Lazy has already finished, False otherwise.
+     */
+    bool await_ready() const noexcept {
+      return this->coroutine.done();
+    }
+
+    /**
+     * Start the Lazy, which will resume the awaiting coroutine when it
+     * finishes.
+     *
+     * @param awaiting The awaiting coroutine.
+     * @returns The coroutine of the Lazy, to which control is transferred.
+     */
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+      this->coroutine.promise().continuation = awaiting;
+      return this->coroutine;
+    }
+
+    /**
+     * Produce the result of the Lazy.
+     *
+     * @returns The result of the Lazy.
+     */
+    T await_resume() {
+      return this->coroutine.promise().getResult();
+    }
+
+    private:
+    /**
+     * The coroutine of the Lazy.
+     */
+    std::coroutine_handle<promise_type> coroutine;
+  };
+
+  /**
+   * Move constructor.
+   *
+   * @param other The Lazy to move from.  It will be left empty.
+   */
+  Lazy(Lazy && other) noexcept : coroutine{std::exchange(other.coroutine, nullptr)} {}
+
+  /**
+   * Move assignment.
+   *
+   * @param other The Lazy to move from.  It will be left empty.
+   * @returns This Lazy.
+   */
+  Lazy & operator=(Lazy && other) noexcept {
+    if (this != &other) {
+      if (this->coroutine) {
+        this->coroutine.destroy();
+      }
+      this->coroutine = std::exchange(other.coroutine, nullptr);
+    }
+    return *this;
+  }
+
+  // Remove the copy constructor.
+  Lazy(const Lazy &) = delete;
+
+  // Remove the copy assignment.
+  Lazy & operator=(const Lazy &) = delete;
+
+  /**
+   * Destructor.
+   *
+   * Destroys the coroutine.
+   */
+  ~Lazy() {
+    if (this->coroutine) {
+      this->coroutine.destroy();
+    }
+  }
+
+  /**
+   * Start the Lazy, suspending the awaiting coroutine until it finishes.
+   *
+   * @returns The awaiter.
+   */
+  Awaiter operator co_await() && noexcept {
+    return Awaiter{this->coroutine};
+  }
+
+  private:
+  friend promise_type;
+
+  /**
+   * Constructor.
+   *
+   * @param coroutine The coroutine, which the Lazy will own.
+   */
+  explicit Lazy(std::coroutine_handle<promise_type> coroutine) noexcept : coroutine{coroutine} {}
+
+  /**
+   * The coroutine, or nullptr if the Lazy has been moved from.
+   */
+  std::coroutine_handle<promise_type> coroutine;
+};
+
+template <typename T>
+Lazy<T> LazyPromise<T>::get_return_object() noexcept {
+  return Lazy<T>{std::coroutine_handle<LazyPromise<T>>::from_promise(*this)};
+}
+
+inline Lazy<void> LazyPromise<void>::get_return_object() noexcept {
+  return Lazy<void>{std::coroutine_handle<LazyPromise<void>>::from_promise(*this)};
+}
+
+/**
+ * Lets a thread that is not a coroutine wait for a coroutine to finish.
+ */
+struct SyncWaitSignal {
+  /**
+   * Protects finished, and is used with the condition.
+   */
+  std::mutex signalMutex;
+
+  /**
+   * Allows the waiting thread to sleep until the coroutine has finished.
+   */
+  std::condition_variable condition;
+
+  /**
+   * Whether or not the coroutine has finished.
+   */
+  bool finished{false};
+};
+
+/**
+ * The coroutine used by syncWait() to await a Lazy.
+ */
+class SyncWaitCoroutine {
+  public:
+  /**
+   * The promise type of the coroutine.
+   */
+  struct promise_type {
+    /**
+     * Wakes the waiting thread once the coroutine has finished.
+     */
+    struct FinalAwaiter {
+      /**
+       * The coroutine is always suspended, so that the waiting thread can
+       * destroy it.
+       *
+       * @returns False.
+       */
+      bool await_ready() const noexcept {
+        return false;
+      }
+
+      /**
+       * Wake the waiting thread.
+       *
+       * The signal is sent while holding its mutex, so that the waiting
+       * thread cannot destroy the coroutine (or the signal) until this is
+       * done with them.
+       *
+       * @param coroutine The coroutine that has finished.
+       */
+      void await_suspend(std::coroutine_handle<promise_type> coroutine) const noexcept {
+        auto & signal = *coroutine.promise().signal;
+        std::scoped_lock signalMutexLock{signal.signalMutex};
+        signal.finished = true;
+        signal.condition.notify_all();
+      }
+
+      /**
+       * Never called, because a finished coroutine is not resumed.
+       */
+      void await_resume() const noexcept {}
+    };
+
+    /**
+     * Create the object that owns the coroutine.
+     *
+     * @returns The object.
+     */
+    SyncWaitCoroutine get_return_object() noexcept {
+      return SyncWaitCoroutine{std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+
+    /**
+     * The coroutine is started explicitly, once its signal is set.
+     *
+     * @returns An awaitable that always suspends.
+     */
+    std::suspend_always initial_suspend() const noexcept {
+      return {};
+    }
+
+    /**
+     * Wake the waiting thread once the coroutine finishes.
+     *
+     * @returns The awaitable that wakes the waiting thread.
+     */
+    FinalAwaiter final_suspend() const noexcept {
+      return {};
+    }
+
+    /**
+     * Nothing is kept for the end of the coroutine.
+     */
+    void return_void() const noexcept {}
+
+    /**
+     * Exceptions are caught by the body of the coroutine.
+     */
+    void unhandled_exception() const noexcept {
+      std::terminate();
+    }
+
+    /**
+     * The signal that the waiting thread is waiting on.
+     */
+    SyncWaitSignal * signal{nullptr};
+  };
+
+  /**
+   * Move constructor.
+   *
+   * @param other The object to move from.  It will be left empty.
+   */
+  SyncWaitCoroutine(SyncWaitCoroutine && other) noexcept : coroutine{std::exchange(other.coroutine, nullptr)} {}
+
+  // Remove the copy constructor.
+  SyncWaitCoroutine(const SyncWaitCoroutine &) = delete;
+
+  /**
+   * Destructor.
+   *
+   * Destroys the coroutine.
+   */
+  ~SyncWaitCoroutine() {
+    if (this->coroutine) {
+      this->coroutine.destroy();
+    }
+  }
+
+  /**
+   * Start the coroutine, and block until it finishes.
+   */
+  void run() {
+    SyncWaitSignal signal{};
+    this->coroutine.promise().signal = &signal;
+    this->coroutine.resume();
+
+    std::unique_lock<std::mutex> signalMutexLock{signal.signalMutex};
+    signal.condition.wait(signalMutexLock, [&] {
+      return signal.finished;
+    });
+  }
+
+  private:
+  /**
+   * Constructor.
+   *
+   * @param coroutine The coroutine, which the object will own.
+   */
+  explicit SyncWaitCoroutine(std::coroutine_handle<promise_type> coroutine) noexcept : coroutine{coroutine} {}
+
+  /**
+   * The coroutine, or nullptr if the object has been moved from.
+   */
+  std::coroutine_handle<promise_type> coroutine;
+};
+
+/**
+ * Run a Lazy from a function that is not a coroutine, blocking until it
+ * finishes.
+ *
+ * The Lazy starts on the calling thread, and runs there until it first moves
+ * elsewhere (e.g., with `co_await pool.schedule()`).  It must not need the
+ * calling thread to make progress, so this must not be called from the only
+ * thread that could run the rest of the Lazy.
+ *
+ * @param lazy The Lazy.
+ * @returns The result of the Lazy.  If the Lazy threw an exception, then it
+ *   is rethrown.
+ */
+template <typename T>
+T syncWait(Lazy<T> lazy) {
+  std::exception_ptr exception{};
+  if constexpr (std::is_void_v<T>) {
+    [](Lazy<T> & lazy, std::exception_ptr & exception) -> SyncWaitCoroutine {
+      try {
+        co_await std::move(lazy);
+      }
+      catch (...) {
+        exception = std::current_exception();
+      }
+    }(lazy, exception).run();
+    if (exception) {
+      std::rethrow_exception(exception);
+    }
+  }
+  else {
+    std::optional<T> result{};
+    [](Lazy<T> & lazy, std::optional<T> & result, std::exception_ptr & exception) -> SyncWaitCoroutine {
+      try {
+        result.emplace(co_await std::move(lazy));
+      }
+      catch (...) {
+        exception = std::current_exception();
+      }
+    }(lazy, result, exception).run();
+    if (exception) {
+      std::rethrow_exception(exception);
+    }
+    return std::move(*result);
+  }
+}
+
+}
+
+#endif // POOL_COROUTINE_HPP
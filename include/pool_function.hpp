@@ -0,0 +1,304 @@
+/**
+ * @file
+ *
+ * Move-only, type-erased callable with an inline buffer, used to hold the
+ * function of a Task.
+ */
+
+#ifndef POOL_FUNCTION_HPP
+#define POOL_FUNCTION_HPP
+
+#include <concepts>
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace Ghoti::Pool {
+
+/**
+ * Allocate a block of memory to hold a callable that does not fit inline.
+ *
+ * Blocks are recycled through per-thread free lists, grouped by size, so that
+ * callables which are repeatedly created do not go back to the system
+ * allocator each time.  Blocks are aligned for `std::max_align_t`.
+ *
+ * @param size The number of bytes required.
+ * @returns A pointer to the block.
+ */
+void * allocateFunctionStorage(size_t size);
+
+/**
+ * Return a block of memory that was provided by allocateFunctionStorage().
+ *
+ * The block may be returned from any thread.
+ *
+ * @param block The block to return.
+ * @param size The number of bytes that were requested for the block.
+ */
+void deallocateFunctionStorage(void * block, size_t size) noexcept;
+
+/**
+ * The default number of bytes that a Function can hold without allocating.
+ */
+constexpr size_t FUNCTION_INLINE_SIZE{64};
+
+// Declared but not defined, so that only function signatures may be used.
+template <typename Signature, size_t InlineSize = FUNCTION_INLINE_SIZE>
+class Function;
+
+/**
+ * A move-only, type-erased callable, in the spirit of
+ * `std::move_only_function`.
+ *
+ * Unlike `std::function`, the callable does not need to be copyable, so it
+ * may capture move-only objects such as a `std::unique_ptr`.  A callable
+ * that is no larger than `InlineSize` bytes (and that may be moved without
+ * throwing) is stored inside of the Function itself.  Larger callables are
+ * stored in a block from allocateFunctionStorage().
+ *
+ * @tparam R The return type of the callable.
+ * @tparam Args The argument types of the callable.
+ * @tparam InlineSize The number of bytes that may be stored inline.
+ */
+template <typename R, typename... Args, size_t InlineSize>
+class Function<R(Args...), InlineSize> {
+  public:
+  /**
+   * Construct an empty Function.
+   */
+  Function() noexcept = default;
+
+  /**
+   * Construct an empty Function.
+   */
+  Function(std::nullptr_t) noexcept {}
+
+  /**
+   * Construct a Function from a callable.
+   *
+   * @param f The callable, which will be moved or copied into the Function.
+   */
+  template <typename F>
+    requires (!std::same_as<std::remove_cvref_t<F>, Function>)
+      && std::is_invocable_r_v<R, std::decay_t<F> &, Args...>
+  Function(F && f) {
+    this->emplace<std::decay_t<F>>(std::forward<F>(f));
+  }
+
+  /**
+   * Move constructor.
+   *
+   * @param other The Function to move from.  It will be left empty.
+   */
+  Function(Function && other) noexcept {
+    this->moveFrom(other);
+  }
+
+  /**
+   * Move assignment.
+   *
+   * @param other The Function to move from.  It will be left empty.
+   * @returns This Function.
+   */
+  Function & operator=(Function && other) noexcept {
+    if (this != &other) {
+      this->reset();
+      this->moveFrom(other);
+    }
+    return *this;
+  }
+
+  /**
+   * Empty the Function.
+   *
+   * @returns This Function.
+   */
+  Function & operator=(std::nullptr_t) noexcept {
+    this->reset();
+    return *this;
+  }
+
+  // Remove the copy constructor.
+  Function(const Function &) = delete;
+
+  // Remove the copy assignment.
+  Function & operator=(const Function &) = delete;
+
+  /**
+   * Destructor.
+   */
+  ~Function() {
+    this->reset();
+  }
+
+  /**
+   * Replace the callable with a new one, constructed in place.
+   *
+   * @tparam F The type of the callable.
+   * @param args The arguments used to construct the callable.
+   */
+  template <typename F, typename... CArgs>
+  void emplace(CArgs &&... args) {
+    this->reset();
+    if constexpr (isInline<F>()) {
+      ::new (static_cast<void *>(this->storage)) F(std::forward<CArgs>(args)...);
+    }
+    else {
+      auto block = allocateFunctionStorage(sizeof(F));
+      try {
+        ::new (block) F(std::forward<CArgs>(args)...);
+      }
+      catch (...) {
+        deallocateFunctionStorage(block, sizeof(F));
+        throw;
+      }
+      ::new (static_cast<void *>(this->storage)) void *{block};
+    }
+    this->operations = &Operations::template table<F>;
+  }
+
+  /**
+   * Invoke the callable.
+   *
+   * The Function must not be empty.
+   *
+   * @param args The arguments to pass to the callable.
+   * @returns The result of the callable.
+   */
+  R operator()(Args... args) {
+    return this->operations->invoke(this->storage, std::forward<Args>(args)...);
+  }
+
+  /**
+   * Determine whether or not the Function holds a callable.
+   *
+   * @returns True if the Function holds a callable, False otherwise.
+   */
+  explicit operator bool() const noexcept {
+    return this->operations != nullptr;
+  }
+
+  /**
+   * Determine whether or not a callable type would be stored inline.
+   *
+   * @tparam F The type of the callable.
+   * @returns True if the callable would be stored inline, False otherwise.
+   */
+  template <typename F>
+  static constexpr bool isInline() {
+    return (sizeof(F) <= InlineSize)
+      && (alignof(F) <= alignof(std::max_align_t))
+      && std::is_nothrow_move_constructible_v<F>;
+  }
+
+  private:
+  /**
+   * The operations needed to use a specific type of callable.
+   */
+  struct Operations {
+    /**
+     * Invoke the callable held in the storage.
+     */
+    R (*invoke)(void * storage, Args &&... args);
+
+    /**
+     * Move the callable from one storage to another, leaving the source
+     * storage empty.
+     */
+    void (*relocate)(void * from, void * to) noexcept;
+
+    /**
+     * Destroy the callable held in the storage.
+     */
+    void (*destroy)(void * storage) noexcept;
+
+    /**
+     * Get a pointer to the callable held in the storage.
+     *
+     * @tparam F The type of the callable.
+     * @param storage The storage of the Function.
+     * @returns The callable.
+     */
+    template <typename F>
+    static F * get(void * storage) noexcept {
+      if constexpr (isInline<F>()) {
+        return std::launder(static_cast<F *>(storage));
+      }
+      else {
+        return static_cast<F *>(*static_cast<void **>(storage));
+      }
+    }
+
+    /**
+     * The operations for a specific type of callable.
+     */
+    template <typename F>
+    static constexpr Operations table{
+      [](void * storage, Args &&... args) -> R {
+        if constexpr (std::is_void_v<R>) {
+          std::invoke(*get<F>(storage), std::forward<Args>(args)...);
+        }
+        else {
+          return std::invoke(*get<F>(storage), std::forward<Args>(args)...);
+        }
+      },
+      [](void * from, void * to) noexcept {
+        if constexpr (isInline<F>()) {
+          ::new (to) F(std::move(*get<F>(from)));
+          get<F>(from)->~F();
+        }
+        else {
+          ::new (to) void *{*static_cast<void **>(from)};
+        }
+      },
+      [](void * storage) noexcept {
+        auto f = get<F>(storage);
+        f->~F();
+        if constexpr (!isInline<F>()) {
+          deallocateFunctionStorage(f, sizeof(F));
+        }
+      },
+    };
+  };
+
+  /**
+   * Destroy the callable, if there is one.
+   */
+  void reset() noexcept {
+    if (this->operations) {
+      this->operations->destroy(this->storage);
+      this->operations = nullptr;
+    }
+  }
+
+  /**
+   * Take the callable from another Function, which must be empty.
+   *
+   * @param other The Function to move from.  It will be left empty.
+   */
+  void moveFrom(Function & other) noexcept {
+    if (other.operations) {
+      other.operations->relocate(other.storage, this->storage);
+      this->operations = other.operations;
+      other.operations = nullptr;
+    }
+  }
+
+  /**
+   * The inline storage, which holds either the callable itself or a pointer
+   * to the block that holds the callable.
+   */
+  alignas(std::max_align_t) unsigned char storage[InlineSize < sizeof(void *) ? sizeof(void *) : InlineSize];
+
+  /**
+   * The operations for the type of callable that is held, or nullptr if the
+   * Function is empty.
+   */
+  const Operations * operations{nullptr};
+};
+
+}
+
+#endif // POOL_FUNCTION_HPP
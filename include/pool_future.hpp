@@ -0,0 +1,578 @@
+/**
+ * @file
+ *
+ * Lightweight Promise and Future types used to return the result of a task
+ * that was given to Pool::submit().
+ */
+
+#ifndef POOL_FUTURE_HPP
+#define POOL_FUTURE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include "pool_function.hpp"
+
+namespace Ghoti::Pool {
+
+/**
+ * The shared state between a Promise and its Future.
+ *
+ * The state is allocated from the same per-thread free lists as large Task
+ * functions, and the result is stored inside of the state itself, so that
+ * passing a result does not go to the system allocator.
+ *
+ * The state is reference counted.  It is created with one reference for the
+ * Promise and one for the Future.
+ *
+ * @tparam T The type of the result.
+ */
+template <typename T>
+class FutureState {
+  public:
+  /**
+   * The type used to hold the result (`std::monostate` for `void`).
+   */
+  using Value = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+  /**
+   * Create a new state, with one reference for the Promise and one for the
+   * Future.
+   *
+   * @returns The new state.
+   */
+  static FutureState * create() {
+    return ::new (allocateFunctionStorage(sizeof(FutureState))) FutureState{};
+  }
+
+  /**
+   * Give up one reference to the state, destroying it if there are no more.
+   */
+  void release() noexcept {
+    if (this->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      this->~FutureState();
+      deallocateFunctionStorage(this, sizeof(FutureState));
+    }
+  }
+
+  /**
+   * Store the result and notify anyone who is waiting on it.
+   *
+   * @param args The arguments used to construct the result.
+   */
+  template <typename... VArgs>
+  void setValue(VArgs &&... args) {
+    ::new (static_cast<void *>(this->storage)) Value(std::forward<VArgs>(args)...);
+    this->hasValue = true;
+    this->complete();
+  }
+
+  /**
+   * Store an exception and notify anyone who is waiting on it.
+   *
+   * @param exception The exception.
+   */
+  void setException(std::exception_ptr exception) {
+    this->exception = std::move(exception);
+    this->complete();
+  }
+
+  /**
+   * Determine whether or not the result is available.
+   *
+   * @returns True if the result is available, False otherwise.
+   */
+  bool ready() const noexcept {
+    return this->status.load(std::memory_order_acquire) == READY;
+  }
+
+  /**
+   * Block until the result is available.
+   */
+  void wait() const noexcept {
+    auto status = this->status.load(std::memory_order_acquire);
+    while (status != READY) {
+      this->status.wait(status, std::memory_order_acquire);
+      status = this->status.load(std::memory_order_acquire);
+    }
+  }
+
+  /**
+   * Take the result, rethrowing the stored exception if there is one.
+   *
+   * The result must be available.
+   *
+   * @returns The result.
+   */
+  T take() {
+    if (this->exception) {
+      std::rethrow_exception(this->exception);
+    }
+    if constexpr (!std::is_void_v<T>) {
+      return std::move(*this->value());
+    }
+  }
+
+  /**
+   * Get the stored exception, if any.
+   *
+   * @returns The stored exception, or nullptr.
+   */
+  std::exception_ptr getException() const noexcept {
+    return this->exception;
+  }
+
+  /**
+   * Set a function to be called when the result is available.
+   *
+   * If the result is already available, then the function is called
+   * immediately, from this thread.  Otherwise it is called from the thread
+   * that provides the result.
+   *
+   * @param continuation The function to call.
+   */
+  void setContinuation(Function<void()> && continuation) {
+    this->continuation = std::move(continuation);
+    auto expected = PENDING;
+    if (!this->status.compare_exchange_strong(expected, CONTINUATION, std::memory_order_acq_rel)) {
+      auto f = std::move(this->continuation);
+      f();
+    }
+  }
+
+  private:
+  /**
+   * No result, and no continuation.
+   */
+  static constexpr uint8_t PENDING{0};
+
+  /**
+   * No result, but a continuation is waiting for one.
+   */
+  static constexpr uint8_t CONTINUATION{1};
+
+  /**
+   * The result is available.
+   */
+  static constexpr uint8_t READY{2};
+
+  /**
+   * Constructor.
+   */
+  FutureState() = default;
+
+  /**
+   * Destructor.
+   */
+  ~FutureState() {
+    if (this->hasValue) {
+      this->value()->~Value();
+    }
+  }
+
+  /**
+   * Get the stored result.
+   *
+   * @returns The stored result.
+   */
+  Value * value() noexcept {
+    return std::launder(reinterpret_cast<Value *>(this->storage));
+  }
+
+  /**
+   * Mark the result as available, wake any waiters, and run the
+   * continuation, if there is one.
+   */
+  void complete() {
+    if (this->status.exchange(READY, std::memory_order_acq_rel) == CONTINUATION) {
+      auto f = std::move(this->continuation);
+      f();
+    }
+    this->status.notify_all();
+  }
+
+  /**
+   * The number of Promise and Future objects that refer to this state.
+   */
+  std::atomic<uint32_t> references{2};
+
+  /**
+   * Whether the result is PENDING, has a CONTINUATION, or is READY.
+   */
+  std::atomic<uint8_t> status{PENDING};
+
+  /**
+   * Whether or not a result has been stored.
+   */
+  bool hasValue{false};
+
+  /**
+   * The stored exception, if any.
+   */
+  std::exception_ptr exception{};
+
+  /**
+   * The function to call when the result becomes available.
+   */
+  Function<void()> continuation{};
+
+  /**
+   * Storage for the result.
+   */
+  alignas(Value) unsigned char storage[sizeof(Value)];
+};
+
+/**
+ * A handle to the result of a task that will be available in the future.
+ *
+ * Similar to `std::future`, but without the separate heap allocation for the
+ * shared state.  A Future is move-only, and its result may be taken (by
+ * get() or then()) only once.
+ *
+ * @tparam T The type of the result.
+ */
+template <typename T>
+class Future {
+  public:
+  /**
+   * Construct a Future with no shared state.
+   */
+  Future() noexcept = default;
+
+  /**
+   * Construct a Future that owns a reference to a shared state.
+   *
+   * @param state The shared state.
+   */
+  explicit Future(FutureState<T> * state) noexcept : state{state} {}
+
+  /**
+   * Move constructor.
+   *
+   * @param other The Future to move from.
+   */
+  Future(Future && other) noexcept : state{std::exchange(other.state, nullptr)} {}
+
+  /**
+   * Move assignment.
+   *
+   * @param other The Future to move from.
+   * @returns This Future.
+   */
+  Future & operator=(Future && other) noexcept {
+    if (this != &other) {
+      this->reset();
+      this->state = std::exchange(other.state, nullptr);
+    }
+    return *this;
+  }
+
+  // Remove the copy constructor.
+  Future(const Future &) = delete;
+
+  // Remove the copy assignment.
+  Future & operator=(const Future &) = delete;
+
+  /**
+   * Destructor.
+   *
+   * Does not block, even if the result is not yet available.
+   */
+  ~Future() {
+    this->reset();
+  }
+
+  /**
+   * Determine whether or not this Future refers to a shared state.
+   *
+   * @returns True if the Future has a shared state, False otherwise.
+   */
+  bool valid() const noexcept {
+    return this->state != nullptr;
+  }
+
+  /**
+   * Determine whether or not the result is available.
+   *
+   * @returns True if the result is available, False otherwise.
+   */
+  bool ready() const noexcept {
+    return this->state && this->state->ready();
+  }
+
+  /**
+   * Block until the result is available.
+   */
+  void wait() const {
+    this->checkState();
+    this->state->wait();
+  }
+
+  /**
+   * Block until the result is available, and then take it.
+   *
+   * The Future will no longer be valid afterwards.
+   *
+   * @returns The result.
+   */
+  T get() {
+    this->checkState();
+    this->state->wait();
+    Future consumed{std::move(*this)};
+    return consumed.state->take();
+  }
+
+  /**
+   * Chain a function to be called with the result, once it is available.
+   *
+   * The function is called from the thread that provides the result, or
+   * immediately from this thread if the result is already available.  If the
+   * task failed with an exception, then the function is not called, and the
+   * exception is passed along to the returned Future instead.
+   *
+   * The Future will no longer be valid afterwards.
+   *
+   * @param f The function to call.  It receives the result (or nothing, if
+   *   the result is `void`).
+   * @returns A Future holding the result of the function.
+   */
+  template <typename F>
+  auto then(F && f) {
+    using U = typename std::conditional_t<std::is_void_v<T>,
+      std::invoke_result<std::decay_t<F> &>,
+      std::invoke_result<std::decay_t<F> &, T>>::type;
+
+    this->checkState();
+    auto next = FutureState<U>::create();
+    auto state = std::exchange(this->state, nullptr);
+    state->setContinuation([state, next, f = std::forward<F>(f)]() mutable {
+      if (auto exception = state->getException()) {
+        next->setException(exception);
+      }
+      else {
+        try {
+          if constexpr (std::is_void_v<T> && std::is_void_v<U>) {
+            std::invoke(f);
+            next->setValue();
+          }
+          else if constexpr (std::is_void_v<T>) {
+            next->setValue(std::invoke(f));
+          }
+          else if constexpr (std::is_void_v<U>) {
+            std::invoke(f, state->take());
+            next->setValue();
+          }
+          else {
+            next->setValue(std::invoke(f, state->take()));
+          }
+        }
+        catch (...) {
+          next->setException(std::current_exception());
+        }
+      }
+      next->release();
+      state->release();
+    });
+    return Future<U>{next};
+  }
+
+  private:
+  /**
+   * Throw if there is no shared state.
+   */
+  void checkState() const {
+    if (!this->state) {
+      throw std::future_error{std::future_errc::no_state};
+    }
+  }
+
+  /**
+   * Give up the reference to the shared state.
+   */
+  void reset() noexcept {
+    if (this->state) {
+      std::exchange(this->state, nullptr)->release();
+    }
+  }
+
+  /**
+   * The shared state, or nullptr.
+   */
+  FutureState<T> * state{nullptr};
+};
+
+/**
+ * The producing side of a Future.
+ *
+ * If a Promise is destroyed without a result having been set, then the Future
+ * receives a `std::future_error` with `std::future_errc::broken_promise`.
+ *
+ * @tparam T The type of the result.
+ */
+template <typename T>
+class Promise {
+  public:
+  /**
+   * Constructor.
+   *
+   * Creates a new shared state.
+   */
+  Promise() : state{FutureState<T>::create()} {}
+
+  /**
+   * Move constructor.
+   *
+   * @param other The Promise to move from.
+   */
+  Promise(Promise && other) noexcept : state{std::exchange(other.state, nullptr)}, futureRetrieved{other.futureRetrieved} {}
+
+  /**
+   * Move assignment.
+   *
+   * @param other The Promise to move from.
+   * @returns This Promise.
+   */
+  Promise & operator=(Promise && other) noexcept {
+    if (this != &other) {
+      this->abandon();
+      this->state = std::exchange(other.state, nullptr);
+      this->futureRetrieved = other.futureRetrieved;
+    }
+    return *this;
+  }
+
+  // Remove the copy constructor.
+  Promise(const Promise &) = delete;
+
+  // Remove the copy assignment.
+  Promise & operator=(const Promise &) = delete;
+
+  /**
+   * Destructor.
+   */
+  ~Promise() {
+    this->abandon();
+  }
+
+  /**
+   * Get the Future associated with this Promise.
+   *
+   * May only be called once.
+   *
+   * @returns The Future.
+   */
+  Future<T> getFuture() {
+    if (!this->state) {
+      throw std::future_error{std::future_errc::no_state};
+    }
+    if (this->futureRetrieved) {
+      throw std::future_error{std::future_errc::future_already_retrieved};
+    }
+    this->futureRetrieved = true;
+    return Future<T>{this->state};
+  }
+
+  /**
+   * Set the result.
+   *
+   * @param args The arguments used to construct the result.
+   */
+  template <typename... VArgs>
+  void setValue(VArgs &&... args) {
+    this->checkState();
+    auto state = std::exchange(this->state, nullptr);
+    state->setValue(std::forward<VArgs>(args)...);
+    this->finish(state);
+  }
+
+  /**
+   * Set an exception as the result.
+   *
+   * @param exception The exception.
+   */
+  void setException(std::exception_ptr exception) {
+    this->checkState();
+    auto state = std::exchange(this->state, nullptr);
+    state->setException(std::move(exception));
+    this->finish(state);
+  }
+
+  /**
+   * Call a function and set its return value (or the exception that it
+   * throws) as the result.
+   *
+   * @param f The function to call.
+   * @param args The arguments to pass to the function.
+   */
+  template <typename F, typename... FArgs>
+  void setFrom(F && f, FArgs &&... args) {
+    try {
+      if constexpr (std::is_void_v<T>) {
+        std::invoke(std::forward<F>(f), std::forward<FArgs>(args)...);
+        this->setValue();
+      }
+      else {
+        this->setValue(std::invoke(std::forward<F>(f), std::forward<FArgs>(args)...));
+      }
+    }
+    catch (...) {
+      if (this->state) {
+        this->setException(std::current_exception());
+      }
+    }
+  }
+
+  private:
+  /**
+   * Throw if there is no shared state.
+   */
+  void checkState() const {
+    if (!this->state) {
+      throw std::future_error{std::future_errc::promise_already_satisfied};
+    }
+  }
+
+  /**
+   * Give up the references held by the Promise once a result has been set.
+   *
+   * @param state The shared state.
+   */
+  void finish(FutureState<T> * state) noexcept {
+    // Nobody will ever ask for this state, so give up its reference too.
+    if (!this->futureRetrieved) {
+      state->release();
+    }
+    state->release();
+  }
+
+  /**
+   * If no result has been set, then break the promise.
+   */
+  void abandon() noexcept {
+    if (this->state) {
+      auto state = std::exchange(this->state, nullptr);
+      state->setException(std::make_exception_ptr(std::future_error{std::future_errc::broken_promise}));
+      this->finish(state);
+    }
+  }
+
+  /**
+   * The shared state, or nullptr once a result has been set.
+   */
+  FutureState<T> * state;
+
+  /**
+   * Whether or not getFuture() has been called.
+   */
+  bool futureRetrieved{false};
+};
+
+}
+
+#endif // POOL_FUTURE_HPP
@@ -4,16 +4,42 @@
  * Code for the Pool thread pool.
  */
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
 #include <condition_variable>
+#include <deque>
+#include <exception>
+#include <fstream>
 #include <future>
-#include <map>
+#include <iomanip>
+#include <limits>
 #include <mutex>
+#include <new>
+#include <optional>
+#include <ostream>
 #include <thread>
+#include <unordered_map>
 #include <queue>
 #include <semaphore>
-#include <set>
+#include <span>
+#include <stdexcept>
+#include <string>
 #include <vector>
 #include "pool.hpp"
+#include "ringQueue.hpp"
+#include "timerWheel.hpp"
+#include "workStealingDeque.hpp"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
 
 using namespace std;
 using namespace Ghoti::Pool;
@@ -67,14 +93,29 @@ static void threadLoop(stop_token token, shared_ptr<State> state);
 static void globalPoolLoop();
 
 /**
- * Task queue for threads that need to be created.
+ * A request for the global thread pool to create one or more threads.
  */
-static auto globalThreadCreateQueue = make_shared<queue<pair<promise<thread::id>, ThreadFunction>>>();
+struct ThreadCreateRequest {
+  /**
+   * Receives the ids of the threads that were created.
+   */
+  promise<vector<thread::id>> notifier;
+
+  /**
+   * The function that each of the threads will execute.
+   */
+  ThreadFunction function;
+
+  /**
+   * The number of threads to create.
+   */
+  size_t count;
+};
 
 /**
- * Task queue of thread ids that need to be joined.
+ * Task queue for threads that need to be created.
  */
-static auto globalThreadJoinQueue = make_shared<queue<thread::id>>();
+static auto globalThreadCreateQueue = make_shared<queue<ThreadCreateRequest>>();
 
 /**
  * Task queue of thread ids that need to be stopped.
@@ -85,7 +126,7 @@ static auto globalThreadStopQueue = make_shared<queue<thread::id>>();
  * Control structure used by the global thread pool to track threads and their
  * associated metadata.
  */
-static auto threads = make_shared<map<thread::id, ThreadInfo>>();
+static auto threads = make_shared<unordered_map<thread::id, ThreadInfo>>();
 
 /**
  * Control structure to determine whether or not the global thread pool thread
@@ -93,6 +134,131 @@ static auto threads = make_shared<map<thread::id, ThreadInfo>>();
  */
 static auto globalPoolNotStarted = make_shared<binary_semaphore>(1);
 
+/**
+ * A thread that has finished its function, and is parked in the warm thread
+ * cache until it is given another one.
+ */
+struct WarmThread {
+  /**
+   * The id of the thread.
+   */
+  thread::id threadId;
+
+  /**
+   * The next function for the thread to run, once one is given to it.
+   */
+  ThreadFunction function{};
+
+  /**
+   * Whether or not the thread should exit instead of waiting for a function.
+   */
+  bool expired{false};
+
+  /**
+   * Wakes the thread when it is given a function, or when it should exit.
+   */
+  condition_variable condition{};
+};
+
+/**
+ * The threads that are parked, and the policy for parking them.
+ *
+ * Protected by the globalMutex.
+ */
+struct WarmThreadCache {
+  /**
+   * The parked threads, in the order in which they were parked.
+   */
+  vector<WarmThread *> parked{};
+
+  /**
+   * How threads are kept for reuse.
+   */
+  WarmThreadPolicy policy{};
+};
+
+/**
+ * The cache of warm threads, shared by all of the threads of the global
+ * thread pool.
+ */
+static auto warmThreadCache = make_shared<WarmThreadCache>();
+
+
+/**
+ * The function run by every thread that the global thread pool creates.
+ *
+ * The thread runs its function, and then parks in the warm thread cache until
+ * it is given another function or expires.
+ *
+ * @param token Token indicating that this jthread has been asked to stop.
+ * @param function The first function that the thread runs.
+ */
+static void globalThreadLoop(stop_token token, ThreadFunction function) {
+  // Create copies of the control structures, in case this thread is still
+  // parked when the main thread ends.
+  auto globalMutex = Ghoti::Pool::globalMutex;
+  auto globalThreadSemaphore = Ghoti::Pool::globalThreadSemaphore;
+  auto threads = Ghoti::Pool::threads;
+  auto warmThreadCache = Ghoti::Pool::warmThreadCache;
+  auto threadId = this_thread::get_id();
+
+#ifdef __linux__
+  // A function may pin the thread, so the next function must not inherit it.
+  cpu_set_t affinity;
+  auto hasAffinity = !pthread_getaffinity_np(pthread_self(), sizeof(affinity), &affinity);
+#endif
+
+  while (true) {
+    function(token);
+
+    // Release anything held by the function before anyone is told that it
+    // has finished.
+    function = nullptr;
+#ifdef __linux__
+    if (hasAffinity) {
+      pthread_setaffinity_np(pthread_self(), sizeof(affinity), &affinity);
+    }
+#endif
+
+    unique_lock lock{*globalMutex};
+
+    // Notify anyone who is joining this thread.  This is done by the thread
+    // itself, rather than by the globalPool, so that a thread which has been
+    // given another function in the meantime is never mistaken for finished.
+    if (auto position = threads->find(threadId); position != threads->end()) {
+      for (auto & notifier : position->second.second) {
+        notifier.set_value();
+      }
+      threads->erase(position);
+    }
+
+    // Let the globalPool know that it may no longer have threads to track.
+    globalThreadSemaphore->release();
+
+    // Park the thread, if there is room.
+    auto & cache = *warmThreadCache;
+    if (cache.parked.size() >= cache.policy.maxThreads) {
+      return;
+    }
+    WarmThread warm{threadId};
+    cache.parked.push_back(&warm);
+    auto parkedAt = chrono::steady_clock::now();
+    while (!warm.function && !warm.expired) {
+      // The deadline is recalculated each time, because the policy may change.
+      auto deadline = parkedAt + cache.policy.idleTimeout;
+      if ((warm.condition.wait_until(lock, deadline) == cv_status::timeout)
+          && !warm.function && (chrono::steady_clock::now() >= parkedAt + cache.policy.idleTimeout)) {
+        erase(cache.parked, &warm);
+        warm.expired = true;
+      }
+    }
+    if (warm.expired) {
+      return;
+    }
+    function = move(warm.function);
+  }
+}
+
 
 static void globalPoolLoop() {
   // Create copies of the control structures.  This will protect them from
@@ -102,8 +268,8 @@ static void globalPoolLoop() {
   auto globalMutex = Ghoti::Pool::globalMutex;
   auto globalThreadCreateQueue = Ghoti::Pool::globalThreadCreateQueue;
   auto globalThreadStopQueue = Ghoti::Pool::globalThreadStopQueue;
-  auto globalThreadJoinQueue = Ghoti::Pool::globalThreadJoinQueue;
   auto threads = Ghoti::Pool::threads;
+  auto globalPoolNotStarted = Ghoti::Pool::globalPoolNotStarted;
 
   // Continue looping until a `break` condition happens.
   // The loop breaks when there is nothing queued up and no threads left
@@ -117,19 +283,26 @@ static void globalPoolLoop() {
     // Prevent race conditions.
     scoped_lock lock{*globalMutex};
 
-    // Create a thread.
+    // Create threads.  Each thread removes itself from the control structure
+    // when its function returns (see globalThreadLoop()).
     while (!globalThreadCreateQueue->empty()) {
-      auto [notifier, threadFunction] = move(globalThreadCreateQueue->front());
+      auto request = move(globalThreadCreateQueue->front());
       globalThreadCreateQueue->pop();
 
-      // Create the thread and put it into the control structure.
-      jthread thread{threadFunction};
-      auto threadId = thread.get_id();
-      thread.detach();
-      (*threads)[threadId] = ThreadInfo{{}, vector<promise<void>>{}};
+      // Create every thread of the request and put it into the control
+      // structure.
+      vector<thread::id> threadIds{};
+      threadIds.reserve(request.count);
+      for (size_t i = 0; i < request.count; ++i) {
+        jthread thread{globalThreadLoop, request.function};
+        auto threadId = thread.get_id();
+        thread.detach();
+        (*threads)[threadId] = ThreadInfo{};
+        threadIds.push_back(threadId);
+      }
 
-      // Set the promise return value with the thread id that was created.
-      notifier.set_value(threadId);
+      // Set the promise return value with the thread ids that were created.
+      request.notifier.set_value(move(threadIds));
     }
     // Stop a thread.
     while (!globalThreadStopQueue->empty()) {
@@ -141,23 +314,6 @@ static void globalPoolLoop() {
         (*threads)[threadId].first();
       }
     }
-    // Join a terminated thread.
-    while (!globalThreadJoinQueue->empty()) {
-      auto threadId = globalThreadJoinQueue->front();
-      globalThreadJoinQueue->pop();
-
-      // Look for the thread so that it can be joined.
-      if (threads->count(threadId)) {
-        // Make appropriate notifications.
-        for (auto & notifier : (*threads)[threadId].second) {
-          notifier.set_value();
-        }
-
-        // Clean up.
-        // The thread will automatically join when it is erased here.
-        threads->erase(threadId);
-      }
-    }
 
     // globalMutex is still acquired, which means that nothing else has been
     // able to write to our queues.  If they are all empty, and there are no
@@ -165,7 +321,6 @@ static void globalPoolLoop() {
     // one will be started if required by future thread requests.
     if (globalThreadCreateQueue->empty()
         && globalThreadStopQueue->empty()
-        && globalThreadJoinQueue->empty()
         && threads->empty()) {
       // It is possible that there are many more signals waiting, so clean out
       // that semaphore.
@@ -187,32 +342,60 @@ static void globalPoolLoop() {
 
 
 thread::id createThread(ThreadFunction func) {
+  return createThreads(1, move(func)).front();
+}
+
+
+vector<thread::id> createThreads(size_t count, ThreadFunction func) {
+  if (!count) {
+    return {};
+  }
+
   // Create the promise that will be passed to the globalPool.
-  promise<thread::id> notifier;
+  promise<vector<thread::id>> notifier;
   auto notifierResult = notifier.get_future();
+  vector<thread::id> threadIds{};
 
   {
     // Prevent race conditions.
     scoped_lock lock{*globalMutex};
 
+    // Hand the function to parked threads first, most recently parked first,
+    // since their caches are the warmest.
+    auto & parked = warmThreadCache->parked;
+    while (count && !parked.empty()) {
+      auto warm = parked.back();
+      parked.pop_back();
+      warm->function = func;
+      (*threads)[warm->threadId] = ThreadInfo{};
+      warm->condition.notify_one();
+      threadIds.push_back(warm->threadId);
+      --count;
+    }
+    if (!count) {
+      return threadIds;
+    }
+
     // Start a global thread pool (if it does not already exist).
     if (globalPoolNotStarted->try_acquire()) {
       globalPool = jthread{globalPoolLoop};
     }
 
-    // Put the promise on the queue.
-    globalThreadCreateQueue->emplace(move(notifier), move(func));
+    // Put the request on the queue.
+    globalThreadCreateQueue->push({move(notifier), move(func), count});
 
     // Let the globalPool know that there is work to do.
     globalThreadSemaphore->release();
   }
 
-  // Block until the thread id is returned.
-  return notifierResult.get();
+  // Block until the thread ids are returned.
+  auto createdIds = notifierResult.get();
+  threadIds.insert(threadIds.end(), createdIds.begin(), createdIds.end());
+  return threadIds;
 }
 
 
-static vector<future<void>> joinThreads(const set<thread::id> & threadIds) {
+static vector<future<void>> requestThreadJoins(const vector<thread::id> & threadIds) {
   vector<future<void>> notifierResults{};
 
   {
@@ -251,6 +434,13 @@ static vector<future<void>> joinThreads(const set<thread::id> & threadIds) {
 }
 
 
+void joinThreads(const vector<thread::id> & threadIds) {
+  for (auto & notifierResult : requestThreadJoins(threadIds)) {
+    notifierResult.get();
+  }
+}
+
+
 void joinGlobalPool() {
   // Get a list of all threads and join them.
   vector<future<void>> notifierResults{};
@@ -259,6 +449,13 @@ void joinGlobalPool() {
     // Prevent race conditions.
     scoped_lock lock{*globalMutex};
 
+    // Parked threads have nothing left to do, so they simply exit.
+    for (auto warm : warmThreadCache->parked) {
+      warm->expired = true;
+      warm->condition.notify_one();
+    }
+    warmThreadCache->parked.clear();
+
     // Tell all the threads to stop, and set a join notification.
     for (auto & [threadId, threadInfo] : *threads) {
 
@@ -286,7 +483,7 @@ void joinGlobalPool() {
 }
 
 
-static bool stopThreads(const set<thread::id> & threadIds) {
+static bool stopThreads(const vector<thread::id> & threadIds) {
   // Prevent race conditions.
   scoped_lock lock{*globalMutex};
 
@@ -310,277 +507,4753 @@ size_t getGlobalPoolThreadCount() {
   return threads->size();
 }
 
+
+void setWarmThreadPolicy(const WarmThreadPolicy & policy) {
+  scoped_lock lock{*globalMutex};
+  auto & cache = *warmThreadCache;
+  cache.policy = policy;
+
+  // The threads that have been parked the longest are the first to go.
+  auto excess = (cache.parked.size() > policy.maxThreads) ? cache.parked.size() - policy.maxThreads : 0;
+  for (size_t i = 0; i < excess; ++i) {
+    cache.parked[i]->expired = true;
+  }
+
+  // Wake every parked thread, so that it either exits or starts to use the
+  // new timeout.
+  for (auto warm : cache.parked) {
+    warm->condition.notify_one();
+  }
+  cache.parked.erase(cache.parked.begin(), cache.parked.begin() + static_cast<ptrdiff_t>(excess));
+}
+
+
+WarmThreadPolicy getWarmThreadPolicy() {
+  scoped_lock lock{*globalMutex};
+  return warmThreadCache->policy;
+}
+
+
+size_t getWarmThreadCount() {
+  scoped_lock lock{*globalMutex};
+  return warmThreadCache->parked.size();
+}
+
 /**
- * Structure to hold the state of the pool.
- *
- * If the pool object is destroyed, then the threads must exit safely, but in
- * order to do so, the synchronization mutexes and queues must still exist.
- * To accomplish this, the State is provided to each thread as a shared
- * pointer.  As such, the State will be destroyed when the object pool and
- * all associated threads are destroyed.
+ * The size of a cache line, used to keep data that is written by different
+ * threads apart.
  */
-struct State {
+#ifdef __cpp_lib_hardware_interference_size
+static constexpr size_t CACHE_LINE_SIZE{hardware_destructive_interference_size};
+#else
+static constexpr size_t CACHE_LINE_SIZE{64};
+#endif
+
+/**
+ * Marks a worker that is not bound to a single NUMA node.
+ */
+static constexpr size_t NO_NUMA_NODE{numeric_limits<size_t>::max()};
+
+/**
+ * The CPUs of each NUMA node, and the NUMA node of each CPU.
+ */
+struct NumaTopology {
   /**
-   * Mutex to control access to the Queue.
+   * The CPUs that belong to each node.
    */
-  mutex queueMutex;
+  vector<vector<size_t>> nodeCpus;
 
   /**
-   * Mutex to control access to the threadsWaiting map.
+   * The node that each CPU belongs to, or NO_NUMA_NODE.
    */
-  mutex controlMutex;
+  vector<size_t> cpuNodes;
+};
+
+/**
+ * Parse a Linux sysfs list, such as "0-3,8,10-11".
+ *
+ * @param path The file that holds the list.
+ * @returns The values in the list, or an empty list if the file could not be
+ *   read.
+ */
+static vector<size_t> readSysfsList(const string & path) {
+  vector<size_t> values{};
+  ifstream file{path};
+  string range;
+  while (getline(file, range, ',')) {
+    size_t first{0};
+    size_t last{0};
+    auto dash = range.find('-');
+    try {
+      first = stoul(range.substr(0, dash));
+      last = (dash == string::npos) ? first : stoul(range.substr(dash + 1));
+    }
+    catch (...) {
+      return {};
+    }
+    for (auto value = first; value <= last; ++value) {
+      values.push_back(value);
+    }
+  }
+  return values;
+}
+
+/**
+ * Get the NUMA topology of the system, which is read only once.
+ *
+ * @returns The NUMA topology of the system.
+ */
+static const NumaTopology & numaTopology() {
+  static const NumaTopology topology = [](){
+    NumaTopology topology{};
+    for (auto node : readSysfsList("/sys/devices/system/node/online")) {
+      if (topology.nodeCpus.size() <= node) {
+        topology.nodeCpus.resize(node + 1);
+      }
+      topology.nodeCpus[node] = readSysfsList("/sys/devices/system/node/node" + to_string(node) + "/cpulist");
+    }
+
+    // Without a topology, the whole system is a single node.
+    if (topology.nodeCpus.empty()) {
+      topology.nodeCpus.emplace_back();
+      for (size_t cpu = 0; cpu < thread::hardware_concurrency(); ++cpu) {
+        topology.nodeCpus.back().push_back(cpu);
+      }
+    }
+
+    for (size_t node = 0; node < topology.nodeCpus.size(); ++node) {
+      for (auto cpu : topology.nodeCpus[node]) {
+        if (topology.cpuNodes.size() <= cpu) {
+          topology.cpuNodes.resize(cpu + 1, NO_NUMA_NODE);
+        }
+        topology.cpuNodes[cpu] = node;
+      }
+    }
+    return topology;
+  }();
+  return topology;
+}
+
+size_t getNumaNodeCount() {
+  return numaTopology().nodeCpus.size();
+}
+
+vector<size_t> getNumaNodeCpus(size_t node) {
+  auto & topology = numaTopology();
+  return node < topology.nodeCpus.size() ? topology.nodeCpus[node] : vector<size_t>{};
+}
+
+/**
+ * The block sizes used by allocateFunctionStorage(), smallest first.
+ */
+static constexpr size_t FUNCTION_STORAGE_SIZES[]{128, 256, 512, 1024};
+
+/**
+ * The number of block sizes.
+ */
+static constexpr size_t FUNCTION_STORAGE_CLASSES{size(FUNCTION_STORAGE_SIZES)};
+
+/**
+ * The most blocks of each size that a thread will hold on to after freeing
+ * them itself.  Blocks that are handed back by other threads are always
+ * kept, because they were allocated by this thread in the first place.
+ */
+static constexpr size_t FUNCTION_STORAGE_CACHE_LIMIT{256};
+
+/**
+ * The number of blocks that a thread collects before handing them back to
+ * the heap that allocated them, all at once.
+ */
+static constexpr size_t REMOTE_FREE_BATCH{32};
 
+/**
+ * The free lists of the blocks used by allocateFunctionStorage(), owned by
+ * one thread at a time.
+ *
+ * A block is always returned to the heap that allocated it.  When it is freed
+ * by the owning thread, it goes straight onto a local free list.  When it is
+ * freed by another thread (e.g., a task that was created by a producer and
+ * destroyed by a worker), it is collected into a batch, and the batch is
+ * pushed onto the heap's remote free list with a single atomic operation.
+ * The owner takes the whole remote list at once when its local list runs
+ * out.  Producers and consumers therefore recycle one another's blocks
+ * without passing them through the system allocator.
+ *
+ * Heaps are never destroyed, because blocks may still be in flight when the
+ * owning thread exits.  Instead, the heap of an exited thread is adopted by
+ * the next thread that needs one.
+ */
+struct FunctionStorageHeap {
   /**
-   * Collection of available threads.
+   * A free block, which is used to link to the next free block.
    */
-  set<thread::id> threads;
+  struct Block {
+    /**
+     * The next free block of the same size.
+     */
+    Block * next;
+  };
 
   /**
-   * Track the waiting state of each thread.
+   * Placed in front of each block, so that the block can find its way back
+   * to the heap that allocated it.
    */
-  map<thread::id, bool> threadsWaiting;
+  struct alignas(max_align_t) Header {
+    /**
+     * The heap that allocated the block, or nullptr if it was allocated by a
+     * thread that had no heap (and is simply given back to the system).
+     */
+    FunctionStorageHeap * heap;
+  };
 
   /**
-   * Track the threads that have been terminated.
+   * Take the blocks that other threads have handed back, and add them to
+   * the local free list.
+   *
+   * Must only be called by the owner of the heap.
+   *
+   * @param index The size class of the blocks.
+   * @returns True if any blocks were taken.
    */
-  set<thread::id> threadsTerminated;
+  bool takeRemoteBlocks(size_t index) {
+    if (!this->remoteHeads[index].load(memory_order_relaxed)) {
+      return false;
+    }
+    auto block = this->remoteHeads[index].exchange(nullptr, memory_order_acquire);
+    if (!block) {
+      return false;
+    }
+    auto last = block;
+    size_t count{1};
+    while (last->next) {
+      last = last->next;
+      ++count;
+    }
+    last->next = this->heads[index];
+    this->heads[index] = block;
+    this->counts[index] += count;
+    return true;
+  }
 
   /**
-   * Queue of tasks waiting to be assigned to a thread.
+   * Give every free block back to the system allocator.
+   *
+   * Must only be called by the owner of the heap.
    */
-  queue<Task> tasks;
+  void release() {
+    for (size_t index = 0; index < FUNCTION_STORAGE_CLASSES; ++index) {
+      this->takeRemoteBlocks(index);
+      while (auto block = this->heads[index]) {
+        this->heads[index] = block->next;
+        ::operator delete(reinterpret_cast<Header *>(block) - 1);
+      }
+      this->counts[index] = 0;
+    }
+  }
 
   /**
-   * Indicates whether or not the threads should terminate.
+   * The first free block of each size.
    */
-  bool terminate;
+  Block * heads[FUNCTION_STORAGE_CLASSES]{};
 
   /**
-   * Allows threads to wait on new tasks or termination.
+   * The number of free blocks of each size.
    */
-  std::condition_variable mutexCondition;
+  size_t counts[FUNCTION_STORAGE_CLASSES]{};
 
   /**
-   * The number of threads that the pool should manage.
-   *
-   * This defaults to the number of logical cores on the system.
+   * The blocks of each size that other threads have handed back.  Kept on
+   * its own cache line, because other threads write to it.
    */
-  size_t targetThreadCount;
+  alignas(CACHE_LINE_SIZE) atomic<Block *> remoteHeads[FUNCTION_STORAGE_CLASSES]{};
 };
-}
 
+/**
+ * The heaps of the threads that have exited, waiting to be adopted.
+ */
+struct AbandonedHeaps {
+  /**
+   * Protects the heaps.
+   */
+  mutex heapsMutex;
 
-Pool::Pool() : Pool(thread::hardware_concurrency()) {}
-
-
-Pool::Pool(size_t threadCount) {
-  this->state = make_shared<State>();
-  this->state->terminate = true;
-  this->state->targetThreadCount = threadCount;
-}
-
+  /**
+   * The heaps.
+   */
+  vector<FunctionStorageHeap *> heaps;
+};
 
-Pool::~Pool() {
-  this->stop();
+/**
+ * Get the heaps of the threads that have exited.
+ *
+ * The list is never destroyed, so that threads which exit during static
+ * destruction may still use it.
+ *
+ * @returns The heaps.
+ */
+static AbandonedHeaps & abandonedHeaps() {
+  static auto & heaps = *new AbandonedHeaps{};
+  return heaps;
 }
 
-
-bool Pool::enqueue(Task && task) {
-  scoped_lock locks{this->state->queueMutex, this->state->controlMutex};
-
-  this->state->tasks.emplace(move(task));
-
-  // Notify a thread that a task is available.
-  if (!this->state->terminate) {
-    this->state->mutexCondition.notify_one();
+/**
+ * The heap of the current thread, and the blocks that it is collecting for
+ * other heaps.
+ */
+struct FunctionStorageCache {
+  /**
+   * Constructor.
+   *
+   * Adopts the heap of a thread that has exited, if there is one.
+   */
+  FunctionStorageCache() {
+    auto & abandoned = abandonedHeaps();
+    scoped_lock heapsMutexLock{abandoned.heapsMutex};
+    if (!abandoned.heaps.empty()) {
+      this->heap = abandoned.heaps.back();
+      abandoned.heaps.pop_back();
+    }
+    else {
+      this->heap = new FunctionStorageHeap{};
+    }
   }
-  return true;
-}
 
+  /**
+   * Destructor.
+   *
+   * Hands back the collected blocks, gives the free blocks back to the
+   * system allocator, and leaves the heap to be adopted by another thread.
+   */
+  ~FunctionStorageCache();
 
-void Pool::start() {
-  // Don't try to start the pool if it is already running.
-  {
-    scoped_lock locks{this->state->queueMutex, this->state->controlMutex};
-    if (!this->state->terminate) {
+  /**
+   * Hand the collected blocks back to the heap that allocated them.
+   */
+  void flush() {
+    if (!this->batchCount) {
       return;
     }
-    // Set the stop condition.
-    this->state->terminate = false;
+    auto & remoteHead = this->batchHeap->remoteHeads[this->batchIndex];
+    auto head = remoteHead.load(memory_order_relaxed);
+    do {
+      this->batchTail->next = head;
+    } while (!remoteHead.compare_exchange_weak(head, this->batchHead, memory_order_release, memory_order_relaxed));
+    this->batchHead = nullptr;
+    this->batchTail = nullptr;
+    this->batchCount = 0;
   }
 
-  this->createThreads();
-}
+  /**
+   * Collect a block that was allocated by another heap.
+   *
+   * @param owner The heap that allocated the block.
+   * @param index The size class of the block.
+   * @param block The block.
+   */
+  void collect(FunctionStorageHeap * owner, size_t index, FunctionStorageHeap::Block * block) {
+    if ((owner != this->batchHeap) || (index != this->batchIndex)) {
+      this->flush();
+      this->batchHeap = owner;
+      this->batchIndex = index;
+    }
+    block->next = this->batchHead;
+    this->batchHead = block;
+    if (!this->batchTail) {
+      this->batchTail = block;
+    }
+    if (++this->batchCount == REMOTE_FREE_BATCH) {
+      this->flush();
+    }
+  }
 
+  /**
+   * The heap of the current thread.
+   */
+  FunctionStorageHeap * heap;
 
-void Pool::stop() {
-  // Set the stop condition.
-  {
-    scoped_lock locks{this->state->queueMutex, this->state->controlMutex};
-    this->state->terminate = true;
+  /**
+   * The heap that the collected blocks belong to.
+   */
+  FunctionStorageHeap * batchHeap{nullptr};
 
-    stopThreads(this->state->threads);
-  }
+  /**
+   * The size class of the collected blocks.
+   */
+  size_t batchIndex{0};
 
-  // Wake up all threads so that they will terminate themselves.
-  this->state->mutexCondition.notify_all();
-}
+  /**
+   * The collected blocks, most recent first.
+   */
+  FunctionStorageHeap::Block * batchHead{nullptr};
+
+  /**
+   * The first block that was collected.
+   */
+  FunctionStorageHeap::Block * batchTail{nullptr};
+
+  /**
+   * The number of collected blocks.
+   */
+  size_t batchCount{0};
+};
+
+/**
+ * Whether or not the FunctionStorageCache of the current thread has been
+ * destroyed.  Blocks may still be freed afterwards, by the destructors of
+ * other thread_local objects.
+ */
+static thread_local bool functionStorageCacheDestroyed{false};
+
+FunctionStorageCache::~FunctionStorageCache() {
+  this->flush();
+  this->heap->release();
+  functionStorageCacheDestroyed = true;
+  auto & abandoned = abandonedHeaps();
+  scoped_lock heapsMutexLock{abandoned.heapsMutex};
+  abandoned.heaps.push_back(this->heap);
+}
+
+/**
+ * The heap of the current thread.
+ */
+static thread_local FunctionStorageCache functionStorageCache{};
+
+/**
+ * Find the size class of a block.
+ *
+ * @param size The number of bytes requested.
+ * @returns The index into FUNCTION_STORAGE_SIZES, or the size of that array if
+ *   the block is too large to be cached.
+ */
+static size_t functionStorageClass(size_t size) {
+  size_t index{0};
+  while ((index < FUNCTION_STORAGE_CLASSES) && (FUNCTION_STORAGE_SIZES[index] < size)) {
+    ++index;
+  }
+  return index;
+}
+
+
+/**
+ * Hand back the blocks that the current thread has collected for other
+ * threads, e.g., before the thread goes to sleep.
+ */
+static void flushFunctionStorage() {
+  if (!functionStorageCacheDestroyed) {
+    functionStorageCache.flush();
+  }
+}
+
+
+void * allocateFunctionStorage(size_t size) {
+  auto index = functionStorageClass(size);
+  if (index == FUNCTION_STORAGE_CLASSES) {
+    return ::operator new(size);
+  }
+
+  FunctionStorageHeap * heap{nullptr};
+  if (!functionStorageCacheDestroyed) {
+    heap = functionStorageCache.heap;
+    if (heap->heads[index] || heap->takeRemoteBlocks(index)) {
+      auto block = heap->heads[index];
+      heap->heads[index] = block->next;
+      --heap->counts[index];
+      return block;
+    }
+  }
+
+  auto header = ::new (::operator new(sizeof(FunctionStorageHeap::Header) + FUNCTION_STORAGE_SIZES[index])) FunctionStorageHeap::Header{heap};
+  return header + 1;
+}
+
+
+void deallocateFunctionStorage(void * block, size_t size) noexcept {
+  auto index = functionStorageClass(size);
+  if (index == FUNCTION_STORAGE_CLASSES) {
+    ::operator delete(block);
+    return;
+  }
+
+  auto header = static_cast<FunctionStorageHeap::Header *>(block) - 1;
+  auto owner = header->heap;
+  auto freed = ::new (block) FunctionStorageHeap::Block{nullptr};
+  if (!owner) {
+    ::operator delete(header);
+    return;
+  }
+
+  // A thread without a heap hands the block back on its own.
+  if (functionStorageCacheDestroyed) {
+    auto & remoteHead = owner->remoteHeads[index];
+    auto head = remoteHead.load(memory_order_relaxed);
+    do {
+      freed->next = head;
+    } while (!remoteHead.compare_exchange_weak(head, freed, memory_order_release, memory_order_relaxed));
+    return;
+  }
+
+  auto & cache = functionStorageCache;
+  if (owner != cache.heap) {
+    cache.collect(owner, index, freed);
+    return;
+  }
+  if (cache.heap->counts[index] >= FUNCTION_STORAGE_CACHE_LIMIT) {
+    ::operator delete(header);
+    return;
+  }
+  freed->next = cache.heap->heads[index];
+  cache.heap->heads[index] = freed;
+  ++cache.heap->counts[index];
+}
+
+/**
+ * An allocator for standard containers that takes its memory from
+ * allocateFunctionStorage(), so that the containers of the pool recycle
+ * their nodes through the same per-thread heaps as the tasks.
+ *
+ * @tparam T The type of the elements.
+ */
+template <typename T>
+struct StorageAllocator {
+  /**
+   * The type of the elements.
+   */
+  using value_type = T;
+
+  /**
+   * Default constructor.
+   */
+  StorageAllocator() = default;
+
+  /**
+   * Converting constructor, used by containers to allocate their nodes.
+   */
+  template <typename U>
+  StorageAllocator(const StorageAllocator<U> &) noexcept {}
+
+  /**
+   * Allocate storage for elements.
+   *
+   * @param count The number of elements.
+   * @returns The storage.
+   */
+  T * allocate(size_t count) {
+    return static_cast<T *>(allocateFunctionStorage(count * sizeof(T)));
+  }
+
+  /**
+   * Free storage for elements.
+   *
+   * @param storage The storage.
+   * @param count The number of elements.
+   */
+  void deallocate(T * storage, size_t count) noexcept {
+    deallocateFunctionStorage(storage, count * sizeof(T));
+  }
+
+  /**
+   * Every StorageAllocator can free the storage of any other.
+   *
+   * @returns True.
+   */
+  template <typename U>
+  bool operator==(const StorageAllocator<U> &) const noexcept {
+    return true;
+  }
+};
+
+/**
+ * A queue of tasks, whose nodes come from allocateFunctionStorage().
+ */
+using TaskQueue = deque<Task, StorageAllocator<Task>>;
+
+#ifndef GHOTI_POOL_NO_STATS
+/**
+ * The statistics counters of a worker slot.
+ *
+ * Each counter is only written by the thread that owns the slot, so it is
+ * updated with a plain load and store instead of a read-modify-write, and it
+ * may be read from any thread at any time.
+ */
+struct WorkerCounters {
+  /**
+   * The number of tasks that were added to the queue by the owning thread.
+   */
+  atomic<uint64_t> submitted{0};
+
+  /**
+   * The number of tasks that were run.
+   */
+  atomic<uint64_t> completed{0};
+
+  /**
+   * The number of tasks that were stolen from another worker.
+   */
+  atomic<uint64_t> stolen{0};
+
+  /**
+   * Nanoseconds spent running tasks.
+   */
+  atomic<uint64_t> busy{0};
+
+  /**
+   * Nanoseconds spent waiting for tasks.
+   */
+  atomic<uint64_t> idle{0};
+
+  /**
+   * The sum of the queue wait times, in nanoseconds.
+   */
+  atomic<uint64_t> queueWaitTotal{0};
+
+  /**
+   * The sum of the execution times, in nanoseconds.
+   */
+  atomic<uint64_t> executionTotal{0};
+
+  /**
+   * The LatencyHistogram buckets of the queue wait times.
+   */
+  atomic<uint64_t> queueWait[LatencyHistogram::BUCKET_COUNT]{};
+
+  /**
+   * The LatencyHistogram buckets of the execution times.
+   */
+  atomic<uint64_t> execution[LatencyHistogram::BUCKET_COUNT]{};
+};
+
+/**
+ * Add to a counter that only the current thread writes.
+ *
+ * @param counter The counter.
+ * @param amount The amount to add.
+ */
+static inline void addToCounter(atomic<uint64_t> & counter, uint64_t amount) {
+  counter.store(counter.load(memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+/**
+ * The number of counters that are shared by the threads which enqueue tasks
+ * from outside of a pool.
+ */
+static constexpr size_t STATS_SHARD_COUNT{16};
+
+/**
+ * A counter shared by some of the threads that enqueue tasks from outside of
+ * a pool, on a cache line of its own.
+ */
+struct alignas(CACHE_LINE_SIZE) StatsShard {
+  /**
+   * The number of tasks that were added to the queue.
+   */
+  atomic<uint64_t> submitted{0};
+};
+
+/**
+ * Choose the StatsShard used by the current thread.
+ *
+ * @returns The index of the StatsShard used by the current thread.
+ */
+static size_t currentStatsShard() {
+  static atomic<size_t> nextShard{0};
+  static thread_local size_t shard{nextShard.fetch_add(1, memory_order_relaxed) % STATS_SHARD_COUNT};
+  return shard;
+}
+#endif
+
+/**
+ * The kinds of event that are recorded in a trace.
+ */
+enum class TraceEventType : uint8_t {
+  /**
+   * A task was added to the queue.
+   */
+  ENQUEUE,
+
+  /**
+   * A task was claimed by a worker.
+   */
+  DEQUEUE,
+
+  /**
+   * A worker started to run a task.
+   */
+  START,
+
+  /**
+   * A worker finished running a task.
+   */
+  END,
+};
+
+/**
+ * An event in a trace.
+ *
+ * The fields are atomic because the writer may overwrite an event while the
+ * trace is being read.  They are written and read without ordering, since
+ * the ring publishes the event as a whole.
+ */
+struct TraceEvent {
+  /**
+   * When the event happened, in steady_clock nanoseconds.
+   */
+  atomic<int64_t> timestamp{0};
+
+  /**
+   * The traceId of the task.
+   */
+  atomic<uint64_t> taskId{0};
+
+  /**
+   * The label of the task.
+   */
+  atomic<const char *> label{nullptr};
+
+  /**
+   * The kind of event.
+   */
+  atomic<TraceEventType> type{TraceEventType::ENQUEUE};
+};
+
+/**
+ * A ring buffer of the TRACE_BUFFER_SIZE most recent trace events of a
+ * worker (or of the threads outside of a pool).
+ */
+struct TraceRing {
+  /**
+   * The events.
+   */
+  TraceEvent events[TRACE_BUFFER_SIZE];
+
+  /**
+   * The number of events that have ever been written.  Event i is kept in
+   * events[i % TRACE_BUFFER_SIZE].
+   */
+  atomic<uint64_t> head{0};
+};
+
+/**
+ * Per-thread information used by the schedulers.
+ *
+ * Worker slots are owned by the pool State and are reused when threads come
+ * and go, so a slot (and the deque in it) lives as long as the State itself.
+ */
+struct alignas(CACHE_LINE_SIZE) Worker {
+  /**
+   * The index of this slot in the State's list of workers.
+   */
+  size_t index;
+
+  /**
+   * The NUMA node that the owning thread is bound to, or NO_NUMA_NODE.
+   */
+  atomic<size_t> node{NO_NUMA_NODE};
+
+  /**
+   * The tasks that have been enqueued by the thread that owns this slot.
+   *
+   * Only used by the work-stealing scheduler.
+   */
+  WorkStealingDeque<Task> deque;
+
+#ifndef GHOTI_POOL_NO_STATS
+  /**
+   * The statistics of every thread that has owned this slot.
+   */
+  WorkerCounters counters;
+#endif
+
+  /**
+   * The trace events of every thread that has owned this slot, or nullptr if
+   * the slot has never been traced.
+   *
+   * Only allocated by the thread that owns the slot.
+   */
+  atomic<TraceRing *> trace{nullptr};
+
+  /**
+   * Destructor.
+   */
+  ~Worker() {
+    delete this->trace.load();
+  }
+};
+
+/**
+ * Stable storage for the worker slots of a pool, indexed by a small worker id.
+ *
+ * Slots are allocated in chunks that double in size, so a slot never moves
+ * once it has been created, and thieves may walk the slots without taking a
+ * lock while new slots are being added.
+ */
+class WorkerSlots {
+  public:
+  WorkerSlots() = default;
+
+  // Remove the copy constructor.
+  WorkerSlots(const WorkerSlots &) = delete;
+
+  // Remove the copy assignment.
+  WorkerSlots & operator=(const WorkerSlots &) = delete;
+
+  /**
+   * Destructor.
+   */
+  ~WorkerSlots() {
+    for (auto & chunk : this->chunks) {
+      delete[] chunk.load();
+    }
+  }
+
+  /**
+   * Get the number of slots that have been created.
+   *
+   * @returns The number of slots that have been created.
+   */
+  size_t size() const {
+    return this->count.load();
+  }
+
+  /**
+   * Get a slot.
+   *
+   * @param index The index of the slot, which must be less than size().
+   * @returns The slot.
+   */
+  Worker & operator[](size_t index) const {
+    auto chunk = static_cast<size_t>(bit_width(index + 1)) - 1;
+    return this->chunks[chunk].load()[index + 1 - (size_t{1} << chunk)];
+  }
+
+  /**
+   * Create a new slot.
+   *
+   * Calls must be serialized by the caller.
+   *
+   * @returns The slot.
+   */
+  Worker & add() {
+    auto index = this->count.load();
+    auto chunk = static_cast<size_t>(bit_width(index + 1)) - 1;
+    if (!this->chunks[chunk].load()) {
+      this->chunks[chunk].store(new Worker[size_t{1} << chunk]);
+    }
+    auto & worker = this->chunks[chunk].load()[index + 1 - (size_t{1} << chunk)];
+    worker.index = index;
+
+    // Publish the slot.
+    this->count.store(index + 1);
+    return worker;
+  }
+
+  private:
+  /**
+   * The chunks of slots.  Chunk i holds 2^i slots.
+   */
+  atomic<Worker *> chunks[numeric_limits<size_t>::digits]{};
+
+  /**
+   * The number of slots that have been created.
+   */
+  atomic<size_t> count{0};
+};
+
+/**
+ * Identifies the pool, and the worker slot within it, that the current thread
+ * is serving (if any).
+ */
+static thread_local struct {
+  /**
+   * The State of the pool that owns the current thread.
+   */
+  State * state;
+
+  /**
+   * The worker slot of the current thread.
+   */
+  Worker * worker;
+} currentWorker{nullptr, nullptr};
+
+/**
+ * Structure to hold the state of a TaskGroup.
+ *
+ * The state is shared with the placeholder tasks that the group enqueues to
+ * the pool, because a placeholder may run after the group has been
+ * destroyed (if a waiting thread already ran its task).
+ */
+struct TaskGroupState {
+  /**
+   * Protects the tasks and the exception, and is used with the condition.
+   */
+  mutex groupMutex;
+
+  /**
+   * Allows a waiting thread to sleep until a task is available or until all
+   * tasks have finished.
+   */
+  condition_variable condition;
+
+  /**
+   * Tasks of the group that have not yet been claimed.
+   */
+  TaskQueue tasks;
+
+  /**
+   * The number of tasks of the group that have not yet finished.
+   */
+  atomic<size_t> pending{0};
+
+  /**
+   * The first exception thrown by a task of the group.
+   */
+  exception_ptr exception;
+};
+
+/**
+ * Claim and run the next unclaimed task of a group, if there is one.
+ *
+ * @param state The state of the group.
+ * @returns True if a task was run, False if there was no unclaimed task.
+ */
+static bool runGroupTask(TaskGroupState & state) {
+  Task task;
+  {
+    scoped_lock groupMutexLock{state.groupMutex};
+    if (state.tasks.empty()) {
+      return false;
+    }
+    task = move(state.tasks.front());
+    state.tasks.pop_front();
+  }
+
+  exception_ptr exception;
+  try {
+    task.function();
+  }
+  catch (...) {
+    exception = current_exception();
+  }
+
+  // Destroy the function (and anything that it captured) before declaring
+  // the task finished.
+  task.function = nullptr;
+
+  if (exception) {
+    scoped_lock groupMutexLock{state.groupMutex};
+    if (!state.exception) {
+      state.exception = exception;
+    }
+  }
+
+  // Wake the waiting threads if this was the last task.
+  if (state.pending.fetch_sub(1) == 1) {
+    scoped_lock groupMutexLock{state.groupMutex};
+    state.condition.notify_all();
+  }
+  return true;
+}
+
+/**
+ * Shared implementation of TaskGroup::wait() and TaskGroup::waitFor().
+ *
+ * @param state The state of the group.
+ * @param deadline The time at which to give up, if any.
+ * @returns True if all tasks finished, False if the deadline passed first.
+ */
+static bool waitGroup(TaskGroupState & state, const chrono::steady_clock::time_point * deadline) {
+  while (state.pending.load()) {
+    // Help, rather than sleep.
+    if (runGroupTask(state)) {
+      continue;
+    }
+
+    // Every task has been claimed, so sleep until they finish (or until
+    // another task is added).
+    unique_lock<mutex> groupMutexLock{state.groupMutex};
+    auto ready = [&] {
+      return !state.pending.load() || !state.tasks.empty();
+    };
+    if (deadline) {
+      if (!state.condition.wait_until(groupMutexLock, *deadline, ready)) {
+        return false;
+      }
+    }
+    else {
+      state.condition.wait(groupMutexLock, ready);
+    }
+  }
+
+  // Report the first exception.
+  exception_ptr exception;
+  {
+    scoped_lock groupMutexLock{state.groupMutex};
+    exception = exchange(state.exception, nullptr);
+  }
+  if (exception) {
+    rethrow_exception(exception);
+  }
+  return true;
+}
+
+/**
+ * Increment of State::threadStates for one thread that is waiting for a task.
+ */
+static constexpr uint64_t WAITING_THREAD{1};
+
+/**
+ * Increment of State::threadStates for one thread that is running a task.
+ */
+static constexpr uint64_t RUNNING_THREAD{uint64_t{1} << 32};
+
+/**
+ * The number of priority lanes.
+ */
+static constexpr size_t PRIORITY_COUNT{3};
+
+/**
+ * The share of claims that each lane is given when every lane has tasks, so
+ * that lower priority tasks are delayed but never starved.
+ *
+ * Indexed by Priority.
+ */
+static constexpr size_t PRIORITY_WEIGHTS[PRIORITY_COUNT]{16, 4, 1};
+
+/**
+ * The sum of PRIORITY_WEIGHTS.
+ */
+static constexpr size_t PRIORITY_WEIGHT_TOTAL{PRIORITY_WEIGHTS[0] + PRIORITY_WEIGHTS[1] + PRIORITY_WEIGHTS[2]};
+
+/**
+ * The default batch size of the work-stealing scheduler: the most tasks that
+ * a thread will claim from the injection queue at once.
+ */
+static constexpr size_t INJECTION_BATCH_SIZE{32};
+
+/**
+ * A queue of tasks of a single priority.
+ *
+ * Each lane has its own cache lines, because the lanes are locked
+ * independently.
+ */
+struct alignas(CACHE_LINE_SIZE) Lane {
+  /**
+   * Protects the tasks.
+   */
+  mutex laneMutex;
+
+  /**
+   * Tasks waiting to be assigned to a thread.
+   *
+   * With Scheduler::RING, only the tasks that did not fit in the ring.
+   */
+  TaskQueue tasks;
+
+  /**
+   * The lock-free ring that holds the tasks, with Scheduler::RING, or
+   * nullptr.
+   */
+  unique_ptr<RingQueue<Task>> ring;
+};
+
+/**
+ * A delayed or periodic task, waiting in the timer wheel of a pool.
+ */
+struct Timer {
+  /**
+   * The task to be enqueued when the timer fires.
+   *
+   * The function of a periodic task is moved out of the Timer while it runs,
+   * and moved back when it is rescheduled.
+   */
+  Task task;
+
+  /**
+   * The number of ticks between the runs of a periodic task, or 0 for a
+   * delayed task.
+   */
+  uint64_t period{0};
+};
+
+struct GroupMember;
+
+/**
+ * Get a new generation for the stop source of a pool.
+ *
+ * Generations are unique across all pools, so that a thread may tell whether
+ * the stop token that it cached is still current, whichever pool it came
+ * from.  0 is never returned, so that it can mean "no token".
+ *
+ * @returns The generation.
+ */
+static uint64_t newStopGeneration() {
+  static atomic<uint64_t> nextStopGeneration{1};
+  return nextStopGeneration.fetch_add(1, memory_order_relaxed);
+}
+
+/**
+ * Structure to hold the state of the pool.
+ *
+ * If the pool object is destroyed, then the threads must exit safely, but in
+ * order to do so, the synchronization mutexes and queues must still exist.
+ * To accomplish this, the State is provided to each thread as a shared
+ * pointer.  As such, the State will be destroyed when the object pool and
+ * all associated threads are destroyed.
+ */
+struct State {
+  // Configuration, and other fields that are read on every dispatch but
+  // rarely written.  These share cache lines with each other, but not with
+  // anything that is written often.
+
+  /**
+   * The strategy used to hand out tasks to the threads.
+   */
+  Scheduler scheduler;
+
+  /**
+   * The most tasks that may be counted in queuedTasks before the
+   * overflowPolicy is applied to a new task.
+   */
+  atomic<size_t> capacity{UNLIMITED_CAPACITY};
+
+  /**
+   * What to do with a new task when the queue is at capacity.
+   */
+  atomic<OverflowPolicy> overflowPolicy{OverflowPolicy::BLOCK};
+
+  /**
+   * The most times that an idle thread checks for a task before it parks.
+   */
+  atomic<size_t> spinCount{IdlePolicy{}.spinCount};
+
+  /**
+   * The longest time that an idle thread spins before it parks.
+   */
+  atomic<chrono::nanoseconds> spinDuration{IdlePolicy{}.spinDuration};
+
+  /**
+   * The queue depth at which a task enqueued by one of the pool's own
+   * threads is run inline, or UNLIMITED_CAPACITY.
+   */
+  atomic<size_t> inlineQueueDepth{InlinePolicy{}.queueDepth};
+
+  /**
+   * The most inline tasks that may be nested on one thread.
+   */
+  atomic<size_t> inlineMaxDepth{InlinePolicy{}.maxDepth};
+
+  /**
+   * Whether or not a task enqueued while the pool is not running is run
+   * inline.
+   */
+  atomic<bool> inlineWhenStopped{InlinePolicy{}.whenStopped};
+
+  /**
+   * The most NORMAL priority tasks that a thread claims from the lanes at
+   * once.
+   */
+  atomic<size_t> batchSize{1};
+
+  /**
+   * Indicates whether or not the threads should terminate.
+   */
+  atomic<bool> terminate;
+
+  /**
+   * Indicates whether or not the threads should terminate once there is
+   * nothing left for them to do.
+   */
+  atomic<bool> draining{false};
+
+  /**
+   * The number of threads that the pool should manage.
+   *
+   * This defaults to the number of logical cores on the system.
+   */
+  atomic<size_t> targetThreadCount;
+
+  /**
+   * The number of threads that have been created and have not yet decided to
+   * terminate.
+   */
+  atomic<size_t> threadCount{0};
+
+  /**
+   * Whether or not the pool is being traced.
+   */
+  atomic<bool> tracing{false};
+
+  /**
+   * When the current trace was started, in steady_clock nanoseconds.  Events
+   * from before then belong to an earlier trace.
+   */
+  atomic<int64_t> traceStart{0};
+
+  /**
+   * The trace events of the threads outside of the pool, or nullptr if the
+   * pool has never been traced.
+   *
+   * Only set while holding the controlMutex.
+   */
+  atomic<TraceRing *> externalTrace{nullptr};
+
+  /**
+   * The storage for every worker slot that has been created.
+   *
+   * New slots are only added while holding the controlMutex.
+   */
+  WorkerSlots workerSlots;
+
+  /**
+   * The group whose threads run the tasks of the pool, or nullptr.
+   */
+  shared_ptr<WorkerGroupState> group;
+
+  /**
+   * The membership of the pool in its group, or nullptr.
+   *
+   * Only used by the Pool object, which removes it from the group when it
+   * is destroyed.
+   */
+  GroupMember * groupMember{nullptr};
+
+  // Counters that are written by every enqueue or claim.  Each is on its own
+  // cache line, so that writing one does not slow down readers of another.
+
+  /**
+   * The number of tasks that have not yet been claimed, across every lane
+   * and every worker deque.
+   *
+   * A task is counted before it becomes visible to a thread, so that the
+   * count never drops below zero.
+   */
+  alignas(CACHE_LINE_SIZE) atomic<size_t> queuedTasks{0};
+
+  /**
+   * The number of waiting threads (low 32 bits) and running threads (high 32
+   * bits).
+   *
+   * Packing both counts into one value allows a thread to move from waiting
+   * to running (and back) with a single atomic operation.
+   */
+  alignas(CACHE_LINE_SIZE) atomic<uint64_t> threadStates{0};
+
+  /**
+   * Bitmask of the lanes that have tasks in them.
+   *
+   * A lane's bit is only changed while holding that lane's mutex.
+   */
+  alignas(CACHE_LINE_SIZE) atomic<uint32_t> nonEmptyLanes{0};
+
+  /**
+   * The number of idle threads that are spinning instead of parked.
+   *
+   * While a thread is spinning, an enqueued task does not need to wake a
+   * parked thread, because the spinning thread will claim it.
+   */
+  alignas(CACHE_LINE_SIZE) atomic<size_t> spinningThreads{0};
+
+  // Used by threads that are parking or waking up.
+
+  /**
+   * Mutex used by threads that are sleeping on the mutexCondition.
+   *
+   * Any change to a value that is checked by a sleeping thread (terminate,
+   * targetThreadCount, etc.) must be made while holding this mutex, so that
+   * the wakeup is not lost.  The task queues themselves are protected by
+   * the mutex of each Lane.
+   */
+  alignas(CACHE_LINE_SIZE) mutex queueMutex;
+
+  /**
+   * Allows threads to wait on new tasks or termination.
+   */
+  std::condition_variable mutexCondition;
+
+  /**
+   * The number of threads that are blocked on the mutexCondition.
+   *
+   * Only modified while holding the queueMutex.
+   */
+  atomic<size_t> sleepingThreads{0};
+
+  // The queues.  Each Lane is on its own cache lines.
+
+  /**
+   * Queues of tasks waiting to be assigned to a thread, one per Priority.
+   *
+   * When using the work-stealing scheduler, these are the injection queues
+   * that hold the tasks enqueued from outside of the pool (and the tasks
+   * enqueued with a priority other than NORMAL from inside of the pool).
+   */
+  Lane lanes[PRIORITY_COUNT];
+
+  // Used by submitters that are waiting for room in the queue.
+
+  /**
+   * Mutex used by submitters that are waiting for room in the queue.
+   */
+  alignas(CACHE_LINE_SIZE) mutex capacityMutex;
+
+  /**
+   * Allows submitters to wait for room in the queue.
+   */
+  condition_variable capacityCondition;
+
+  /**
+   * The number of submitters that are blocked on the capacityCondition.
+   *
+   * Only modified while holding the capacityMutex.
+   */
+  atomic<size_t> blockedSubmitters{0};
+
+  // Written for every task while the pool is being traced.
+
+  /**
+   * The traceId that will be given to the next task.
+   */
+  alignas(CACHE_LINE_SIZE) atomic<uint64_t> nextTraceId{1};
+
+  // Thread bookkeeping, the autoscaler, and the timers, none of which are
+  // touched on the dispatch path.
+
+  /**
+   * Mutex to control access to the thread bookkeeping collections.
+   *
+   * This mutex is never taken on the task dispatch path.
+   */
+  alignas(CACHE_LINE_SIZE) mutex controlMutex;
+
+  /**
+   * Collection of available threads.
+   *
+   * Protected by the controlMutex.
+   */
+  vector<thread::id> threads;
+
+  /**
+   * Allows drain() to wait until every thread has finished.  Notified by
+   * each thread as it terminates.
+   */
+  condition_variable drainCondition;
+
+  /**
+   * Requested when the pool is stopped, so that running tasks may finish
+   * early.  Replaced when the pool is started again.
+   *
+   * Protected by the controlMutex.
+   */
+  stop_source stopSource;
+
+  /**
+   * The generation of the stopSource, which changes whenever the stopSource
+   * is replaced.
+   *
+   * Only changed while the controlMutex is held, but read without it, so that
+   * getStopToken() only needs the lock when the token has changed.
+   */
+  atomic<uint64_t> stopGeneration{newStopGeneration()};
+
+  /**
+   * The number of threads that have been terminated.
+   */
+  atomic<size_t> terminatedThreadCount{0};
+
+  /**
+   * The indices of worker slots that are not currently owned by a thread.
+   *
+   * Protected by the controlMutex.
+   */
+  vector<size_t> freeWorkerSlots;
+
+  /**
+   * The CPUs on which the threads may run.
+   *
+   * Protected by the controlMutex.
+   */
+  ThreadAffinity affinity;
+
+  /**
+   * Mutex used by the autoscaler thread.
+   */
+  mutex autoscaleMutex;
+
+  /**
+   * Allows the autoscaler thread to wait for its next sample, or for a
+   * change to its policy.
+   */
+  condition_variable autoscaleCondition;
+
+  /**
+   * How the pool adjusts its own thread count, if it does.
+   *
+   * Protected by the autoscaleMutex.
+   */
+  optional<AutoscalePolicy> autoscalePolicy;
+
+  /**
+   * Whether or not an autoscaler thread is running.
+   *
+   * Protected by the autoscaleMutex.
+   */
+  bool autoscalerRunning{false};
+
+  /**
+   * Mutex used by the timer thread, which protects the timer wheel.
+   */
+  mutex timerMutex;
+
+  /**
+   * Allows the timer thread to wait for the next timer, or for a new timer
+   * that is due earlier.
+   */
+  condition_variable timerCondition;
+
+  /**
+   * The delayed and periodic tasks of the pool.
+   *
+   * Protected by the timerMutex.
+   */
+  TimerWheel<Timer> timers;
+
+  /**
+   * The time of tick 0 of the timer wheel.
+   */
+  chrono::steady_clock::time_point timerEpoch{chrono::steady_clock::now()};
+
+  /**
+   * The tick that the timer thread is sleeping until, so that a new timer
+   * only wakes it if it is due earlier.
+   *
+   * Protected by the timerMutex.
+   */
+  uint64_t timerWakeTick{numeric_limits<uint64_t>::max()};
+
+  /**
+   * Whether or not a timer thread is running.
+   *
+   * Protected by the timerMutex.
+   */
+  bool timerThreadRunning{false};
+
+  /**
+   * Owns the externalTrace.
+   */
+  unique_ptr<TraceRing> externalTraceStorage;
+
+#ifndef GHOTI_POOL_NO_STATS
+  /**
+   * The number of tasks that were added to the queue from outside of the
+   * pool.  Threads of the pool count their own tasks in their worker slot.
+   */
+  StatsShard submittedShards[STATS_SHARD_COUNT];
+#endif
+};
+
+/**
+ * A Pool that uses the threads of a WorkerGroup.
+ */
+struct GroupMember {
+  /**
+   * The shared state of the pool.
+   */
+  shared_ptr<State> state;
+
+  /**
+   * The share of the group that the pool may use.
+   *
+   * Protected by the groupMutex.
+   */
+  ExecutorQuota quota;
+
+  /**
+   * The worker slot in the pool of each thread of the group, by the index
+   * of the thread.
+   */
+  vector<Worker *> slots;
+
+  /**
+   * The number of tasks of the pool that the threads of the group are
+   * running.
+   *
+   * Protected by the groupMutex.
+   */
+  size_t running{0};
+
+  /**
+   * The virtual time of the pool, which advances each time that one of its
+   * tasks is run, by an amount inversely proportional to its weight.  The
+   * pool with the lowest virtual time is served first.
+   *
+   * Protected by the groupMutex.
+   */
+  uint64_t pass{0};
+};
+
+/**
+ * Structure to hold the state of a WorkerGroup.
+ *
+ * Like the State of a pool, this is shared with the threads of the group, so
+ * that they may finish safely after the WorkerGroup object is destroyed.
+ */
+struct WorkerGroupState {
+  /**
+   * Protects the members and the stopping flag, and is used with the
+   * conditions.
+   */
+  mutex groupMutex;
+
+  /**
+   * Allows an idle thread to sleep until a pool has a task for it.
+   */
+  condition_variable condition;
+
+  /**
+   * Allows a pool that is being joined to wait until the threads of the
+   * group have finished running its tasks.
+   */
+  condition_variable idleCondition;
+
+  /**
+   * The pools that use the group.
+   */
+  vector<shared_ptr<GroupMember>> members;
+
+  /**
+   * The ids of the threads of the group.
+   */
+  vector<thread::id> threads;
+
+  /**
+   * The number of threads in the group.
+   */
+  size_t threadCount{0};
+
+  /**
+   * The virtual time of the pool that was served most recently.  A pool
+   * that had nothing to do catches up to it, so that it cannot claim more
+   * than its share once it has tasks again.
+   */
+  uint64_t pass{0};
+
+  /**
+   * Whether or not the threads of the group should terminate.
+   */
+  bool stopping{false};
+
+  /**
+   * The number of threads of the group that are looking for, or waiting
+   * for, a task.
+   *
+   * A thread is counted before it looks, so that a task that it does not
+   * find is always followed by a notification.
+   */
+  atomic<size_t> sleepingThreads{0};
+};
+}
+
+
+/**
+ * Wake up as many sleeping threads as are needed to claim a number of tasks.
+ *
+ * Must be called while holding the queueMutex.
+ *
+ * @param state The shared pool state.
+ * @param taskCount The number of tasks that have been made available.
+ */
+static void wakeThreads(State & state, size_t taskCount) {
+  auto sleeping = state.sleepingThreads.load();
+  if (taskCount >= sleeping) {
+    state.mutexCondition.notify_all();
+    return;
+  }
+  for (size_t i = 0; i < taskCount; ++i) {
+    state.mutexCondition.notify_one();
+  }
+}
+
+
+/**
+ * Wake up as many threads of a group as are needed to claim a number of new
+ * tasks.
+ *
+ * @param group The state of the group.
+ * @param taskCount The number of tasks that have been made available.
+ */
+static void wakeGroup(WorkerGroupState & group, size_t taskCount) {
+  // Only pay for the lock when there is a thread that must be woken.
+  if (!group.sleepingThreads.load()) {
+    return;
+  }
+  scoped_lock groupMutexLock{group.groupMutex};
+  if (taskCount >= group.sleepingThreads.load()) {
+    group.condition.notify_all();
+    return;
+  }
+  for (size_t i = 0; i < taskCount; ++i) {
+    group.condition.notify_one();
+  }
+}
+
+
+/**
+ * Make sure that enough threads are awake to claim a number of new tasks.
+ *
+ * Spinning threads will find the tasks without being woken, so only the tasks
+ * in excess of the spinning threads wake a parked thread.  A thread that stops
+ * spinning because it claimed a task wakes another thread itself, if there are
+ * still tasks left to claim.  The threads of the pool's WorkerGroup (if any)
+ * are woken as well.
+ *
+ * @param state The shared pool state.
+ * @param taskCount The number of tasks that have been made available.
+ */
+static void notifyTasks(State & state, size_t taskCount) {
+  if (state.group) [[unlikely]] {
+    wakeGroup(*state.group, taskCount);
+  }
+  auto spinning = state.spinningThreads.load();
+
+  // Only pay for the lock when there is a thread that must be woken.
+  if ((taskCount > spinning) && state.sleepingThreads.load()) {
+    scoped_lock queueMutexLock{state.queueMutex};
+    wakeThreads(state, taskCount - spinning);
+  }
+}
+
+
+/**
+ * Record a trace event.
+ *
+ * @param state The shared pool state.
+ * @param worker The worker slot of the current thread, or nullptr if the
+ *   current thread is not one of the pool's threads.
+ * @param type The kind of event.
+ * @param task The task.
+ */
+static void traceEvent(State & state, Worker * worker, TraceEventType type, const Task & task) {
+  TraceRing * ring;
+  uint64_t position;
+  if (worker) {
+    ring = worker->trace.load(memory_order_acquire);
+    if (!ring) {
+      ring = new TraceRing{};
+      worker->trace.store(ring, memory_order_release);
+    }
+
+    // Only the owner writes to a worker's ring.
+    position = ring->head.load(memory_order_relaxed);
+  }
+  else {
+    ring = state.externalTrace.load(memory_order_acquire);
+    if (!ring) {
+      return;
+    }
+    position = ring->head.fetch_add(1, memory_order_relaxed);
+  }
+
+  auto & event = ring->events[position % TRACE_BUFFER_SIZE];
+  event.timestamp.store(chrono::steady_clock::now().time_since_epoch().count(), memory_order_relaxed);
+  event.taskId.store(task.traceId, memory_order_relaxed);
+  event.label.store(task.label, memory_order_relaxed);
+  event.type.store(type, memory_order_relaxed);
+  if (worker) {
+    ring->head.store(position + 1, memory_order_release);
+  }
+}
+
+
+/**
+ * Record the enqueuing of Tasks in the trace.
+ *
+ * @param state The shared pool state.
+ * @param tasks The Tasks.
+ */
+static void traceEnqueue(State & state, span<Task> tasks) {
+  auto worker = (currentWorker.state == &state) ? currentWorker.worker : nullptr;
+  auto id = state.nextTraceId.fetch_add(tasks.size(), memory_order_relaxed);
+  for (auto & task : tasks) {
+    task.traceId = id++;
+    traceEvent(state, worker, TraceEventType::ENQUEUE, task);
+  }
+}
+
+
+/**
+ * Record when Tasks were enqueued, so that their queue wait can be measured,
+ * and trace them if the pool is being traced.
+ *
+ * Must be called before the tasks become visible to the pool's threads.
+ *
+ * @param state The shared pool state.
+ * @param tasks The Tasks.
+ */
+static inline void stampTasks(State & state, span<Task> tasks) {
+#ifndef GHOTI_POOL_NO_STATS
+  auto now = chrono::steady_clock::now();
+  for (auto & task : tasks) {
+    task.enqueued = now;
+  }
+#endif
+  if (state.tracing.load(memory_order_relaxed)) [[unlikely]] {
+    traceEnqueue(state, tasks);
+  }
+}
+
+
+/**
+ * Count tasks that have been added to the queue by the current thread.
+ *
+ * @param state The shared pool state.
+ * @param count The number of tasks.
+ */
+static inline void countSubmitted([[maybe_unused]] State & state, [[maybe_unused]] size_t count) {
+#ifndef GHOTI_POOL_NO_STATS
+  if (currentWorker.state == &state) {
+    addToCounter(currentWorker.worker->counters.submitted, count);
+  }
+  else {
+    state.submittedShards[currentStatsShard()].submitted.fetch_add(count, memory_order_relaxed);
+  }
+#endif
+}
+
+
+/**
+ * Count a task that a worker has stolen from another worker.
+ *
+ * @param worker The worker slot of the current thread.
+ */
+static inline void countStolen([[maybe_unused]] Worker * worker) {
+#ifndef GHOTI_POOL_NO_STATS
+  addToCounter(worker->counters.stolen, 1);
+#endif
+}
+
+
+/**
+ * Get the time to use for the statistics of a worker.
+ *
+ * @returns The current time, or the epoch if statistics are not collected.
+ */
+static inline chrono::steady_clock::time_point statsNow() {
+#ifndef GHOTI_POOL_NO_STATS
+  return chrono::steady_clock::now();
+#else
+  return {};
+#endif
+}
+
+
+/**
+ * Record that a worker has claimed a task and is about to run it.
+ *
+ * @param worker The worker slot of the current thread.
+ * @param task The task.
+ * @param idleSince When the worker started waiting for the task.
+ * @returns When the task started.
+ */
+static inline chrono::steady_clock::time_point recordTaskStart([[maybe_unused]] Worker * worker, [[maybe_unused]] const Task & task, [[maybe_unused]] chrono::steady_clock::time_point idleSince) {
+  auto now = statsNow();
+#ifndef GHOTI_POOL_NO_STATS
+  auto & counters = worker->counters;
+  auto wait = max(now - task.enqueued, chrono::steady_clock::duration::zero());
+  addToCounter(counters.idle, static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(now - idleSince).count()));
+  addToCounter(counters.queueWaitTotal, static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(wait).count()));
+  addToCounter(counters.queueWait[LatencyHistogram::getBucket(wait)], 1);
+#endif
+  return now;
+}
+
+
+/**
+ * Record that a worker has finished running a task.
+ *
+ * @param worker The worker slot of the current thread.
+ * @param started When the task started.
+ * @returns When the task finished.
+ */
+static inline chrono::steady_clock::time_point recordTaskEnd([[maybe_unused]] Worker * worker, [[maybe_unused]] chrono::steady_clock::time_point started) {
+  auto now = statsNow();
+#ifndef GHOTI_POOL_NO_STATS
+  auto & counters = worker->counters;
+  auto elapsed = now - started;
+  auto nanoseconds = static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(elapsed).count());
+  addToCounter(counters.completed, 1);
+  addToCounter(counters.busy, nanoseconds);
+  addToCounter(counters.executionTotal, nanoseconds);
+  addToCounter(counters.execution[LatencyHistogram::getBucket(elapsed)], 1);
+#endif
+  return now;
+}
+
+
+/**
+ * Count new tasks against the capacity of the queue.
+ *
+ * The tasks must be counted before they become visible, so that a thread
+ * which claims one never observes a negative count.
+ *
+ * @param state The shared pool state.
+ * @param count The number of tasks that the caller would like to enqueue.
+ * @returns The number of tasks that may be enqueued, which is less than count
+ *   if there is not enough room in the queue.
+ */
+static size_t reserveTasks(State & state, size_t count) {
+  auto capacity = state.capacity.load();
+  if (capacity == UNLIMITED_CAPACITY) {
+    state.queuedTasks.fetch_add(count);
+    return count;
+  }
+
+  auto queued = state.queuedTasks.load();
+  while (queued < capacity) {
+    auto reserved = min(count, capacity - queued);
+    if (state.queuedTasks.compare_exchange_weak(queued, queued + reserved)) {
+      return reserved;
+    }
+  }
+  return 0;
+}
+
+
+/**
+ * Stop counting tasks that have been claimed (or that failed to enqueue),
+ * waking a submitter that is waiting for room in the queue.
+ *
+ * @param state The shared pool state.
+ * @param count The number of tasks.
+ */
+static void releaseTasks(State & state, size_t count) {
+  state.queuedTasks.fetch_sub(count);
+
+  // Only pay for the lock when there is a submitter that must be woken.
+  if (state.blockedSubmitters.load()) {
+    scoped_lock capacityMutexLock{state.capacityMutex};
+    state.capacityCondition.notify_one();
+  }
+}
+
+
+/**
+ * Remove the oldest queued task, preferring the lowest priority.
+ *
+ * @param state The shared pool state.
+ * @param task The Task that will receive the removed task.
+ * @returns True if a task was removed, False if there was nothing to remove.
+ */
+static bool dropOldestTask(State & state, Task & task) {
+  for (auto index = PRIORITY_COUNT; index-- > 0;) {
+    auto & ring = state.lanes[index].ring;
+    if (ring && ring->pop(task)) {
+      return true;
+    }
+    if (!(state.nonEmptyLanes.load() & (uint32_t{1} << index))) {
+      continue;
+    }
+    auto & lane = state.lanes[index];
+    scoped_lock laneMutexLock{lane.laneMutex};
+    if (lane.tasks.empty()) {
+      continue;
+    }
+    task = move(lane.tasks.front());
+    lane.tasks.pop_front();
+    if (lane.tasks.empty()) {
+      state.nonEmptyLanes.fetch_and(~(uint32_t{1} << index));
+    }
+    return true;
+  }
+
+  // The remaining tasks are on the worker deques, where the oldest task of
+  // each deque may be stolen from any thread.
+  auto & workers = state.workerSlots;
+  for (size_t i = 0, count = workers.size(); i < count; ++i) {
+    if (auto claimed = unique_ptr<Task>{workers[i].deque.steal()}) {
+      task = move(*claimed);
+      return true;
+    }
+  }
+  return false;
+}
+
+
+/**
+ * Wait until one task can be counted against the capacity of the queue,
+ * according to the overflow policy.
+ *
+ * @param state The shared pool state.
+ * @param policy Either BLOCK or DROP_OLDEST.
+ * @returns True if one task may be enqueued, False if it must be rejected.
+ */
+static bool makeRoom(State & state, OverflowPolicy policy) {
+  if (policy == OverflowPolicy::BLOCK) {
+    unique_lock<mutex> capacityMutexLock{state.capacityMutex};
+    state.blockedSubmitters.fetch_add(1);
+    state.capacityCondition.wait(capacityMutexLock, [&] {
+      return reserveTasks(state, 1) == 1;
+    });
+    state.blockedSubmitters.fetch_sub(1);
+    return true;
+  }
+
+  if (policy == OverflowPolicy::DROP_OLDEST) {
+    while (true) {
+      // The new task takes over the place of the removed task.  The removed
+      // task is destroyed without having been run.
+      Task dropped;
+      if (dropOldestTask(state, dropped) || reserveTasks(state, 1)) {
+        return true;
+      }
+
+      // With no room at all, the new task is the only one that can go.
+      if (!state.capacity.load()) {
+        return false;
+      }
+
+      // Every queued task is in the middle of being enqueued or claimed.
+      this_thread::yield();
+    }
+  }
+
+  return false;
+}
+
+
+/**
+ * Choose what to do with a new task when the queue is at capacity.
+ *
+ * @param state The shared pool state.
+ * @param tryOnly If true, then the task must be rejected.
+ * @returns The overflow policy to apply to the task.
+ */
+static OverflowPolicy chooseOverflowPolicy(State & state, bool tryOnly) {
+  if (tryOnly) {
+    return OverflowPolicy::REJECT;
+  }
+  auto policy = state.overflowPolicy.load();
+
+  // A pool thread that waits for room in its own queue could deadlock the
+  // pool, so it runs the task itself instead.
+  if ((policy == OverflowPolicy::BLOCK) && (currentWorker.state == &state)) {
+    return OverflowPolicy::CALLER_RUNS;
+  }
+  return policy;
+}
+
+
+/**
+ * The number of inline tasks that are running on the current thread, one
+ * inside the other.
+ */
+static thread_local size_t inlineDepth{0};
+
+
+/**
+ * Decide whether or not a new task should be run inline by the current
+ * thread, according to the InlinePolicy of the pool.
+ *
+ * @param state The shared pool state.
+ * @returns True if the task should be run inline, False if it should be
+ *   enqueued.
+ */
+static inline bool shouldRunInline(State & state) {
+  if (inlineDepth >= state.inlineMaxDepth.load(memory_order_relaxed)) {
+    return false;
+  }
+  if (state.inlineWhenStopped.load(memory_order_relaxed) && state.terminate.load()) {
+    return true;
+  }
+  return (currentWorker.state == &state)
+    && (state.queuedTasks.load(memory_order_relaxed) >= state.inlineQueueDepth.load(memory_order_relaxed));
+}
+
+
+/**
+ * Run a task inline, on the current thread.
+ *
+ * @param task The Task to run.
+ */
+static void runInline(Task & task) {
+  ++inlineDepth;
+  try {
+    task.function();
+  }
+  catch (...) {
+    --inlineDepth;
+    throw;
+  }
+  --inlineDepth;
+}
+
+
+/**
+ * Add a Task to the ring of a lane, or to the overflow queue of the lane if
+ * the ring is full.
+ *
+ * @param state The shared pool state.
+ * @param index The index of the lane.
+ * @param task The Task.  It is moved from.
+ */
+static void pushRingTask(State & state, size_t index, Task & task) {
+  auto & lane = state.lanes[index];
+  if (lane.ring->push(task)) {
+    return;
+  }
+  scoped_lock laneMutexLock{lane.laneMutex};
+  lane.tasks.emplace_back(move(task));
+  state.nonEmptyLanes.fetch_or(uint32_t{1} << index);
+}
+
+
+/**
+ * Add Tasks which have already been counted by reserveTasks() to the queue.
+ *
+ * The tasks of each priority are added while holding that lane's lock only
+ * once, and only as many threads are woken as are needed to claim the tasks.
+ *
+ * @param state The shared pool state.
+ * @param tasks The Tasks to be added.  They are moved out of the span.
+ */
+static void pushTasks(State & state, span<Task> tasks) {
+  auto local = (state.scheduler == Scheduler::WORK_STEALING)
+    && (currentWorker.state == &state);
+  stampTasks(state, tasks);
+
+  for (size_t index = 0; index < PRIORITY_COUNT; ++index) {
+    auto priority = static_cast<Priority>(index);
+
+    // NORMAL tasks enqueued from one of our own threads go onto that
+    // thread's deque.
+    if (local && (priority == Priority::NORMAL)) {
+      for (auto & task : tasks) {
+        if (task.priority == priority) {
+          currentWorker.worker->deque.push(new Task{move(task)});
+        }
+      }
+      continue;
+    }
+
+    if (state.scheduler == Scheduler::RING) {
+      for (auto & task : tasks) {
+        if (task.priority == priority) {
+          pushRingTask(state, index, task);
+        }
+      }
+      continue;
+    }
+
+    auto & lane = state.lanes[index];
+    unique_lock<mutex> laneMutexLock{lane.laneMutex, defer_lock};
+    for (auto & task : tasks) {
+      if (task.priority == priority) {
+        if (!laneMutexLock) {
+          laneMutexLock.lock();
+        }
+        lane.tasks.emplace_back(move(task));
+      }
+    }
+    if (laneMutexLock && !lane.tasks.empty()) {
+      state.nonEmptyLanes.fetch_or(uint32_t{1} << index);
+    }
+  }
+
+  countSubmitted(state, tasks.size());
+  notifyTasks(state, tasks.size());
+}
+
+
+/**
+ * Enqueue a batch of Tasks, applying the overflow policy to the tasks that do
+ * not fit in the queue.
+ *
+ * @param state The shared pool state.
+ * @param tasks The Tasks to be enqueued.  They are moved out of the span.
+ * @returns True on success, False if any of the tasks were rejected.  The
+ *   rejected tasks are not moved from.
+ */
+static bool enqueueTasks(State & state, span<Task> tasks) {
+  while (!tasks.empty()) {
+    if (shouldRunInline(state)) {
+      auto task = move(tasks.front());
+      tasks = tasks.subspan(1);
+      runInline(task);
+      continue;
+    }
+
+    // Enqueue as many tasks as there is room for, all at once.
+    auto count = reserveTasks(state, tasks.size());
+
+    if (!count) {
+      auto policy = chooseOverflowPolicy(state, false);
+      if (policy == OverflowPolicy::CALLER_RUNS) {
+        auto task = move(tasks.front());
+        tasks = tasks.subspan(1);
+        task.function();
+        continue;
+      }
+      if (!makeRoom(state, policy)) {
+        return false;
+      }
+      count = 1;
+    }
+
+    pushTasks(state, tasks.first(count));
+    tasks = tasks.subspan(count);
+  }
+  return true;
+}
+
+
+/**
+ * Keep creating threads until the target thread count is reached.
+ *
+ * A pool that is not running does not create threads, so that join() can
+ * never miss a thread that is created while it is joining.
+ *
+ * @param state The shared pool state.
+ */
+static void createPoolThreads(const shared_ptr<State> & state) {
+  scoped_lock controlMutexLock{state->controlMutex};
+
+  // Create all of the missing threads at once.  The count is checked again
+  // afterwards, because threads may have terminated in the meantime.
+  while (!state->terminate.load() && !state->draining.load()) {
+    auto count = state->threadCount.load();
+    auto target = state->targetThreadCount.load();
+    if (count >= target) {
+      break;
+    }
+
+    // Count the threads before they start, so that each sees itself when
+    // deciding whether or not the pool has too many threads.
+    state->threadCount.fetch_add(target - count);
+    auto threadIds = createThreads(target - count, [state](stop_token token) -> void {
+      return Ghoti::Pool::threadLoop(token, state);
+    });
+    state->threads.insert(state->threads.end(), threadIds.begin(), threadIds.end());
+  }
+}
+
+
+/**
+ * Change the target thread count, creating or removing threads as needed.
+ *
+ * @param state The shared pool state.
+ * @param threadCount The desired thread count.
+ */
+static void resizePool(const shared_ptr<State> & state, size_t threadCount) {
+  // Set the target thread count.
+  {
+    scoped_lock queueMutexLock{state->queueMutex};
+    state->targetThreadCount = threadCount;
+  }
+
+  // Create new threads if needed.
+  createPoolThreads(state);
+
+  // Notify threads so that they can remove themselves (or take something from
+  // the queue) if needed.
+  state->mutexCondition.notify_all();
+}
+
+
+/**
+ * What the autoscaler has observed about the pool so far.
+ */
+struct AutoscaleSamples {
+  /**
+   * When the pool started to have tasks queued with no thread free to claim
+   * them, if it still does.
+   */
+  optional<chrono::steady_clock::time_point> backlogSince{};
+
+  /**
+   * When the pool started to have idle threads with nothing queued, if it
+   * still does.
+   */
+  optional<chrono::steady_clock::time_point> idleSince{};
+
+  /**
+   * When the autoscaler last changed the thread count.
+   */
+  optional<chrono::steady_clock::time_point> lastChange{};
+};
+
+
+/**
+ * Decide what the thread count of the pool should be, based on a new sample.
+ *
+ * @param state The shared pool state.
+ * @param policy How the pool adjusts its thread count.
+ * @param samples What the autoscaler has observed so far, which is updated
+ *   with the new sample.
+ * @param now The time of the new sample.
+ * @returns The desired thread count.
+ */
+static size_t chooseThreadCount(State & state, const AutoscalePolicy & policy, AutoscaleSamples & samples, chrono::steady_clock::time_point now) {
+  auto queued = state.queuedTasks.load();
+  auto waiting = static_cast<size_t>(state.threadStates.load() % RUNNING_THREAD);
+  auto threads = state.threadCount.load();
+  auto target = state.targetThreadCount.load();
+
+  // Track how long the pool has been behind, and how long it has been idle.
+  if (queued && !waiting) {
+    samples.backlogSince = samples.backlogSince.value_or(now);
+  }
+  else {
+    samples.backlogSince.reset();
+  }
+  if (!queued && waiting) {
+    samples.idleSince = samples.idleSince.value_or(now);
+  }
+  else {
+    samples.idleSince.reset();
+  }
+
+  // Limit the rate of change, so that the pool does not thrash.
+  if (samples.lastChange && (now - *samples.lastChange < policy.cooldown)) {
+    return target;
+  }
+
+  auto deep = queued >= policy.queueDepthPerThread * max(threads, size_t{1});
+  auto late = samples.backlogSince && (now - *samples.backlogSince >= policy.waitThreshold);
+  if ((deep || late) && (target < policy.maxThreads)) {
+    return min(policy.maxThreads, target + policy.maxGrowth);
+  }
+
+  auto idle = samples.idleSince && (now - *samples.idleSince >= policy.idleTimeout);
+  if (idle && (target > policy.minThreads)) {
+    return max(policy.minThreads, target - min({policy.maxShrink, waiting, target}));
+  }
+
+  return target;
+}
+
+
+/**
+ * The loop executed by the autoscaler thread of a pool.
+ *
+ * @param token Token indicating that this jthread has been asked to stop.
+ * @param state The shared pool state.
+ */
+static void autoscaleLoop(stop_token token, shared_ptr<State> state) {
+  AutoscaleSamples samples{};
+  unique_lock<mutex> autoscaleMutexLock{state->autoscaleMutex};
+  auto running = [&](){
+    return state->autoscalePolicy && !state->terminate.load() && !state->draining.load() && !token.stop_requested();
+  };
+
+  while (running()) {
+    state->autoscaleCondition.wait_for(autoscaleMutexLock, state->autoscalePolicy->interval);
+    if (!running()) {
+      break;
+    }
+
+    // Resize without holding the lock, because creating threads is slow.
+    auto policy = *state->autoscalePolicy;
+    autoscaleMutexLock.unlock();
+    auto now = chrono::steady_clock::now();
+    auto threadCount = chooseThreadCount(*state, policy, samples, now);
+    if (threadCount != state->targetThreadCount.load()) {
+      resizePool(state, threadCount);
+      samples = {};
+      samples.lastChange = now;
+    }
+    autoscaleMutexLock.lock();
+  }
+
+  state->autoscalerRunning = false;
+  autoscaleMutexLock.unlock();
+
+  scoped_lock controlMutexLock{state->controlMutex};
+  auto & threads = state->threads;
+  auto position = find(threads.begin(), threads.end(), this_thread::get_id());
+  if (position != threads.end()) {
+    *position = threads.back();
+    threads.pop_back();
+  }
+  state->drainCondition.notify_all();
+}
+
+
+/**
+ * Start the autoscaler thread of a pool, if the pool is running and has an
+ * autoscale policy, and the thread is not already running.
+ *
+ * @param state The shared pool state.
+ */
+static void startAutoscaler(const shared_ptr<State> & state) {
+  scoped_lock autoscaleMutexLock{state->autoscaleMutex};
+  if (!state->autoscalePolicy || state->terminate.load() || state->draining.load() || state->autoscalerRunning) {
+    return;
+  }
+  state->autoscalerRunning = true;
+
+  // The thread is tracked along with the pool's other threads so that join()
+  // waits for it.  The controlMutex is held until then, so that the thread
+  // cannot try to remove itself before it has been added.
+  scoped_lock controlMutexLock{state->controlMutex};
+  state->threads.push_back(createThread([state](stop_token token) -> void {
+    autoscaleLoop(token, state);
+  }));
+}
+
+
+/**
+ * Wake the autoscaler thread of a pool, so that it notices a change.
+ *
+ * @param state The shared pool state.
+ */
+static void wakeAutoscaler(State & state) {
+  scoped_lock autoscaleMutexLock{state.autoscaleMutex};
+  state.autoscaleCondition.notify_all();
+}
+
+
+/**
+ * Convert a point in time to a tick of the timer wheel of a pool.
+ *
+ * @param state The shared pool state.
+ * @param time The point in time.
+ * @param roundUp If true, then a time between two ticks gives the later one,
+ *   so that a deadline is never reached early.
+ * @returns The tick.
+ */
+static uint64_t toTimerTick(const State & state, chrono::steady_clock::time_point time, bool roundUp) {
+  if (time <= state.timerEpoch) {
+    return 0;
+  }
+  auto elapsed = time - state.timerEpoch;
+  auto ticks = static_cast<uint64_t>(elapsed / TIMER_TICK);
+  if (roundUp && (elapsed % TIMER_TICK != chrono::steady_clock::duration::zero())) {
+    ++ticks;
+  }
+  return ticks;
+}
+
+
+/**
+ * Wake the timer thread of a pool if it is sleeping past the deadline of a
+ * new timer.
+ *
+ * Must be called while holding the timerMutex.
+ *
+ * @param state The shared pool state.
+ * @param deadline The tick at which the new timer fires.
+ */
+static void wakeTimerThread(State & state, uint64_t deadline) {
+  if (deadline < state.timerWakeTick) {
+    state.timerWakeTick = deadline;
+    state.timerCondition.notify_one();
+  }
+}
+
+
+// Forward declaration.
+static void rescheduleTimer(const shared_ptr<State> & state, TimerWheel<Timer>::Handle handle, TaskFunction && function);
+
+
+/**
+ * The task that is enqueued for each run of a periodic task.
+ *
+ * The timer is rescheduled once the run is over, whether the function
+ * returned or threw, and also when the run is destroyed without having been
+ * run at all (because the pool rejected, dropped, or discarded it), so that
+ * no single run can end the timer.
+ */
+class PeriodicRun {
+  public:
+  /**
+   * Constructor.
+   *
+   * The run only holds a weak reference to the State, because the State
+   * holds the run while it is queued.
+   *
+   * @param state The shared pool state.
+   * @param handle The handle of the timer of the task.
+   * @param function The function of the task.
+   */
+  PeriodicRun(const shared_ptr<State> & state, TimerWheel<Timer>::Handle handle, TaskFunction && function) : state{state}, handle{handle}, function{move(function)} {}
+
+  /**
+   * Move constructor.
+   *
+   * @param other The run to move from.  It will be left without a function,
+   *   so that only one of the two reschedules the timer.
+   */
+  PeriodicRun(PeriodicRun && other) = default;
+
+  // Remove the move assignment, which would drop a function without
+  // rescheduling it.
+  PeriodicRun & operator=(PeriodicRun &&) = delete;
+
+  /**
+   * Destructor.
+   *
+   * Reschedules the timer, if the run has not already done so.
+   */
+  ~PeriodicRun() {
+    try {
+      this->reschedule();
+    }
+    catch (...) {}
+  }
+
+  /**
+   * Run the function of the task, and then reschedule the timer.
+   */
+  void operator()() {
+    this->function();
+    this->reschedule();
+  }
+
+  private:
+  /**
+   * Hand the function back to the timer, if it has not already been.
+   */
+  void reschedule() {
+    if (!this->function) {
+      return;
+    }
+    if (auto state = this->state.lock()) {
+      rescheduleTimer(state, this->handle, move(this->function));
+    }
+  }
+
+  /**
+   * The shared pool state.
+   */
+  weak_ptr<State> state;
+
+  /**
+   * The handle of the timer of the task.
+   */
+  TimerWheel<Timer>::Handle handle;
+
+  /**
+   * The function of the task, until it is handed back to the timer.
+   */
+  TaskFunction function;
+};
+
+
+/**
+ * Create the tasks for the timers that have fired.
+ *
+ * Must be called while holding the timerMutex.  A delayed task is removed
+ * from the wheel.  A periodic task stays in the wheel, and is run by a
+ * PeriodicRun that reschedules it afterwards.
+ *
+ * @param state The shared pool state.
+ * @param due The handles of the timers that have fired.
+ * @param tasks Receives the tasks to be enqueued.
+ */
+static void collectTimerTasks(const shared_ptr<State> & state, span<const TimerWheel<Timer>::Handle> due, vector<Task> & tasks) {
+  for (auto handle : due) {
+    auto & timer = state->timers.get(handle);
+    if (!timer.period) {
+      tasks.push_back(move(state->timers.remove(handle)->task));
+      continue;
+    }
+
+    tasks.push_back(Task{
+      PeriodicRun{state, handle, move(timer.task.function)},
+      timer.task.priority,
+      timer.task.label,
+    });
+  }
+}
+
+
+/**
+ * Add the tasks of the timers that have fired to the queue of a pool.
+ *
+ * The timer thread must not block on a full queue, because that would delay
+ * every other timer, so OverflowPolicy::BLOCK enqueues the tasks regardless
+ * of the capacity.  The other policies apply as usual.
+ *
+ * @param state The shared pool state.
+ * @param tasks The tasks to be enqueued.  They are moved out of the span.
+ */
+static void enqueueTimerTasks(State & state, span<Task> tasks) {
+  if (state.overflowPolicy.load() == OverflowPolicy::BLOCK) {
+    state.queuedTasks.fetch_add(tasks.size());
+    pushTasks(state, tasks);
+    return;
+  }
+  enqueueTasks(state, tasks);
+}
+
+
+/**
+ * The loop executed by the timer thread of a pool.
+ *
+ * @param token Token indicating that this jthread has been asked to stop.
+ * @param state The shared pool state.
+ */
+static void timerLoop(stop_token token, shared_ptr<State> state) {
+  vector<TimerWheel<Timer>::Handle> due{};
+  vector<Task> tasks{};
+  unique_lock<mutex> timerMutexLock{state->timerMutex};
+  auto running = [&](){
+    return !state->terminate.load() && !state->draining.load() && !token.stop_requested();
+  };
+
+  while (running()) {
+    state->timers.advance(toTimerTick(*state, chrono::steady_clock::now(), false), due);
+    if (!due.empty()) {
+      collectTimerTasks(state, due, tasks);
+      due.clear();
+
+      // Enqueue without holding the lock, so that new timers can be added
+      // and periodic tasks can be rescheduled in the meantime.
+      timerMutexLock.unlock();
+      enqueueTimerTasks(*state, tasks);
+      tasks.clear();
+      timerMutexLock.lock();
+      continue;
+    }
+
+    auto next = state->timers.getNextTick();
+    state->timerWakeTick = next.value_or(numeric_limits<uint64_t>::max());
+    if (next) {
+      state->timerCondition.wait_until(timerMutexLock, state->timerEpoch + *next * TIMER_TICK);
+    }
+    else {
+      state->timerCondition.wait(timerMutexLock);
+    }
+  }
+
+  state->timerThreadRunning = false;
+  state->timerWakeTick = numeric_limits<uint64_t>::max();
+  timerMutexLock.unlock();
+
+  scoped_lock controlMutexLock{state->controlMutex};
+  auto & threads = state->threads;
+  auto position = find(threads.begin(), threads.end(), this_thread::get_id());
+  if (position != threads.end()) {
+    *position = threads.back();
+    threads.pop_back();
+  }
+  state->drainCondition.notify_all();
+}
+
+
+/**
+ * Start the timer thread of a pool, if the pool is running and has timers,
+ * and the thread is not already running.
+ *
+ * @param state The shared pool state.
+ */
+static void startTimerThread(const shared_ptr<State> & state) {
+  scoped_lock timerMutexLock{state->timerMutex};
+  if (!state->timers.size() || state->terminate.load() || state->draining.load() || state->timerThreadRunning) {
+    return;
+  }
+  state->timerThreadRunning = true;
+
+  // As with the autoscaler, the thread is tracked along with the pool's
+  // other threads so that join() waits for it.
+  scoped_lock controlMutexLock{state->controlMutex};
+  state->threads.push_back(createThread([state](stop_token token) -> void {
+    timerLoop(token, state);
+  }));
+}
+
+
+/**
+ * Put a periodic task back into the timer wheel after it has run (or been
+ * skipped), unless it was cancelled in the meantime.
+ *
+ * @param state The shared pool state.
+ * @param handle The handle of the timer of the task.
+ * @param function The function of the task.
+ */
+static void rescheduleTimer(const shared_ptr<State> & state, TimerWheel<Timer>::Handle handle, TaskFunction && function) {
+  // A cancelled task is destroyed without holding the lock.
+  TaskFunction cancelled{};
+  {
+    scoped_lock timerMutexLock{state->timerMutex};
+    if (!state->timers.contains(handle)) {
+      cancelled = move(function);
+      return;
+    }
+    auto & timer = state->timers.get(handle);
+    timer.task.function = move(function);
+
+    // A run that overran its period delays the next one, rather than letting
+    // the missed runs pile up.
+    auto deadline = max(state->timers.getDeadline(handle) + timer.period, toTimerTick(*state, chrono::steady_clock::now(), true));
+    state->timers.reschedule(handle, deadline);
+    wakeTimerThread(*state, state->timers.getDeadline(handle));
+  }
+
+  // The pool may have been restarted while the task was running.
+  startTimerThread(state);
+}
+
+
+/**
+ * Add a delayed or periodic task to the timer wheel of a pool.
+ *
+ * @param state The shared pool state.
+ * @param deadline The tick at which the task is first enqueued.
+ * @param period The number of ticks between runs, or 0 for a delayed task.
+ * @param task The task.
+ * @returns The handle of the timer.
+ */
+static TimerWheel<Timer>::Handle addTimer(const shared_ptr<State> & state, uint64_t deadline, uint64_t period, Task && task) {
+  auto handle = [&](){
+    scoped_lock timerMutexLock{state->timerMutex};
+    auto handle = state->timers.insert(deadline, Timer{move(task), period});
+    wakeTimerThread(*state, state->timers.getDeadline(handle));
+    return handle;
+  }();
+  startTimerThread(state);
+  return handle;
+}
+
+
+/**
+ * Wake the timer thread of a pool, so that it notices that the pool has
+ * stopped.
+ *
+ * @param state The shared pool state.
+ */
+static void stopTimerThread(State & state) {
+  scoped_lock timerMutexLock{state.timerMutex};
+  state.timerCondition.notify_all();
+}
+
+
+size_t LatencyHistogram::getBucket(chrono::nanoseconds duration) {
+  auto value = static_cast<uint64_t>(max(duration.count(), chrono::nanoseconds::rep{0}));
+  value = min(value, (uint64_t{1} << MAX_BITS) - 1);
+  if (value < SUB_BUCKET_COUNT) {
+    return static_cast<size_t>(value);
+  }
+
+  // The top SUB_BUCKET_BITS bits below the leading bit choose the sub-bucket.
+  auto exponent = static_cast<size_t>(bit_width(value)) - 1;
+  auto subBucket = static_cast<size_t>(value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKET_COUNT - 1);
+  return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT + subBucket;
+}
+
+
+chrono::nanoseconds LatencyHistogram::getBucketStart(size_t bucket) {
+  if (bucket < SUB_BUCKET_COUNT) {
+    return chrono::nanoseconds{static_cast<chrono::nanoseconds::rep>(bucket)};
+  }
+  auto shift = bucket / SUB_BUCKET_COUNT - 1;
+  auto subBucket = bucket % SUB_BUCKET_COUNT;
+  return chrono::nanoseconds{static_cast<chrono::nanoseconds::rep>((SUB_BUCKET_COUNT + subBucket) << shift)};
+}
+
+
+uint64_t LatencyHistogram::getCount() const {
+  uint64_t count{0};
+  for (auto bucketCount : this->counts) {
+    count += bucketCount;
+  }
+  return count;
+}
+
+
+chrono::nanoseconds LatencyHistogram::getMean() const {
+  auto count = this->getCount();
+  return count ? this->total / static_cast<chrono::nanoseconds::rep>(count) : chrono::nanoseconds{0};
+}
+
+
+chrono::nanoseconds LatencyHistogram::getPercentile(double percentile) const {
+  auto count = this->getCount();
+  if (!count) {
+    return chrono::nanoseconds{0};
+  }
+
+  // The rank of the percentile, counting from 1.
+  auto rank = max(static_cast<uint64_t>(min(max(percentile, 0.), 100.) / 100. * static_cast<double>(count) + .5), uint64_t{1});
+  uint64_t seen{0};
+  for (size_t bucket = 0; bucket < BUCKET_COUNT; ++bucket) {
+    seen += this->counts[bucket];
+    if (seen >= rank) {
+      return getBucketStart(bucket + 1) - chrono::nanoseconds{1};
+    }
+  }
+  return getBucketStart(BUCKET_COUNT) - chrono::nanoseconds{1};
+}
+
+
+TimerHandle::TimerHandle(weak_ptr<State> state, uint32_t index, uint32_t generation) : state{move(state)}, index{index}, generation{generation} {}
+
+
+bool TimerHandle::cancel() {
+  auto state = this->state.lock();
+  if (!state) {
+    return false;
+  }
+
+  // The task is destroyed without holding the lock.
+  optional<Timer> timer{};
+  {
+    scoped_lock timerMutexLock{state->timerMutex};
+    timer = state->timers.remove({this->index, this->generation});
+  }
+  return timer.has_value();
+}
+
+
+/**
+ * The scratch memory of the current thread, from Pool::allocator().
+ */
+static thread_local ScratchArena scratchArena{};
+
+
+/**
+ * Round an address up to a multiple of an alignment.
+ *
+ * @param address The address.
+ * @param alignment The alignment, which is a power of 2.
+ * @returns The aligned address.
+ */
+static inline uintptr_t alignAddress(uintptr_t address, size_t alignment) {
+  return (address + alignment - 1) & ~(uintptr_t{alignment} - 1);
+}
+
+
+ScratchArena::~ScratchArena() {
+  while (this->chunk) {
+    ::operator delete(exchange(this->chunk, this->chunk->previous));
+  }
+}
+
+
+void ScratchArena::reset() noexcept {
+  if (!this->chunk) {
+    return;
+  }
+  if (!this->chunk->previous) {
+    this->next = reinterpret_cast<byte *>(this->chunk + 1);
+    return;
+  }
+
+  // Replace the chunks with a single chunk that can hold all of them.
+  size_t total{0};
+  while (this->chunk) {
+    total += this->chunk->size;
+    ::operator delete(exchange(this->chunk, this->chunk->previous));
+  }
+  this->next = nullptr;
+  this->end = nullptr;
+  this->previousUsed = 0;
+  try {
+    this->addChunk(total, 1);
+  }
+  catch (...) {}
+}
+
+
+size_t ScratchArena::getUsedBytes() const noexcept {
+  if (!this->chunk) {
+    return 0;
+  }
+  return this->previousUsed + static_cast<size_t>(this->next - reinterpret_cast<const byte *>(this->chunk + 1));
+}
+
+
+void * ScratchArena::do_allocate(size_t bytes, size_t alignment) {
+  auto address = alignAddress(reinterpret_cast<uintptr_t>(this->next), alignment);
+  if (!this->chunk || (bytes > reinterpret_cast<uintptr_t>(this->end) - min(address, reinterpret_cast<uintptr_t>(this->end)))) {
+    this->addChunk(bytes, alignment);
+    address = alignAddress(reinterpret_cast<uintptr_t>(this->next), alignment);
+  }
+  this->next = reinterpret_cast<byte *>(address) + bytes;
+  return reinterpret_cast<void *>(address);
+}
+
+
+void ScratchArena::addChunk(size_t bytes, size_t alignment) {
+  auto size = max({CHUNK_SIZE, this->chunk ? this->chunk->size * 2 : 0, bytes + alignment});
+  auto added = ::new (::operator new(sizeof(Chunk) + size)) Chunk{this->chunk, size};
+  if (this->chunk) {
+    this->previousUsed += static_cast<size_t>(this->next - reinterpret_cast<byte *>(this->chunk + 1));
+  }
+  this->chunk = added;
+  this->next = reinterpret_cast<byte *>(added + 1);
+  this->end = this->next + size;
+}
+
+
+Pool::Pool() : Pool(thread::hardware_concurrency()) {}
+
+
+Pool::Pool(size_t threadCount) : Pool(threadCount, Scheduler::FIFO) {}
+
+
+Pool::Pool(size_t threadCount, Scheduler scheduler) {
+  this->state = make_shared<State>();
+  this->state->terminate = true;
+  this->state->targetThreadCount = threadCount;
+  this->state->scheduler = scheduler;
+  if (scheduler == Scheduler::WORK_STEALING) {
+    this->state->batchSize = INJECTION_BATCH_SIZE;
+  }
+  if (scheduler == Scheduler::RING) {
+    for (auto & lane : this->state->lanes) {
+      lane.ring = make_unique<RingQueue<Task>>(RING_CAPACITY);
+    }
+    this->state->capacity = RING_CAPACITY;
+  }
+}
+
+
+Pool::~Pool() {
+  this->stop();
+
+  // Leave the group, so that its threads no longer serve this pool.
+  if (auto & group = this->state->group) {
+    scoped_lock groupMutexLock{group->groupMutex};
+    auto member = this->state->groupMember;
+    erase_if(group->members, [member](const shared_ptr<GroupMember> & candidate) {
+      return candidate.get() == member;
+    });
+  }
+}
+
+
+bool Pool::enqueue(Task && task) {
+  return this->emplace(task.priority, [](Task & target, void * source) {
+    target = move(*static_cast<Task *>(source));
+  }, &task, false);
+}
+
+
+bool Pool::tryEnqueue(Task && task) {
+  return this->emplace(task.priority, [](Task & target, void * source) {
+    target = move(*static_cast<Task *>(source));
+  }, &task, true);
+}
+
+
+bool Pool::emplace(Priority priority, TaskConstructor construct, void * context, bool tryOnly) {
+  auto & state = *this->state;
+
+  if (!tryOnly && shouldRunInline(state)) {
+    Task task;
+    construct(task, context);
+    runInline(task);
+    return true;
+  }
+
+  if (!reserveTasks(state, 1)) {
+    auto policy = chooseOverflowPolicy(state, tryOnly);
+    if (policy == OverflowPolicy::CALLER_RUNS) {
+      Task task;
+      construct(task, context);
+      task.function();
+      return true;
+    }
+    if (!makeRoom(state, policy)) {
+      return false;
+    }
+  }
+
+  try {
+    // NORMAL tasks enqueued from one of our own threads go onto that
+    // thread's deque.
+    if ((state.scheduler == Scheduler::WORK_STEALING)
+        && (priority == Priority::NORMAL)
+        && (currentWorker.state == &state)) {
+      auto task = make_unique<Task>();
+      construct(*task, context);
+      stampTasks(state, {task.get(), 1});
+      currentWorker.worker->deque.push(task.release());
+    }
+    else if (state.scheduler == Scheduler::RING) {
+      // The ring is filled by moving the task into a slot, which does not
+      // allocate.
+      Task task;
+      construct(task, context);
+      stampTasks(state, {&task, 1});
+      pushRingTask(state, static_cast<size_t>(priority), task);
+    }
+    else {
+      auto index = static_cast<size_t>(priority);
+      auto & lane = state.lanes[index];
+      scoped_lock laneMutexLock{lane.laneMutex};
+
+      // Construct the task directly in the queue.
+      lane.tasks.emplace_back();
+      try {
+        construct(lane.tasks.back(), context);
+      }
+      catch (...) {
+        lane.tasks.pop_back();
+        throw;
+      }
+      stampTasks(state, {&lane.tasks.back(), 1});
+      if (lane.tasks.size() == 1) {
+        state.nonEmptyLanes.fetch_or(uint32_t{1} << index);
+      }
+    }
+  }
+  catch (...) {
+    releaseTasks(state, 1);
+    throw;
+  }
+
+  countSubmitted(state, 1);
+  notifyTasks(state, 1);
+  return true;
+}
+
+
+bool Pool::enqueueBatch(span<Task> tasks) {
+  return enqueueTasks(*this->state, tasks);
+}
+
+
+TimerHandle Pool::enqueueAt(chrono::steady_clock::time_point deadline, Task && task) {
+  auto handle = addTimer(this->state, toTimerTick(*this->state, deadline, true), 0, move(task));
+  return TimerHandle{this->state, handle.index, handle.generation};
+}
+
+
+TimerHandle Pool::enqueueAfter(chrono::nanoseconds delay, Task && task) {
+  return this->enqueueAt(chrono::steady_clock::now() + delay, move(task));
+}
+
+
+TimerHandle Pool::enqueueEvery(chrono::nanoseconds period, Task && task) {
+  auto ticks = max(static_cast<uint64_t>((period + TIMER_TICK - chrono::nanoseconds{1}) / TIMER_TICK), uint64_t{1});
+  auto deadline = toTimerTick(*this->state, chrono::steady_clock::now() + period, true);
+  auto handle = addTimer(this->state, deadline, ticks, move(task));
+  return TimerHandle{this->state, handle.index, handle.generation};
+}
+
+
+ScratchArena & Pool::allocator() {
+  return scratchArena;
+}
+
+
+size_t Pool::getTimerCount() const {
+  scoped_lock timerMutexLock{this->state->timerMutex};
+  return this->state->timers.size();
+}
+
+
+void Pool::start() {
+  // Don't try to start the pool if it is already running.
+  {
+    scoped_lock queueMutexLock{this->state->queueMutex};
+    if (!this->state->terminate.load()) {
+      return;
+    }
+    // Set the stop condition.
+    this->state->terminate = false;
+  }
+
+  // The tasks of this run must not see the stop of the previous one.
+  {
+    scoped_lock controlMutexLock{this->state->controlMutex};
+    if (this->state->stopSource.stop_requested()) {
+      this->state->stopSource = stop_source{};
+      this->state->stopGeneration.store(newStopGeneration(), memory_order_release);
+    }
+  }
+
+  this->createThreads();
+  startAutoscaler(this->state);
+  startTimerThread(this->state);
+
+  // The threads of the group skipped this pool while it was stopped.
+  if (this->state->group) {
+    wakeGroup(*this->state->group, this->state->queuedTasks.load());
+  }
+}
+
+
+void Pool::stop() {
+  // Set the stop condition.
+  {
+    scoped_lock queueMutexLock{this->state->queueMutex};
+    this->state->terminate = true;
+  }
+  {
+    scoped_lock controlMutexLock{this->state->controlMutex};
+    this->state->stopSource.request_stop();
+    stopThreads(this->state->threads);
+  }
+
+  // Wake up all threads so that they will terminate themselves.
+  this->state->mutexCondition.notify_all();
+  wakeAutoscaler(*this->state);
+  stopTimerThread(*this->state);
+}
 
 
 void Pool::join() {
-  // Join the threads.
-  auto notifierResults = joinThreads(this->state->threads);
+  // Set the stop condition first, so that no more threads are created.
+  {
+    scoped_lock queueMutexLock{state->queueMutex};
+    this->state->terminate = true;
+  }
+
+  // Join the threads, and clean them up from the state object.
+  vector<future<void>> notifierResults;
+  {
+    scoped_lock controlMutexLock{state->controlMutex};
+    this->state->stopSource.request_stop();
+    notifierResults = requestThreadJoins(this->state->threads);
+    this->state->threads.clear();
+  }
+
+  // Wake up all threads so that they will terminate themselves.
+  this->state->mutexCondition.notify_all();
+  wakeAutoscaler(*this->state);
+  stopTimerThread(*this->state);
+
+  // Now try to join the threads.
+  for (auto & notifierResult : notifierResults) {
+    // Wait for the thread to join in the globalPool thread.
+    notifierResult.get();
+  }
+
+  // Wait for the threads of the group to finish this pool's tasks.
+  if (auto & group = this->state->group) {
+    unique_lock<mutex> groupMutexLock{group->groupMutex};
+    group->idleCondition.wait(groupMutexLock, [&] {
+      return !this->state->groupMember->running;
+    });
+  }
+}
+
+
+/**
+ * Wait on a condition until a predicate is satisfied or a deadline passes.
+ *
+ * @param condition The condition to wait on.
+ * @param lock The lock of the condition, which is held.
+ * @param deadline When to give up, or time_point::max() to wait forever.
+ * @param predicate The predicate.
+ * @returns The final value of the predicate.
+ */
+template <typename Predicate>
+static bool waitWithDeadline(condition_variable & condition, unique_lock<mutex> & lock, chrono::steady_clock::time_point deadline, Predicate predicate) {
+  if (deadline == chrono::steady_clock::time_point::max()) {
+    condition.wait(lock, predicate);
+    return true;
+  }
+  return condition.wait_until(lock, deadline, predicate);
+}
+
+
+bool Pool::drain(chrono::nanoseconds timeout) {
+  auto & state = *this->state;
+  auto now = chrono::steady_clock::now();
+  auto deadline = (timeout >= chrono::steady_clock::time_point::max() - now)
+    ? chrono::steady_clock::time_point::max()
+    : now + chrono::duration_cast<chrono::steady_clock::duration>(timeout);
+
+  auto running{false};
+  {
+    scoped_lock queueMutexLock{state.queueMutex};
+    running = !state.terminate.load();
+    state.draining = running;
+  }
+
+  auto drained{true};
+  if (running) {
+    // Wake the sleeping threads (and the autoscaler and timer threads), so
+    // that each finishes once it sees that there is nothing left to do.
+    state.mutexCondition.notify_all();
+    wakeAutoscaler(state);
+    stopTimerThread(state);
+    {
+      unique_lock<mutex> controlMutexLock{state.controlMutex};
+      drained = waitWithDeadline(state.drainCondition, controlMutexLock, deadline, [&] {
+        return state.threads.empty();
+      });
+    }
+    if (drained && state.group) {
+      unique_lock<mutex> groupMutexLock{state.group->groupMutex};
+      drained = waitWithDeadline(state.group->idleCondition, groupMutexLock, deadline, [&] {
+        return !state.queuedTasks.load() && !state.groupMember->running;
+      });
+    }
+  }
+
+  this->join();
+  {
+    scoped_lock queueMutexLock{state.queueMutex};
+    state.draining = false;
+  }
+  return drained && !state.queuedTasks.load();
+}
+
+
+vector<Task> Pool::discard() {
+  this->join();
+
+  // No thread of the pool is running, so even the worker deques may be
+  // emptied from here.
+  auto & state = *this->state;
+  vector<Task> tasks{};
+  for (size_t index = 0; index < PRIORITY_COUNT; ++index) {
+    auto & lane = state.lanes[index];
+    if (lane.ring) {
+      Task task;
+      while (lane.ring->pop(task)) {
+        tasks.push_back(move(task));
+      }
+    }
+    {
+      scoped_lock laneMutexLock{lane.laneMutex};
+      for (auto & task : lane.tasks) {
+        tasks.push_back(move(task));
+      }
+      lane.tasks.clear();
+      state.nonEmptyLanes.fetch_and(~(uint32_t{1} << index));
+    }
+
+    // Tasks on the deques are NORMAL, and are taken newest first.
+    if (index == static_cast<size_t>(Priority::NORMAL)) {
+      auto first = tasks.size();
+      for (size_t slot = 0; slot < state.workerSlots.size(); ++slot) {
+        while (auto task = unique_ptr<Task>{state.workerSlots[slot].deque.take()}) {
+          tasks.push_back(move(*task));
+        }
+      }
+      reverse(tasks.begin() + static_cast<ptrdiff_t>(first), tasks.end());
+    }
+  }
+
+  releaseTasks(state, tasks.size());
+  return tasks;
+}
+
+
+/**
+ * The stop token that the current thread last read from a pool, along with
+ * the generation of the stop source that it came from.
+ *
+ * Tasks that take a `std::stop_token` read it for every run, so the token is
+ * only read again (under the controlMutex) when the pool has replaced its
+ * stop source, or when the thread serves a different pool.
+ */
+static thread_local struct {
+  /**
+   * The generation of the stop source of the token, or 0 if there is none.
+   */
+  uint64_t generation;
+
+  /**
+   * The stop token.
+   */
+  stop_token token;
+} cachedStopToken{0, {}};
+
+
+stop_token Pool::getStopToken() {
+  auto state = currentWorker.state;
+  if (!state) {
+    return {};
+  }
+  if (cachedStopToken.generation != state->stopGeneration.load(memory_order_acquire)) {
+    scoped_lock controlMutexLock{state->controlMutex};
+    cachedStopToken = {state->stopGeneration.load(memory_order_relaxed), state->stopSource.get_token()};
+  }
+  return cachedStopToken.token;
+}
+
+
+size_t Pool::getTaskQueueCount() {
+  return this->state->queuedTasks.load();
+}
+
+
+void Pool::setCapacity(size_t capacity, OverflowPolicy policy) {
+  this->state->capacity = capacity;
+  this->state->overflowPolicy = policy;
+
+  // A blocked submitter may now have room, or may no longer be allowed to
+  // block.
+  scoped_lock capacityMutexLock{this->state->capacityMutex};
+  this->state->capacityCondition.notify_all();
+}
+
+
+size_t Pool::getCapacity() const {
+  return this->state->capacity.load();
+}
+
+
+OverflowPolicy Pool::getOverflowPolicy() const {
+  return this->state->overflowPolicy.load();
+}
+
+
+void Pool::setIdlePolicy(IdlePolicy policy) {
+  this->state->spinCount = policy.spinCount;
+  this->state->spinDuration = policy.spinDuration;
+}
+
+
+IdlePolicy Pool::getIdlePolicy() const {
+  return {this->state->spinCount.load(), this->state->spinDuration.load()};
+}
+
+
+void Pool::setBatchSize(size_t batchSize) {
+  this->state->batchSize = max(batchSize, size_t{1});
+}
+
+
+size_t Pool::getBatchSize() const {
+  return this->state->batchSize.load();
+}
+
+
+void Pool::setInlinePolicy(InlinePolicy policy) {
+  this->state->inlineQueueDepth = policy.queueDepth;
+  this->state->inlineMaxDepth = policy.maxDepth;
+  this->state->inlineWhenStopped = policy.whenStopped;
+}
+
+
+InlinePolicy Pool::getInlinePolicy() const {
+  return {this->state->inlineQueueDepth.load(), this->state->inlineMaxDepth.load(), this->state->inlineWhenStopped.load()};
+}
+
+
+void Pool::setThreadAffinity(ThreadAffinity affinity) {
+  scoped_lock controlMutexLock{this->state->controlMutex};
+  this->state->affinity = move(affinity);
+}
+
+
+ThreadAffinity Pool::getThreadAffinity() const {
+  scoped_lock controlMutexLock{this->state->controlMutex};
+  return this->state->affinity;
+}
+
+
+void Pool::setAutoscalePolicy(AutoscalePolicy policy) {
+  {
+    scoped_lock autoscaleMutexLock{this->state->autoscaleMutex};
+    this->state->autoscalePolicy = policy;
+    this->state->autoscaleCondition.notify_all();
+  }
+
+  // Bring the thread count within the limits of the policy.
+  auto target = this->state->targetThreadCount.load();
+  auto clamped = max(policy.minThreads, min(policy.maxThreads, target));
+  if (clamped != target) {
+    resizePool(this->state, clamped);
+  }
+
+  startAutoscaler(this->state);
+}
+
+
+void Pool::clearAutoscalePolicy() {
+  scoped_lock autoscaleMutexLock{this->state->autoscaleMutex};
+  this->state->autoscalePolicy.reset();
+  this->state->autoscaleCondition.notify_all();
+}
+
+
+optional<AutoscalePolicy> Pool::getAutoscalePolicy() const {
+  scoped_lock autoscaleMutexLock{this->state->autoscaleMutex};
+  return this->state->autoscalePolicy;
+}
+
+
+void Pool::setThreadCount(size_t threadCount) {
+  resizePool(this->state, threadCount);
+}
+
+
+size_t Pool::getThreadCount() const {
+  return this->state->threadCount.load();
+}
+
+
+size_t Pool::getWaitingThreadCount() const {
+  return this->state->threadStates.load() % RUNNING_THREAD;
+}
+
+
+size_t Pool::getTerminatedThreadCount() const {
+  return this->state->terminatedThreadCount.load();
+}
+
+
+size_t Pool::getRunningThreadCount() const {
+  return this->state->threadStates.load() / RUNNING_THREAD;
+}
+
+
+Scheduler Pool::getScheduler() const {
+  return this->state->scheduler;
+}
+
+
+PoolStats Pool::getStats() const {
+  PoolStats stats{};
+#ifndef GHOTI_POOL_NO_STATS
+  auto & state = *this->state;
+  stats.enabled = true;
+  for (auto & shard : state.submittedShards) {
+    stats.submitted += shard.submitted.load(memory_order_relaxed);
+  }
+
+  // Merge the counters of every worker slot.
+  auto & workers = state.workerSlots;
+  stats.workers.reserve(workers.size());
+  for (size_t i = 0, count = workers.size(); i < count; ++i) {
+    auto & counters = workers[i].counters;
+    auto & worker = stats.workers.emplace_back();
+    worker.completed = counters.completed.load(memory_order_relaxed);
+    worker.stolen = counters.stolen.load(memory_order_relaxed);
+    worker.busy = chrono::nanoseconds{counters.busy.load(memory_order_relaxed)};
+    worker.idle = chrono::nanoseconds{counters.idle.load(memory_order_relaxed)};
+
+    stats.submitted += counters.submitted.load(memory_order_relaxed);
+    stats.completed += worker.completed;
+    stats.stolen += worker.stolen;
+    stats.queueWait.total += chrono::nanoseconds{counters.queueWaitTotal.load(memory_order_relaxed)};
+    stats.execution.total += chrono::nanoseconds{counters.executionTotal.load(memory_order_relaxed)};
+    for (size_t bucket = 0; bucket < LatencyHistogram::BUCKET_COUNT; ++bucket) {
+      stats.queueWait.counts[bucket] += counters.queueWait[bucket].load(memory_order_relaxed);
+      stats.execution.counts[bucket] += counters.execution[bucket].load(memory_order_relaxed);
+    }
+  }
+#endif
+  return stats;
+}
+
+
+void Pool::startTrace() {
+  auto & state = *this->state;
+  {
+    scoped_lock controlMutexLock{state.controlMutex};
+    if (!state.externalTraceStorage) {
+      state.externalTraceStorage = make_unique<TraceRing>();
+      state.externalTrace.store(state.externalTraceStorage.get(), memory_order_release);
+    }
+  }
+  state.traceStart = chrono::steady_clock::now().time_since_epoch().count();
+  state.tracing = true;
+}
+
+
+void Pool::stopTrace() {
+  this->state->tracing = false;
+}
+
+
+bool Pool::isTracing() const {
+  return this->state->tracing.load();
+}
+
+
+/**
+ * Write a string as a JSON string literal.
+ *
+ * @param out The stream to write to.
+ * @param text The string.
+ */
+static void writeJsonString(ostream & out, const char * text) {
+  out << '"';
+  for (; *text; ++text) {
+    auto c = static_cast<unsigned char>(*text);
+    if ((c == '"') || (c == '\\')) {
+      out << '\\' << *text;
+    }
+    else if (c < 0x20) {
+      out << "\\u" << hex << setw(4) << setfill('0') << static_cast<unsigned>(c) << dec << setfill(' ');
+    }
+    else {
+      out << *text;
+    }
+  }
+  out << '"';
+}
+
+
+/**
+ * Write the events of one ring buffer in the Chrome trace event format.
+ *
+ * @param out The stream to write to.
+ * @param ring The ring buffer.
+ * @param tid The thread id to show the events on.
+ * @param start When the trace started, in steady_clock nanoseconds.
+ * @param first Whether or not no event has been written yet, which is
+ *   updated.
+ */
+static void writeTraceRing(ostream & out, const TraceRing & ring, size_t tid, int64_t start, bool & first) {
+  auto head = ring.head.load(memory_order_acquire);
+  for (auto position = head - min<uint64_t>(head, TRACE_BUFFER_SIZE); position < head; ++position) {
+    auto & event = ring.events[position % TRACE_BUFFER_SIZE];
+    auto timestamp = event.timestamp.load(memory_order_relaxed) - start;
+    if (timestamp < 0) {
+      continue;
+    }
+    auto id = event.taskId.load(memory_order_relaxed);
+    auto label = event.label.load(memory_order_relaxed);
+    auto type = event.type.load(memory_order_relaxed);
+
+    // Chrome timestamps are in microseconds.
+    auto writeCommon = [&](const char * phase) {
+      out << (exchange(first, false) ? "\n" : ",\n") << "{\"ph\":\"" << phase << "\",\"pid\":1,\"tid\":" << tid
+        << ",\"ts\":" << timestamp / 1000 << '.' << setw(3) << setfill('0') << timestamp % 1000 << setfill(' ');
+    };
+    auto writeName = [&](const char * category) {
+      out << ",\"cat\":\"" << category << "\",\"name\":";
+      writeJsonString(out, label ? label : "task");
+    };
+
+    switch (type) {
+      case TraceEventType::ENQUEUE:
+        // A zero-length slice, so that the flow arrow has something to
+        // start from.
+        writeCommon("X");
+        writeName("enqueue");
+        out << ",\"dur\":0,\"args\":{\"id\":" << id << "}}";
+        writeCommon("s");
+        out << ",\"cat\":\"flow\",\"name\":\"task\",\"id\":" << id << '}';
+        break;
+      case TraceEventType::DEQUEUE:
+        writeCommon("i");
+        writeName("dequeue");
+        out << ",\"s\":\"t\",\"args\":{\"id\":" << id << "}}";
+        break;
+      case TraceEventType::START:
+        writeCommon("B");
+        writeName("task");
+        out << ",\"args\":{\"id\":" << id << "}}";
+        writeCommon("f");
+        out << ",\"bp\":\"e\",\"cat\":\"flow\",\"name\":\"task\",\"id\":" << id << '}';
+        break;
+      case TraceEventType::END:
+        writeCommon("E");
+        out << '}';
+        break;
+    }
+  }
+}
+
+
+void Pool::writeTrace(ostream & out) const {
+  auto & state = *this->state;
+  auto start = state.traceStart.load();
+  auto & workers = state.workerSlots;
+  auto count = workers.size();
+
+  out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+
+  // Name the threads.
+  bool first{true};
+  for (size_t tid = 0; tid <= count; ++tid) {
+    out << (exchange(first, false) ? "\n" : ",\n") << "{\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+      << ",\"name\":\"thread_name\",\"args\":{\"name\":\"";
+    if (tid) {
+      out << "worker " << tid - 1;
+    }
+    else {
+      out << "external";
+    }
+    out << "\"}}";
+  }
+
+  if (auto ring = state.externalTrace.load(memory_order_acquire)) {
+    writeTraceRing(out, *ring, 0, start, first);
+  }
+  for (size_t i = 0; i < count; ++i) {
+    if (auto ring = workers[i].trace.load(memory_order_acquire)) {
+      writeTraceRing(out, *ring, i + 1, start, first);
+    }
+  }
+  out << "\n]}\n";
+}
+
+
+void Pool::createThreads() {
+  createPoolThreads(this->state);
+}
+
+
+/**
+ * Determine whether or not a sleeping thread needs to wake up and decide if it
+ * should terminate.
+ *
+ * @param state The shared pool state.
+ * @param token Token indicating that this jthread has been asked to stop.
+ * @returns True if the thread might need to terminate, False otherwise.
+ */
+static bool mightTerminate(State & state, const stop_token & token) {
+  return state.terminate.load()
+    || (state.threadCount.load() > state.targetThreadCount.load())
+    || token.stop_requested();
+}
+
+
+/**
+ * Decide whether or not the current thread should terminate.
+ *
+ * If the thread should terminate because the pool has too many threads, then
+ * only as many threads as are in excess will be told to terminate.  A thread
+ * which is told to terminate has already been removed from the threadCount.
+ *
+ * @param state The shared pool state.
+ * @param token Token indicating that this jthread has been asked to stop.
+ * @returns True if the thread must terminate, False otherwise.
+ */
+static bool claimTermination(State & state, const stop_token & token) {
+  if (state.terminate.load() || token.stop_requested()) {
+    state.threadCount.fetch_sub(1);
+    return true;
+  }
+
+  auto count = state.threadCount.load();
+  while (count > state.targetThreadCount.load()) {
+    if (state.threadCount.compare_exchange_weak(count, count - 1)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+/**
+ * Give the current thread a worker slot.
+ *
+ * @param state The shared pool state.
+ * @returns The worker slot.
+ */
+static Worker * acquireWorkerSlot(State & state) {
+  scoped_lock controlMutexLock{state.controlMutex};
+
+  // Reuse a slot, if one is available.
+  if (!state.freeWorkerSlots.empty()) {
+    auto index = state.freeWorkerSlots.back();
+    state.freeWorkerSlots.pop_back();
+    return &state.workerSlots[index];
+  }
+
+  return &state.workerSlots.add();
+}
+
+
+/**
+ * Restrict the current thread to the CPUs chosen for the pool, and record the
+ * NUMA node that the thread is bound to (if any) in its worker slot.
+ *
+ * @param state The shared pool state.
+ * @param worker The worker slot of the current thread.
+ */
+static void applyThreadAffinity(State & state, Worker * worker) {
+  vector<size_t> cpus{};
+  {
+    scoped_lock controlMutexLock{state.controlMutex};
+    auto & affinity = state.affinity;
+    if (affinity.pinEach && !affinity.cpus.empty()) {
+      cpus.push_back(affinity.cpus[worker->index % affinity.cpus.size()]);
+    }
+    else {
+      cpus = affinity.cpus;
+    }
+  }
+
+  // The thread is bound to a node only if every one of its CPUs is on it.
+  auto & topology = numaTopology();
+  auto node = NO_NUMA_NODE;
+  for (size_t i = 0; i < cpus.size(); ++i) {
+    auto cpuNode = cpus[i] < topology.cpuNodes.size() ? topology.cpuNodes[cpus[i]] : NO_NUMA_NODE;
+    if (!i) {
+      node = cpuNode;
+    }
+    else if (cpuNode != node) {
+      node = NO_NUMA_NODE;
+      break;
+    }
+  }
+  worker->node = node;
+
+#ifdef __linux__
+  if (!cpus.empty()) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : cpus) {
+      if (cpu < CPU_SETSIZE) {
+        CPU_SET(cpu, &set);
+      }
+    }
+
+    // Affinity is best-effort, so a failure leaves the thread where it is.
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  }
+#endif
+}
+
+
+/**
+ * Give up the current thread's worker slot.
+ *
+ * Any tasks remaining in the slot's deque are moved to the NORMAL lane so
+ * that they are not stranded.
+ *
+ * @param state The shared pool state.
+ * @param worker The worker slot.
+ */
+static void releaseWorkerSlot(State & state, Worker * worker) {
+  {
+    auto index = static_cast<size_t>(Priority::NORMAL);
+    auto & lane = state.lanes[index];
+    scoped_lock laneMutexLock{lane.laneMutex};
+
+    // The deque is taken newest first, so the tasks are reversed to keep
+    // them in the order in which they were pushed.
+    auto first = lane.tasks.size();
+    while (auto task = unique_ptr<Task>{worker->deque.take()}) {
+      lane.tasks.emplace_back(move(*task));
+    }
+    reverse(lane.tasks.begin() + static_cast<ptrdiff_t>(first), lane.tasks.end());
+    if (!lane.tasks.empty()) {
+      state.nonEmptyLanes.fetch_or(uint32_t{1} << index);
+    }
+  }
+
+  scoped_lock controlMutexLock{state.controlMutex};
+  state.freeWorkerSlots.push_back(worker->index);
+}
+
+
+/**
+ * The ticket of the current thread, used by preferredLane().
+ *
+ * It is reset each time that a thread starts to serve a pool, since a thread
+ * may be reused from the warm thread cache.
+ */
+static thread_local size_t laneTicket{0};
+
+
+/**
+ * Choose the lane that the current thread should prefer for its next claim.
+ *
+ * Each thread cycles through PRIORITY_WEIGHT_TOTAL tickets, and each lane is
+ * preferred for as many of those tickets as its weight.  When every lane has
+ * tasks, a LOW task is therefore still claimed at least once every
+ * PRIORITY_WEIGHT_TOTAL claims.
+ *
+ * @returns The index of the preferred lane.
+ */
+static size_t preferredLane() {
+  auto current = laneTicket;
+  laneTicket = (laneTicket + 1) % PRIORITY_WEIGHT_TOTAL;
+  for (size_t index = 0; index < PRIORITY_COUNT; ++index) {
+    if (current < PRIORITY_WEIGHTS[index]) {
+      return index;
+    }
+    current -= PRIORITY_WEIGHTS[index];
+  }
+  return PRIORITY_COUNT - 1;
+}
+
+
+/**
+ * Try to claim a task from one of the lanes.
+ *
+ * The preferred lane is used if it has tasks, otherwise the highest priority
+ * lane that has tasks is used.  Lanes without tasks are skipped without taking
+ * their lock.
+ *
+ * When a worker claims from the NORMAL lane, it claims this thread's share of
+ * the lane (up to the batch size of the pool) while the lock is held.  The
+ * first task is run now, and the rest are moved onto the worker's deque,
+ * where they may still be stolen.  This applies to both the FIFO scheduler,
+ * whose batch size is 1 unless it is raised, and the WORK_STEALING
+ * scheduler, whose batch size defaults to INJECTION_BATCH_SIZE (32).
+ *
+ * @param state The shared pool state.
+ * @param worker The worker slot of the current thread, or nullptr.
+ * @param task The Task that will receive the claimed task.
+ * @returns True if a task was claimed, False otherwise.
+ */
+static bool claimLaneTask(State & state, Worker * worker, Task & task) {
+  auto preferred = preferredLane();
+
+  while (auto mask = state.nonEmptyLanes.load()) {
+    auto index = (mask & (uint32_t{1} << preferred))
+      ? preferred
+      : static_cast<size_t>(countr_zero(mask));
+    auto & lane = state.lanes[index];
+    scoped_lock laneMutexLock{lane.laneMutex};
+
+    // Another thread emptied the lane first.
+    if (lane.tasks.empty()) {
+      continue;
+    }
+
+    size_t claimCount{1};
+    if (worker && (index == static_cast<size_t>(Priority::NORMAL))) {
+      auto threadCount = max(state.threadCount.load(), size_t{1});
+      auto share = (lane.tasks.size() + threadCount - 1) / threadCount;
+      claimCount = min(share, state.batchSize.load(memory_order_relaxed));
+    }
+
+    task = move(lane.tasks.front());
+    lane.tasks.pop_front();
+    for (size_t i = 1; i < claimCount; ++i) {
+      worker->deque.push(new Task{move(lane.tasks.front())});
+      lane.tasks.pop_front();
+    }
+    if (lane.tasks.empty()) {
+      state.nonEmptyLanes.fetch_and(~(uint32_t{1} << index));
+    }
+    releaseTasks(state, 1);
+    return true;
+  }
+
+  return false;
+}
+
+
+/**
+ * Try to steal the oldest task from the deque of another worker.
+ *
+ * A thread that is bound to a NUMA node steals from threads on its own node
+ * first, and only crosses to another node when there is nothing to steal
+ * locally.
+ *
+ * @param state The shared pool state.
+ * @param worker The worker slot of the current thread.
+ * @param task The Task that will receive the stolen task.
+ * @returns True if a task was stolen, False otherwise.
+ */
+static bool stealTask(State & state, Worker * worker, Task & task) {
+  // Rotates the starting victim so that thieves do not all pile onto the same
+  // deque.
+  static thread_local size_t victimOffset{0};
+
+  auto & workers = state.workerSlots;
+  auto count = workers.size();
+  auto node = worker->node.load();
+  ++victimOffset;
+  for (size_t pass = 0; pass < 2; ++pass) {
+    for (size_t i = 0; i < count; ++i) {
+      auto victim = &workers[(worker->index + victimOffset + i) % count];
+      if (victim == worker) {
+        continue;
+      }
+      if ((node != NO_NUMA_NODE) && ((victim->node.load() == node) != (pass == 0))) {
+        continue;
+      }
+      if (auto claimed = unique_ptr<Task>{victim->deque.steal()}) {
+        task = move(*claimed);
+        releaseTasks(state, 1);
+        countStolen(worker);
+        return true;
+      }
+    }
+    if (node == NO_NUMA_NODE) {
+      break;
+    }
+  }
+
+  return false;
+}
+
+
+/**
+ * Try to claim the oldest task from the lane of a single priority.
+ *
+ * Unlike the other claimLaneTask(), this neither consults preferredLane() nor
+ * claims a batch, and the lane is skipped without taking its lock when it has
+ * no tasks.
+ *
+ * @param state The shared pool state.
+ * @param task The Task that will receive the claimed task.
+ * @param priority The priority of the lane.
+ * @returns True if a task was claimed, False otherwise.
+ */
+static bool claimLaneTask(State & state, Task & task, Priority priority) {
+  auto index = static_cast<size_t>(priority);
+  if (!(state.nonEmptyLanes.load() & (uint32_t{1} << index))) {
+    return false;
+  }
+
+  auto & lane = state.lanes[index];
+  scoped_lock laneMutexLock{lane.laneMutex};
+  if (lane.tasks.empty()) {
+    return false;
+  }
+  task = move(lane.tasks.front());
+  lane.tasks.pop_front();
+  if (lane.tasks.empty()) {
+    state.nonEmptyLanes.fetch_and(~(uint32_t{1} << index));
+  }
+  releaseTasks(state, 1);
+  return true;
+}
+
+
+/**
+ * Check whether the lane of HIGH priority tasks has any, and claim one.
+ *
+ * HIGH priority tasks never go onto a deque, so a worker must check for them
+ * before its deque, or they could wait behind a long chain of other tasks.
+ * Only the HIGH lane is claimed from, so that this check never moves tasks of
+ * another lane ahead of the worker's deque.
+ *
+ * @param state The shared pool state.
+ * @param task The Task that will receive the claimed task.
+ * @returns True if a task was claimed, False otherwise.
+ */
+static bool claimHighTask(State & state, Task & task) {
+  return claimLaneTask(state, task, Priority::HIGH);
+}
+
+
+/**
+ * Try to claim a task using the work-stealing scheduler.
+ *
+ * HIGH priority tasks are checked first, followed by the worker's own deque,
+ * followed by the lanes, followed by the deques of the other workers.  Only
+ * the lanes require a lock, and they are skipped entirely when they are empty.
+ *
+ * @param state The shared pool state.
+ * @param worker The worker slot of the current thread.
+ * @param task The Task that will receive the claimed task.
+ * @returns True if a task was claimed, False otherwise.
+ */
+static bool claimWorkStealingTask(State & state, Worker * worker, Task & task) {
+  if (claimHighTask(state, task)) {
+    return true;
+  }
+
+  // Newest task from our own deque.
+  if (auto claimed = unique_ptr<Task>{worker->deque.take()}) {
+    task = move(*claimed);
+    releaseTasks(state, 1);
+    return true;
+  }
+
+  // Oldest tasks from the lanes, or else from someone else's deque.
+  return claimLaneTask(state, worker, task) || stealTask(state, worker, task);
+}
+
+
+/**
+ * Try to claim a task using the FIFO scheduler.
+ *
+ * Without batching, this only claims from the lanes.  With batching, the
+ * worker's deque holds the rest of its batch, which is run oldest first so
+ * that the tasks stay in order, and idle workers steal from the batches of
+ * the others.
+ *
+ * @param state The shared pool state.
+ * @param worker The worker slot of the current thread.
+ * @param task The Task that will receive the claimed task.
+ * @returns True if a task was claimed, False otherwise.
+ */
+static bool claimFifoTask(State & state, Worker * worker, Task & task) {
+  // The deque is checked even without batching, in case the batch size has
+  // just been lowered.
+  if ((state.batchSize.load(memory_order_relaxed) <= 1) && worker->deque.empty()) {
+    return claimLaneTask(state, nullptr, task);
+  }
+
+  if (claimHighTask(state, task)) {
+    return true;
+  }
+
+  // Oldest task of our own batch.  Thieves may win the race for it, so keep
+  // trying while there is anything left.
+  while (!worker->deque.empty()) {
+    if (auto claimed = unique_ptr<Task>{worker->deque.steal()}) {
+      task = move(*claimed);
+      releaseTasks(state, 1);
+      return true;
+    }
+  }
+
+  return claimLaneTask(state, worker, task) || stealTask(state, worker, task);
+}
+
+
+/**
+ * Try to claim a task using the ring scheduler.
+ *
+ * The rings are tried in the same order as the lanes of the FIFO scheduler,
+ * followed by the overflow queues of the lanes, if any of them have tasks.
+ *
+ * @param state The shared pool state.
+ * @param task The Task that will receive the claimed task.
+ * @returns True if a task was claimed, False otherwise.
+ */
+static bool claimRingTask(State & state, Task & task) {
+  auto preferred = preferredLane();
+  if (state.lanes[preferred].ring->pop(task)) {
+    releaseTasks(state, 1);
+    return true;
+  }
+  for (size_t index = 0; index < PRIORITY_COUNT; ++index) {
+    if ((index != preferred) && state.lanes[index].ring->pop(task)) {
+      releaseTasks(state, 1);
+      return true;
+    }
+  }
+  return state.nonEmptyLanes.load() && claimLaneTask(state, nullptr, task);
+}
+
+
+/**
+ * Try to claim a task, using the scheduler of the pool.
+ *
+ * @param state The shared pool state.
+ * @param worker The worker slot of the current thread.
+ * @param task The Task that will receive the claimed task.
+ * @returns True if a task was claimed, False otherwise.
+ */
+static bool claimNextTask(State & state, Worker * worker, Task & task) {
+  switch (state.scheduler) {
+    case Scheduler::WORK_STEALING:
+      return claimWorkStealingTask(state, worker, task);
+    case Scheduler::RING:
+      return claimRingTask(state, task);
+    default:
+      return claimFifoTask(state, worker, task);
+  }
+}
+
+
+/**
+ * Ask the processor to start loading the task that the current worker will
+ * claim next from its own deque, so that it is in the cache by the time that
+ * the current task has finished.
+ *
+ * Only the Task itself is loaded, which includes the inline storage of its
+ * function.  A function that is stored elsewhere is not followed, because
+ * another thread may steal (and free) the Task at any time.
+ *
+ * @param state The shared pool state.
+ * @param worker The worker slot of the current thread.
+ */
+static inline void prefetchNextTask([[maybe_unused]] State & state, [[maybe_unused]] Worker * worker) {
+#if defined(__GNUC__) || defined(__clang__)
+  auto next = (state.scheduler == Scheduler::WORK_STEALING)
+    ? worker->deque.peekBottom()
+    : worker->deque.peekTop();
+  if (next) {
+    for (size_t offset = 0; offset < sizeof(Task); offset += CACHE_LINE_SIZE) {
+      __builtin_prefetch(reinterpret_cast<const char *>(next) + offset);
+    }
+  }
+#endif
+}
+
+
+/**
+ * Let the processor know that the current thread is spinning.
+ */
+static inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+  _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+  asm volatile("yield");
+#else
+  this_thread::yield();
+#endif
+}
+
+
+/**
+ * How many spin iterations pass between checks of the clock.
+ */
+static constexpr size_t SPIN_CLOCK_INTERVAL{16};
+
+
+/**
+ * Spin for a while, trying to claim a task, before the thread parks.
+ *
+ * @param state The shared pool state.
+ * @param token Token indicating that this jthread has been asked to stop.
+ * @param worker The worker slot of the current thread.
+ * @param task The Task that will receive the claimed task.
+ * @returns True if a task was claimed, False if the thread should park (or
+ *   might need to terminate).
+ */
+static bool spinForTask(State & state, const stop_token & token, Worker * worker, Task & task) {
+  auto spinCount = state.spinCount.load();
+  if (!spinCount) {
+    return false;
+  }
+
+  auto deadline = chrono::steady_clock::now() + state.spinDuration.load();
+  auto claimed{false};
+  state.spinningThreads.fetch_add(1);
+
+  for (size_t i = 1; i <= spinCount; ++i) {
+    if (mightTerminate(state, token)) {
+      break;
+    }
+
+    // Only look for a task when there is one to be found, so that spinning
+    // threads do not contend on the lanes and deques.
+    if (state.queuedTasks.load()) {
+      claimed = claimNextTask(state, worker, task);
+      if (claimed) {
+        break;
+      }
+    }
+
+    // Pause for the first half of the spin, then give up the processor
+    // between checks, in case the thread that will enqueue the next task is
+    // waiting for it.
+    if (i <= spinCount / 2) {
+      cpuRelax();
+    }
+    else {
+      this_thread::yield();
+    }
+    if (!(i % SPIN_CLOCK_INTERVAL) && (chrono::steady_clock::now() >= deadline)) {
+      break;
+    }
+  }
+
+  // Enqueuers did not wake anyone while this thread was spinning, so if this
+  // was the last spinning thread, then it must hand off any remaining tasks.
+  if ((state.spinningThreads.fetch_sub(1) == 1) && claimed && state.queuedTasks.load()) {
+    notifyTasks(state, 1);
+  }
+  return claimed;
+}
+
+
+/**
+ * Wait for, and then claim, a task.
+ *
+ * @param state The shared pool state.
+ * @param token Token indicating that this jthread has been asked to stop.
+ * @param worker The worker slot of the current thread.
+ * @param task The Task that will receive the claimed task.
+ * @returns True if a task was claimed, False if the thread must terminate.
+ */
+static bool claimTask(State & state, const stop_token & token, Worker * worker, Task & task) {
+  while (true) {
+    // Terminate the thread if needed.
+    if (mightTerminate(state, token) && claimTermination(state, token)) {
+      return false;
+    }
+
+    auto claimed = claimNextTask(state, worker, task);
+    if (claimed || spinForTask(state, token, worker, task)) {
+      return true;
+    }
+
+    // A draining pool lets each thread go once there is nothing left to do.
+    if (state.draining.load() && !state.queuedTasks.load()) {
+      state.threadCount.fetch_sub(1);
+      return false;
+    }
+
+    // Sleep only when there is nothing to claim, handing back the blocks of
+    // other threads first so that they are not stranded while this one
+    // sleeps.
+    flushFunctionStorage();
+    unique_lock<mutex> queueMutexLock{state.queueMutex};
+    state.sleepingThreads.fetch_add(1);
+
+    // Wake up if there is a task or if the terminate (or draining) flag is
+    // set.
+    state.mutexCondition.wait(queueMutexLock, [&] {
+      return mightTerminate(state, token) || state.queuedTasks.load() || state.draining.load();
+    });
+    state.sleepingThreads.fetch_sub(1);
+  }
+}
+
+
+/**
+ * Run a task that the current thread has claimed, recording it in the
+ * statistics and the trace, and then release the thread's scratch memory.
+ *
+ * @param state The shared pool state.
+ * @param worker The worker slot of the current thread.
+ * @param task The claimed task.
+ * @param idleSince When the thread started waiting for the task.
+ * @returns When the task finished.
+ */
+static chrono::steady_clock::time_point runClaimedTask(State & state, Worker * worker, Task & task, chrono::steady_clock::time_point idleSince) {
+  prefetchNextTask(state, worker);
+
+  auto traced = state.tracing.load(memory_order_relaxed);
+  if (traced) [[unlikely]] {
+    traceEvent(state, worker, TraceEventType::DEQUEUE, task);
+  }
+
+  auto started = recordTaskStart(worker, task, idleSince);
+  if (traced) [[unlikely]] {
+    traceEvent(state, worker, TraceEventType::START, task);
+  }
+  task.function();
+  if (traced) [[unlikely]] {
+    traceEvent(state, worker, TraceEventType::END, task);
+  }
+  scratchArena.reset();
+  return recordTaskEnd(worker, started);
+}
+
+
+static void Ghoti::Pool::threadLoop(stop_token token, shared_ptr<State> state) {
+  auto threadId = this_thread::get_id();
+  auto worker = acquireWorkerSlot(*state);
+  currentWorker = {state.get(), worker};
+  laneTicket = 0;
+  applyThreadAffinity(*state, worker);
+
+  // This thread starts out waiting for a task.
+  state->threadStates.fetch_add(WAITING_THREAD);
+  auto idleSince = statsNow();
+
+  // The thread loop will continue forever unless the terminate flag is set.
+  while (true) {
+    Task task;
+
+    // Try to claim a Task.
+    if (!claimTask(*state, token, worker, task)) {
+      break;
+    }
+
+    // Execute the task, telling the pool that we are no longer waiting.
+    state->threadStates.fetch_add(RUNNING_THREAD - WAITING_THREAD);
+    idleSince = runClaimedTask(*state, worker, task, idleSince);
+    state->threadStates.fetch_sub(RUNNING_THREAD - WAITING_THREAD);
+  }
+
+  currentWorker = {nullptr, nullptr};
+  releaseWorkerSlot(*state, worker);
+
+  {
+    scoped_lock controlMutexLock{state->controlMutex};
+    auto & threads = state->threads;
+    auto position = find(threads.begin(), threads.end(), threadId);
+    if (position != threads.end()) {
+      *position = threads.back();
+      threads.pop_back();
+    }
+    state->drainCondition.notify_all();
+  }
+  state->terminatedThreadCount.fetch_add(1);
+  state->threadStates.fetch_sub(WAITING_THREAD);
+}
+
+
+
+/**
+ * The amount by which the virtual time of a pool with a weight of 1 advances
+ * each time that a thread of its group claims one of its tasks.
+ */
+static constexpr uint64_t GROUP_STRIDE{uint64_t{1} << 20};
+
+
+/**
+ * Choose the pool of a group that should be served next.
+ *
+ * A pool is eligible if it is running, has tasks waiting, and has not
+ * reached its maxConcurrency.  Pools below their minConcurrency come first,
+ * followed by the pool with the lowest virtual time.
+ *
+ * Must be called while holding the groupMutex.
+ *
+ * @param group The state of the group.
+ * @returns The chosen member, or nullptr if no pool is eligible.
+ */
+static const shared_ptr<GroupMember> * chooseGroupMember(WorkerGroupState & group) {
+  const shared_ptr<GroupMember> * chosen{nullptr};
+  auto chosenBelowMinimum{false};
+  for (auto & member : group.members) {
+    auto & state = *member->state;
+    if (state.terminate.load() || !state.queuedTasks.load()
+        || (member->running >= member->quota.maxConcurrency)) {
+      continue;
+    }
 
-  // Clean up the threads from the state object.
-  {
-    scoped_lock<mutex> controlMutexLock{state->controlMutex};
-    this->state->terminate = true;
-    this->state->threads.clear();
+    // A pool that had nothing to do does not get to make up for lost time.
+    member->pass = max(member->pass, group.pass);
+    auto belowMinimum = member->running < member->quota.minConcurrency;
+    if (!chosen || (belowMinimum && !chosenBelowMinimum)
+        || ((belowMinimum == chosenBelowMinimum) && (member->pass < (*chosen)->pass))) {
+      chosen = &member;
+      chosenBelowMinimum = belowMinimum;
+    }
   }
+  return chosen;
+}
 
-  // Wake up all threads so that they will terminate themselves.
-  this->state->mutexCondition.notify_all();
 
-  // Now try to join the threads.
-  for (auto & notifierResult : notifierResults) {
-    // Wait for the thread to join in the globalPool thread.
-    notifierResult.get();
+/**
+ * The function executed by each thread of a WorkerGroup, which repeatedly
+ * chooses a pool of the group and runs one of its tasks.
+ *
+ * @param token Token indicating that this jthread has been asked to stop.
+ * @param group The state of the group.
+ * @param index The index of the thread within the group.
+ */
+static void groupThreadLoop(stop_token token, shared_ptr<WorkerGroupState> group, size_t index) {
+  auto idleSince = statsNow();
+  laneTicket = 0;
+
+  while (true) {
+    shared_ptr<GroupMember> member;
+    {
+      unique_lock<mutex> groupMutexLock{group->groupMutex};
+      while (true) {
+        if (group->stopping || token.stop_requested()) {
+          return;
+        }
+
+        // Counted before looking, so that a pool which gets a task after the
+        // look is sure to wake this thread.
+        group->sleepingThreads.fetch_add(1);
+        if (auto chosen = chooseGroupMember(*group)) {
+          group->sleepingThreads.fetch_sub(1);
+          member = *chosen;
+          break;
+        }
+        flushFunctionStorage();
+        group->condition.wait(groupMutexLock);
+        group->sleepingThreads.fetch_sub(1);
+      }
+      group->pass = member->pass;
+      member->pass += max(GROUP_STRIDE / member->quota.weight, uint64_t{1});
+      ++member->running;
+    }
+
+    // Another thread may have claimed the task first.
+    auto & state = *member->state;
+    auto worker = member->slots[index];
+    Task task;
+    auto claimed = claimNextTask(state, worker, task);
+    if (claimed) {
+      currentWorker = {&state, worker};
+      state.threadStates.fetch_add(RUNNING_THREAD);
+      idleSince = runClaimedTask(state, worker, task, idleSince);
+      state.threadStates.fetch_sub(RUNNING_THREAD);
+      currentWorker = {nullptr, nullptr};
+    }
+
+    {
+      scoped_lock groupMutexLock{group->groupMutex};
+      if (!--member->running && (state.terminate.load() || state.draining.load())) {
+        group->idleCondition.notify_all();
+      }
+    }
+    if (!claimed) {
+      this_thread::yield();
+    }
   }
 }
 
 
-size_t Pool::getTaskQueueCount() {
-  scoped_lock queueMutexLock{this->state->queueMutex};
-  return this->state->tasks.size();
+/**
+ * Make a quota usable by the scheduling of a group.
+ *
+ * @param quota The quota requested for a pool.
+ * @returns The quota, with a weight of at least 1.
+ */
+static ExecutorQuota normalizeQuota(ExecutorQuota quota) {
+  quota.weight = max(quota.weight, size_t{1});
+  return quota;
 }
 
 
-void Pool::setThreadCount(size_t threadCount) {
-  // Set the target thread count.
+WorkerGroup::WorkerGroup() : WorkerGroup(thread::hardware_concurrency()) {}
+
+
+WorkerGroup::WorkerGroup(size_t threadCount) : state{make_shared<WorkerGroupState>()} {
+  this->state->threadCount = threadCount;
+  for (size_t index = 0; index < threadCount; ++index) {
+    this->state->threads.push_back(createThread([group = this->state, index](stop_token token) -> void {
+      groupThreadLoop(token, group, index);
+    }));
+  }
+}
+
+
+WorkerGroup::~WorkerGroup() {
   {
-    scoped_lock controlMutexLock{state->controlMutex};
-    this->state->targetThreadCount = threadCount;
+    scoped_lock groupMutexLock{this->state->groupMutex};
+    this->state->stopping = true;
   }
+  this->state->condition.notify_all();
+  for (auto & notifierResult : requestThreadJoins(this->state->threads)) {
+    notifierResult.get();
+  }
+}
 
-  // Create new threads if needed.
-  this->createThreads();
 
-  // Notify threads so that they can remove themselves (or take something from
-  // the queue) if needed.
-  this->state->mutexCondition.notify_all();
+size_t WorkerGroup::getThreadCount() const {
+  return this->state->threadCount;
 }
 
 
-size_t Pool::getThreadCount() const {
-  scoped_lock controlMutexLock{state->controlMutex};
-  return this->state->threads.size();
+size_t WorkerGroup::getPoolCount() const {
+  scoped_lock groupMutexLock{this->state->groupMutex};
+  return this->state->members.size();
 }
 
 
-size_t Pool::getWaitingThreadCount() const {
-  scoped_lock controlMutexLock{state->controlMutex};
-  size_t count{0};
+Pool::Pool(WorkerGroup & group, ExecutorQuota quota, Scheduler scheduler) : Pool(0, scheduler) {
+  auto member = make_shared<GroupMember>();
+  member->state = this->state;
+  member->quota = normalizeQuota(quota);
+  for (size_t index = 0; index < group.state->threadCount; ++index) {
+    member->slots.push_back(acquireWorkerSlot(*this->state));
+  }
+  this->state->group = group.state;
+  this->state->groupMember = member.get();
 
-  for (auto & [thread_id, waiting] : state->threadsWaiting) {
-    if (waiting) {
-      count++;
-    }
+  scoped_lock groupMutexLock{group.state->groupMutex};
+  group.state->members.push_back(move(member));
+}
+
+
+void Pool::setExecutorQuota(ExecutorQuota quota) {
+  auto & group = this->state->group;
+  if (!group) {
+    return;
+  }
+  {
+    scoped_lock groupMutexLock{group->groupMutex};
+    this->state->groupMember->quota = normalizeQuota(quota);
   }
 
-  return count;
+  // A higher limit may let a waiting thread take one of the tasks.
+  wakeGroup(*group, this->state->queuedTasks.load());
 }
 
 
-size_t Pool::getTerminatedThreadCount() const {
-  scoped_lock controlMutexLock{state->controlMutex};
-  return this->state->threadsTerminated.size();
+ExecutorQuota Pool::getExecutorQuota() const {
+  auto & group = this->state->group;
+  if (!group) {
+    return {};
+  }
+  scoped_lock groupMutexLock{group->groupMutex};
+  return this->state->groupMember->quota;
 }
 
 
-size_t Pool::getRunningThreadCount() const {
-  scoped_lock controlMutexLock{state->controlMutex};
-  size_t count{0};
+TaskGroup::TaskGroup(Pool & pool) : pool{pool}, state{make_shared<TaskGroupState>()} {}
 
-  for (auto & [thread_id, waiting] : state->threadsWaiting) {
-    if (!waiting) {
-      count++;
-    }
-  }
 
-  return count;
+TaskGroup::~TaskGroup() {
+  try {
+    this->wait();
+  }
+  catch (...) {}
 }
 
 
-void Pool::createThreads() {
-  scoped_lock controlMutexLock{this->state->controlMutex};
+bool TaskGroup::run(Task && task) {
+  {
+    scoped_lock groupMutexLock{this->state->groupMutex};
+    this->state->tasks.emplace_back(move(task));
+    this->state->pending.fetch_add(1);
 
-  // Create threads in the pool.
-  while (this->state->threads.size() < this->state->targetThreadCount) {
-    this->state->threads.insert(createThread([state = this->state](stop_token token) -> void {
-      return Ghoti::Pool::threadLoop(token, state);
-    }));
+    // A waiting thread may be asleep, and can now help with this task.
+    this->state->condition.notify_all();
+  }
+
+  // The placeholder runs whichever task of the group is next.
+  if (!this->pool.enqueue([state = this->state](){
+    runGroupTask(*state);
+  })) {
+    // The task stays in the group, and will be run by the waiting thread.
+    return false;
   }
+  return true;
 }
 
 
-static void Ghoti::Pool::threadLoop(stop_token token, shared_ptr<State> state) {
-  auto threadId = this_thread::get_id();
+void TaskGroup::wait() {
+  waitGroup(*this->state, nullptr);
+}
 
-  // The thread loop will continue forever unless the terminate flag is set.
-  while (true) {
-    Task task;
-    // Set our waiting state the true.
-    {
-      scoped_lock controlMutexLock{state->controlMutex};
-      state->threadsWaiting[threadId] = true;
+
+bool TaskGroup::waitFor(chrono::nanoseconds timeout) {
+  auto deadline = chrono::steady_clock::now() + timeout;
+  return waitGroup(*this->state, &deadline);
+}
+
+
+size_t TaskGroup::getPendingCount() const {
+  return this->state->pending.load();
+}
+
+
+namespace Ghoti::Pool {
+/**
+ * A node of a TaskGraph.
+ */
+struct GraphNode {
+  /**
+   * The function that the node runs.
+   */
+  TaskFunction function;
+
+  /**
+   * The name of the node in a trace of the pool.
+   */
+  const char * label;
+
+  /**
+   * The nodes that must wait for this node.
+   */
+  vector<size_t> successors;
+
+  /**
+   * The number of nodes that this node must wait for.
+   */
+  size_t predecessorCount;
+};
+
+/**
+ * Structure to hold the state of a TaskGraph.
+ *
+ * The state is shared with the placeholder tasks that the graph enqueues to
+ * the pool, because a placeholder may run after the graph has finished (if
+ * another thread already ran its node), or even after the graph has been
+ * destroyed.
+ */
+struct TaskGraphState : enable_shared_from_this<TaskGraphState> {
+  /**
+   * The nodes of the graph.
+   */
+  vector<GraphNode> nodes;
+
+  /**
+   * Whether or not nodes or edges have been added since the graph was last
+   * prepared to run.
+   */
+  bool changed{false};
+
+  /**
+   * The nodes that have no predecessors.
+   */
+  vector<size_t> roots;
+
+  /**
+   * The number of predecessors of each node that have yet to finish in the
+   * current run.
+   */
+  unique_ptr<atomic<size_t>[]> pending;
+
+  /**
+   * The number of nodes that have yet to finish in the current run.
+   */
+  atomic<size_t> remaining{0};
+
+  /**
+   * Whether or not a node has thrown in the current run.
+   */
+  atomic<bool> failed{false};
+
+  /**
+   * The pool that is running the graph.
+   */
+  Pool * pool{nullptr};
+
+  /**
+   * Protects the ready nodes, waiting, finished, and the exception, and is
+   * used with the condition.
+   */
+  mutex graphMutex;
+
+  /**
+   * Allows the thread that runs the graph to sleep until a node is ready or
+   * until the graph has finished.
+   */
+  condition_variable condition;
+
+  /**
+   * The nodes of the current run that are ready, in the order that they
+   * became ready.  Those from readyHead on have not yet been claimed.
+   *
+   * Each node becomes ready at most once per run, so room for every node is
+   * reserved when the graph is prepared, and a run never allocates here.
+   */
+  vector<size_t> ready;
+
+  /**
+   * The position of the oldest ready node that has not yet been claimed.
+   */
+  size_t readyHead{0};
+
+  /**
+   * Whether or not the thread that runs the graph is asleep on the
+   * condition.
+   */
+  bool waiting{false};
+
+  /**
+   * Whether or not every node of the current run has finished.
+   */
+  bool finished{false};
+
+  /**
+   * The first exception thrown by a node in the current run.
+   */
+  exception_ptr exception;
+};
+}
+
+
+/**
+ * Marks the absence of a node.
+ */
+static constexpr size_t NO_GRAPH_NODE{numeric_limits<size_t>::max()};
+
+
+static void runGraphNode(TaskGraphState & state, size_t index);
+
+
+/**
+ * Claim the oldest ready node of a graph, if there is one.
+ *
+ * @param state The state of the graph.
+ * @returns The index of the node, or NO_GRAPH_NODE if no node is ready.
+ */
+static size_t claimGraphNode(TaskGraphState & state) {
+  scoped_lock graphMutexLock{state.graphMutex};
+  if (state.readyHead == state.ready.size()) {
+    return NO_GRAPH_NODE;
+  }
+  return state.ready[state.readyHead++];
+}
+
+
+/**
+ * Make a node of a graph whose predecessors have all finished ready to run,
+ * and enqueue a placeholder task to run it.
+ *
+ * The placeholder runs whichever node is ready next.  The node itself stays
+ * with the graph until it is claimed, so if the pool rejects, drops, or
+ * discards the placeholder, or is not running, then the thread that runs the
+ * graph runs the node instead.
+ *
+ * @param state The state of the graph.
+ * @param index The index of the node.
+ */
+static void scheduleGraphNode(TaskGraphState & state, size_t index) {
+  {
+    scoped_lock graphMutexLock{state.graphMutex};
+    state.ready.push_back(index);
+    if (state.waiting) {
+      state.condition.notify_all();
     }
+  }
 
-    // Try to claim a Task.
-    {
-      unique_lock<mutex> queueMutexLock{state->queueMutex};
-
-      // Wake up if there is a task or if the terminate flag is set.
-      state->mutexCondition.wait(queueMutexLock, [&] {
-        scoped_lock controlMutexLock{state->controlMutex};
-        return state->terminate
-            || (state->threads.size() > state->targetThreadCount)
-            || token.stop_requested()
-            || !state->tasks.empty();
-      });
+  state.pool->enqueue(Task{[state = state.shared_from_this()](){
+    if (auto index = claimGraphNode(*state); index != NO_GRAPH_NODE) {
+      runGraphNode(*state, index);
+    }
+  }, Priority::NORMAL, state.nodes[index].label});
+}
 
-      {
-        scoped_lock controlMutexLock{state->controlMutex};
 
-        // Terminate the thread if needed.
-        if (state->terminate
-            || (state->threads.size() > state->targetThreadCount)
-            || token.stop_requested()) {
-          state->threads.erase(threadId);
-          state->threadsWaiting.erase(threadId);
-          state->threadsTerminated.insert(threadId);
-          break;
+/**
+ * Run a node of a graph, followed by any chain of successors that it makes
+ * ready.
+ *
+ * Of the successors that become ready when a node finishes, the last is run
+ * on the current thread, while its data is still in cache, and the rest are
+ * enqueued.
+ *
+ * @param state The state of the graph.
+ * @param index The index of the node.
+ */
+static void runGraphNode(TaskGraphState & state, size_t index) {
+  while (index != NO_GRAPH_NODE) {
+    auto & node = state.nodes[index];
+
+    // Once a node has failed, the rest of the graph is skipped.
+    if (!state.failed.load(memory_order_relaxed)) {
+      try {
+        node.function();
+      }
+      catch (...) {
+        scoped_lock graphMutexLock{state.graphMutex};
+        if (!state.exception) {
+          state.exception = current_exception();
         }
+        state.failed = true;
+      }
+    }
 
-        // Tell the pool that we are no longer waiting.
-        state->threadsWaiting[threadId] = false;
+    auto next = NO_GRAPH_NODE;
+    for (auto successor : node.successors) {
+      if (state.pending[successor].fetch_sub(1, memory_order_acq_rel) == 1) {
+        if (next != NO_GRAPH_NODE) {
+          scheduleGraphNode(state, next);
+        }
+        next = successor;
       }
+    }
 
-      // Claim a task.
-      task = move(state->tasks.front());
-      state->tasks.pop();
+    // The graph cannot finish while next is still to be run, so the state
+    // is only released (along with the thread that runs the graph) by the
+    // very last node.
+    if (state.remaining.fetch_sub(1, memory_order_acq_rel) == 1) {
+      scoped_lock graphMutexLock{state.graphMutex};
+      state.finished = true;
+      state.condition.notify_all();
     }
+    index = next;
+  }
+}
 
-    // Execute the task.
-    task.function();
+
+/**
+ * Find the roots of a graph, make sure that it has no cycles, and make room
+ * for its counters.
+ *
+ * @param state The state of the graph.
+ */
+static void prepareGraph(TaskGraphState & state) {
+  auto count = state.nodes.size();
+  state.roots.clear();
+  for (size_t i = 0; i < count; ++i) {
+    if (!state.nodes[i].predecessorCount) {
+      state.roots.push_back(i);
+    }
+  }
+
+  // Every node of a graph without a cycle can be reached by repeatedly
+  // removing the nodes that have no remaining predecessors.
+  vector<size_t> predecessors(count);
+  vector<size_t> ready{state.roots};
+  size_t reached{0};
+  for (size_t i = 0; i < count; ++i) {
+    predecessors[i] = state.nodes[i].predecessorCount;
+  }
+  while (!ready.empty()) {
+    auto index = ready.back();
+    ready.pop_back();
+    ++reached;
+    for (auto successor : state.nodes[index].successors) {
+      if (!--predecessors[successor]) {
+        ready.push_back(successor);
+      }
+    }
+  }
+  if (reached != count) {
+    throw logic_error{"TaskGraph has a cycle"};
   }
 
+  state.pending = make_unique<atomic<size_t>[]>(count);
   {
-    // Record that this thread is terminating.
-    scoped_lock lock{*globalMutex};
-    globalThreadJoinQueue->emplace(threadId);
+    // A placeholder from an earlier run may still be looking for a node.
+    scoped_lock graphMutexLock{state.graphMutex};
+    state.ready.reserve(count);
+  }
+  state.changed = false;
+}
 
-    // Let the globalPool know that there is work to do.
-    globalThreadSemaphore->release();
+
+TaskGraph::Node::Node(TaskGraph & graph, size_t index) : graph{&graph}, index{index} {}
+
+
+TaskGraph::Node & TaskGraph::Node::precede(Node other) {
+  auto & state = *this->graph->state;
+  state.nodes[this->index].successors.push_back(other.index);
+  ++state.nodes[other.index].predecessorCount;
+  state.changed = true;
+  return *this;
+}
+
+
+TaskGraph::Node & TaskGraph::Node::succeed(Node other) {
+  other.precede(*this);
+  return *this;
+}
+
+
+size_t TaskGraph::Node::getIndex() const {
+  return this->index;
+}
+
+
+TaskGraph::TaskGraph() : state{make_shared<TaskGraphState>()} {}
+
+
+TaskGraph::~TaskGraph() = default;
+
+
+TaskGraph::Node TaskGraph::add(TaskFunction && function, const char * label) {
+  auto & state = *this->state;
+  state.nodes.push_back({move(function), label, {}, 0});
+  state.changed = true;
+  return Node{*this, state.nodes.size() - 1};
+}
+
+
+void TaskGraph::run(Pool & pool) {
+  auto & state = *this->state;
+  if (state.changed) {
+    prepareGraph(state);
+  }
+  if (state.nodes.empty()) {
+    return;
+  }
+
+  for (size_t i = 0; i < state.nodes.size(); ++i) {
+    state.pending[i].store(state.nodes[i].predecessorCount, memory_order_relaxed);
+  }
+  state.remaining = state.nodes.size();
+  state.failed = false;
+  state.pool = &pool;
+  {
+    scoped_lock graphMutexLock{state.graphMutex};
+    state.ready.clear();
+    state.readyHead = 0;
+    state.finished = false;
+    state.exception = nullptr;
+  }
+
+  // Enqueue the roots, and help by running the last of them on this thread.
+  for (size_t i = 0; i + 1 < state.roots.size(); ++i) {
+    scheduleGraphNode(state, state.roots[i]);
+  }
+  runGraphNode(state, state.roots.back());
+
+  // Keep helping with the nodes that are ready, rather than only sleeping,
+  // so that the graph finishes even when the pool does not run them.
+  exception_ptr exception;
+  {
+    unique_lock<mutex> graphMutexLock{state.graphMutex};
+    while (!state.finished) {
+      if (state.readyHead != state.ready.size()) {
+        auto index = state.ready[state.readyHead++];
+        graphMutexLock.unlock();
+        runGraphNode(state, index);
+        graphMutexLock.lock();
+        continue;
+      }
+      state.waiting = true;
+      state.condition.wait(graphMutexLock);
+      state.waiting = false;
+    }
+    exception = exchange(state.exception, nullptr);
+  }
+  if (exception) {
+    rethrow_exception(exception);
   }
 }
 
+
+size_t TaskGraph::size() const {
+  return this->state->nodes.size();
+}
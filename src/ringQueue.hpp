@@ -0,0 +1,189 @@
+/**
+ * @file
+ *
+ * Bounded lock-free multi-producer, multi-consumer queue used by the Pool ring
+ * scheduler.
+ */
+
+#ifndef RINGQUEUE_HPP
+#define RINGQUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace Ghoti::Pool {
+
+/**
+ * A bounded multi-producer, multi-consumer FIFO queue.
+ *
+ * Items are kept in a ring of preallocated slots, so that pushing and popping
+ * never allocate.  Each slot has a sequence number that tells a producer when
+ * the slot is free for the item of a given position, and tells a consumer
+ * when the item of that position has been stored.  Producers and consumers
+ * each claim a position with a single compare-and-swap, and never wait on a
+ * lock.  Any thread may call any method.
+ *
+ * The implementation follows Dmitry Vyukov's "Bounded MPMC queue".
+ *
+ * @tparam T The type of item that is being stored.  It must be default
+ *   constructible and nothrow move assignable.
+ */
+template <typename T>
+class RingQueue {
+  public:
+  /**
+   * Constructor.
+   *
+   * @param capacity The most items that the queue may hold.  It will be
+   *   rounded up to a power of 2.
+   */
+  RingQueue(size_t capacity) {
+    size_t size{1};
+    while (size < capacity) {
+      size <<= 1;
+    }
+    this->mask = size - 1;
+    this->slots = std::make_unique<Slot[]>(size);
+    for (size_t i = 0; i < size; ++i) {
+      this->slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  // Remove the copy constructor.
+  RingQueue(const RingQueue &) = delete;
+
+  // Remove the copy assignment.
+  RingQueue & operator=(const RingQueue &) = delete;
+
+  /**
+   * Get the most items that the queue may hold.
+   *
+   * @returns The capacity of the queue.
+   */
+  size_t capacity() const {
+    return this->mask + 1;
+  }
+
+  /**
+   * Add an item to the back of the queue.
+   *
+   * @param item The item.  It is only moved from if it was added.
+   * @returns True if the item was added, False if the queue was full.
+   */
+  bool push(T & item) {
+    auto position = this->enqueuePosition.load(std::memory_order_relaxed);
+    while (true) {
+      auto & slot = this->slots[position & this->mask];
+      auto sequence = slot.sequence.load(std::memory_order_acquire);
+      auto difference = static_cast<std::ptrdiff_t>(sequence - position);
+      if (!difference) {
+        if (this->enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+          slot.item = std::move(item);
+          slot.sequence.store(position + 1, std::memory_order_release);
+          return true;
+        }
+      }
+      else if (difference < 0) {
+        // The slot still holds the item from one lap ago.
+        return false;
+      }
+      else {
+        // Another producer claimed the position first.
+        position = this->enqueuePosition.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /**
+   * Remove the item at the front of the queue.
+   *
+   * @param item Receives the item.
+   * @returns True if an item was removed, False if the queue was empty.
+   */
+  bool pop(T & item) {
+    auto position = this->dequeuePosition.load(std::memory_order_relaxed);
+    while (true) {
+      auto & slot = this->slots[position & this->mask];
+      auto sequence = slot.sequence.load(std::memory_order_acquire);
+      auto difference = static_cast<std::ptrdiff_t>(sequence - (position + 1));
+      if (!difference) {
+        if (this->dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+          item = std::move(slot.item);
+          slot.sequence.store(position + this->mask + 1, std::memory_order_release);
+          return true;
+        }
+      }
+      else if (difference < 0) {
+        // The item of this position has not been stored yet.
+        return false;
+      }
+      else {
+        // Another consumer claimed the position first.
+        position = this->dequeuePosition.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /**
+   * Determine whether or not the queue appears to be empty.
+   *
+   * The answer may be out of date by the time that it is returned.
+   *
+   * @returns True if the queue appears to be empty, False otherwise.
+   */
+  bool empty() const {
+    return this->dequeuePosition.load(std::memory_order_relaxed)
+      >= this->enqueuePosition.load(std::memory_order_relaxed);
+  }
+
+  private:
+  /**
+   * The size of a cache line, used to keep the positions apart.
+   *
+   * std::hardware_destructive_interference_size is not used, because its
+   * value may differ between translation units that include this header.
+   */
+  static constexpr size_t CACHE_LINE_SIZE{64};
+
+  /**
+   * A slot of the ring.
+   */
+  struct Slot {
+    /**
+     * The position for which the slot is next free (when it equals the
+     * position) or next holds an item (when it is one past the position).
+     */
+    std::atomic<size_t> sequence{0};
+
+    /**
+     * The item stored in the slot.
+     */
+    T item{};
+  };
+
+  /**
+   * The slots of the ring.
+   */
+  std::unique_ptr<Slot[]> slots;
+
+  /**
+   * Selects a slot from a position.
+   */
+  size_t mask;
+
+  /**
+   * The position of the next item to be pushed.
+   */
+  alignas(CACHE_LINE_SIZE) std::atomic<size_t> enqueuePosition{0};
+
+  /**
+   * The position of the next item to be popped.
+   */
+  alignas(CACHE_LINE_SIZE) std::atomic<size_t> dequeuePosition{0};
+};
+
+}
+
+#endif // RINGQUEUE_HPP
@@ -0,0 +1,455 @@
+/**
+ * @file
+ *
+ * Hierarchical timer wheel used by the Pool to hold delayed and periodic
+ * tasks.
+ */
+
+#ifndef TIMERWHEEL_HPP
+#define TIMERWHEEL_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace Ghoti::Pool {
+
+/**
+ * A hierarchical timer wheel.
+ *
+ * Time is measured in ticks.  The wheel has LEVEL_COUNT levels of SLOT_COUNT
+ * slots each, where a slot of level L covers SLOT_COUNT^L ticks.  A timer is
+ * placed in the lowest level whose range reaches its deadline, and is moved
+ * down a level ("cascaded") each time the current tick reaches the start of
+ * its slot, until it reaches level 0 and fires.  Inserting or cancelling a
+ * timer is therefore O(1), and each timer is touched at most LEVEL_COUNT
+ * times before it fires, no matter how many timers there are.
+ *
+ * Timers are stored in a single vector, and linked into their slot by index,
+ * so a Handle remains valid as the storage grows.  Each node has a
+ * generation, which changes when the node is freed, so that a Handle to a
+ * timer that has already finished is recognized and ignored.
+ *
+ * The wheel is not thread-safe; the caller must provide its own locking.
+ *
+ * @tparam T The type of item that is held by each timer.  It must be
+ *   default constructible and movable.
+ */
+template <typename T>
+class TimerWheel {
+  public:
+  /**
+   * A point in time, measured in ticks.
+   */
+  using Tick = uint64_t;
+
+  /**
+   * Identifies a timer in the wheel.
+   */
+  struct Handle {
+    /**
+     * The index of the timer's node.
+     */
+    uint32_t index;
+
+    /**
+     * The generation of the node when the timer was created.
+     */
+    uint32_t generation;
+  };
+
+  /**
+   * The number of bits of the tick that select a slot in each level.
+   */
+  static constexpr size_t SLOT_BITS{8};
+
+  /**
+   * The number of slots in each level.
+   */
+  static constexpr size_t SLOT_COUNT{size_t{1} << SLOT_BITS};
+
+  /**
+   * The number of levels.  Together, they cover 2^32 ticks.  A timer that is
+   * further away than that waits in the last slot of the top level, and is
+   * placed again when that slot is cascaded.
+   */
+  static constexpr size_t LEVEL_COUNT{4};
+
+  /**
+   * Get the current tick of the wheel.
+   *
+   * @returns The current tick.
+   */
+  Tick getNow() const {
+    return this->now;
+  }
+
+  /**
+   * Get the number of timers that are waiting in the wheel.
+   *
+   * Timers that have fired but have not yet been freed are not counted.
+   *
+   * @returns The number of timers.
+   */
+  size_t size() const {
+    return this->linkedCount;
+  }
+
+  /**
+   * Add a timer to the wheel.
+   *
+   * @param deadline The tick at which the timer fires.  A deadline that is
+   *   not after the current tick fires on the next tick.
+   * @param item The item held by the timer.
+   * @returns The handle of the timer.
+   */
+  Handle insert(Tick deadline, T && item) {
+    uint32_t index;
+    if (this->freeHead != NONE) {
+      index = this->freeHead;
+      this->freeHead = this->nodes[index].next;
+    }
+    else {
+      index = static_cast<uint32_t>(this->nodes.size());
+      this->nodes.emplace_back();
+    }
+    auto & node = this->nodes[index];
+    node.item = std::move(item);
+    this->link(index, std::max(deadline, this->now + 1));
+    return {index, node.generation};
+  }
+
+  /**
+   * Determine whether or not a handle refers to a timer that has not been
+   * freed, whether or not it is still waiting in the wheel.
+   *
+   * @param handle The handle of the timer.
+   * @returns True if the timer exists, False otherwise.
+   */
+  bool contains(Handle handle) const {
+    return (handle.index < this->nodes.size())
+      && (this->nodes[handle.index].generation == handle.generation)
+      && (this->nodes[handle.index].bucket != FREE);
+  }
+
+  /**
+   * Get the item held by a timer.
+   *
+   * @param handle The handle of a timer that exists.
+   * @returns The item.
+   */
+  T & get(Handle handle) {
+    return this->nodes[handle.index].item;
+  }
+
+  /**
+   * Get the deadline of a timer.
+   *
+   * @param handle The handle of a timer that exists.
+   * @returns The tick at which the timer fires (or fired).
+   */
+  Tick getDeadline(Handle handle) const {
+    return this->nodes[handle.index].deadline;
+  }
+
+  /**
+   * Put a timer that has fired back into the wheel.
+   *
+   * @param handle The handle of a timer that has fired and has not been
+   *   freed.
+   * @param deadline The tick at which the timer fires again.  A deadline
+   *   that is not after the current tick fires on the next tick.
+   */
+  void reschedule(Handle handle, Tick deadline) {
+    this->link(handle.index, std::max(deadline, this->now + 1));
+  }
+
+  /**
+   * Remove a timer, whether it is waiting in the wheel or has already fired.
+   *
+   * @param handle The handle of the timer.
+   * @returns The item held by the timer, or nothing if the timer did not
+   *   exist.
+   */
+  std::optional<T> remove(Handle handle) {
+    if (!this->contains(handle)) {
+      return std::nullopt;
+    }
+    if (this->nodes[handle.index].bucket != DETACHED) {
+      this->unlink(handle.index);
+    }
+    std::optional<T> item{std::move(this->nodes[handle.index].item)};
+    this->free(handle.index);
+    return item;
+  }
+
+  /**
+   * Move the current tick forward, collecting the timers that fire.
+   *
+   * The timers that fire are removed from their slots but are not freed, so
+   * that the caller may either remove() or reschedule() them.
+   *
+   * @param target The tick to advance to.
+   * @param due Receives the handles of the timers that fire, in the order of
+   *   their deadlines.
+   */
+  void advance(Tick target, std::vector<Handle> & due) {
+    while (this->now < target) {
+      if (!this->linkedCount) {
+        this->now = target;
+        break;
+      }
+
+      // Nothing happens before the next cascade of the lowest level that has
+      // any timers, so skip straight to it.
+      size_t lowest{0};
+      while (!this->levelCounts[lowest]) {
+        ++lowest;
+      }
+      if (lowest) {
+        auto last = this->now | ((Tick{1} << (SLOT_BITS * lowest)) - 1);
+        if (last >= target) {
+          this->now = target;
+          break;
+        }
+        this->now = last;
+      }
+
+      ++this->now;
+
+      // Cascade every level whose slot has just changed, from the top down.
+      for (size_t level = LEVEL_COUNT - 1; level > 0; --level) {
+        if (this->now & ((Tick{1} << (SLOT_BITS * level)) - 1)) {
+          continue;
+        }
+        auto bucket = level * SLOT_COUNT + ((this->now >> (SLOT_BITS * level)) & MASK);
+        auto index = this->buckets[bucket];
+        while (index != NONE) {
+          auto next = this->nodes[index].next;
+          this->unlink(index);
+          this->link(index, this->nodes[index].deadline);
+          index = next;
+        }
+      }
+
+      // Fire the timers in the current slot of level 0.
+      auto index = this->buckets[this->now & MASK];
+      while (index != NONE) {
+        auto next = this->nodes[index].next;
+        this->unlink(index);
+        due.push_back({index, this->nodes[index].generation});
+        index = next;
+      }
+    }
+  }
+
+  /**
+   * Find the next tick at which advance() may have something to do.
+   *
+   * @returns The tick at which the next timer fires or cascades, or nothing
+   *   if there are no timers in the wheel.
+   */
+  std::optional<Tick> getNextTick() const {
+    if (!this->linkedCount) {
+      return std::nullopt;
+    }
+
+    // The next cascade of the lowest higher level that has any timers, which
+    // may come before the next timer of level 0.
+    std::optional<Tick> next{};
+    size_t lowest{1};
+    while ((lowest < LEVEL_COUNT) && !this->levelCounts[lowest]) {
+      ++lowest;
+    }
+    if (lowest < LEVEL_COUNT) {
+      next = (this->now | ((Tick{1} << (SLOT_BITS * lowest)) - 1)) + 1;
+    }
+
+    if (this->levelCounts[0]) {
+      for (Tick tick = this->now + 1; !next || (tick < *next); ++tick) {
+        if (this->buckets[tick & MASK] != NONE) {
+          return tick;
+        }
+      }
+    }
+    return next;
+  }
+
+  private:
+  /**
+   * Marks the end of a list of nodes.
+   */
+  static constexpr uint32_t NONE{std::numeric_limits<uint32_t>::max()};
+
+  /**
+   * The bucket of a node that has fired but has not been freed.
+   */
+  static constexpr uint32_t DETACHED{std::numeric_limits<uint32_t>::max() - 1};
+
+  /**
+   * The bucket of a node that is on the free list.
+   */
+  static constexpr uint32_t FREE{std::numeric_limits<uint32_t>::max()};
+
+  /**
+   * Selects a slot from the bits of a tick.
+   */
+  static constexpr Tick MASK{SLOT_COUNT - 1};
+
+  /**
+   * A timer, or a free node.
+   */
+  struct Node {
+    /**
+     * The item held by the timer.
+     */
+    T item{};
+
+    /**
+     * The tick at which the timer fires.
+     */
+    Tick deadline{0};
+
+    /**
+     * The previous node in the same bucket, or NONE.
+     */
+    uint32_t previous{NONE};
+
+    /**
+     * The next node in the same bucket (or on the free list), or NONE.
+     */
+    uint32_t next{NONE};
+
+    /**
+     * The bucket that holds the node, or DETACHED, or FREE.
+     */
+    uint32_t bucket{DETACHED};
+
+    /**
+     * Incremented each time that the node is freed.
+     */
+    uint32_t generation{0};
+  };
+
+  /**
+   * Choose the bucket for a deadline, relative to the current tick.
+   *
+   * @param deadline The deadline, which is not before the current tick.
+   * @returns The index of the bucket.
+   */
+  size_t chooseBucket(Tick deadline) const {
+    for (size_t level = 0; level < LEVEL_COUNT; ++level) {
+      auto shift = SLOT_BITS * level;
+      if ((deadline >> shift) - (this->now >> shift) < SLOT_COUNT) {
+        return level * SLOT_COUNT + ((deadline >> shift) & MASK);
+      }
+    }
+
+    // Wait in the last slot of the top level, which is the last one to be
+    // cascaded.
+    auto shift = SLOT_BITS * (LEVEL_COUNT - 1);
+    return (LEVEL_COUNT - 1) * SLOT_COUNT + (((this->now >> shift) + SLOT_COUNT - 1) & MASK);
+  }
+
+  /**
+   * Link a node into the bucket for its deadline.
+   *
+   * A deadline of the current tick is only used while cascading, when the
+   * slot of the current tick has not fired yet.
+   *
+   * @param index The index of the node, which is not in a bucket.
+   * @param deadline The deadline of the node, which is not before the
+   *   current tick.
+   */
+  void link(uint32_t index, Tick deadline) {
+    auto & node = this->nodes[index];
+    node.deadline = deadline;
+    auto bucket = this->chooseBucket(deadline);
+    node.bucket = static_cast<uint32_t>(bucket);
+    node.previous = NONE;
+    node.next = this->buckets[bucket];
+    if (node.next != NONE) {
+      this->nodes[node.next].previous = index;
+    }
+    this->buckets[bucket] = index;
+    ++this->levelCounts[bucket / SLOT_COUNT];
+    ++this->linkedCount;
+  }
+
+  /**
+   * Unlink a node from its bucket.
+   *
+   * @param index The index of the node, which is in a bucket.
+   */
+  void unlink(uint32_t index) {
+    auto & node = this->nodes[index];
+    if (node.previous != NONE) {
+      this->nodes[node.previous].next = node.next;
+    }
+    else {
+      this->buckets[node.bucket] = node.next;
+    }
+    if (node.next != NONE) {
+      this->nodes[node.next].previous = node.previous;
+    }
+    --this->levelCounts[node.bucket / SLOT_COUNT];
+    --this->linkedCount;
+    node.bucket = DETACHED;
+  }
+
+  /**
+   * Put a node that is not in a bucket onto the free list.
+   *
+   * @param index The index of the node.
+   */
+  void free(uint32_t index) {
+    auto & node = this->nodes[index];
+    node.item = T{};
+    node.bucket = FREE;
+    ++node.generation;
+    node.next = this->freeHead;
+    this->freeHead = index;
+  }
+
+  /**
+   * Every node, whether it is a timer or free.
+   */
+  std::vector<Node> nodes{};
+
+  /**
+   * The first node of each bucket, by level and then slot.
+   */
+  std::array<uint32_t, LEVEL_COUNT * SLOT_COUNT> buckets = [](){
+    std::array<uint32_t, LEVEL_COUNT * SLOT_COUNT> buckets{};
+    buckets.fill(NONE);
+    return buckets;
+  }();
+
+  /**
+   * The number of timers in the buckets of each level.
+   */
+  std::array<size_t, LEVEL_COUNT> levelCounts{};
+
+  /**
+   * The number of timers in all of the buckets.
+   */
+  size_t linkedCount{0};
+
+  /**
+   * The first node of the free list, or NONE.
+   */
+  uint32_t freeHead{NONE};
+
+  /**
+   * The current tick.
+   */
+  Tick now{0};
+};
+
+}
+
+#endif // TIMERWHEEL_HPP
@@ -0,0 +1,282 @@
+/**
+ * @file
+ *
+ * Lock-free work-stealing deque used by the Pool work-stealing scheduler.
+ */
+
+#ifndef WORKSTEALINGDEQUE_HPP
+#define WORKSTEALINGDEQUE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace Ghoti::Pool {
+
+/**
+ * A Chase-Lev work-stealing deque.
+ *
+ * The deque has a single owner, which pushes and takes items from the bottom
+ * in LIFO order.  Any other thread may steal items from the top in FIFO order.
+ * Neither operation requires a lock.  Only the owning thread may call push()
+ * and take(), but steal(), size(), and empty() may be called from anywhere.
+ *
+ * Items are stored as pointers so that each slot can be read and written
+ * atomically.  The deque takes ownership of any pointer that is pushed, and
+ * gives that ownership to whoever successfully takes or steals it.  Anything
+ * that is left in the deque is deleted when the deque is destroyed.
+ *
+ * The implementation follows "Correct and Efficient Work-Stealing for Weak
+ * Memory Models" (Lê, Pop, Cohen, and Zappa Nardelli, 2013), using sequentially
+ * consistent operations in place of the stand-alone fences of the paper.
+ *
+ * @tparam T The type of item that is being stored.
+ */
+template <typename T>
+class WorkStealingDeque {
+  public:
+  /**
+   * Constructor.
+   *
+   * @param capacity The initial capacity of the deque.  It will be rounded up
+   *   to a power of 2.  The deque will grow as needed.
+   */
+  WorkStealingDeque(size_t capacity = 64) : top{0}, bottom{0} {
+    size_t size{1};
+    while (size < capacity) {
+      size <<= 1;
+    }
+    this->buffers.push_back(std::make_unique<Buffer>(size));
+    this->buffer.store(this->buffers.back().get(), std::memory_order_relaxed);
+  }
+
+  /**
+   * Destructor.
+   *
+   * Deletes any items that remain in the deque.
+   */
+  ~WorkStealingDeque() {
+    while (auto item = this->take()) {
+      delete item;
+    }
+  }
+
+  // Remove the copy constructor.
+  WorkStealingDeque(const WorkStealingDeque &) = delete;
+
+  // Remove the copy assignment.
+  WorkStealingDeque & operator=(const WorkStealingDeque &) = delete;
+
+  /**
+   * Push an item onto the bottom of the deque.
+   *
+   * Must only be called by the owner of the deque.
+   *
+   * @param item The item to push.  The deque takes ownership of the pointer.
+   */
+  void push(T * item) {
+    auto b = this->bottom.load(std::memory_order_relaxed);
+    auto t = this->top.load(std::memory_order_acquire);
+    auto buf = this->buffer.load(std::memory_order_relaxed);
+
+    // Grow the buffer if it is full.
+    if (b - t > static_cast<int64_t>(buf->mask)) {
+      buf = this->grow(buf, t, b);
+    }
+
+    buf->put(b, item);
+    this->bottom.store(b + 1, std::memory_order_release);
+  }
+
+  /**
+   * Take an item from the bottom of the deque.
+   *
+   * Must only be called by the owner of the deque.
+   *
+   * @returns The item, or nullptr if the deque is empty.
+   */
+  T * take() {
+    auto b = this->bottom.load(std::memory_order_relaxed) - 1;
+    auto buf = this->buffer.load(std::memory_order_relaxed);
+    this->bottom.store(b, std::memory_order_seq_cst);
+    auto t = this->top.load(std::memory_order_seq_cst);
+
+    // The deque was empty.
+    if (t > b) {
+      this->bottom.store(b + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+
+    auto item = buf->get(b);
+    if (t == b) {
+      // This is the last item, so we must race the thieves for it.
+      if (!this->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+        item = nullptr;
+      }
+      this->bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return item;
+  }
+
+  /**
+   * Steal an item from the top of the deque.
+   *
+   * May be called from any thread.
+   *
+   * @returns The item, or nullptr if the deque is empty or if another thread
+   *   won the race for the item.
+   */
+  T * steal() {
+    auto t = this->top.load(std::memory_order_seq_cst);
+    auto b = this->bottom.load(std::memory_order_seq_cst);
+
+    if (t >= b) {
+      return nullptr;
+    }
+
+    auto item = this->buffer.load(std::memory_order_acquire)->get(t);
+    if (!this->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+      return nullptr;
+    }
+    return item;
+  }
+
+  /**
+   * Get the item that take() would return next, without removing it.
+   *
+   * Must only be called by the owner of the deque.  A thief may take the item
+   * (and its new owner may destroy it) at any time, so the pointer must not be
+   * dereferenced.  It is only a hint, e.g., for prefetching.
+   *
+   * @returns The item, or nullptr if the deque is empty.
+   */
+  T * peekBottom() const {
+    auto b = this->bottom.load(std::memory_order_relaxed);
+    auto t = this->top.load(std::memory_order_relaxed);
+    return (t < b) ? this->buffer.load(std::memory_order_relaxed)->get(b - 1) : nullptr;
+  }
+
+  /**
+   * Get the item that steal() would return next, without removing it.
+   *
+   * Must only be called by the owner of the deque, because only the owner
+   * replaces the buffer.  The same caveats as peekBottom() apply.
+   *
+   * @returns The item, or nullptr if the deque is empty.
+   */
+  T * peekTop() const {
+    auto b = this->bottom.load(std::memory_order_relaxed);
+    auto t = this->top.load(std::memory_order_relaxed);
+    return (t < b) ? this->buffer.load(std::memory_order_relaxed)->get(t) : nullptr;
+  }
+
+  /**
+   * Get the approximate number of items in the deque.
+   *
+   * @returns The approximate number of items in the deque.
+   */
+  size_t size() const {
+    auto b = this->bottom.load(std::memory_order_relaxed);
+    auto t = this->top.load(std::memory_order_relaxed);
+    return b > t ? static_cast<size_t>(b - t) : 0;
+  }
+
+  /**
+   * Determine whether or not the deque is (approximately) empty.
+   *
+   * @returns True if the deque is empty, False otherwise.
+   */
+  bool empty() const {
+    return this->size() == 0;
+  }
+
+  private:
+  /**
+   * Circular array of item slots.
+   */
+  struct Buffer {
+    /**
+     * Constructor.
+     *
+     * @param size The number of slots.  Must be a power of 2.
+     */
+    Buffer(size_t size) : mask{size - 1}, slots{std::make_unique<std::atomic<T *>[]>(size)} {}
+
+    /**
+     * Read a slot.
+     *
+     * @param index The (unwrapped) index of the slot.
+     * @returns The item in the slot.
+     */
+    T * get(int64_t index) const {
+      return this->slots[static_cast<size_t>(index) & this->mask].load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Write a slot.
+     *
+     * @param index The (unwrapped) index of the slot.
+     * @param item The item to write into the slot.
+     */
+    void put(int64_t index, T * item) {
+      this->slots[static_cast<size_t>(index) & this->mask].store(item, std::memory_order_relaxed);
+    }
+
+    /**
+     * One less than the number of slots, used to wrap the indices.
+     */
+    size_t mask;
+
+    /**
+     * The slots themselves.
+     */
+    std::unique_ptr<std::atomic<T *>[]> slots;
+  };
+
+  /**
+   * Replace the buffer with one that is twice as large.
+   *
+   * The old buffer is retained, because a thief may still be reading from it.
+   *
+   * @param old The current buffer.
+   * @param t The current top index.
+   * @param b The current bottom index.
+   * @returns The new buffer.
+   */
+  Buffer * grow(Buffer * old, int64_t t, int64_t b) {
+    this->buffers.push_back(std::make_unique<Buffer>((old->mask + 1) << 1));
+    auto buf = this->buffers.back().get();
+    for (auto i = t; i < b; ++i) {
+      buf->put(i, old->get(i));
+    }
+    this->buffer.store(buf, std::memory_order_release);
+    return buf;
+  }
+
+  /**
+   * The index of the next item to be stolen.
+   */
+  std::atomic<int64_t> top;
+
+  /**
+   * The index one past the most recently pushed item.
+   */
+  std::atomic<int64_t> bottom;
+
+  /**
+   * The buffer that is currently in use.
+   */
+  std::atomic<Buffer *> buffer;
+
+  /**
+   * Every buffer that has been used by this deque.
+   *
+   * Only modified by the owner.
+   */
+  std::vector<std::unique_ptr<Buffer>> buffers;
+};
+
+}
+
+#endif // WORKSTEALINGDEQUE_HPP
@@ -0,0 +1,728 @@
+/**
+ * @file
+ *
+ * Stress and scalability tests for the Pool thread pool.
+ *
+ * Each scenario runs a fixed number of tasks, checks that every task ran
+ * exactly once, and reports the throughput and the p50/p99/p999 latency from
+ * enqueuing a task until it starts to run.  The scenarios cover:
+ *
+ * - Mixes of producer and worker threads for each scheduler.
+ * - A pool that is resized with Pool::setThreadCount() while tasks are being
+ *   enqueued.
+ * - Repeated start(), stop(), and join() cycles of a pool with queued tasks.
+ *
+ * The program fails if a check fails, or if a result is worse than its
+ * baseline by more than the tolerance.  Run it with `make stress`, or build it
+ * with ThreadSanitizer with `make stress-tsan`.
+ *
+ * Options:
+ *
+ * - `--scale <factor>` multiplies the number of tasks of every scenario.
+ * - `--filter <text>` only runs the scenarios whose name contains the text.
+ * - `--repetitions <count>` runs each scenario several times (default 3) and
+ *   reports the best throughput and latencies of the runs, so that a single
+ *   run that was disturbed by the rest of the machine does not fail the
+ *   checks.
+ * - `--baseline <file>` compares the results against a baseline file.
+ * - `--write-baseline <file>` writes the results as a new baseline file.
+ * - `--tolerance <factor>` is how far the throughput may be below its
+ *   baseline, as a factor of 1 + tolerance (default 1, i.e., half the
+ *   throughput).
+ * - `--latency-tolerance <factor>` is how far the p99 latency may be above its
+ *   baseline, as a factor of 1 + tolerance (default 3, i.e., four times the
+ *   latency).  Tail latencies depend on how the operating system schedules
+ *   the threads, so they vary more from run to run than the throughput.
+ */
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "pool.hpp"
+
+using namespace std;
+using namespace std::chrono;
+using namespace Ghoti::Pool;
+
+/**
+ * The number of tasks in each producer/consumer scenario, before scaling.
+ */
+static constexpr size_t MIX_TASKS{200000};
+
+/**
+ * The number of tasks in the resize scenario, before scaling.
+ */
+static constexpr size_t RESIZE_TASKS{500000};
+
+/**
+ * The number of start/stop/join cycles, before scaling.
+ */
+static constexpr size_t LIFECYCLE_CYCLES{2000};
+
+/**
+ * The number of tasks enqueued in each start/stop/join cycle.
+ */
+static constexpr size_t TASKS_PER_CYCLE{50};
+
+/**
+ * The most threads that the resize scenario asks for.
+ */
+static constexpr size_t RESIZE_MAX_THREADS{8};
+
+/**
+ * How long a scenario may take to run all of its tasks before it fails.
+ */
+static constexpr seconds SCENARIO_TIMEOUT{300};
+
+/**
+ * The number of shards in a LatencyRecorder.
+ */
+static constexpr size_t RECORDER_SHARDS{16};
+
+/**
+ * Records latencies from many threads into the buckets of a LatencyHistogram.
+ *
+ * Each thread records into one of several shards of atomic counters, so that
+ * the threads do not all contend on the same counters.  Because the bucket
+ * boundaries are fixed, the same latencies always give the same percentiles,
+ * whatever order they were recorded in.
+ */
+class LatencyRecorder {
+  public:
+  /**
+   * Record a latency.
+   *
+   * @param latency The latency.
+   */
+  void record(nanoseconds latency) {
+    auto & shard = this->shards[LatencyRecorder::shardIndex()];
+    shard.counts[LatencyHistogram::getBucket(latency)].fetch_add(1, memory_order_relaxed);
+    shard.total.fetch_add(static_cast<uint64_t>(latency.count()), memory_order_relaxed);
+  }
+
+  /**
+   * Remove all recorded latencies.
+   *
+   * This must not be called while a latency is being recorded.
+   */
+  void reset() {
+    for (auto & shard : this->shards) {
+      for (auto & count : shard.counts) {
+        count.store(0, memory_order_relaxed);
+      }
+      shard.total.store(0, memory_order_relaxed);
+    }
+  }
+
+  /**
+   * Merge the shards into a histogram.
+   *
+   * @returns The histogram of every recorded latency.
+   */
+  LatencyHistogram getHistogram() const {
+    LatencyHistogram histogram{};
+    for (auto & shard : this->shards) {
+      for (size_t bucket = 0; bucket < LatencyHistogram::BUCKET_COUNT; ++bucket) {
+        histogram.counts[bucket] += shard.counts[bucket].load(memory_order_relaxed);
+      }
+      histogram.total += nanoseconds{shard.total.load(memory_order_relaxed)};
+    }
+    return histogram;
+  }
+
+  private:
+  /**
+   * The counters of some of the threads.
+   */
+  struct alignas(64) Shard {
+    /**
+     * The number of latencies recorded in each bucket.
+     */
+    array<atomic<uint64_t>, LatencyHistogram::BUCKET_COUNT> counts{};
+
+    /**
+     * The sum of the recorded latencies, in nanoseconds.
+     */
+    atomic<uint64_t> total{0};
+  };
+
+  /**
+   * Get the shard of the calling thread.
+   *
+   * @returns The index of the shard.
+   */
+  static size_t shardIndex() {
+    static atomic<size_t> nextShard{0};
+    thread_local size_t shard{nextShard.fetch_add(1, memory_order_relaxed) % RECORDER_SHARDS};
+    return shard;
+  }
+
+  /**
+   * The shards.
+   */
+  array<Shard, RECORDER_SHARDS> shards{};
+};
+
+/**
+ * The results of one scenario.
+ */
+struct Result {
+  /**
+   * The name of the scenario.
+   */
+  string name;
+
+  /**
+   * The number of tasks that ran.
+   */
+  size_t tasks;
+
+  /**
+   * The time from enqueuing the first task until the last task finished.
+   */
+  duration<double> elapsed;
+
+  /**
+   * The median enqueue-to-run latency, in nanoseconds.
+   */
+  uint64_t p50;
+
+  /**
+   * The 99th percentile enqueue-to-run latency, in nanoseconds.
+   */
+  uint64_t p99;
+
+  /**
+   * The 99.9th percentile enqueue-to-run latency, in nanoseconds.
+   */
+  uint64_t p999;
+
+  /**
+   * Whether or not every task ran exactly once.
+   */
+  bool passed;
+
+  /**
+   * Get the number of tasks run per second.
+   *
+   * @returns The throughput.
+   */
+  double throughput() const {
+    return this->elapsed.count() > 0 ? static_cast<double>(this->tasks) / this->elapsed.count() : 0;
+  }
+};
+
+/**
+ * The options given on the command line.
+ */
+struct Options {
+  /**
+   * Multiplies the number of tasks in every scenario.
+   */
+  double scale{1};
+
+  /**
+   * Only scenarios whose name contains this text are run.
+   */
+  string filter{};
+
+  /**
+   * The number of times that each scenario is run.
+   */
+  size_t repetitions{3};
+
+  /**
+   * The baseline file to compare the results against, if any.
+   */
+  string baseline{};
+
+  /**
+   * The file to write the results to as a new baseline, if any.
+   */
+  string writeBaseline{};
+
+  /**
+   * How far the throughput may be below its baseline.
+   */
+  double tolerance{1};
+
+  /**
+   * How far the p99 latency may be above its baseline.
+   */
+  double latencyTolerance{3};
+};
+
+/**
+ * The latencies of the scenario that is running.
+ *
+ * It is large, so it is allocated once and reset for each scenario.
+ */
+static auto latencies = make_unique<LatencyRecorder>();
+
+/**
+ * Get the time since an earlier time.
+ *
+ * @param since The earlier time.
+ * @returns The time since then.
+ */
+static nanoseconds nanosecondsSince(steady_clock::time_point since) {
+  return duration_cast<nanoseconds>(steady_clock::now() - since);
+}
+
+/**
+ * Scale a number of tasks, keeping at least one.
+ *
+ * @param count The number of tasks.
+ * @param options The command line options.
+ * @returns The scaled number of tasks.
+ */
+static size_t scaled(size_t count, const Options & options) {
+  return max<size_t>(static_cast<size_t>(static_cast<double>(count) * options.scale), 1);
+}
+
+/**
+ * Wait until a number of tasks have finished.
+ *
+ * @param finished The number of tasks that have finished.
+ * @param target The number of tasks to wait for.
+ * @returns True if the tasks finished, False if the SCENARIO_TIMEOUT passed
+ *   first.
+ */
+static bool waitForTasks(const atomic<size_t> & finished, size_t target) {
+  auto deadline = steady_clock::now() + SCENARIO_TIMEOUT;
+  while (finished.load(memory_order_acquire) < target) {
+    if (steady_clock::now() > deadline) {
+      return false;
+    }
+    this_thread::sleep_for(100us);
+  }
+  return true;
+}
+
+/**
+ * Fill in the latencies of a result, and report any failed check.
+ *
+ * @param result The result.
+ * @param failure A description of the failed check, or empty if every check
+ *   passed.
+ * @returns The result.
+ */
+static Result finishResult(Result result, const string & failure) {
+  auto histogram = latencies->getHistogram();
+  result.p50 = static_cast<uint64_t>(histogram.getPercentile(50).count());
+  result.p99 = static_cast<uint64_t>(histogram.getPercentile(99).count());
+  result.p999 = static_cast<uint64_t>(histogram.getPercentile(99.9).count());
+  result.passed = failure.empty();
+  if (!result.passed) {
+    cerr << "FAIL " << result.name << ": " << failure << endl;
+  }
+  return result;
+}
+
+/**
+ * Enqueue tasks from several producer threads onto a pool, and wait for them
+ * to run.
+ *
+ * @param name The name of the scenario.
+ * @param scheduler The scheduler of the pool.
+ * @param batchSize The batch size of the pool.
+ * @param producers The number of producer threads.
+ * @param workers The number of threads of the pool.
+ * @param taskCount The number of tasks, which is rounded down to a multiple of
+ *   the number of producers.
+ * @returns The result.
+ */
+static Result runMix(const string & name, Scheduler scheduler, size_t batchSize, size_t producers, size_t workers, size_t taskCount) {
+  latencies->reset();
+  size_t perProducer = max<size_t>(taskCount / producers, 1);
+  size_t total = perProducer * producers;
+  atomic<size_t> finished{0};
+
+  Pool pool{workers, scheduler};
+  pool.setBatchSize(batchSize);
+  pool.start();
+
+  auto started = steady_clock::now();
+  {
+    vector<jthread> threads;
+    for (size_t producer = 0; producer < producers; ++producer) {
+      threads.emplace_back([&] {
+        for (size_t i = 0; i < perProducer; ++i) {
+          pool.enqueue([&finished, enqueuedAt = steady_clock::now()] {
+            latencies->record(nanosecondsSince(enqueuedAt));
+            finished.fetch_add(1, memory_order_release);
+          });
+        }
+      });
+    }
+  }
+  bool completed = waitForTasks(finished, total);
+  auto elapsed = steady_clock::now() - started;
+  pool.join();
+
+  string failure;
+  if (!completed) {
+    failure = "timed out with " + to_string(finished.load()) + " of " + to_string(total) + " tasks run";
+  }
+  else if ((finished.load() != total) || pool.getTaskQueueCount()) {
+    failure = to_string(finished.load()) + " of " + to_string(total) + " tasks run, "
+      + to_string(pool.getTaskQueueCount()) + " still queued";
+  }
+  return finishResult({name, total, elapsed, 0, 0, 0, false}, failure);
+}
+
+/**
+ * Enqueue tasks onto a pool while its number of threads is changed, and check
+ * that each task ran exactly once.
+ *
+ * @param taskCount The number of tasks.
+ * @returns The result.
+ */
+static Result runResize(size_t taskCount) {
+  latencies->reset();
+  static constexpr size_t PRODUCERS{2};
+  size_t perProducer = max<size_t>(taskCount / PRODUCERS, 1);
+  size_t total = perProducer * PRODUCERS;
+  atomic<size_t> finished{0};
+  auto runs = make_unique<atomic<uint32_t>[]>(total);
+
+  Pool pool{RESIZE_MAX_THREADS / 2};
+  pool.start();
+
+  auto started = steady_clock::now();
+  atomic<size_t> producing{PRODUCERS};
+  {
+    vector<jthread> threads;
+    for (size_t producer = 0; producer < PRODUCERS; ++producer) {
+      threads.emplace_back([&, producer] {
+        for (size_t i = producer * perProducer; i < (producer + 1) * perProducer; ++i) {
+          pool.enqueue([&finished, &runs, i, enqueuedAt = steady_clock::now()] {
+            latencies->record(nanosecondsSince(enqueuedAt));
+            runs[i].fetch_add(1, memory_order_relaxed);
+            finished.fetch_add(1, memory_order_release);
+          });
+        }
+        producing.fetch_sub(1);
+      });
+    }
+
+    // Walk the thread count up and down (1, 2, ..., max, ..., 2, 1, ...) in a
+    // fixed order until the producers are done.
+    threads.emplace_back([&] {
+      size_t step{0};
+      while (producing.load()) {
+        size_t position = step++ % (2 * RESIZE_MAX_THREADS - 2);
+        pool.setThreadCount(position < RESIZE_MAX_THREADS ? position + 1 : 2 * RESIZE_MAX_THREADS - 1 - position);
+        this_thread::sleep_for(1ms);
+      }
+      pool.setThreadCount(RESIZE_MAX_THREADS / 2);
+    });
+  }
+  bool completed = waitForTasks(finished, total);
+  auto elapsed = steady_clock::now() - started;
+  pool.join();
+
+  string failure;
+  if (!completed) {
+    failure = "timed out with " + to_string(finished.load()) + " of " + to_string(total) + " tasks run";
+  }
+  else {
+    for (size_t i = 0; i < total; ++i) {
+      if (runs[i].load() != 1) {
+        failure = "task " + to_string(i) + " ran " + to_string(runs[i].load()) + " times";
+        break;
+      }
+    }
+  }
+  return finishResult({"resize", total, elapsed, 0, 0, 0, false}, failure);
+}
+
+/**
+ * Repeatedly start a pool, enqueue tasks, and stop or join it, and check that
+ * every task runs once the pool is started for the last time.
+ *
+ * Tasks that are still queued when the pool stops wait through the stopped
+ * period, so the latencies of this scenario measure how long tasks survive
+ * across cycles rather than how quickly they are claimed.
+ *
+ * @param cycles The number of cycles.
+ * @returns The result.
+ */
+static Result runLifecycle(size_t cycles) {
+  latencies->reset();
+  size_t total = cycles * TASKS_PER_CYCLE;
+  atomic<size_t> finished{0};
+
+  Pool pool{2};
+  auto started = steady_clock::now();
+  for (size_t cycle = 0; cycle < cycles; ++cycle) {
+    pool.start();
+    for (size_t i = 0; i < TASKS_PER_CYCLE; ++i) {
+      pool.enqueue([&finished, enqueuedAt = steady_clock::now()] {
+        latencies->record(nanosecondsSince(enqueuedAt));
+        finished.fetch_add(1, memory_order_release);
+      });
+    }
+    // Alternate between the three ways of ending a cycle.
+    switch (cycle % 3) {
+      case 0:
+        pool.stop();
+        break;
+      case 1:
+        pool.join();
+        break;
+      default:
+        pool.stop();
+        pool.join();
+    }
+  }
+  pool.start();
+  bool completed = waitForTasks(finished, total);
+  auto elapsed = steady_clock::now() - started;
+  pool.join();
+
+  string failure;
+  if (!completed) {
+    failure = "timed out with " + to_string(finished.load()) + " of " + to_string(total) + " tasks run";
+  }
+  else if ((finished.load() != total) || pool.getTaskQueueCount()) {
+    failure = to_string(finished.load()) + " of " + to_string(total) + " tasks run, "
+      + to_string(pool.getTaskQueueCount()) + " still queued";
+  }
+  return finishResult({"lifecycle", total, elapsed, 0, 0, 0, false}, failure);
+}
+
+/**
+ * Combine the results of two runs of a scenario.
+ *
+ * @param first The result of one run.
+ * @param second The result of another run.
+ * @returns The best throughput and latencies of the two runs, which only
+ *   passed if both runs passed.
+ */
+static Result bestOf(const Result & first, const Result & second) {
+  Result best{first};
+  best.elapsed = min(first.elapsed, second.elapsed);
+  best.p50 = min(first.p50, second.p50);
+  best.p99 = min(first.p99, second.p99);
+  best.p999 = min(first.p999, second.p999);
+  best.passed = first.passed && second.passed;
+  return best;
+}
+
+/**
+ * Print the header of the results table.
+ */
+static void printHeader() {
+  printf("%-28s %10s %14s %12s %12s %12s\n", "scenario", "tasks", "tasks/s", "p50 ns", "p99 ns", "p999 ns");
+}
+
+/**
+ * Print one row of the results table.
+ *
+ * @param result The result.
+ */
+static void printResult(const Result & result) {
+  printf("%-28s %10zu %14.0f %12llu %12llu %12llu%s\n",
+    result.name.c_str(),
+    result.tasks,
+    result.throughput(),
+    static_cast<unsigned long long>(result.p50),
+    static_cast<unsigned long long>(result.p99),
+    static_cast<unsigned long long>(result.p999),
+    result.passed ? "" : "  FAILED");
+  fflush(stdout);
+}
+
+/**
+ * Write the results as a baseline file.
+ *
+ * @param path The path of the file.
+ * @param results The results.
+ * @returns True if the file was written, False otherwise.
+ */
+static bool writeBaseline(const string & path, const vector<Result> & results) {
+  ofstream file{path};
+  file << "# Stress test baseline: <scenario> <tasks/s> <p99 ns>\n";
+  file << "# Regenerate with `make stress-baseline` on the machine that runs `make stress`.\n";
+  for (auto & result : results) {
+    file << result.name << " " << static_cast<uint64_t>(result.throughput()) << " " << result.p99 << "\n";
+  }
+  return static_cast<bool>(file);
+}
+
+/**
+ * Compare the results against a baseline file.
+ *
+ * A scenario that is not in the baseline is not compared.  A baseline value of
+ * 0 is not compared.
+ *
+ * @param path The path of the file.
+ * @param results The results.
+ * @param options The command line options, which give the tolerances.
+ * @returns True if no result regressed, False otherwise.
+ */
+static bool checkBaseline(const string & path, const vector<Result> & results, const Options & options) {
+  ifstream file{path};
+  if (!file) {
+    cerr << "Cannot read the baseline " << path << endl;
+    return false;
+  }
+  map<string, pair<double, double>> baseline;
+  string line;
+  while (getline(file, line)) {
+    if (line.empty() || (line[0] == '#')) {
+      continue;
+    }
+    istringstream fields{line};
+    string name;
+    double throughput{0}, p99{0};
+    if (fields >> name >> throughput >> p99) {
+      baseline[name] = {throughput, p99};
+    }
+  }
+
+  bool passed{true};
+  for (auto & result : results) {
+    auto found = baseline.find(result.name);
+    if (found == baseline.end()) {
+      continue;
+    }
+    auto [throughput, p99] = found->second;
+    if (throughput && (result.throughput() * (1 + options.tolerance) < throughput)) {
+      cerr << "REGRESSION " << result.name << ": " << static_cast<uint64_t>(result.throughput())
+        << " tasks/s, baseline " << static_cast<uint64_t>(throughput) << endl;
+      passed = false;
+    }
+    if (p99 && (static_cast<double>(result.p99) > p99 * (1 + options.latencyTolerance))) {
+      cerr << "REGRESSION " << result.name << ": p99 " << result.p99
+        << " ns, baseline " << static_cast<uint64_t>(p99) << endl;
+      passed = false;
+    }
+  }
+  return passed;
+}
+
+/**
+ * Parse the command line.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @param options Receives the options.
+ * @returns True if the command line was valid, False otherwise.
+ */
+static bool parseOptions(int argc, char ** argv, Options & options) {
+  for (int i = 1; i < argc; ++i) {
+    string option{argv[i]};
+    if (i + 1 >= argc) {
+      return false;
+    }
+    string value{argv[++i]};
+    try {
+      if (option == "--scale") {
+        options.scale = stod(value);
+      }
+      else if (option == "--filter") {
+        options.filter = value;
+      }
+      else if (option == "--repetitions") {
+        options.repetitions = stoul(value);
+      }
+      else if (option == "--baseline") {
+        options.baseline = value;
+      }
+      else if (option == "--write-baseline") {
+        options.writeBaseline = value;
+      }
+      else if (option == "--tolerance") {
+        options.tolerance = stod(value);
+      }
+      else if (option == "--latency-tolerance") {
+        options.latencyTolerance = stod(value);
+      }
+      else {
+        return false;
+      }
+    }
+    catch (const exception &) {
+      return false;
+    }
+  }
+  return options.scale > 0 && options.repetitions && options.tolerance >= 0 && options.latencyTolerance >= 0;
+}
+
+int main(int argc, char ** argv) {
+  Options options;
+  if (!parseOptions(argc, argv, options)) {
+    cerr << "Usage: " << argv[0]
+      << " [--scale <factor>] [--filter <text>] [--repetitions <count>] [--baseline <file>] [--write-baseline <file>] [--tolerance <factor>] [--latency-tolerance <factor>]" << endl;
+    return 2;
+  }
+
+  // The scenarios, in the order that they are run and reported.
+  vector<pair<string, function<Result()>>> scenarios;
+  struct SchedulerCase {
+    const char * name;
+    Scheduler scheduler;
+    size_t batchSize;
+  };
+  for (auto [schedulerName, scheduler, batchSize] : {
+      SchedulerCase{"fifo", Scheduler::FIFO, 1},
+      SchedulerCase{"fifo-batch", Scheduler::FIFO, 32},
+      SchedulerCase{"work-stealing", Scheduler::WORK_STEALING, 32},
+      SchedulerCase{"ring", Scheduler::RING, 1}}) {
+    for (auto [producers, workers] : {pair<size_t, size_t>{1, 1}, {1, 4}, {4, 1}, {4, 4}}) {
+      string name = string{schedulerName} + "/p" + to_string(producers) + "-w" + to_string(workers);
+      scenarios.emplace_back(name, [=, scheduler = scheduler, batchSize = batchSize] {
+        return runMix(name, scheduler, batchSize, producers, workers, scaled(MIX_TASKS, options));
+      });
+    }
+  }
+  scenarios.emplace_back("resize", [&] {
+    return runResize(scaled(RESIZE_TASKS, options));
+  });
+  scenarios.emplace_back("lifecycle", [&] {
+    return runLifecycle(scaled(LIFECYCLE_CYCLES, options));
+  });
+
+  vector<Result> results;
+  bool passed{true};
+  printHeader();
+  for (auto & [name, scenario] : scenarios) {
+    if (name.find(options.filter) == string::npos) {
+      continue;
+    }
+    auto best = scenario();
+    for (size_t repetition = 1; repetition < options.repetitions; ++repetition) {
+      best = bestOf(best, scenario());
+    }
+    results.push_back(best);
+    printResult(results.back());
+    passed = passed && results.back().passed;
+  }
+
+  if (!options.writeBaseline.empty()) {
+    if (!writeBaseline(options.writeBaseline, results)) {
+      cerr << "Cannot write the baseline " << options.writeBaseline << endl;
+      passed = false;
+    }
+  }
+  else if (!options.baseline.empty()) {
+    passed = checkBaseline(options.baseline, results, options) && passed;
+  }
+
+  joinGlobalPool();
+  return passed ? 0 : 1;
+}
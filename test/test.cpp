@@ -5,10 +5,28 @@
  */
 
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
 #include <functional>
+#include <future>
 #include <iostream>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
 #include <thread>
+#include <vector>
 #include "pool.hpp"
+#include "pool_algorithms.hpp"
+#include "pool_basic.hpp"
+#include "pool_coroutine.hpp"
+
+#ifdef __linux__
+#include <sched.h>
+#endif
 
 using namespace std;
 using namespace Ghoti::Pool;
@@ -24,6 +42,19 @@ function threadSleep = [](chrono::milliseconds duration){
   };
 };
 
+// Helper function that will poll until a condition is true, or until the
+// timeout expires.  Returns the final value of the condition.
+static bool waitUntil(function<bool()> condition, chrono::milliseconds timeout = 5000ms) {
+  auto deadline = chrono::steady_clock::now() + timeout;
+  while (!condition()) {
+    if (chrono::steady_clock::now() > deadline) {
+      return false;
+    }
+    this_thread::sleep_for(100us);
+  }
+  return true;
+}
+
 TEST(JoinGlobalPool, Repeated) {
   // Verify that calling joinGlobalPool() repeatedly doesn't break anything.
   EXPECT_NO_THROW(joinGlobalPool());
@@ -48,15 +79,96 @@ TEST(JoinGlobalPool, AsJoin) {
     this_thread::yield();
   }
 
-  // Verify that there is one thread running, even though the Pool has been
-  // destroyed.
-  EXPECT_EQ(getGlobalPoolThreadCount(), 2);
+  // Verify that the thread running the task is still tracked, even though
+  // the Pool has been destroyed.  The idle thread may already have finished.
+  EXPECT_GE(getGlobalPoolThreadCount(), 1);
 
   // Verify that the global join will indeed wait until all threads are joined.
   joinGlobalPool();
   EXPECT_EQ(getGlobalPoolThreadCount(), 0);
 }
 
+TEST(JoinGlobalPool, WarmThreads) {
+  // Verify that the threads of a joined pool are parked, and then reused by
+  // the next pool that starts.
+  EXPECT_NO_THROW(joinGlobalPool());
+  auto policy = getWarmThreadPolicy();
+  setWarmThreadPolicy({4, 5s});
+
+  auto runIds = [](size_t threadCount) {
+    Pool a{threadCount};
+    mutex idsMutex;
+    set<thread::id> ids;
+    atomic<bool> release{false};
+    for (size_t i = 0; i < threadCount; ++i) {
+      a.enqueue({[&](){
+        {
+          scoped_lock lock{idsMutex};
+          ids.insert(this_thread::get_id());
+        }
+        while (!release) {
+          this_thread::sleep_for(100us);
+        }
+      }});
+    }
+    a.start();
+    EXPECT_TRUE(waitUntil([&](){
+      scoped_lock lock{idsMutex};
+      return ids.size() == threadCount;
+    }));
+    release = true;
+    a.join();
+    return ids;
+  };
+
+  auto first = runIds(2);
+  EXPECT_EQ(getWarmThreadCount(), 2);
+  EXPECT_EQ(getGlobalPoolThreadCount(), 0);
+  EXPECT_EQ(runIds(2), first);
+
+  // Only as many threads as the policy allows are kept.
+  runIds(6);
+  EXPECT_EQ(getWarmThreadCount(), 4);
+  setWarmThreadPolicy({1, 5s});
+  EXPECT_EQ(getWarmThreadCount(), 1);
+
+  // Parked threads exit once they have been idle for too long.
+  setWarmThreadPolicy({4, 1ms});
+  EXPECT_TRUE(waitUntil([&](){ return getWarmThreadCount() == 0; }));
+
+  // Without a cache, every thread exits.
+  setWarmThreadPolicy({0, 5s});
+  runIds(2);
+  EXPECT_EQ(getWarmThreadCount(), 0);
+
+  setWarmThreadPolicy(policy);
+  EXPECT_NO_THROW(joinGlobalPool());
+}
+
+TEST(JoinGlobalPool, CreateThreads) {
+  // Verify that a batch of threads is created at once, and that each of them
+  // runs the function.
+  EXPECT_NO_THROW(joinGlobalPool());
+
+  atomic<size_t> started{0};
+  atomic<bool> finish{false};
+  auto threadIds = createThreads(4, [&](stop_token){
+    ++started;
+    while (!finish) {
+      this_thread::sleep_for(100us);
+    }
+  });
+  EXPECT_EQ(threadIds.size(), 4);
+  EXPECT_EQ(set<thread::id>(threadIds.begin(), threadIds.end()).size(), 4);
+  EXPECT_EQ(getGlobalPoolThreadCount(), 4);
+  EXPECT_TRUE(waitUntil([&](){ return started == 4; }));
+  EXPECT_TRUE(createThreads(0, [](stop_token){}).empty());
+
+  finish = true;
+  joinGlobalPool();
+  EXPECT_EQ(getGlobalPoolThreadCount(), 0);
+}
+
 TEST(Pool, IndependentThreads) {
   // Verify that two pools of threads create independent threads in the pool.
   EXPECT_NO_THROW(joinGlobalPool());
@@ -150,6 +262,24 @@ TEST(PoolSize, Specified) {
   EXPECT_EQ(a.getRunningThreadCount(), 0);
 }
 
+TEST(PoolSize, Resize) {
+  // Verify that the counts stay correct when the pool is resized many times,
+  // even though the ids of terminated threads may be reused.
+  Pool a{2};
+  a.start();
+  for (size_t i = 0; i < 20; ++i) {
+    a.setThreadCount(4);
+    a.setThreadCount(2);
+    EXPECT_TRUE(waitUntil([&](){ return a.getTerminatedThreadCount() == (i + 1) * 2; }));
+  }
+  EXPECT_TRUE(waitUntil([&](){ return a.getTerminatedThreadCount() == 40; }));
+  EXPECT_EQ(a.getThreadCount(), 2);
+
+  a.join();
+  EXPECT_EQ(a.getTerminatedThreadCount(), 42);
+  EXPECT_EQ(a.getWaitingThreadCount(), 0);
+}
+
 TEST(TaskQueue, Count) {
   // Create a thread pool with no threads, enqueue tasks that will
   // never be processed.
@@ -169,6 +299,1442 @@ TEST(TaskQueue, Count) {
   EXPECT_EQ(a.getTaskQueueCount(), 2);
 }
 
+TEST(TaskQueue, Batch) {
+  // Verify that a batch of tasks is properly enqueued, and that the tasks are
+  // moved out of the batch.
+  Pool a{0};
+  vector<Task> tasks(3);
+  for (auto & task : tasks) {
+    task.function = emptyFunc;
+  }
+  EXPECT_TRUE(a.enqueueBatch(tasks));
+  EXPECT_EQ(a.getTaskQueueCount(), 3);
+  EXPECT_FALSE(tasks[0].function);
+
+  // Verify that an empty batch does nothing.
+  EXPECT_TRUE(a.enqueueBatch({}));
+  EXPECT_EQ(a.getTaskQueueCount(), 3);
+}
+
+TEST(TaskQueue, BatchRuns) {
+  // Verify that every task in a batch runs, with every scheduler and from
+  // both inside and outside of the pool.
+  for (auto scheduler : {Scheduler::FIFO, Scheduler::WORK_STEALING, Scheduler::RING}) {
+    Pool a{3, scheduler};
+    atomic<size_t> count{0};
+    vector<Task> tasks{};
+    for (size_t i = 0; i < 1000; ++i) {
+      tasks.push_back({[&](){
+        ++count;
+      }});
+    }
+    a.start();
+    a.enqueueBatch(tasks);
+    a.enqueue({[&](){
+      vector<Task> nested{};
+      for (size_t i = 0; i < 100; ++i) {
+        nested.push_back({[&](){
+          ++count;
+        }});
+      }
+      a.enqueueBatch(nested);
+    }});
+
+    EXPECT_TRUE(waitUntil([&](){ return count == 1100; }));
+    a.join();
+  }
+}
+
+TEST(TaskQueue, ClaimBatches) {
+  // The FIFO scheduler does not batch unless asked to.
+  EXPECT_EQ(Pool{0}.getBatchSize(), 1);
+  EXPECT_EQ(Pool(0, Scheduler::WORK_STEALING).getBatchSize(), 32);
+
+  // Verify that a single thread that claims batches still runs the tasks in
+  // order, and that several threads run every task.
+  for (size_t threadCount : {1, 3}) {
+    Pool a{threadCount};
+    a.setBatchSize(8);
+    EXPECT_EQ(a.getBatchSize(), 8);
+    mutex orderMutex;
+    vector<size_t> order;
+    for (size_t i = 0; i < 1000; ++i) {
+      a.enqueue({[&, i](){
+        scoped_lock lock{orderMutex};
+        order.push_back(i);
+      }});
+    }
+    a.start();
+    EXPECT_TRUE(waitUntil([&](){
+      scoped_lock lock{orderMutex};
+      return order.size() == 1000;
+    }));
+    a.join();
+    EXPECT_EQ(a.getTaskQueueCount(), 0);
+    if (threadCount == 1) {
+      EXPECT_TRUE(is_sorted(order.begin(), order.end()));
+    }
+  }
+
+  // A batch size of 0 means no batching.
+  Pool b{0};
+  b.setBatchSize(0);
+  EXPECT_EQ(b.getBatchSize(), 1);
+}
+
+TEST(Function, MoveOnly) {
+  // Verify that a Function can hold a move-only callable, and that moving the
+  // Function moves the callable.
+  auto value = make_unique<int>(42);
+  Function<int()> f{[value = move(value)](){
+    return *value;
+  }};
+  EXPECT_TRUE(f);
+  EXPECT_EQ(f(), 42);
+
+  auto g = move(f);
+  EXPECT_FALSE(f);
+  EXPECT_EQ(g(), 42);
+
+  g = nullptr;
+  EXPECT_FALSE(g);
+}
+
+TEST(Function, Storage) {
+  // Verify that small callables are stored inline, that large callables are
+  // not, and that both behave the same.
+  struct Small {
+    char data[FUNCTION_INLINE_SIZE];
+    size_t operator()(size_t i) { return data[i]; }
+  };
+  struct Large {
+    char data[FUNCTION_INLINE_SIZE + 1];
+    size_t operator()(size_t i) { return data[i]; }
+  };
+  EXPECT_TRUE(Function<size_t(size_t)>::isInline<Small>());
+  EXPECT_FALSE(Function<size_t(size_t)>::isInline<Large>());
+
+  Small small{};
+  small.data[1] = 1;
+  Large large{};
+  large.data[FUNCTION_INLINE_SIZE] = 2;
+
+  Function<size_t(size_t)> f{small};
+  EXPECT_EQ(f(1), 1);
+  f = Function<size_t(size_t)>{large};
+  EXPECT_EQ(f(FUNCTION_INLINE_SIZE), 2);
+
+  // Verify that a large callable survives being moved.
+  auto g = move(f);
+  EXPECT_EQ(g(FUNCTION_INLINE_SIZE), 2);
+}
+
+TEST(Function, RemoteFree) {
+  // Verify that blocks freed by another thread are handed back to the thread
+  // that allocated them, and reused by it.
+  constexpr size_t count{1000};
+  constexpr size_t size{FUNCTION_INLINE_SIZE * 2};
+  vector<void *> blocks;
+  for (size_t i = 0; i < count; ++i) {
+    blocks.push_back(allocateFunctionStorage(size));
+  }
+  set<void *> allocated{blocks.begin(), blocks.end()};
+  thread{[&](){
+    for (auto block : blocks) {
+      deallocateFunctionStorage(block, size);
+    }
+  }}.join();
+
+  // The blocks that this thread freed itself come first, and there are at
+  // most a few hundred of them.
+  size_t reused{0};
+  blocks.resize(count + 1000);
+  for (auto & block : blocks) {
+    block = allocateFunctionStorage(size);
+    reused += allocated.count(block);
+  }
+  EXPECT_EQ(reused, count);
+  for (auto block : blocks) {
+    deallocateFunctionStorage(block, size);
+  }
+}
+
+TEST(Function, ScratchArena) {
+  // Verify that the scratch memory is aligned, grows past a single chunk,
+  // and is reset after each task.
+  Pool a{1};
+  a.start();
+  auto used = a.submit([](){
+    auto & arena = Pool::allocator();
+    pmr::vector<int> values{&arena};
+    values.resize(ScratchArena::CHUNK_SIZE);
+    auto aligned = arena.allocate(1, 64);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(aligned) % 64, 0);
+    return arena.getUsedBytes();
+  }).get();
+  EXPECT_GT(used, ScratchArena::CHUNK_SIZE);
+  EXPECT_EQ(a.submit([](){ return Pool::allocator().getUsedBytes(); }).get(), 0);
+
+  // Verify that a thread outside of the pool resets the arena itself.
+  auto & arena = Pool::allocator();
+  EXPECT_NE(arena.allocate(100), nullptr);
+  EXPECT_GE(arena.getUsedBytes(), 100);
+  arena.reset();
+  EXPECT_EQ(arena.getUsedBytes(), 0);
+  a.join();
+}
+
+TEST(TaskQueue, EnqueueCallable) {
+  // Verify that a callable (including one with a move-only capture) may be
+  // enqueued directly.
+  Pool a{2};
+  atomic<size_t> count{0};
+  auto value = make_unique<size_t>(5);
+
+  a.enqueue([&, value = move(value)](){
+    count += *value;
+  });
+  a.enqueue([&](){
+    ++count;
+  });
+  EXPECT_EQ(a.getTaskQueueCount(), 2);
+
+  a.start();
+  EXPECT_TRUE(waitUntil([&](){ return count == 6; }));
+  a.join();
+}
+
+TEST(Priority, Order) {
+  // Verify that higher priority tasks are claimed first, with every
+  // scheduler.
+  for (auto scheduler : {Scheduler::FIFO, Scheduler::WORK_STEALING, Scheduler::RING}) {
+    Pool a{1, scheduler};
+    mutex orderMutex;
+    string order;
+
+    for (auto [priority, name] : {
+        pair{Priority::LOW, 'L'}, pair{Priority::NORMAL, 'N'}, pair{Priority::HIGH, 'H'}}) {
+      for (size_t i = 0; i < 5; ++i) {
+        a.enqueue([&, name](){
+          scoped_lock lock{orderMutex};
+          order += name;
+        }, priority);
+      }
+    }
+    EXPECT_EQ(a.getTaskQueueCount(), 15);
+
+    a.start();
+    EXPECT_TRUE(waitUntil([&](){
+      scoped_lock lock{orderMutex};
+      return order.size() == 15;
+    }));
+    a.join();
+    EXPECT_EQ(order, "HHHHHNNNNNLLLLL");
+  }
+}
+
+TEST(Priority, NoStarvation) {
+  // Verify that a LOW priority task is not starved by a steady supply of HIGH
+  // priority tasks.
+  Pool a{1};
+  atomic<size_t> high{0};
+  atomic<size_t> highBeforeLow{0};
+  atomic<bool> low{false};
+
+  for (size_t i = 0; i < 100; ++i) {
+    a.enqueue([&](){ ++high; }, Priority::HIGH);
+  }
+  a.enqueue(Task{[&](){
+    highBeforeLow = high.load();
+    low = true;
+  }, Priority::LOW});
+
+  a.start();
+  EXPECT_TRUE(waitUntil([&](){ return low && (high == 100); }));
+  a.join();
+  EXPECT_EQ(high, 100);
+  EXPECT_LT(highBeforeLow, 100);
+}
+
+TEST(Capacity, Reject) {
+  // Verify that a full queue rejects new tasks, with both enqueue() and
+  // tryEnqueue(), and that a rejected Task is not moved from.
+  Pool a{0};
+  EXPECT_EQ(a.getCapacity(), UNLIMITED_CAPACITY);
+  a.setCapacity(2, OverflowPolicy::REJECT);
+  EXPECT_EQ(a.getCapacity(), 2);
+  EXPECT_EQ(a.getOverflowPolicy(), OverflowPolicy::REJECT);
+
+  EXPECT_TRUE(a.enqueue(emptyFunc));
+  EXPECT_TRUE(a.tryEnqueue(emptyFunc));
+  Task task{emptyFunc};
+  EXPECT_FALSE(a.enqueue(move(task)));
+  EXPECT_TRUE(task.function);
+  EXPECT_EQ(a.getTaskQueueCount(), 2);
+
+  // Verify that a batch enqueues as many tasks as fit.
+  a.setCapacity(3, OverflowPolicy::REJECT);
+  vector<Task> tasks(2);
+  for (auto & task : tasks) {
+    task.function = emptyFunc;
+  }
+  EXPECT_FALSE(a.enqueueBatch(tasks));
+  EXPECT_FALSE(tasks[0].function);
+  EXPECT_TRUE(tasks[1].function);
+  EXPECT_EQ(a.getTaskQueueCount(), 3);
+
+  // Verify that tryEnqueue() rejects even when the policy is to block.
+  a.setCapacity(3, OverflowPolicy::BLOCK);
+  EXPECT_FALSE(a.tryEnqueue(emptyFunc));
+}
+
+TEST(Capacity, DropOldest) {
+  // Verify that a full queue discards its oldest, lowest priority task to
+  // make room for a new one.
+  Pool a{0};
+  a.setCapacity(2, OverflowPolicy::DROP_OLDEST);
+  auto first = a.submit([](){ return 1; });
+  auto second = a.submit([](){ return 2; });
+  EXPECT_TRUE(a.enqueue(emptyFunc, Priority::HIGH));
+  EXPECT_EQ(a.getTaskQueueCount(), 2);
+  EXPECT_THROW(first.get(), future_error);
+  EXPECT_FALSE(second.ready());
+}
+
+TEST(Capacity, CallerRuns) {
+  // Verify that a full queue runs a new task on the thread that enqueues it.
+  Pool a{0};
+  a.setCapacity(1, OverflowPolicy::CALLER_RUNS);
+  thread::id ranOn{};
+  EXPECT_TRUE(a.enqueue(emptyFunc));
+  EXPECT_TRUE(a.enqueue([&](){ ranOn = this_thread::get_id(); }));
+  EXPECT_EQ(ranOn, this_thread::get_id());
+  EXPECT_EQ(a.getTaskQueueCount(), 1);
+}
+
+TEST(Capacity, Block) {
+  // Verify that a full queue blocks the submitter until a thread claims a
+  // task.
+  Pool a{1};
+  a.setCapacity(1);
+  atomic<size_t> count{0};
+  atomic<bool> enqueued{false};
+  a.enqueue([&](){ ++count; });
+
+  jthread submitter{[&](){
+    a.enqueue([&](){ ++count; });
+    enqueued = true;
+  }};
+  this_thread::sleep_for(10ms);
+  EXPECT_FALSE(enqueued);
+
+  a.start();
+  EXPECT_TRUE(waitUntil([&](){ return enqueued && (count == 2); }));
+  a.join();
+}
+
+TEST(IdlePolicy, Spin) {
+  // Verify that every task runs when idle threads spin before parking, with
+  // every scheduler and from both inside and outside of the pool.
+  for (auto scheduler : {Scheduler::FIFO, Scheduler::WORK_STEALING, Scheduler::RING}) {
+    Pool a{3, scheduler};
+    a.setIdlePolicy({100000, 1ms});
+    EXPECT_EQ(a.getIdlePolicy().spinCount, 100000);
+    EXPECT_EQ(a.getIdlePolicy().spinDuration, 1ms);
+    a.start();
+
+    atomic<size_t> count{0};
+    for (size_t round = 0; round < 10; ++round) {
+      for (size_t i = 0; i < 100; ++i) {
+        a.enqueue([&](){
+          a.enqueue([&](){ ++count; });
+        });
+      }
+      EXPECT_TRUE(waitUntil([&](){ return count == (round + 1) * 100; }));
+
+      // Let the threads give up spinning and park.
+      this_thread::sleep_for(2ms);
+    }
+    a.join();
+  }
+}
+
+TEST(InlinePolicy, QueueDepth) {
+  // Verify that a task enqueued by a pool thread runs inline once the queue
+  // is deep enough, up to the nesting limit, and is queued beyond it.
+  Pool a{1};
+  a.setInlinePolicy({0, 4, false});
+  EXPECT_EQ(a.getInlinePolicy().queueDepth, 0);
+  EXPECT_EQ(a.getInlinePolicy().maxDepth, 4);
+  EXPECT_FALSE(a.getInlinePolicy().whenStopped);
+  a.start();
+
+  atomic<size_t> count{0};
+  size_t nesting{0};
+  size_t maxNesting{0};
+  function<void(size_t)> chain = [&](size_t remaining){
+    ++nesting;
+    maxNesting = max(maxNesting, nesting);
+    if (remaining) {
+      a.enqueue([&, remaining](){ chain(remaining - 1); });
+    }
+    --nesting;
+    ++count;
+  };
+  a.enqueue([&](){ chain(10); });
+  EXPECT_TRUE(waitUntil([&](){ return count == 11; }));
+  a.join();
+  EXPECT_EQ(maxNesting, 5);
+}
+
+TEST(InlinePolicy, WhenStopped) {
+  // Verify that a task enqueued while the pool is not running runs inline,
+  // but only when the policy asks for it, and never from tryEnqueue().
+  Pool a{1};
+  EXPECT_TRUE(a.enqueue(emptyFunc));
+  EXPECT_EQ(a.getTaskQueueCount(), 1);
+
+  a.setInlinePolicy({UNLIMITED_CAPACITY, 16, true});
+  thread::id ranOn{};
+  EXPECT_TRUE(a.enqueue([&](){ ranOn = this_thread::get_id(); }));
+  EXPECT_EQ(ranOn, this_thread::get_id());
+  EXPECT_TRUE(a.tryEnqueue(emptyFunc));
+  EXPECT_EQ(a.getTaskQueueCount(), 2);
+
+  // A running pool queues the task as usual.
+  a.start();
+  EXPECT_TRUE(waitUntil([&](){ return a.getTaskQueueCount() == 0; }));
+  atomic<bool> ran{false};
+  a.enqueue([&](){ ran = true; });
+  EXPECT_TRUE(waitUntil([&](){ return ran.load(); }));
+  a.join();
+}
+
+TEST(WorkerGroup, Shared) {
+  // Verify that several pools run their tasks on the threads of one group,
+  // with both schedulers, and without creating threads of their own.
+  WorkerGroup group{2};
+  EXPECT_EQ(group.getThreadCount(), 2);
+  atomic<size_t> count{0};
+  {
+    Pool a{group};
+    Pool b{group, {}, Scheduler::WORK_STEALING};
+    EXPECT_EQ(group.getPoolCount(), 2);
+    a.start();
+    b.start();
+    for (size_t i = 0; i < 100; ++i) {
+      a.enqueue([&](){ ++count; });
+      b.enqueue([&](){
+        b.enqueue([&](){ ++count; });
+      });
+    }
+    EXPECT_TRUE(waitUntil([&](){ return count == 200; }));
+    EXPECT_EQ(a.getThreadCount(), 0);
+    EXPECT_EQ(b.getStats().workers.size(), 2);
+    a.join();
+    b.join();
+
+    // A stopped pool is not served until it is started again.
+    a.enqueue([&](){ ++count; });
+    this_thread::sleep_for(10ms);
+    EXPECT_EQ(count, 200);
+    a.start();
+    EXPECT_TRUE(waitUntil([&](){ return count == 201; }));
+    a.join();
+  }
+  EXPECT_EQ(group.getPoolCount(), 0);
+}
+
+TEST(WorkerGroup, Weight) {
+  // Verify that the threads of a group are shared in proportion to the
+  // weights of the pools, and that a pool below its minimum comes first.
+  WorkerGroup group{1};
+  Pool blocker{group};
+  Pool a{group, {3}};
+  Pool b{group, {1}};
+  Pool c{group, {1, 1}};
+  EXPECT_EQ(a.getExecutorQuota().weight, 3);
+  EXPECT_EQ(c.getExecutorQuota().minConcurrency, 1);
+  for (auto pool : {&blocker, &a, &b, &c}) {
+    pool->start();
+  }
+
+  // Hold the only thread while the tasks are queued.
+  atomic<bool> release{false};
+  atomic<bool> blocked{false};
+  blocker.enqueue([&](){
+    blocked = true;
+    while (!release) {
+      this_thread::yield();
+    }
+  });
+  ASSERT_TRUE(waitUntil([&](){ return blocked.load(); }));
+
+  mutex orderMutex;
+  string order;
+  auto record = [&](char name) {
+    return [&, name](){
+      scoped_lock lock{orderMutex};
+      order.push_back(name);
+    };
+  };
+  for (size_t i = 0; i < 200; ++i) {
+    a.enqueue(record('a'));
+    b.enqueue(record('b'));
+  }
+  for (size_t i = 0; i < 10; ++i) {
+    c.enqueue(record('c'));
+  }
+  release = true;
+  EXPECT_TRUE(waitUntil([&](){
+    scoped_lock lock{orderMutex};
+    return order.size() == 410;
+  }));
+
+  EXPECT_EQ(order.substr(0, 10), string(10, 'c'));
+  auto share = count(order.begin() + 10, order.begin() + 210, 'a');
+  EXPECT_GE(share, 145);
+  EXPECT_LE(share, 155);
+  for (auto pool : {&blocker, &a, &b, &c}) {
+    pool->join();
+  }
+}
+
+TEST(WorkerGroup, MaxConcurrency) {
+  // Verify that a pool never runs more tasks at once than its maximum, and
+  // that join() waits for the tasks that the group is running.
+  WorkerGroup group{4};
+  Pool a{group, {1, 0, 2}};
+  a.start();
+  atomic<size_t> running{0};
+  atomic<size_t> most{0};
+  atomic<size_t> count{0};
+  for (size_t i = 0; i < 20; ++i) {
+    a.enqueue([&](){
+      auto now = ++running;
+      auto previous = most.load();
+      while ((now > previous) && !most.compare_exchange_weak(previous, now)) {}
+      this_thread::sleep_for(1ms);
+      --running;
+      ++count;
+    });
+  }
+  EXPECT_TRUE(waitUntil([&](){ return count == 20; }));
+  EXPECT_LE(most, 2);
+
+  // Raising the limit lets the other threads help.
+  a.setExecutorQuota({1, 0, UNLIMITED_CONCURRENCY});
+  EXPECT_EQ(a.getExecutorQuota().maxConcurrency, UNLIMITED_CONCURRENCY);
+  atomic<bool> finished{false};
+  a.enqueue([&](){
+    this_thread::sleep_for(10ms);
+    finished = true;
+  });
+  EXPECT_TRUE(waitUntil([&](){ return a.getTaskQueueCount() == 0; }));
+  a.join();
+  EXPECT_TRUE(finished);
+}
+
+TEST(Stop, Drain) {
+  // Verify that drain() finishes every queued task, including the tasks
+  // that they enqueue, and then stops the pool.
+  for (auto scheduler : {Scheduler::FIFO, Scheduler::WORK_STEALING, Scheduler::RING}) {
+    Pool a{2, scheduler};
+    atomic<size_t> count{0};
+    for (size_t i = 0; i < 100; ++i) {
+      a.enqueue([&](){
+        a.enqueue([&](){ ++count; });
+        ++count;
+      });
+    }
+    a.enqueueAfter(1h, emptyFunc);
+    a.start();
+    EXPECT_TRUE(a.drain());
+    EXPECT_EQ(count, 200);
+    EXPECT_EQ(a.getTaskQueueCount(), 0);
+    EXPECT_EQ(a.getThreadCount(), 0);
+    EXPECT_EQ(a.getTimerCount(), 1);
+
+    // The pool may be started again.
+    a.start();
+    a.enqueue([&](){ ++count; });
+    EXPECT_TRUE(waitUntil([&](){ return count == 201; }));
+    a.join();
+  }
+}
+
+TEST(Stop, DrainTimeout) {
+  // Verify that a drain which runs out of time asks the running task to
+  // stop, and leaves the rest of the tasks in the queue.
+  Pool a{1};
+  atomic<bool> started{false};
+  atomic<bool> stopped{false};
+  a.enqueue([&](stop_token token){
+    started = true;
+    while (!token.stop_requested()) {
+      this_thread::yield();
+    }
+    stopped = true;
+  });
+  for (size_t i = 0; i < 5; ++i) {
+    a.enqueue(emptyFunc);
+  }
+  a.start();
+  ASSERT_TRUE(waitUntil([&](){ return started.load(); }));
+  EXPECT_FALSE(a.drain(20ms));
+  EXPECT_TRUE(stopped);
+  EXPECT_EQ(a.getTaskQueueCount(), 5);
+
+  // Starting the pool again gives the tasks a new token.
+  atomic<bool> stopRequested{true};
+  a.enqueue([&](stop_token token){ stopRequested = token.stop_requested(); });
+  a.start();
+  EXPECT_TRUE(a.drain());
+  EXPECT_FALSE(stopRequested);
+  EXPECT_FALSE(Pool::getStopToken().stop_possible());
+}
+
+TEST(Stop, Discard) {
+  // Verify that discard() returns the unrun tasks, by priority and then in
+  // the order in which they were enqueued, including those on a deque.
+  Pool a{1, Scheduler::WORK_STEALING};
+  string order;
+
+  // Tasks enqueued by a thread of the pool go onto its deque.
+  atomic<bool> release{false};
+  a.enqueue([&](){
+    for (size_t i = 0; i < 3; ++i) {
+      a.enqueue([&, i](){ order.push_back(static_cast<char>('0' + i)); });
+    }
+    while (!release) {
+      this_thread::yield();
+    }
+  }, Priority::HIGH);
+  a.enqueue([&](){ order.push_back('L'); }, Priority::LOW);
+  a.enqueue([&](){ order.push_back('N'); });
+  a.enqueue([&](){ order.push_back('H'); }, Priority::HIGH);
+  a.start();
+  EXPECT_TRUE(waitUntil([&](){ return a.getTaskQueueCount() == 6; }));
+  a.stop();
+  release = true;
+
+  auto tasks = a.discard();
+  EXPECT_EQ(a.getTaskQueueCount(), 0);
+  ASSERT_EQ(tasks.size(), 6);
+  for (auto & task : tasks) {
+    task.function();
+  }
+  EXPECT_EQ(order, "HN012L");
+}
+
+TEST(Affinity, NumaTopology) {
+  // Verify that every NUMA node has CPUs, and that there are no CPUs for a
+  // node that does not exist.
+  ASSERT_GE(getNumaNodeCount(), 1);
+  for (size_t node = 0; node < getNumaNodeCount(); ++node) {
+    EXPECT_FALSE(getNumaNodeCpus(node).empty());
+  }
+  EXPECT_TRUE(getNumaNodeCpus(getNumaNodeCount()).empty());
+}
+
+TEST(Affinity, Pin) {
+  // Verify that the threads of a pool are pinned to the requested CPU.
+  auto cpu = getNumaNodeCpus(0).front();
+  Pool a{2};
+  a.setThreadAffinity({{cpu}, true});
+  EXPECT_EQ(a.getThreadAffinity().cpus, vector<size_t>{cpu});
+  EXPECT_TRUE(a.getThreadAffinity().pinEach);
+  a.start();
+
+  auto allowed = a.submit([](){
+    vector<size_t> cpus{};
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    sched_getaffinity(0, sizeof(set), &set);
+    for (size_t i = 0; i < CPU_SETSIZE; ++i) {
+      if (CPU_ISSET(i, &set)) {
+        cpus.push_back(i);
+      }
+    }
+#endif
+    return cpus;
+  }).get();
+#ifdef __linux__
+  EXPECT_EQ(allowed, vector<size_t>{cpu});
+#endif
+  a.join();
+}
+
+TEST(Autoscale, GrowAndShrink) {
+  // Verify that the pool grows while its threads are busy and tasks are
+  // waiting, and that it shrinks back once the threads are idle.
+  Pool a{1};
+  AutoscalePolicy policy{};
+  policy.minThreads = 2;
+  policy.maxThreads = 4;
+  policy.waitThreshold = 1ms;
+  policy.idleTimeout = 10ms;
+  policy.interval = 1ms;
+  policy.cooldown = 1ms;
+  a.setAutoscalePolicy(policy);
+  ASSERT_TRUE(a.getAutoscalePolicy());
+  EXPECT_EQ(a.getAutoscalePolicy()->maxThreads, 4);
+  a.start();
+
+  // The thread count is brought within the limits immediately.
+  EXPECT_EQ(a.getThreadCount(), 2);
+
+  atomic<bool> finish{false};
+  atomic<size_t> count{0};
+  for (size_t i = 0; i < 8; ++i) {
+    a.enqueue([&](){
+      while (!finish) {
+        this_thread::sleep_for(100us);
+      }
+      ++count;
+    });
+  }
+  EXPECT_TRUE(waitUntil([&](){ return a.getThreadCount() == 4; }));
+  EXPECT_TRUE(waitUntil([&](){ return a.getRunningThreadCount() == 4; }));
+
+  finish = true;
+  EXPECT_TRUE(waitUntil([&](){ return count == 8; }));
+  EXPECT_TRUE(waitUntil([&](){ return a.getThreadCount() == 2; }));
+
+  // Without a policy, the thread count stays where it is.
+  a.clearAutoscalePolicy();
+  EXPECT_FALSE(a.getAutoscalePolicy());
+  a.join();
+  EXPECT_EQ(a.getThreadCount(), 0);
+}
+
+TEST(Timer, Delay) {
+  // Verify that a delayed task is not enqueued before its deadline, that it
+  // can be cancelled until then, and that only then.
+  Pool a{1};
+  a.start();
+  atomic<int> ran{0};
+  auto enqueued = chrono::steady_clock::now();
+  atomic<chrono::steady_clock::duration> delay{};
+  auto later = a.enqueueAfter(20ms, [&](){
+    delay = chrono::steady_clock::now() - enqueued;
+    ++ran;
+  });
+  auto cancelled = a.enqueueAt(enqueued + 10ms, [&](){ ran += 10; });
+  EXPECT_EQ(a.getTimerCount(), 2);
+  EXPECT_TRUE(cancelled.cancel());
+  EXPECT_FALSE(cancelled.cancel());
+  EXPECT_EQ(a.getTimerCount(), 1);
+
+  EXPECT_TRUE(waitUntil([&](){ return ran.load() == 1; }));
+  EXPECT_GE(delay.load(), 20ms);
+  EXPECT_FALSE(later.cancel());
+  EXPECT_EQ(a.getTimerCount(), 0);
+
+  // Verify that a default handle, and a handle to a destroyed pool, cancel
+  // nothing.
+  EXPECT_FALSE(TimerHandle{}.cancel());
+  TimerHandle orphan{};
+  {
+    Pool b{0};
+    orphan = b.enqueueAfter(1h, emptyFunc);
+  }
+  EXPECT_FALSE(orphan.cancel());
+  a.join();
+}
+
+TEST(Timer, CascadeBeforeNearTimer) {
+  // Verify that a timer in a higher level of the wheel fires on its own
+  // deadline, even when a timer in the lowest level has a later deadline.
+  Pool a{1};
+  a.start();
+  auto start = chrono::steady_clock::now();
+  atomic<bool> early{false};
+  atomic<int64_t> firedAt{0};
+  atomic<bool> laterFired{false};
+  atomic<bool> firedFirst{false};
+
+  // The 300ms timer is too far away for the lowest level of the wheel.
+  a.enqueueAfter(300ms, [&](){
+    firedAt = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+    firedFirst = !laterFired;
+  });
+  a.enqueueAfter(190ms, [&](){ early = true; });
+  EXPECT_TRUE(waitUntil([&](){ return early.load(); }));
+
+  // Both of these land in the lowest level, and the 240ms one fires after
+  // the 300ms timer is due.
+  this_thread::sleep_until(start + 200ms);
+  a.enqueueAfter(240ms, [&](){ laterFired = true; });
+  a.enqueueAfter(10ms, emptyFunc);
+
+  EXPECT_TRUE(waitUntil([&](){ return laterFired.load(); }));
+  EXPECT_TRUE(firedFirst);
+  EXPECT_GE(firedAt, 300);
+  EXPECT_LT(firedAt, 400);
+  a.join();
+}
+
+TEST(Timer, Stopped) {
+  // Verify that a deadline that passes while the pool is stopped is acted on
+  // once the pool is started.
+  Pool a{1};
+  atomic<bool> ran{false};
+  a.enqueueAfter(1ms, [&](){ ran = true; });
+  this_thread::sleep_for(10ms);
+  EXPECT_FALSE(ran);
+  EXPECT_EQ(a.getTaskQueueCount(), 0);
+  a.start();
+  EXPECT_TRUE(waitUntil([&](){ return ran.load(); }));
+  a.join();
+}
+
+TEST(Timer, Periodic) {
+  // Verify that a periodic task runs repeatedly, that its runs never
+  // overlap even when a run takes longer than the period, and that it stops
+  // once it is cancelled.
+  Pool a{2};
+  a.start();
+  atomic<int> runs{0};
+  atomic<int> running{0};
+  atomic<bool> overlapped{false};
+  auto handle = a.enqueueEvery(1ms, [&](){
+    if (++running > 1) {
+      overlapped = true;
+    }
+    this_thread::sleep_for(3ms);
+    ++runs;
+    --running;
+  });
+  EXPECT_TRUE(waitUntil([&](){ return runs.load() >= 5; }));
+  EXPECT_TRUE(handle.cancel());
+  EXPECT_FALSE(handle.cancel());
+
+  // A run that was in progress when the task was cancelled may still finish.
+  this_thread::sleep_for(10ms);
+  auto seen = runs.load();
+  this_thread::sleep_for(20ms);
+  EXPECT_EQ(runs, seen);
+  EXPECT_FALSE(overlapped);
+  EXPECT_EQ(a.getTimerCount(), 0);
+  a.join();
+}
+
+TEST(Timer, PeriodicSkipped) {
+  // Verify that a periodic task keeps firing after a run that throws, and
+  // after a run that is discarded without being run.
+  Pool a{0};
+  atomic<int> runs{0};
+  auto handle = a.enqueueEvery(1ms, [&](){
+    if (++runs == 1) {
+      throw runtime_error{"periodic"};
+    }
+  });
+
+  // With no threads, each run waits in the queue until it is discarded.
+  a.start();
+  EXPECT_TRUE(waitUntil([&](){ return a.getTaskQueueCount() == 1; }));
+  {
+    auto tasks = a.discard();
+    ASSERT_EQ(tasks.size(), 1);
+    EXPECT_THROW(tasks[0].function(), runtime_error);
+  }
+  EXPECT_EQ(a.getTimerCount(), 1);
+
+  a.start();
+  EXPECT_TRUE(waitUntil([&](){ return a.getTaskQueueCount() == 1; }));
+  a.discard();
+  EXPECT_EQ(a.getTimerCount(), 1);
+
+  a.start();
+  EXPECT_TRUE(waitUntil([&](){ return a.getTaskQueueCount() == 1; }));
+  auto tasks = a.discard();
+  ASSERT_EQ(tasks.size(), 1);
+  tasks[0].function();
+  EXPECT_EQ(runs, 2);
+  EXPECT_TRUE(handle.cancel());
+  EXPECT_EQ(a.getTimerCount(), 0);
+}
+
+TEST(Timer, Many) {
+  // Verify that many timers, spread across several buckets of the wheel, all
+  // fire, and that cancelling half of them leaves the rest untouched.
+  Pool a{1};
+  constexpr size_t count{100000};
+  atomic<size_t> ran{0};
+  vector<TimerHandle> handles;
+  handles.reserve(count);
+  auto start = chrono::steady_clock::now();
+  for (size_t i = 0; i < count; ++i) {
+    handles.push_back(a.enqueueAt(start + chrono::microseconds{i % 50000}, [&](){ ++ran; }));
+  }
+  size_t cancelled{0};
+  for (size_t i = 0; i < count; i += 2) {
+    cancelled += handles[i].cancel();
+  }
+  EXPECT_EQ(cancelled, count / 2);
+  EXPECT_EQ(a.getTimerCount(), count / 2);
+
+  a.start();
+  EXPECT_TRUE(waitUntil([&](){ return ran.load() == count / 2; }));
+  EXPECT_EQ(a.getTimerCount(), 0);
+  a.join();
+}
+
+TEST(Stats, Histogram) {
+  // Verify that every duration lands in a bucket which starts no later than
+  // the duration, and which is no wider than 1/8 of it.
+  for (int64_t value : {0, 1, 7, 8, 9, 15, 16, 17, 100, 1000, 123456, 99999999}) {
+    auto duration = chrono::nanoseconds{value};
+    auto bucket = LatencyHistogram::getBucket(duration);
+    EXPECT_LE(LatencyHistogram::getBucketStart(bucket), duration);
+    EXPECT_GT(LatencyHistogram::getBucketStart(bucket + 1), duration);
+    EXPECT_LE((LatencyHistogram::getBucketStart(bucket + 1) - LatencyHistogram::getBucketStart(bucket)) * 8, max(duration, 8ns));
+  }
+  EXPECT_EQ(LatencyHistogram::getBucket(-1ns), 0);
+  EXPECT_EQ(LatencyHistogram::getBucket(chrono::hours{24}), LatencyHistogram::BUCKET_COUNT - 1);
+
+  LatencyHistogram histogram{};
+  EXPECT_EQ(histogram.getPercentile(50), 0ns);
+  for (int64_t value = 1; value <= 100; ++value) {
+    ++histogram.counts[LatencyHistogram::getBucket(chrono::microseconds{value})];
+    histogram.total += chrono::microseconds{value};
+  }
+  EXPECT_EQ(histogram.getCount(), 100);
+  EXPECT_EQ(histogram.getMean(), 50500ns);
+  EXPECT_GE(histogram.getPercentile(50), 50us);
+  EXPECT_LE(histogram.getPercentile(50), 57us);
+  EXPECT_GE(histogram.getPercentile(100), 100us);
+  EXPECT_LE(histogram.getPercentile(0), histogram.getPercentile(50));
+}
+
+TEST(Stats, Counts) {
+  // Verify that the pool counts every task, and how long it waited and ran,
+  // with both schedulers.
+  for (auto scheduler : {Scheduler::FIFO, Scheduler::WORK_STEALING}) {
+    Pool a{2, scheduler};
+    if (!a.getStats().enabled) {
+      GTEST_SKIP() << "Statistics are compiled out.";
+    }
+
+    // Tasks enqueued before the pool starts wait for at least 1ms.
+    for (size_t i = 0; i < 50; ++i) {
+      a.enqueue([&](){
+        a.enqueue([](){ this_thread::sleep_for(10us); });
+      });
+    }
+    this_thread::sleep_for(1ms);
+    a.start();
+    EXPECT_TRUE(waitUntil([&](){ return a.getStats().completed == 100; }));
+
+    auto stats = a.getStats();
+    EXPECT_EQ(stats.submitted, 100);
+    EXPECT_LE(stats.stolen, 100);
+    EXPECT_EQ(stats.queueWait.getCount(), 100);
+    EXPECT_EQ(stats.execution.getCount(), 100);
+    EXPECT_GE(stats.queueWait.getPercentile(100), 1ms);
+    EXPECT_GE(stats.execution.getPercentile(100), 10us);
+    EXPECT_GE(stats.workers.size(), 2);
+
+    uint64_t completed{0};
+    chrono::nanoseconds busy{0};
+    for (auto & worker : stats.workers) {
+      completed += worker.completed;
+      busy += worker.busy;
+    }
+    EXPECT_EQ(completed, 100);
+    EXPECT_GE(busy, 50 * 10us);
+    EXPECT_GE(busy, stats.execution.total);
+    a.join();
+  }
+}
+
+TEST(Trace, Chrome) {
+  // Verify that a trace holds every task that was enqueued while the pool was
+  // being traced, and nothing from before.
+  auto occurrences = [](const string & text, const string & pattern) {
+    size_t count{0};
+    for (auto position = text.find(pattern); position != string::npos; position = text.find(pattern, position + 1)) {
+      ++count;
+    }
+    return count;
+  };
+
+  for (auto scheduler : {Scheduler::FIFO, Scheduler::WORK_STEALING}) {
+    Pool a{2, scheduler};
+    a.start();
+    atomic<size_t> count{0};
+    a.enqueue({[&](){ ++count; }, Priority::NORMAL, "before"});
+    EXPECT_TRUE(waitUntil([&](){ return count == 1; }));
+
+    EXPECT_FALSE(a.isTracing());
+    a.startTrace();
+    EXPECT_TRUE(a.isTracing());
+    for (size_t i = 0; i < 10; ++i) {
+      a.enqueue({[&](){
+        a.enqueue({[&](){ ++count; }, Priority::NORMAL, "inner \"quoted\""});
+        ++count;
+      }, Priority::NORMAL, "outer"});
+    }
+    EXPECT_TRUE(waitUntil([&](){ return count == 21; }));
+    a.join();
+    a.stopTrace();
+    EXPECT_FALSE(a.isTracing());
+
+    stringstream trace{};
+    a.writeTrace(trace);
+    auto text = trace.str();
+    EXPECT_EQ(text.find("{\"displayTimeUnit\":\"ns\",\"traceEvents\":["), 0);
+    EXPECT_EQ(occurrences(text, "\"before\""), 0);
+    EXPECT_EQ(occurrences(text, "\"name\":\"outer\""), 30);
+    EXPECT_EQ(occurrences(text, "\"name\":\"inner \\\"quoted\\\"\""), 30);
+    EXPECT_EQ(occurrences(text, "\"ph\":\"B\""), 20);
+    EXPECT_EQ(occurrences(text, "\"ph\":\"E\""), 20);
+    EXPECT_EQ(occurrences(text, "\"ph\":\"s\""), 20);
+    EXPECT_EQ(occurrences(text, "\"ph\":\"f\""), 20);
+  }
+}
+
+TEST(Submit, Result) {
+  // Verify that the result of a submitted function is returned through the
+  // Future, including for functions with arguments and with no result.
+  Pool a{2};
+  a.start();
+
+  auto sum = a.submit([](int x, int y){ return x + y; }, 2, 3);
+  auto empty = a.submit(emptyFunc);
+  auto text = a.submit([](string s){ return s + "!"; }, string{"hello"});
+  EXPECT_EQ(sum.get(), 5);
+  EXPECT_FALSE(sum.valid());
+  EXPECT_NO_THROW(empty.get());
+  EXPECT_EQ(text.get(), "hello!");
+  a.join();
+}
+
+TEST(Submit, Exception) {
+  // Verify that an exception thrown by the function is stored in the Future,
+  // and that a task which never runs breaks its promise.
+  Future<int> broken{};
+  {
+    Pool a{1};
+    a.start();
+    auto f = a.submit([]() -> int { throw runtime_error{"oops"}; });
+    EXPECT_THROW(f.get(), runtime_error);
+    a.join();
+
+    broken = a.submit([](){ return 1; });
+    EXPECT_FALSE(broken.ready());
+  }
+  EXPECT_TRUE(broken.ready());
+  EXPECT_THROW(broken.get(), future_error);
+}
+
+TEST(Submit, Then) {
+  // Verify that continuations run with the result, whether they are attached
+  // before or after the result is available.
+  Pool a{0};
+  auto later = a.submit([](){ return 20; }).then([](int x){ return x + 1; }).then([](int x){ return x * 2; });
+  EXPECT_FALSE(later.ready());
+
+  a.setThreadCount(1);
+  a.start();
+  EXPECT_EQ(later.get(), 42);
+
+  auto first = a.submit([](){ return 1; });
+  first.wait();
+  EXPECT_TRUE(first.ready());
+  atomic<int> seen{0};
+  auto done = move(first).then([&](int x){ seen = x; });
+  EXPECT_TRUE(done.ready());
+  EXPECT_EQ(seen, 1);
+
+  // Verify that an exception skips the continuation.
+  auto failed = a.submit([]() -> int { throw runtime_error{"oops"}; }).then([&](int){ seen = 2; });
+  EXPECT_THROW(failed.get(), runtime_error);
+  EXPECT_EQ(seen, 1);
+  a.join();
+}
+
+TEST(Algorithms, ParallelFor) {
+  // Verify that every index is visited exactly once, with both schedulers,
+  // with automatic and explicit grain sizes.
+  for (auto scheduler : {Scheduler::FIFO, Scheduler::WORK_STEALING}) {
+    Pool a{3, scheduler};
+    a.start();
+    vector<atomic<int>> visits(10000);
+
+    parallelFor(a, 0, 10000, [&](int i){
+      ++visits[i];
+    });
+    parallelFor(a, size_t{0}, size_t{10000}, [&](size_t i){
+      ++visits[i];
+    }, 7);
+
+    size_t wrong{0};
+    for (auto & visit : visits) {
+      wrong += visit != 2;
+    }
+    EXPECT_EQ(wrong, 0);
+    a.join();
+  }
+}
+
+TEST(Algorithms, CallerHelps) {
+  // Verify that the algorithms complete even when no pool thread is running,
+  // because the calling thread does the work itself.
+  Pool a{0};
+  atomic<size_t> count{0};
+  parallelFor(a, 0, 1000, [&](int){
+    ++count;
+  });
+  EXPECT_EQ(count, 1000);
+  a.join();
+}
+
+TEST(Algorithms, ParallelReduce) {
+  // Verify the reduction, including one that is nested inside of a pool
+  // thread.
+  Pool a{2, Scheduler::WORK_STEALING};
+  a.start();
+
+  auto sum = parallelReduce(a, 1, 10001, int64_t{0}, [](int i){ return int64_t{i}; }, plus<>{});
+  EXPECT_EQ(sum, 50005000);
+
+  auto nested = a.submit([&](){
+    return parallelReduce(a, 0, 100, 0, [](int){ return 1; }, plus<>{}, 1);
+  });
+  EXPECT_EQ(nested.get(), 100);
+
+  // Verify that an empty range returns the identity.
+  EXPECT_EQ(parallelReduce(a, 5, 5, 7, [](int){ return 1; }, plus<>{}), 7);
+  a.join();
+}
+
+TEST(Algorithms, ParallelInvoke) {
+  // Verify that every function runs, and that an exception is propagated.
+  Pool a{2};
+  a.start();
+  atomic<int> count{0};
+  parallelInvoke(a,
+    [&](){ count += 1; },
+    [&](){ count += 10; },
+    [&](){ count += 100; });
+  EXPECT_EQ(count, 111);
+
+  EXPECT_THROW(parallelInvoke(a,
+    [&](){ ++count; },
+    [&](){ throw runtime_error{"oops"}; }), runtime_error);
+  EXPECT_EQ(count, 112);
+  a.join();
+}
+
+// Helper coroutine that moves onto a pool and reports the thread it ran on.
+static Lazy<thread::id> threadOnPool(Pool & pool) {
+  co_await pool.schedule();
+  co_return this_thread::get_id();
+}
+
+// Helper coroutine that produces a value without suspending.
+static Lazy<int> immediate(int value) {
+  co_return value;
+}
+
+// Helper coroutine that awaits a long chain of other coroutines.
+static Lazy<int> sumOnPool(Pool & pool, int count) {
+  co_await pool.schedule();
+  int sum{0};
+  for (int i = 0; i < count; ++i) {
+    sum += co_await immediate(1);
+  }
+  co_return sum;
+}
+
+// Helper coroutine that throws after moving onto a pool.
+static Lazy<> failOnPool(Pool & pool) {
+  co_await pool.schedule();
+  throw runtime_error{"oops"};
+}
+
+// Helper coroutine that awaits a coroutine that throws.
+static Lazy<int> catchOnPool(Pool & pool) {
+  try {
+    co_await failOnPool(pool);
+  }
+  catch (runtime_error &) {
+    co_return 1;
+  }
+  co_return 0;
+}
+
+TEST(Coroutine, Schedule) {
+  // Verify that schedule() moves the coroutine onto a pool thread, and that
+  // the result is delivered to syncWait().
+  Pool a{1};
+  a.start();
+  auto id = syncWait(threadOnPool(a));
+  EXPECT_NE(id, this_thread::get_id());
+
+  // Verify that a rejected schedule() continues on the current thread.
+  Pool b{0};
+  b.setCapacity(1, OverflowPolicy::REJECT);
+  b.enqueue(emptyFunc);
+  EXPECT_EQ(syncWait(threadOnPool(b)), this_thread::get_id());
+  a.join();
+  b.join();
+}
+
+TEST(Coroutine, Nested) {
+  // Verify that a long chain of awaits does not grow the stack, because of
+  // symmetric transfer.  The sanitizers disable the tail calls that symmetric
+  // transfer relies on, so the chain is kept short for them.
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+  constexpr int chain{1000};
+#else
+  constexpr int chain{100000};
+#endif
+  Pool a{2, Scheduler::WORK_STEALING};
+  a.start();
+  EXPECT_EQ(syncWait(sumOnPool(a, chain)), chain);
+
+  // Verify that exceptions are propagated to the awaiting coroutine, and to
+  // syncWait().
+  EXPECT_EQ(syncWait(catchOnPool(a)), 1);
+  EXPECT_THROW(syncWait(failOnPool(a)), runtime_error);
+  a.join();
+}
+
+TEST(TaskGroup, Wait) {
+  // Verify that waiting on a group waits for all of its tasks, that the pool
+  // keeps running afterwards, and that the group can be reused.
+  Pool a{3, Scheduler::WORK_STEALING};
+  a.start();
+  TaskGroup group{a};
+  atomic<size_t> count{0};
+
+  for (size_t batch = 1; batch <= 3; ++batch) {
+    for (size_t i = 0; i < 1000; ++i) {
+      group.run([&](){
+        ++count;
+      });
+    }
+    group.wait();
+    EXPECT_EQ(count, batch * 1000);
+    EXPECT_EQ(group.getPendingCount(), 0);
+    EXPECT_EQ(a.getThreadCount(), 3);
+  }
+  a.join();
+}
+
+TEST(TaskGroup, WaiterHelps) {
+  // Verify that the waiting thread runs the group's tasks itself when no
+  // pool thread is available.
+  Pool a{0};
+  TaskGroup group{a};
+  atomic<size_t> count{0};
+  for (size_t i = 0; i < 10; ++i) {
+    group.run([&](){
+      ++count;
+    });
+  }
+  EXPECT_EQ(group.getPendingCount(), 10);
+  EXPECT_TRUE(group.waitFor(0ms));
+  EXPECT_EQ(count, 10);
+}
+
+TEST(TaskGroup, WaitFor) {
+  // Verify that waitFor() gives up while a pool thread is still running one
+  // of the group's tasks.
+  Pool a{1};
+  a.start();
+  TaskGroup group{a};
+  atomic<bool> started{false};
+  atomic<bool> release{false};
+
+  group.run([&](){
+    started = true;
+    while (!release) {
+      this_thread::yield();
+    }
+  });
+  EXPECT_TRUE(waitUntil([&](){ return started.load(); }));
+  EXPECT_FALSE(group.waitFor(1ms));
+
+  release = true;
+  EXPECT_TRUE(group.waitFor(5s));
+  a.join();
+}
+
+TEST(TaskGroup, Exception) {
+  // Verify that an exception from a task is rethrown by wait(), once.
+  Pool a{2};
+  a.start();
+  TaskGroup group{a};
+  group.run([](){ throw runtime_error{"oops"}; });
+  group.run(emptyFunc);
+  EXPECT_THROW(group.wait(), runtime_error);
+  EXPECT_NO_THROW(group.wait());
+  a.join();
+}
+
+TEST(TaskGraph, Diamond) {
+  // Verify that each node runs after its predecessors, and that the graph
+  // may be run again.
+  Pool a{2};
+  a.start();
+  mutex orderMutex;
+  vector<int> order{};
+  auto record = [&](int value) {
+    return [&, value](){
+      scoped_lock lock{orderMutex};
+      order.push_back(value);
+    };
+  };
+
+  TaskGraph graph{};
+  auto first = graph.add(record(1), "first");
+  auto left = graph.add(record(2));
+  auto right = graph.add(record(3));
+  auto last = graph.add(record(4));
+  first.precede(left).precede(right);
+  last.succeed(left).succeed(right);
+  EXPECT_EQ(graph.size(), 4);
+  EXPECT_EQ(last.getIndex(), 3);
+
+  for (size_t run = 0; run < 3; ++run) {
+    order.clear();
+    graph.run(a);
+    ASSERT_EQ(order.size(), 4);
+    EXPECT_EQ(order.front(), 1);
+    EXPECT_EQ(order.back(), 4);
+  }
+
+  // An empty graph has nothing to wait for.
+  TaskGraph empty{};
+  empty.run(a);
+  a.join();
+}
+
+TEST(TaskGraph, Large) {
+  // Verify that every node of a large random graph runs exactly once per run,
+  // and only after all of its predecessors, with both schedulers.
+  constexpr size_t count{2000};
+  for (auto scheduler : {Scheduler::FIFO, Scheduler::WORK_STEALING}) {
+    Pool a{3, scheduler};
+    a.start();
+    vector<atomic<size_t>> runs(count);
+    vector<vector<size_t>> predecessors(count);
+    atomic<size_t> violations{0};
+
+    TaskGraph graph{};
+    vector<TaskGraph::Node> nodes{};
+    for (size_t i = 0; i < count; ++i) {
+      nodes.push_back(graph.add([&, i](){
+        auto expected = runs[i].load() + 1;
+        for (auto predecessor : predecessors[i]) {
+          if (runs[predecessor].load() != expected) {
+            ++violations;
+          }
+        }
+        runs[i] = expected;
+      }));
+    }
+
+    // Edges only go from lower to higher indices, so there is no cycle.
+    size_t seed{12345};
+    for (size_t i = 1; i < count; ++i) {
+      for (size_t edge = 0; edge < 3; ++edge) {
+        seed = seed * 6364136223846793005 + 1442695040888963407;
+        auto predecessor = (seed >> 33) % i;
+        nodes[predecessor].precede(nodes[i]);
+        predecessors[i].push_back(predecessor);
+      }
+    }
+
+    for (size_t run = 1; run <= 3; ++run) {
+      graph.run(a);
+      for (size_t i = 0; i < count; ++i) {
+        EXPECT_EQ(runs[i].load(), run);
+      }
+    }
+    EXPECT_EQ(violations.load(), 0);
+    a.join();
+  }
+}
+
+TEST(TaskGraph, Exception) {
+  // Verify that the first exception is rethrown, that the nodes after it are
+  // skipped, and that a cycle is refused.
+  Pool a{2};
+  a.start();
+  TaskGraph graph{};
+  atomic<bool> skipped{true};
+  auto thrower = graph.add([](){ throw runtime_error{"node"}; });
+  thrower.precede(graph.add([&](){ skipped = false; }));
+  EXPECT_THROW(graph.run(a), runtime_error);
+  EXPECT_TRUE(skipped);
+
+  TaskGraph cycle{};
+  auto x = cycle.add([](){});
+  auto y = cycle.add([](){});
+  x.precede(y);
+  y.precede(x);
+  EXPECT_THROW(cycle.run(a), logic_error);
+  a.join();
+}
+
+TEST(TaskGraph, UnstartedPool) {
+  // Verify that a graph finishes on a pool that has not been started, with
+  // the waiting thread running every node, and that the placeholders left in
+  // the queue do nothing once the pool starts.
+  Pool a{2};
+  TaskGraph graph{};
+  atomic<size_t> count{0};
+  auto first = graph.add([&](){ ++count; });
+  for (size_t i = 0; i < 10; ++i) {
+    first.precede(graph.add([&](){ ++count; }));
+  }
+  graph.run(a);
+  EXPECT_EQ(count, 11);
+  EXPECT_GT(a.getTaskQueueCount(), 0);
+
+  a.start();
+  EXPECT_TRUE(waitUntil([&](){ return a.getTaskQueueCount() == 0; }));
+  a.join();
+  EXPECT_EQ(count, 11);
+}
+
+TEST(TaskGraph, Discard) {
+  // Verify that a graph finishes when the pool discards the placeholders of
+  // its nodes while it runs.
+  Pool a{1};
+  atomic<bool> release{false};
+  a.enqueue([&](){
+    while (!release) {
+      this_thread::yield();
+    }
+  });
+  a.start();
+  EXPECT_TRUE(waitUntil([&](){ return a.getRunningThreadCount() == 1; }));
+
+  TaskGraph graph{};
+  atomic<size_t> count{0};
+  size_t discarded{0};
+  auto first = graph.add([&](){ ++count; });
+  auto left = graph.add([&](){ ++count; });
+  auto right = graph.add([&](){
+    // The placeholder of the left node is queued behind the busy thread.
+    a.stop();
+    release = true;
+    discarded = a.discard().size();
+    ++count;
+  });
+  first.precede(left).precede(right);
+  graph.run(a);
+  EXPECT_EQ(count, 3);
+  EXPECT_EQ(discarded, 1);
+}
+
 TEST(StopJoin, Compare) {
   // Compare .stop() vs .join().
   Pool a{3};
@@ -209,6 +1775,209 @@ TEST(StopJoin, Compare) {
   EXPECT_EQ(a.getRunningThreadCount(), 0);
 }
 
+TEST(WorkStealing, Count) {
+  // Tasks enqueued from outside of the pool are counted, even when the pool
+  // has not been started yet.
+  Pool a{0, Scheduler::WORK_STEALING};
+  EXPECT_EQ(a.getScheduler(), Scheduler::WORK_STEALING);
+
+  a.enqueue({emptyFunc});
+  a.enqueue({emptyFunc});
+  EXPECT_EQ(a.getTaskQueueCount(), 2);
+}
+
+TEST(WorkStealing, NestedTasks) {
+  // Verify that tasks enqueued from within the pool (onto the worker deques)
+  // and from outside of the pool (onto the injection queue) all complete.
+  Pool a{4, Scheduler::WORK_STEALING};
+  atomic<size_t> count{0};
+
+  for (size_t i = 0; i < 100; ++i) {
+    a.enqueue({[&](){
+      for (size_t j = 0; j < 10; ++j) {
+        a.enqueue({[&](){
+          ++count;
+        }});
+      }
+      ++count;
+    }});
+  }
+  a.start();
+
+  EXPECT_TRUE(waitUntil([&](){ return count == 1100; }));
+  EXPECT_EQ(a.getTaskQueueCount(), 0);
+  a.join();
+  EXPECT_EQ(a.getTerminatedThreadCount(), 4);
+}
+
+TEST(WorkStealing, HighBeforeNested) {
+  // Verify that checking for HIGH priority tasks neither pulls NORMAL tasks
+  // ahead of a worker's nested tasks nor skips the HIGH task, whichever lane
+  // the worker would otherwise prefer.
+  static constexpr size_t ROUNDS{50};
+  Pool a{1, Scheduler::WORK_STEALING};
+  mutex orderMutex;
+  vector<int> order;
+  auto record = [&](int value) {
+    scoped_lock orderMutexLock{orderMutex};
+    order.push_back(value);
+  };
+
+  // Each step enqueues a HIGH task and a nested step.
+  function<void(size_t)> step = [&](size_t round) {
+    record(static_cast<int>(2 * round));
+    a.enqueue([&, round](){ record(static_cast<int>(2 * round + 1)); }, Priority::HIGH);
+    if (round + 1 < ROUNDS) {
+      a.enqueue([&, round](){ step(round + 1); });
+    }
+  };
+  a.enqueue([&](){ step(0); }, Priority::HIGH);
+  for (size_t i = 0; i < 100; ++i) {
+    a.enqueue([&](){ record(-1); });
+  }
+  a.start();
+
+  EXPECT_TRUE(waitUntil([&](){
+    scoped_lock orderMutexLock{orderMutex};
+    return order.size() == 2 * ROUNDS + 100;
+  }));
+  a.join();
+  for (size_t i = 0; i < 2 * ROUNDS; ++i) {
+    EXPECT_EQ(order[i], static_cast<int>(i));
+  }
+}
+
+TEST(WorkStealing, StopKeepsTasks) {
+  // Verify that tasks left on a worker deque when the pool is stopped are not
+  // lost, and that they run when the pool is restarted.
+  Pool a{1, Scheduler::WORK_STEALING};
+  atomic<size_t> count{0};
+  atomic<bool> enqueued{false};
+
+  a.enqueue({[&](){
+    for (size_t i = 0; i < 3; ++i) {
+      a.enqueue({[&](){
+        ++count;
+      }});
+    }
+    enqueued = true;
+    this_thread::sleep_for(10ms);
+  }});
+  a.start();
+
+  // Stop the pool while the first task is still running.
+  EXPECT_TRUE(waitUntil([&](){ return enqueued.load(); }));
+  a.join();
+  EXPECT_EQ(count, 0);
+  EXPECT_EQ(a.getTaskQueueCount(), 3);
+
+  // Restart the pool so that the remaining tasks run.
+  a.start();
+  EXPECT_TRUE(waitUntil([&](){ return count == 3; }));
+  a.join();
+}
+
+TEST(Ring, Capacity) {
+  // The ring scheduler starts out bounded by the size of its rings.
+  Pool a{0, Scheduler::RING};
+  EXPECT_EQ(a.getScheduler(), Scheduler::RING);
+  EXPECT_EQ(a.getCapacity(), RING_CAPACITY);
+
+  for (size_t i = 0; i < RING_CAPACITY; ++i) {
+    EXPECT_TRUE(a.tryEnqueue({emptyFunc}));
+  }
+  EXPECT_FALSE(a.tryEnqueue({emptyFunc}));
+  EXPECT_EQ(a.getTaskQueueCount(), RING_CAPACITY);
+}
+
+TEST(Ring, Overflow) {
+  // Verify that, when the capacity is raised above the size of a ring, the
+  // tasks that do not fit still run, in order.
+  Pool a{1, Scheduler::RING};
+  a.setCapacity(UNLIMITED_CAPACITY);
+  constexpr size_t count{RING_CAPACITY + 100};
+  vector<size_t> order;
+
+  for (size_t i = 0; i < count; ++i) {
+    a.enqueue({[&, i](){
+      order.push_back(i);
+    }});
+  }
+  EXPECT_EQ(a.getTaskQueueCount(), count);
+  a.start();
+
+  EXPECT_TRUE(waitUntil([&](){ return a.getTaskQueueCount() == 0; }));
+  a.join();
+  ASSERT_EQ(order.size(), count);
+  EXPECT_TRUE(is_sorted(order.begin(), order.end()));
+}
+
+// Helper task type for the BasicPool tests, which increments a counter.
+struct CountTask {
+  atomic<size_t> * count{nullptr};
+
+  void operator()() const {
+    ++*this->count;
+  }
+};
+
+TEST(BasicPool, Runs) {
+  // Verify that every task runs, with either idle policy, and from both
+  // inside and outside of the pool.
+  auto check = [](auto & a) {
+    atomic<size_t> count{0};
+    for (size_t i = 0; i < 100; ++i) {
+      a.enqueue({&count});
+    }
+    EXPECT_EQ(a.getTaskQueueCount(), 100);
+    a.start();
+    EXPECT_TRUE(waitUntil([&](){ return count == 100; }));
+    EXPECT_EQ(a.getTaskQueueCount(), 0);
+    EXPECT_EQ(a.getRunningThreadCount(), 3);
+    a.join();
+    EXPECT_EQ(a.getRunningThreadCount(), 0);
+  };
+
+  BasicPool<CountTask> a{3};
+  check(a);
+  BasicPool<CountTask, LockedQueue<CountTask>, SpinWhenIdle<1000>> b{3};
+  check(b);
+
+  // Tasks may enqueue more tasks into their own pool.
+  atomic<size_t> count{0};
+  BasicPool<function<void()>> c{2};
+  c.start();
+  for (size_t i = 0; i < 10; ++i) {
+    c.enqueue([&](){
+      for (size_t j = 0; j < 10; ++j) {
+        c.enqueue([&](){ ++count; });
+      }
+      ++count;
+    });
+  }
+  EXPECT_TRUE(waitUntil([&](){ return count == 110; }));
+  c.join();
+}
+
+TEST(BasicPool, StopKeepsTasks) {
+  // Verify that tasks that are queued when the pool stops stay queued, and
+  // run when the pool is restarted.
+  BasicPool<CountTask> a{1};
+  atomic<size_t> count{0};
+  a.start();
+  a.join();
+  for (size_t i = 0; i < 5; ++i) {
+    a.enqueue({&count});
+  }
+  this_thread::sleep_for(1ms);
+  EXPECT_EQ(count, 0);
+  EXPECT_EQ(a.getTaskQueueCount(), 5);
+
+  a.start();
+  EXPECT_TRUE(waitUntil([&](){ return count == 5; }));
+  a.join();
+}
+
 int main(int argc, char** argv) {
   testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();